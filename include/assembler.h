@@ -7,8 +7,14 @@
 #define ASSEMBLER_H
 
 #include <stdint.h>
+#include <stdio.h>
 #include "symbols.h"
 #include "parser.h"
+#include "threadpool.h"
+#include "transform.h"
+#include "strpool.h"
+#include "rodata.h"
+#include "run.h"
 
 /* ========== Constants ========== */
 
@@ -22,6 +28,12 @@
 #define ASM_MAX_MACRO_DEPTH   16   /* Maximum nesting of macro expansion */
 #define ASM_MAX_MACRO_ARGS    16   /* Maximum arguments per macro */
 #define ASM_MAX_LOOP_DEPTH    32   /* Maximum nesting of !for/!while */
+#define ASM_MAX_THREADS       64   /* Maximum worker threads */
+#define ASM_PASS2_MIN_CHUNK   256  /* Minimum lines per parallel pass 2 chunk */
+#define ASM_INLINE_SAVED_CYCLES 12 /* JSR + RTS cycles an inlined call drops */
+#define ASM_SOA_MAX_FIELD_SIZE 4   /* Widest !soa field in bytes */
+#define ASM_DATA_LOOP_MIN     256  /* Iterations before a data-only !for is generated directly */
+#define ASM_BALANCE_PASSES    8    /* Pass 1 runs that may move !balanced padding */
 
 /* ========== Output Format ========== */
 
@@ -106,8 +118,178 @@ typedef struct {
     Expr *condition;            /* Condition expression (owned) */
 } LoopEntry;
 
+/* ========== Inline Subroutines ========== */
+
+/* A routine marked !inline, with the source of its body */
+typedef struct {
+    char *name;                 /* Routine label (owned) */
+    char *body;                 /* Source lines before the final RTS (owned) */
+    size_t body_length;
+    size_t body_capacity;
+    const char *filename;       /* File where defined */
+    int line_number;            /* Line of the !inline */
+    uint16_t address;           /* Address of the routine */
+    int size;                   /* Body bytes, or -1 until pass 1 has collected it */
+} InlineRoutine;
+
+/* A JSR replaced by a copy of the routine body */
+typedef struct {
+    const char *routine;        /* Routine name (owned by the routine) */
+    const char *filename;       /* File of the call */
+    int line_number;            /* Line of the call */
+    uint16_t address;           /* Address of the copy */
+    int size;                   /* Bytes the copy occupies */
+} InlineCall;
+
+/* ========== Imported Images ========== */
+
+/* Data an !image conversion produced, kept for pass 2 */
+typedef struct ConvertedImage {
+    uint64_t key;               /* image_cache_key of the file and options */
+    uint8_t *data;              /* Converted bytes (owned) */
+    int length;
+    struct ConvertedImage *next;
+} ConvertedImage;
+
+/* ========== Assembly-Time Runs ========== */
+
+/* Bytes a !run captured, kept for later runs from the same memory */
+typedef struct RunCapture {
+    uint64_t key;               /* run_cache_key of the memory and options */
+    uint8_t *data;              /* Captured bytes (owned) */
+    int length;
+    struct RunCapture *next;
+} RunCapture;
+
+/* Character set and maps a !charmap built, kept for pass 2 and the listing */
+typedef struct BuiltCharmap {
+    const Statement *stmt;      /* Directive that built it */
+    uint8_t *data;              /* Charset, screen map, then color map if any (owned) */
+    int charset_size;
+    int map_size;               /* Bytes in each map: width * height */
+    int has_colors;
+    int width;                  /* Map size in cells */
+    int height;
+    int chars;                  /* Characters used */
+    int unique;                 /* Distinct cells in the input */
+    int limit;                  /* Characters available */
+    struct BuiltCharmap *next;
+} BuiltCharmap;
+
+/* ========== String Pools ========== */
+
+/* A string a !strpool region took in */
+typedef struct {
+    uint8_t *bytes;             /* Bytes to pool (owned) */
+    int length;
+    Symbol *symbol;             /* Label of the string's line, or NULL */
+} PooledString;
+
+/* A !strpool region and, once its !strpool_end is reached, its pool */
+typedef struct StringPool {
+    const Statement *stmt;      /* !strpool directive */
+    const Statement *end;       /* !strpool_end that places the pool, NULL while open */
+    const char *filename;       /* Where the region starts */
+    int line_number;
+    StrPoolOptions options;
+    PooledString *strings;
+    int count;
+    int capacity;
+    int input_size;             /* Bytes the strings would take on their own */
+    StrPool pool;               /* Built pool */
+    uint16_t address;
+    struct StringPool *next;
+} StringPool;
+
+/* ========== Read-Only Data ========== */
+
+/* A block of a !rodata region: a global label's data up to the next one */
+typedef struct {
+    uint8_t *bytes;             /* Owned */
+    int length;
+    int capacity;
+    int align;                  /* From an !align before it, 1 otherwise */
+} RodataEntry;
+
+/* A label inside a !rodata region and where it points in its block */
+typedef struct {
+    Symbol *symbol;
+    int block;
+    int offset;
+} RodataLabel;
+
+/* A !rodata region and, once its !rodata_end is reached, its packed data */
+typedef struct RodataRegion {
+    const Statement *stmt;      /* !rodata directive */
+    const Statement *end;       /* !rodata_end that places the data, NULL while open */
+    const char *filename;       /* Where the region starts */
+    int line_number;
+    RodataEntry *blocks;
+    int count;
+    int capacity;
+    RodataLabel *labels;
+    int label_count;
+    int label_capacity;
+    int align;                  /* !align for the next block, 0 if none */
+    int input_size;             /* Bytes the blocks would take unpacked */
+    RodataPack pack;
+    uint16_t address;
+    struct RodataRegion *next;
+} RodataRegion;
+
+/* ========== Struct-of-Arrays Tables ========== */
+
+/* Placement of the tables of one !soa directive */
+typedef struct {
+    int count;              /* Entries (bytes) per table */
+    int tables;             /* Tables placed */
+    int waste;              /* Bytes skipped so that no table crosses a page */
+    int32_t end;            /* Address after the last table */
+} SoaLayout;
+
+/* ========== Cycle-Balanced Blocks ========== */
+
+/* A !balanced block: line indices of its markers and how it pads */
+typedef struct {
+    const Statement *stmt;      /* !balanced directive */
+    const char *filename;       /* Where the block starts */
+    int line_number;
+    int start;                  /* Line of !balanced */
+    int middle;                 /* Line of !balanced_else, -1 until reached */
+    int end;                    /* Line of !balanced_end, -1 until reached */
+    uint8_t branch;             /* Opcode of the branch around the first path */
+    unsigned keep;              /* DELAY_KEEP_* bits the padding leaves untouched */
+    int max;                    /* Most padding bytes, -1 for no limit */
+} BalancedBlock;
+
+/* ========== Value-Tracking Optimizer ========== */
+
+/* What the optimizer does to an instruction */
+#define OPT_REMOVE      1       /* Drop it: it changes nothing that is not already so */
+#define OPT_BRANCH      2       /* Replace a JMP by a branch known to be taken */
+
+/* One change, planned on a stored line and made when pass 1 stores it again */
+typedef struct {
+    int line;                   /* Index of the stored line */
+    const char *file;           /* Statement it was planned for */
+    int source_line;
+    char mnemonic[8];           /* Instruction it was planned for */
+    uint8_t kind;               /* OPT_REMOVE or OPT_BRANCH */
+    uint8_t opcode;             /* Branch replacing a JMP */
+    uint8_t applied;            /* Made by the last pass 1 */
+    int bytes;                  /* Bytes saved */
+    int cycles;                 /* Cycles saved */
+    char reason[48];            /* What made it possible, for the report */
+} OptEdit;
+
 /* ========== Assembled Statement ========== */
 
+/* A symbol read by a stored line, with the value it had in pass 1 */
+typedef struct {
+    Symbol *symbol;
+    int32_t value;
+} LineRead;
+
 /*
  * Stores a parsed statement along with its assembled bytes.
  * Used between pass 1 and pass 2, and for listing generation.
@@ -122,15 +304,48 @@ typedef struct {
     char *zone;             /* Zone for local label resolution (owned) */
     int cycles;             /* Cycle count (for listings) */
     int page_penalty;       /* 1 if +1 cycle on page cross */
+    uint16_t real_address;  /* Output address at line start (from pass 1) */
+    int in_pseudopc;        /* 1 if line starts inside !pseudopc (from pass 1) */
+
+    /* Dependencies (recorded in pass 1 when Assembler.incremental is set) */
+    LineRead *reads;        /* Symbols the line's expressions read (owned) */
+    int read_count;
+    Symbol *defines;        /* Symbol defined by the line's label or assignment */
+    uint16_t size;          /* Output bytes the line occupied in pass 1 */
+    int resolved;           /* 1 if pass 1 already produced the final result */
+
+    uint16_t pad;           /* Bytes a !pgo_pad line fills, or cycles of !balanced padding (chosen in pass 1) */
+    uint8_t smc;            /* Operand bytes named by a :@ label (bit n = byte n) */
+    uint8_t pooled;         /* Data moved into a !strpool or !rodata (generates nothing here) */
+    uint8_t *generated;     /* Output of a data-only !for loop, generated in pass 1 (owned) */
+    int generated_size;
+    RunOptions *run;        /* !run pass 2 checked, executed once pass 2 is done (owned) */
+    CpuType cpu;            /* CPU the line was assembled for */
+    uint8_t optimized;      /* OPT_REMOVE or OPT_BRANCH the optimizer made, or 0 */
+
+    /* Attribution for the size report (recorded in pass 1) */
+    const char *origin_file;    /* File of the line, or of the outermost expansion's call */
+    const char *origin_zone;    /* Zone of the outermost expansion's call ("" for none), NULL outside expansions */
+    const char *frames;         /* Macro and loop expansions "<m>;<for i>", outermost first, or NULL */
+    uint16_t emitted;           /* Output bytes pass 2 generated or reserved */
 } AssembledLine;
 
-/* ========== CPU Types ========== */
+/* ========== Buffered Diagnostics ========== */
 
-typedef enum {
-    CPU_6502,       /* Standard 6502 (no illegal opcodes) */
-    CPU_6510,       /* 6510 with illegal opcodes (default) */
-    CPU_65C02       /* 65C02 with extended instructions */
-} CpuType;
+/*
+ * Diagnostics collected while a pass 2 chunk runs on a worker thread,
+ * replayed to stderr in source order once all chunks are done.
+ */
+typedef struct {
+    int is_error;           /* 1 for errors, 0 for warnings */
+    char *text;             /* Formatted "file:line: kind: message" (owned) */
+} Diagnostic;
+
+typedef struct {
+    Diagnostic *items;
+    int count;
+    int capacity;
+} DiagBuffer;
 
 /* ========== Assembler Context ========== */
 
@@ -174,6 +389,7 @@ typedef struct {
     uint8_t fill_byte;          /* Byte to fill gaps with */
     int verbose;                /* Verbose output mode */
     int show_cycles;            /* Show cycle counts */
+    int export_lists;           /* Write !let elements to symbol output as name_i */
 
     /* Include file handling */
     IncludeEntry include_stack[ASM_MAX_INCLUDE_DEPTH];
@@ -201,6 +417,89 @@ typedef struct {
 
     /* CPU selection */
     CpuType cpu_type;           /* Current CPU type */
+
+    /* Zone naming */
+    int anon_zone_counter;      /* Counter for anonymous !zone names */
+
+    /* Parallel code generation */
+    int threads;                /* Threads for pass 2 (1 = serial) */
+    ThreadPool *pool;           /* Worker pool (created on demand) */
+    int pass2_chunks;           /* Chunks run by last pass 2 (0 = serial) */
+    DiagBuffer *diag;           /* If set, diagnostics are buffered here */
+
+    /* Incremental re-evaluation */
+    int incremental;            /* Record dependencies, revisit only changed lines */
+    int emit_pass1;             /* Pass 1 is generating the current line's bytes */
+    int reuse_pass1;            /* Pass 1 output is valid for skipped lines */
+    uint8_t *claimed;           /* Pass 1 map of output bytes owned by a line */
+    int pass2_revisited;        /* Lines pass 2 evaluated again */
+    int pass2_skipped;          /* Lines pass 2 kept from pass 1 */
+
+    /* Profile-guided layout */
+    struct PgoProfile *profile; /* Profile to lay out !pgo_pad against (not owned) */
+    int *layout_pads;           /* Padding for each !pgo_pad in source order (owned) */
+    int layout_pad_count;
+    int layout_slot;            /* Next !pgo_pad in pass 1 */
+    AssembledLine *stored_line; /* Stored line being assembled, or NULL */
+
+    /* Cycle-balanced blocks */
+    BalancedBlock *balanced;    /* !balanced blocks of pass 1, in source order */
+    int balanced_count;
+    int balanced_capacity;
+    int balanced_open;          /* Block pass 1 is inside, or -1 */
+    int *balance_pads;          /* First-path padding cycles of each block (owned) */
+    int balance_pad_count;
+    int balance_changed;        /* Pass 1 chose padding that moves later code */
+
+    /* Value-tracking optimizer */
+    int optimize;               /* Reassemble with optimize_plan's changes */
+    OptEdit *opt_edits;         /* Changes in stored line order (owned) */
+    int opt_edit_count;
+    int opt_edit_capacity;
+    int opt_slot;               /* Next change pass 1 may make */
+
+    /* Inline subroutines */
+    InlineRoutine *inlines;     /* Routines marked !inline, in source order */
+    int inline_count;
+    int inline_capacity;
+    InlineRoutine *inline_open; /* Routine whose body pass 1 is collecting, or NULL */
+    int inline_forward;         /* Pass 1 met a call before its routine */
+    InlineCall *inline_calls;   /* Calls replaced by a copy of the body */
+    int inline_call_count;
+    int inline_call_capacity;
+    int inline_threshold;       /* Inline plain JSRs to bodies up to this size (0 = jsr+ only) */
+
+    /* Expansions stored lines are attributed to */
+    int expansion_depth;        /* Macro, loop and inline expansions entered */
+    const char *origin_file;    /* File the outermost expansion was entered from */
+    const char *origin_zone;    /* Zone it was entered from ("" for none) */
+    const char *frames;         /* Macro and loop frames entered, or NULL */
+
+    /* Imported images */
+    char *image_cache_dir;      /* Directory !image conversions are cached in, or NULL (owned) */
+    ConvertedImage *images;     /* Conversions of this run, newest first */
+    int image_cache_hits;       /* !image results read from the cache directory */
+    int data_loops;             /* Long data-only !for loops generated without expansion */
+
+    /* Assembly-time runs */
+    char *run_cache_dir;        /* Directory !run captures are cached in, or NULL (owned) */
+    RunCapture *run_captures;   /* Captures of this run, newest first */
+    int runs;                   /* !run directives executed */
+    int run_cache_hits;         /* !run captures reused instead of executed */
+    BuiltCharmap *charmaps;     /* !charmap results of pass 1, newest first */
+
+    /* String pools */
+    StringPool *strpools;       /* !strpool regions of pass 1, newest first */
+    StringPool *strpool_open;   /* Region pass 1 is collecting strings for, or NULL */
+
+    /* Read-only data */
+    RodataRegion *rodata;       /* !rodata regions of pass 1, newest first */
+    RodataRegion *rodata_open;  /* Region pass 1 is collecting blocks for, or NULL */
+
+    /* Names stored statements point at (include paths, macro pseudo-files,
+     * zones and frames of expansions) */
+    char **file_names;          /* Owned */
+    int file_name_count;
 } Assembler;
 
 /* Maximum command-line defines */
@@ -233,6 +532,14 @@ void assembler_reset(Assembler *as);
  */
 int assembler_assemble_file(Assembler *as, const char *filename);
 
+/*
+ * Assemble source read from an open stream (e.g. stdin).
+ * The stream is read in chunks and its line index built as data arrives.
+ * filename is used for diagnostics only.
+ * Returns 0 on success, non-zero on error.
+ */
+int assembler_assemble_stream(Assembler *as, FILE *fp, const char *filename);
+
 /*
  * Assemble a source string (for testing).
  * Returns 0 on success, non-zero on error.
@@ -247,12 +554,46 @@ int assembler_pass1(Assembler *as, const char *source, const char *filename);
 
 /*
  * Run pass 2: Generate code, resolve symbols.
+ * With more than one thread configured, the stored lines are split into
+ * chunks generated concurrently. Output is byte-identical to serial mode;
+ * programs that pass 2 cannot split safely (symbols reassigned during the
+ * pass, overlapping output, forward anonymous references outside
+ * instructions and !byte/!word) are generated serially.
+ *
+ * With Assembler.incremental set, pass 1 records the symbols each line
+ * reads and already generates instructions and data whose inputs are
+ * known. Pass 2 then revisits only lines that were not resolved or whose
+ * inputs now have a different value; pass2_revisited and pass2_skipped
+ * count the two cases.
  * Returns 0 on success, non-zero on error.
  */
 int assembler_pass2(Assembler *as);
 
+/*
+ * Set the number of threads used by pass 2.
+ * 0 selects the number of online processors; 1 is serial.
+ */
+void assembler_set_threads(Assembler *as, int threads);
+
+/*
+ * Cache !image conversions in dir, keyed by a hash of the PNG file and
+ * the conversion options. NULL turns the cache off (the default).
+ */
+void assembler_set_image_cache(Assembler *as, const char *dir);
+
+/*
+ * Cache !run captures in dir, keyed by a hash of the memory the run
+ * starts from and its options. NULL turns the cache off (the default).
+ */
+void assembler_set_run_cache(Assembler *as, const char *dir);
+
 /* ========== Output Functions ========== */
 
+/*
+ * Output destinations for the write functions below may be a filename,
+ * "-" for standard output, or "fd:N" for an already open file descriptor.
+ */
+
 /*
  * Write assembled output to file.
  * Returns 0 on success, non-zero on error.
@@ -281,6 +622,12 @@ const uint8_t *assembler_get_output(Assembler *as, uint16_t *start_addr, int *si
 
 /* ========== Code Emission ========== */
 
+/*
+ * Check if the current line generates bytes: always in pass 2, and in
+ * pass 1 for lines an incremental assembly resolves early.
+ */
+int assembler_emitting(Assembler *as);
+
 /*
  * Emit a single byte at current PC.
  */
@@ -324,6 +671,19 @@ int assembler_assemble_instruction(Assembler *as, Statement *stmt);
  */
 int assembler_assemble_directive(Assembler *as, Statement *stmt);
 
+/*
+ * Value of a named directive argument written as name=value, or NULL
+ * if the directive does not have it.
+ */
+Expr *assembler_directive_arg(const Statement *stmt, const char *name);
+
+/*
+ * Lay out the tables of a !soa statement starting at address.
+ * Returns 0, or -1 with the error reported.
+ */
+int assembler_soa_layout(Assembler *as, const Statement *stmt, uint16_t address,
+                         SoaLayout *layout);
+
 /* ========== Error Handling ========== */
 
 /*
@@ -407,10 +767,11 @@ int assembler_include_file(Assembler *as, const char *filename);
  * Include a binary file at current PC.
  * offset: byte offset into file (0 for start)
  * length: bytes to read (0 for entire file from offset)
+ * transforms: steps applied in order to the bytes read (may be NULL)
  * Returns 0 on success, -1 on error.
  */
-int assembler_include_binary(Assembler *as, const char *filename,
-                             int offset, int length);
+int assembler_include_binary(Assembler *as, const char *filename, int offset, int length,
+                             const BinaryTransform *transforms, int transform_count);
 
 /*
  * Get full include stack trace for error messages.
@@ -504,6 +865,14 @@ int assembler_in_macro(Assembler *as);
  */
 int assembler_macro_unique_id(Assembler *as);
 
+/* ========== Inline Subroutine Functions ========== */
+
+/*
+ * Look up a routine marked !inline.
+ * Returns routine pointer or NULL if not found.
+ */
+InlineRoutine *inline_lookup(Assembler *as, const char *name);
+
 /* ========== Loop Functions ========== */
 
 /*
@@ -0,0 +1,70 @@
+/*
+ * charmap.h - Charset Deduplication and Screen Map Building
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef CHARMAP_H
+#define CHARMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "image.h"
+
+#define CHARMAP_MAX_CHARS       256     /* Screen codes a character set holds */
+#define CHARMAP_MAX_CELLS       (1 << 20)  /* Largest map in cells */
+
+/* How cells are matched to characters */
+typedef struct {
+    int tolerance;           /* Pixels a cell may differ from its character by */
+    int invert;              /* Characters 128-255 are 0-127 inverted */
+} CharmapOptions;
+
+/* A character set and the screen map that draws the input with it */
+typedef struct {
+    int width;               /* Map size in cells */
+    int height;
+    int chars;               /* Characters used */
+    int unique;              /* Distinct cells in the input */
+    int limit;               /* Characters available: 256, or 128 with invert */
+    uint8_t *charset;        /* 8 bytes per character (owned) */
+    int charset_size;        /* chars * 8, or a full 2048 with invert */
+    uint8_t *screen;         /* width * height screen codes, row-major (owned) */
+    uint8_t *colors;         /* width * height colors, or NULL (owned) */
+} Charmap;
+
+/*
+ * Cut a 1-bit-per-pixel bitmap of width x height cells into cells. Rows
+ * are width bytes each, leftmost pixel in bit 7, and there are height * 8
+ * of them. A cell packs its eight rows into a uint64_t, top row in the
+ * high byte (caller frees *cells).
+ * Returns 0, or -1 with *error set.
+ */
+int charmap_cells_from_bitmap(const uint8_t *data, size_t size, int width, int height,
+                              uint64_t **cells, const char **error);
+
+/*
+ * Cut an image into cells: a bit is set for each pixel that is not the
+ * background (-1 for the most common color). *colors gets the most used
+ * other color of each cell (caller frees both).
+ * Returns 0, or -1 with *error set.
+ */
+int charmap_cells_from_image(const C64Image *image, int background,
+                             uint64_t **cells, uint8_t **colors, const char **error);
+
+/*
+ * Build the smallest character set for width x height cells: equal cells
+ * share a character, found through a hash table. With a tolerance or
+ * invert, the most frequent cells become characters first and every other
+ * cell takes the nearest character within tolerance pixels, or its
+ * inverse at code + 128.
+ *
+ * map takes ownership of colors. Returns 0, or -1 with *error set if the
+ * cells need more characters than fit; map->unique and map->chars still
+ * tell how many were needed.
+ */
+int charmap_build(const uint64_t *cells, uint8_t *colors, int width, int height,
+                  const CharmapOptions *options, Charmap *map, const char **error);
+
+void charmap_free(Charmap *map);
+
+#endif /* CHARMAP_H */
@@ -0,0 +1,64 @@
+/*
+ * delay.h - Exact-Cycle Delay Code Generation
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef DELAY_H
+#define DELAY_H
+
+#include <stdint.h>
+
+#define DELAY_MAX_CYCLES        65535   /* Longest delay !delay generates */
+#define DELAY_MAX_LOOP          256     /* Iterations of one LDX #0 / DEX / BNE loop */
+
+/* What a delay must leave untouched (preserve= letters) */
+#define DELAY_KEEP_A            0x01    /* a */
+#define DELAY_KEEP_X            0x02    /* x */
+#define DELAY_KEEP_Y            0x04    /* y */
+#define DELAY_KEEP_N            0x08    /* n */
+#define DELAY_KEEP_V            0x10    /* v */
+#define DELAY_KEEP_Z            0x20    /* z */
+#define DELAY_KEEP_C            0x40    /* c */
+#define DELAY_KEEP_STACK        0x80    /* s: no PHP/PLP */
+#define DELAY_KEEP_FLAGS        (DELAY_KEEP_N | DELAY_KEEP_V | DELAY_KEEP_Z | DELAY_KEEP_C)  /* p */
+
+/* Generated delay code */
+typedef struct {
+    uint8_t *bytes;          /* Owned, NULL when length is 0 */
+    int length;
+    int loops;               /* Countdown loops in the code */
+} DelayCode;
+
+/*
+ * Translate preserve= letters into DELAY_KEEP_* bits.
+ * Returns 0, or -1 for a letter that is not one of a, x, y, n, v, z, c, s, p.
+ */
+int delay_parse_keep(const char *letters, unsigned *keep);
+
+/*
+ * Generate the shortest code found that takes exactly `cycles` cycles
+ * when placed at address and leaves everything in keep untouched.
+ * Straight-line code uses NOP, PHP/PLP pairs and one 3-cycle filler
+ * (DOP zp when illegal opcodes are allowed, otherwise BIT zp or
+ * JMP to the next instruction); long delays count X or Y down in
+ * loops whose cost includes a page-crossing branch at that address,
+ * or nest an X loop inside a Y loop when neither is kept.
+ * Kept N and Z are saved around the loops with PHP/PLP, and with X and
+ * Y both kept X is held in A (pushed with PHA first if A is kept), so
+ * only a kept stack together with kept N or Z, or with A, X and Y all
+ * kept, rules loops out.
+ * Cycle counts come from the opcode table.
+ *
+ * Returns 0, or -1 if cycles is 1 or out of range.
+ */
+int delay_generate(int cycles, unsigned keep, int illegal, uint16_t address, DelayCode *code);
+
+/*
+ * Run code at address in the 6510 model and store the cycles it took.
+ * Returns 0, or -1 if it does not run through or disturbs anything in keep.
+ */
+int delay_measure(const DelayCode *code, uint16_t address, unsigned keep, int *cycles);
+
+void delay_code_free(DelayCode *code);
+
+#endif /* DELAY_H */
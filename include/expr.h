@@ -16,7 +16,11 @@ typedef enum {
     EXPR_SYMBOL,    /* Symbol reference */
     EXPR_UNARY,     /* Unary operator: -, ~, !, <, > */
     EXPR_BINARY,    /* Binary operator: +, -, *, /, etc. */
-    EXPR_CURRENT    /* Current program counter (*) */
+    EXPR_CURRENT,   /* Current program counter (*) */
+    EXPR_CALL,      /* Function call: name(args) */
+    EXPR_PARAM,     /* Parameter of the function body being evaluated */
+    EXPR_INDEX,     /* List element: name[index] */
+    EXPR_LIST       /* List: [items] or [body for var, start, end] (only for !let) */
 } ExprType;
 
 /* Unary operators */
@@ -63,6 +67,21 @@ typedef struct Expr {
             struct Expr *left;
             struct Expr *right;
         } binary;
+        struct {                /* For EXPR_CALL */
+            char *name;         /* Function name (allocated) */
+            struct Expr **args; /* Arguments (owned) */
+            int arg_count;
+        } call;
+        int param;              /* For EXPR_PARAM: argument index */
+        struct {                /* For EXPR_INDEX */
+            char *name;         /* List name (allocated) */
+            struct Expr *index;
+        } index;
+        struct {                /* For EXPR_LIST */
+            struct Expr **items;    /* Elements, or body, start and end (owned) */
+            int count;
+            char *var;          /* Comprehension variable (allocated), or NULL */
+        } list;
     } data;
 } Expr;
 
@@ -71,6 +90,8 @@ typedef struct {
     int32_t value;          /* Evaluated value */
     int defined;            /* 1 if all symbols were defined */
     int is_zeropage;        /* 1 if value is known to fit in zero page */
+    const char *error;      /* Why a function call or list index failed, or NULL */
+    const char *function;   /* Function the error is about, or NULL for a list */
 } ExprResult;
 
 /* Expression parser context */
@@ -112,6 +133,12 @@ Expr *expr_binary(BinaryOp op, Expr *left, Expr *right);
  */
 Expr *expr_current(void);
 
+/*
+ * Create a function call expression.
+ * Makes a copy of the name; takes ownership of args and its expressions.
+ */
+Expr *expr_call(const char *name, Expr **args, int arg_count);
+
 /*
  * Free an expression tree.
  */
@@ -149,6 +176,13 @@ Expr *expr_parse(ExprParser *parser);
  */
 Expr *expr_parse_primary(ExprParser *parser);
 
+/*
+ * Parse a list: [a, b, ...], [body for var, start, end] (body evaluated
+ * with var from start to end inclusive, as !for counts) or an expression
+ * naming another list. Returns NULL on error like expr_parse().
+ */
+Expr *expr_parse_list(ExprParser *parser);
+
 /*
  * Get last parser error message.
  */
@@ -170,6 +204,17 @@ const char *expr_parser_error(ExprParser *parser);
  */
 ExprResult expr_eval(Expr *expr, SymbolTable *symbols, AnonLabels *anon, uint16_t pc, int pass, const char *current_zone);
 
+/*
+ * Copy of expr with each symbol named var (compared without case, the
+ * way !for substitutes its variable) turned into a slot for the value
+ * expr_eval_bound() is given. Returns NULL if out of memory.
+ */
+Expr *expr_bind(const Expr *expr, const char *var);
+
+/* expr_eval() of an expr_bind() copy with its variable set to value */
+ExprResult expr_eval_bound(Expr *expr, SymbolTable *symbols, AnonLabels *anon, uint16_t pc,
+                           int pass, const char *current_zone, int32_t value);
+
 /*
  * Evaluate an expression and return just the value.
  * Returns 0 if any symbols are undefined.
@@ -183,6 +228,97 @@ int32_t expr_eval_value(Expr *expr, SymbolTable *symbols, uint16_t pc);
  */
 int expr_has_symbols(Expr *expr);
 
+/*
+ * Call fn for each symbol an expression reads, in evaluation order.
+ * Local names are mangled with current_zone exactly as expr_eval does;
+ * anonymous label references are passed through unchanged. A function
+ * call is passed as "__call_<name>" before the symbols of its arguments;
+ * a list read by name[index] or len(name) is passed as "__list_<name>".
+ */
+void expr_visit_symbols(Expr *expr, const char *current_zone,
+                        void (*fn)(const char *name, void *userdata),
+                        void *userdata);
+
+/* ========== User Functions ========== */
+
+#define EXPR_MAX_PARAMS      8      /* Parameters of one function */
+#define EXPR_MAX_CALL_DEPTH  256    /* Nested calls before evaluation gives up */
+#define EXPR_MEMO_LIMIT      65536  /* Results remembered per function */
+
+/* Functions defined with !func, found by expr_eval through the symbol
+ * table's functions field */
+typedef struct ExprFunctions ExprFunctions;
+
+ExprFunctions *expr_functions_create(void);
+void expr_functions_free(ExprFunctions *functions);
+
+/*
+ * Define name(params) = body. The body is copied with each parameter
+ * turned into an argument slot, so a call only binds values. Names in the
+ * body other than parameters are looked up where the function is called.
+ * if(c, a, b) is built in and evaluates only the chosen one of a and b.
+ *
+ * A body that reads nothing but its parameters and calls only such
+ * functions (itself included) is pure: its results for pass 1 arguments
+ * are remembered, and later calls with the same arguments, in either
+ * pass, reuse them.
+ *
+ * Returns 0, or -1 with *error set (static text about name).
+ */
+int expr_function_define(ExprFunctions *functions, const char *name,
+                         const char *const *params, int param_count,
+                         Expr *body, const char **error);
+
+/* Whether name is if(), len() or a defined pure function */
+int expr_function_is_pure(const ExprFunctions *functions, const char *name);
+
+/* Functions defined, and results remembered across all of them */
+int expr_function_count(const ExprFunctions *functions);
+long expr_function_memo_count(const ExprFunctions *functions);
+
+/* ========== Lists ========== */
+
+#define EXPR_MAX_LIST        65536  /* Elements of one list */
+
+/* Lists defined with !let, found by expr_eval through the symbol table's
+ * lists field. A list is fixed once defined; its elements are stored in
+ * the fewest bytes (1, 2 or 4) that hold all of them. */
+typedef struct ExprLists ExprLists;
+typedef struct ExprList ExprList;
+
+ExprLists *expr_lists_create(void);
+void expr_lists_free(ExprLists *lists);
+
+/*
+ * Evaluate a list expression from expr_parse_list() into *values
+ * (caller frees) and *count. Returns 0, or -1 with *failed holding the
+ * first element that is not known (defined = 0), with its error if any,
+ * or a list error.
+ */
+int expr_list_eval(Expr *list, SymbolTable *symbols, AnonLabels *anon, uint16_t pc,
+                   int pass, const char *current_zone,
+                   int32_t **values, int *count, ExprResult *failed);
+
+/*
+ * Define name as count values; tag is kept for the caller (the assembler
+ * stores the index of the defining line). Returns 0, or -1 with *error set.
+ */
+int expr_list_define(ExprLists *lists, const char *name, const int32_t *values,
+                     int count, int tag, const char **error);
+
+/* The list called name, or NULL */
+const ExprList *expr_list_find(const ExprLists *lists, const char *name);
+
+const char *expr_list_name(const ExprList *list);
+int expr_list_length(const ExprList *list);
+int32_t expr_list_get(const ExprList *list, int index);
+int expr_list_tag(const ExprList *list);
+
+/* Lists in the order they were defined, and bytes their elements take */
+int expr_list_count(const ExprLists *lists);
+const ExprList *expr_list_at(const ExprLists *lists, int i);
+long expr_list_bytes(const ExprLists *lists);
+
 /*
  * Check if an expression is a simple number (no operators or symbols).
  */
@@ -0,0 +1,113 @@
+/*
+ * image.h - PNG Import and C64 Graphics Conversion
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "threadpool.h"
+
+#define IMAGE_MAX_SIZE          4096    /* Largest width or height decoded */
+#define IMAGE_COLORS            16      /* C64 palette entries */
+#define IMAGE_TRANSPARENT       0xFF    /* Pixel with alpha below half */
+
+/* Output formats of !image */
+typedef enum {
+    IMAGE_KOALA,             /* koala: 160x200 multicolor bitmap, screen, color RAM, background */
+    IMAGE_HIRES,             /* hires: 320x200 bitmap and screen */
+    IMAGE_SPRITES,           /* sprites: 24x21 cells, 64 bytes each */
+    IMAGE_CHARSET,           /* charset: 8x8 cells, 8 bytes each */
+    IMAGE_MODE_COUNT
+} ImageMode;
+
+/* Sizes of the converted formats */
+#define IMAGE_BITMAP_SIZE       8000
+#define IMAGE_SCREEN_SIZE       1000
+#define IMAGE_KOALA_SIZE        (IMAGE_BITMAP_SIZE + 2 * IMAGE_SCREEN_SIZE + 1)
+#define IMAGE_HIRES_SIZE        (IMAGE_BITMAP_SIZE + IMAGE_SCREEN_SIZE)
+#define IMAGE_SPRITE_SIZE       64
+
+/* A decoded image with every pixel matched to the C64 palette */
+typedef struct {
+    int width;
+    int height;
+    uint8_t *pixels;         /* Color 0-15 or IMAGE_TRANSPARENT per pixel, row-major (owned) */
+} C64Image;
+
+/* How to convert */
+typedef struct {
+    ImageMode mode;
+    int background;          /* Background color 0-15, or -1 for the most common one */
+} ImageOptions;
+
+/*
+ * Name of a mode as used by mode=, and the reverse.
+ * image_mode_lookup returns -1 for an unknown name.
+ */
+const char *image_mode_name(ImageMode mode);
+int image_mode_lookup(const char *name);
+
+/* ========== Decoding ========== */
+
+/*
+ * Decode a non-interlaced PNG held in memory into 8-bit RGBA, four bytes
+ * per pixel (caller frees *rgba). Every color type and bit depth is
+ * accepted; 16-bit samples keep their high byte.
+ * Returns 0, or -1 with *error set.
+ */
+int image_png_decode(const uint8_t *data, size_t size, int *width, int *height,
+                     uint8_t **rgba, const char **error);
+
+/* C64 color closest to an RGB value */
+int image_nearest_color(uint8_t r, uint8_t g, uint8_t b);
+
+/*
+ * Decode a PNG and match every pixel to the C64 palette.
+ * Returns 0, or -1 with *error set.
+ */
+int image_load(const uint8_t *data, size_t size, C64Image *image, const char **error);
+
+void image_free(C64Image *image);
+
+/* ========== Conversion ========== */
+
+/*
+ * Bytes converting a width x height image produces, or -1 with *error
+ * set if the size does not suit the mode. Koala takes 160x200 or
+ * 320x200 (every second pixel is used), hires 320x200, sprites
+ * multiples of 24x21 and charset multiples of 8x8.
+ */
+int image_output_size(ImageMode mode, int width, int height, const char **error);
+
+/*
+ * Convert an image. Bitmap modes choose each cell's colors from the
+ * pixels it uses most; sprites and charsets set a bit for every pixel
+ * that is not the background. Cells are converted on pool (NULL runs
+ * them on the calling thread).
+ *
+ * Returns 0 with *out (caller frees) and *length set, or -1 with *error.
+ */
+int image_convert(const C64Image *image, const ImageOptions *options, ThreadPool *pool,
+                  uint8_t **out, int *length, const char **error);
+
+/* ========== Conversion Cache ========== */
+
+/* Key of a conversion: a hash of the PNG file and the options */
+uint64_t image_cache_key(const uint8_t *data, size_t size, const ImageOptions *options);
+
+/*
+ * Read a cached conversion from dir (caller frees *out).
+ * Returns 0, or -1 if there is no valid entry for key.
+ */
+int image_cache_load(const char *dir, uint64_t key, uint8_t **out, int *length);
+
+/*
+ * Store a conversion in dir, creating the directory if needed.
+ * Returns 0, or -1 if it cannot be written.
+ */
+int image_cache_store(const char *dir, uint64_t key, const uint8_t *data, int length);
+
+#endif /* IMAGE_H */
@@ -0,0 +1,50 @@
+/*
+ * irq.h - IRQ Entry Latency and Jitter Analysis
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdio.h>
+#include "assembler.h"
+
+/* Cycles of the 6510 interrupt sequence (push PC and P, fetch vector) */
+#define IRQ_ENTRY_CYCLES        7
+
+/* Cycles of the KERNAL's $FF48 entry up to JMP ($0314) */
+#define IRQ_KERNAL_CYCLES       29
+
+/* Worst-case instruction length at or above which a suggestion is made */
+#define IRQ_SUGGEST_CYCLES      4
+
+/*
+ * Cycle range of a single instruction: best excludes, worst includes
+ * page crossings and taken branches. Returns 0, or -1 if the bytes do
+ * not start with a known opcode.
+ */
+int irq_instruction_cycles(const uint8_t *bytes, uint16_t address, int *best, int *worst);
+
+/*
+ * The same for a given CPU. On the 65C02, BRA is always taken and
+ * decimal-mode ADC/SBC is counted in the worst case.
+ */
+int irq_instruction_cycles_cpu(CpuType cpu, const uint8_t *bytes, uint16_t address,
+                               int *best, int *worst);
+
+/*
+ * Write the IRQ report for every !irq region to out.
+ *
+ * A region runs from !irq handler to !irq_end (or the next !irq) and
+ * holds main-loop code the handler can interrupt. An interrupt is taken
+ * once the instruction in progress completes, so it waits 1 to N cycles
+ * where N is the longest instruction in the region. The report gives
+ * that instruction, the resulting jitter, the latency from the IRQ to
+ * the handler's !irq_mark (following its fall-through path and JMPs),
+ * and suggestions for the instructions that set the worst case.
+ *
+ * Must be called after a successful pass 2.
+ */
+void assembler_irq_report(Assembler *as, FILE *out);
+
+#endif /* IRQ_H */
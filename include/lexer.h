@@ -53,7 +53,9 @@ typedef enum {
     TOK_RBRACKET,       /* ] */
     TOK_COMMA,          /* , */
     TOK_COLON,          /* : */
+    TOK_DOTDOT,         /* .. (range) */
     TOK_HASH,           /* # */
+    TOK_OPERAND_LABEL,  /* :@ (label on an instruction's operand) */
 
     /* Special */
     TOK_ERROR           /* Lexer error */
@@ -107,6 +109,9 @@ int token_equals(const Token *tok, const char *text);
 /* Check if token is an instruction mnemonic */
 int token_is_mnemonic(const Token *tok);
 
+/* Check if token is an instruction only the 65C02 has (BRA, STZ, ...) */
+int token_is_65c02_mnemonic(const Token *tok);
+
 /* Free any allocated data in token (for TOK_STRING) */
 void token_free(Token *tok);
 
@@ -1,5 +1,5 @@
 /*
- * opcodes.h - 6502/6510 Opcode Definitions
+ * opcodes.h - 6502/6510/65C02 Opcode Definitions
  * ASM64 - 6502/6510 Assembler for Commodore 64
  */
 
@@ -8,7 +8,17 @@
 
 #include <stdint.h>
 
-/* Addressing modes for 6502/6510 */
+/* ========== CPU Types ========== */
+
+typedef enum {
+    CPU_6502,       /* Standard 6502 (no illegal opcodes) */
+    CPU_6510,       /* 6510 with illegal opcodes (default) */
+    CPU_65C02       /* 65C02 with extended instructions */
+} CpuType;
+
+#define CPU_TYPE_COUNT      3
+
+/* Addressing modes for 6502/6510/65C02 */
 typedef enum {
     ADDR_IMPLIED,       /* INX, DEX, etc. - no operand */
     ADDR_ACCUMULATOR,   /* ASL A, ROL A, etc. */
@@ -23,6 +33,9 @@ typedef enum {
     ADDR_INDIRECT_X,    /* LDA ($80,X) - indexed indirect */
     ADDR_INDIRECT_Y,    /* LDA ($80),Y - indirect indexed */
     ADDR_RELATIVE,      /* BNE label - branches */
+    ADDR_ZP_INDIRECT,   /* LDA ($80) - 65C02 */
+    ADDR_ABS_INDIRECT_X,/* JMP ($1000,X) - 65C02 */
+    ADDR_ZP_RELATIVE,   /* BBR0 $80,label - 65C02 bit branches */
     ADDR_INVALID        /* Invalid/unsupported mode */
 } AddressingMode;
 
@@ -44,7 +57,8 @@ typedef enum {
     INST_RETURN     = 0x04,  /* Return instruction (RTS, RTI) */
     INST_ILLEGAL    = 0x08,  /* Illegal/undocumented opcode */
     INST_STACK      = 0x10,  /* Stack operation (PHA, PLA, etc.) */
-    INST_BREAK      = 0x20   /* BRK instruction */
+    INST_BREAK      = 0x20,  /* BRK instruction */
+    INST_65C02      = 0x40   /* Only on the 65C02 */
 } InstructionFlags;
 
 /* Mnemonic info - describes what modes an instruction supports */
@@ -63,7 +77,21 @@ typedef struct {
 const OpcodeEntry *opcode_find(const char *mnemonic, AddressingMode mode);
 
 /*
- * Get all valid addressing modes for a mnemonic.
+ * Find opcode entry by mnemonic and addressing mode on a given CPU.
+ * The 6502 has no illegal opcodes; the 65C02 adds its own instructions
+ * and modes and has different timings for some official ones.
+ * opcode_find is the 6510 lookup.
+ */
+const OpcodeEntry *opcode_find_cpu(CpuType cpu, const char *mnemonic, AddressingMode mode);
+
+/*
+ * Check if a CPU has an instruction in any addressing mode.
+ * Returns 1 if it does, 0 if not.
+ */
+int opcode_cpu_has_mnemonic(CpuType cpu, const char *mnemonic);
+
+/*
+ * Get all valid 6502/6510 addressing modes for a mnemonic.
  * Returns bitmask of valid modes, or 0 if mnemonic is unknown.
  */
 uint16_t opcode_get_valid_modes(const char *mnemonic);
@@ -75,7 +103,7 @@ uint16_t opcode_get_valid_modes(const char *mnemonic);
 uint8_t opcode_get_flags(const char *mnemonic);
 
 /*
- * Check if a mnemonic is a valid 6502 instruction.
+ * Check if a mnemonic is a valid 6502/6510/65C02 instruction.
  * Returns 1 if valid, 0 if not.
  */
 int opcode_is_valid_mnemonic(const char *mnemonic);
@@ -108,4 +136,23 @@ void opcodes_init(void);
  */
 const OpcodeEntry *opcode_find_by_opcode(uint8_t opcode);
 
+/*
+ * Find the entry an opcode byte decodes to on a given CPU (the per-CPU
+ * opcode matrix). opcode_find_by_opcode decodes for the 6510.
+ * Returns NULL if the byte is not an instruction on that CPU.
+ */
+const OpcodeEntry *opcode_find_by_opcode_cpu(CpuType cpu, uint8_t opcode);
+
+/*
+ * Extra cycles an instruction takes on a CPU when the decimal flag is
+ * set (1 for ADC/SBC on the 65C02, otherwise 0).
+ */
+int opcode_decimal_penalty(CpuType cpu, const OpcodeEntry *entry);
+
+/*
+ * Check if an opcode is a read-modify-write of memory (INC, ASL, DCP, ...).
+ * Returns 1 if it is, 0 if not.
+ */
+int opcode_is_rmw(const OpcodeEntry *entry);
+
 #endif /* OPCODES_H */
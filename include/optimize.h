@@ -0,0 +1,42 @@
+/*
+ * optimize.h - Register and Flag Value-Tracking Optimizer
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <stdio.h>
+#include "assembler.h"
+
+#define OPT_MAX_ROUNDS          8       /* Reassemblies that may drop changes before giving up */
+
+/*
+ * Track A, X, Y and the C, Z, N, V and D flags through the straight-line
+ * code of the final assembled lines and plan as->opt_edits: drop loads,
+ * transfers, flag instructions and immediate compares that change
+ * nothing, and turn a JMP into a branch whose flag is known (or BRA on
+ * the 65C02) where it reaches without crossing a page. Labels, branch
+ * and jump targets, data, gaps in the code, JSR and returns forget what
+ * is known; self-modifying code (:@ operands and instructions stored
+ * to), !pseudopc code, !balanced and !raster_block regions and code at
+ * or below a literal address an operand or !word points to are never
+ * changed.
+ *
+ * Must be called after a successful pass 2. Returns the number of
+ * changes planned.
+ */
+int optimize_plan(Assembler *as);
+
+/*
+ * Check the changes the last assembly made against its lines, whose
+ * layout moved with them, and drop each one that no longer holds or was
+ * not made. Returns the number dropped; the program must then be
+ * assembled again.
+ */
+int optimize_verify(Assembler *as);
+
+/* List each change made with the bytes and cycles it saves, then the totals */
+void optimize_report(const Assembler *as, FILE *out);
+
+#endif /* OPTIMIZE_H */
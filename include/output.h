@@ -0,0 +1,73 @@
+/*
+ * output.h - Concurrent Output File Writers
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "assembler.h"
+
+/* Stdio buffer size used while rendering an output file */
+#define OUTPUT_BUFFER_SIZE  (1024 * 1024)
+
+/* Block alignment for direct (page cache bypassing) writes */
+#define OUTPUT_DIRECT_ALIGN 4096
+
+/* Flags for assembler_write_outputs */
+#define OUTPUT_DIRECT       0x01    /* Use O_DIRECT where the filesystem allows */
+
+/* Kinds of output file */
+typedef enum {
+    OUTPUT_FILE_PROGRAM,     /* PRG or raw binary, per Assembler.format */
+    OUTPUT_FILE_SYMBOLS,     /* VICE label file */
+    OUTPUT_FILE_LISTING,     /* Listing file */
+    OUTPUT_FILE_FOLDED       /* Bytes per file/zone/expansion stack (flamegraph input) */
+} OutputFileKind;
+
+/* A requested output file and what happened when writing it */
+typedef struct {
+    OutputFileKind kind;
+    const char *filename;    /* Filename, "-" for stdout or "fd:N" */
+
+    /* Filled in by assembler_write_outputs */
+    int result;              /* 0 on success, -1 on error */
+    size_t bytes;            /* Bytes written */
+    double ms;               /* Time spent rendering and committing */
+    int direct;              /* 1 if the data went out with O_DIRECT */
+} OutputJob;
+
+/*
+ * Write all requested outputs concurrently, one worker thread per job,
+ * from the assembler state left by pass 2 (which must not change until
+ * this returns).
+ *
+ * Regular files are rendered into a temporary file next to the target
+ * and renamed over it only once complete, so a failed or interrupted
+ * write never leaves a truncated file behind. "-" and "fd:N" destinations
+ * are rendered in memory and written in job order once all workers have
+ * finished.
+ *
+ * Errors are reported through assembler_error after all jobs complete.
+ * Returns 0 if every job succeeded, -1 otherwise.
+ */
+int assembler_write_outputs(Assembler *as, OutputJob *jobs, int count, int flags);
+
+/*
+ * Short name of an output kind ("program", "symbols", "listing", "folded").
+ */
+const char *output_kind_name(OutputFileKind kind);
+
+/*
+ * Print where the output bytes and instruction base cycles come from:
+ * tables by include file, zone, outermost and innermost macro, and
+ * !for/!while loop, largest first. Lines inside an expansion count
+ * towards the file and zone of the outermost call.
+ *
+ * Must be called after a successful pass 2.
+ */
+void assembler_size_report(Assembler *as, FILE *out);
+
+#endif /* OUTPUT_H */
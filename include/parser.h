@@ -31,25 +31,50 @@ typedef struct {
     int is_anon_back;   /* 1 if anonymous backward (-) */
 } LabelInfo;
 
+/* Operand bytes a :@ label names */
+typedef enum {
+    OPERAND_LABEL_ALL,      /* :@name - every operand byte */
+    OPERAND_LABEL_LO,       /* :@lo name - the first operand byte */
+    OPERAND_LABEL_HI        /* :@hi name - the second operand byte */
+} OperandLabelPart;
+
 /* Parsed instruction */
 typedef struct {
     char *mnemonic;         /* Instruction mnemonic (allocated) */
     AddressingMode mode;    /* Determined addressing mode */
     Expr *operand;          /* Operand expression (owned) */
+    Expr *target;           /* Branch target of BBR/BBS (owned), or NULL */
     int forced_zp;          /* 1 if forced zero-page with <operand */
     int forced_abs;         /* 1 if forced absolute with !operand or >operand */
     uint8_t opcode;         /* Resolved opcode byte */
     int size;               /* Instruction size in bytes */
     int cycles;             /* Base cycle count */
     int page_penalty;       /* 1 if +1 cycle on page cross */
+    int inline_call;        /* 1 if written jsr+ (inline an !inline routine) */
+    LabelInfo *operand_label;       /* Self-modifying operand label (:@name), or NULL (owned) */
+    OperandLabelPart operand_part;  /* Operand bytes the label covers */
 } InstructionInfo;
 
+#define PARSER_MAX_TRANSFORM_ARGS 2   /* Arguments of one transform= step */
+
+/* One step of a !binary transform= chain: name or name(arg, ...) */
+typedef struct {
+    char *name;             /* Step name (allocated) */
+    Expr *args[PARSER_MAX_TRANSFORM_ARGS];  /* Arguments (owned) */
+    int arg_count;
+} TransformStep;
+
 /* Parsed directive */
 typedef struct {
     char *name;             /* Directive name without ! (allocated) */
     Expr **args;            /* Array of argument expressions (owned) */
     int arg_count;          /* Number of arguments */
     char *string_arg;       /* String argument if any (allocated) */
+    int block_start;        /* Index of the first argument inside { } (0 = none) */
+    TransformStep *transforms;  /* !binary transform= chain (owned), or NULL */
+    int transform_count;    /* Steps in the chain, -1 if it is malformed */
+    Expr *range_end;        /* End of a start..end argument (!run capture=), or NULL (owned) */
+    int range_arg;          /* Argument range_end belongs to, -1 if the range is malformed */
 } DirectiveInfo;
 
 /* Parsed assignment */
@@ -92,6 +117,7 @@ typedef struct {
     SymbolTable *symbols;   /* Symbol table for lookups */
     uint16_t pc;            /* Current program counter */
     int pass;               /* Assembly pass (1 or 2) */
+    CpuType cpu;            /* Instruction set to parse (default 6510) */
     const char *error;      /* Last error message */
 } Parser;
 
@@ -112,6 +138,11 @@ void parser_set_pc(Parser *parser, uint16_t pc);
  */
 void parser_set_pass(Parser *parser, int pass);
 
+/*
+ * Set the CPU whose mnemonics and addressing modes are recognized.
+ */
+void parser_set_cpu(Parser *parser, CpuType cpu);
+
 /*
  * Parse a single line into a statement.
  * Returns statement that caller must free with statement_free().
@@ -134,6 +165,7 @@ const char *parser_error(Parser *parser);
  * Determine addressing mode from parsed operand.
  * Uses expression result to choose zero-page vs absolute.
  *
+ * cpu: CPU whose addressing modes are available
  * mnemonic: instruction mnemonic (for mode validation)
  * expr: operand expression (can be NULL for implied)
  * has_hash: 1 if # prefix was present (immediate)
@@ -146,6 +178,7 @@ const char *parser_error(Parser *parser);
  * Returns addressing mode or ADDR_INVALID on error.
  */
 AddressingMode detect_addressing_mode(
+    CpuType cpu,
     const char *mnemonic,
     Expr *expr,
     int has_hash,
@@ -0,0 +1,42 @@
+/*
+ * perf.h - Performance Lint for Assembled Code
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef PERF_H
+#define PERF_H
+
+#include "assembler.h"
+
+/* Checks run by -Wperf; each one can be turned off with -Wno-perf=<name> */
+typedef enum {
+    PERF_FORCED_ABS,         /* forced_abs: zero-page operand assembled absolute */
+    PERF_JSR_RTS,            /* jsr_rts: JSR directly followed by RTS */
+    PERF_BRANCH_PAGE,        /* branch_page: loop branch crossing a page */
+    PERF_INDEX_PAGE,         /* index_page: abs,X/abs,Y read in a loop that may cross a page */
+    PERF_PHA_TEMP,           /* pha_temp: PHA/PLA holding A while a zero-page byte is free */
+    PERF_RMW_IO,             /* rmw_io: RMW on an I/O register in a !raster_block */
+    PERF_CHECK_COUNT
+} PerfCheck;
+
+/* Zero-page bytes the C64 KERNAL and BASIC leave free, tried in order */
+#define PERF_FREE_ZP            { 0x02, 0xFB, 0xFC, 0xFD, 0xFE }
+
+/*
+ * Name of a check as used in warnings and -Wno-perf=, and the reverse.
+ * perf_check_lookup returns -1 for an unknown name.
+ */
+const char *perf_check_name(PerfCheck check);
+int perf_check_lookup(const char *name);
+
+/*
+ * Warn about slow code patterns in the final assembled lines. Checks
+ * whose bit (1 << PerfCheck) is set in disabled are skipped. Each
+ * warning gives the estimated cycle cost and ends in [-Wperf=<name>].
+ *
+ * Must be called after a successful pass 2. Returns the number of
+ * warnings issued.
+ */
+int assembler_perf_lint(Assembler *as, unsigned disabled);
+
+#endif /* PERF_H */
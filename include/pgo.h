@@ -0,0 +1,96 @@
+/*
+ * pgo.h - Profile-Guided Code Layout
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef PGO_H
+#define PGO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "assembler.h"
+#include "raster.h"
+
+#define PGO_PAD_MAX             255     /* Most fill bytes one !pgo_pad inserts */
+#define PGO_DEFAULT_FRAMES      50      /* Frames profiled unless told otherwise */
+#define PGO_LAYOUT_ROUNDS       4       /* Passes over the slots while the estimate improves */
+
+/* Execution counts of one instruction, keyed by its source location */
+typedef struct {
+    char *file;              /* Source file (owned) */
+    int line;                /* Source line */
+    int occurrence;          /* Nth instruction assembled from that line (macros, loops) */
+    uint32_t count;          /* Times executed */
+    uint32_t taken;          /* Times a branch was taken */
+    uint32_t *index;         /* X or Y histogram of an abs,X/abs,Y access (256, owned), or NULL */
+} PgoRecord;
+
+/* Padding chosen for one !pgo_pad */
+typedef struct {
+    char *file;              /* Source file (owned) */
+    int line;
+    int pad;
+} PgoSlot;
+
+typedef struct PgoProfile {
+    int frames;              /* Frames the profile covers */
+    PgoRecord *records;      /* Sorted by file, line and occurrence */
+    int record_count;
+
+    /* Result of the last pgo_plan_layout */
+    PgoSlot *slots;
+    int slot_count;
+    int matched;             /* Records that matched an assembled instruction */
+    uint64_t before;         /* Page-crossing cycles over the profile, unpadded */
+    uint64_t after;          /* ... and with the chosen padding */
+} PgoProfile;
+
+/*
+ * Read a profile written by pgo_train.
+ * Returns NULL if the file cannot be read or is not a profile.
+ */
+PgoProfile *pgo_profile_load(const char *filename);
+
+void pgo_profile_free(PgoProfile *profile);
+
+/*
+ * Resolve an entry point given as a number ($c000, 0xc000, 49152) or a
+ * symbol of the assembled program. Returns 0, or -1 if it is neither.
+ */
+int pgo_resolve_address(Assembler *as, const char *text, uint16_t *address);
+
+/*
+ * Run the assembled image in the 6510 model from entry for the given
+ * number of frames and write per-instruction execution counts to
+ * filename. The entry is called once per frame: when it returns with
+ * RTS/RTI or leaves the assembled code (e.g. JMP $EA31) the CPU idles
+ * until the next frame. Code that never returns simply runs for all
+ * frames. Reads of $D011/$D012 return the raster line of the current
+ * cycle; DMA stalls are not modelled. A summary goes to report if not
+ * NULL.
+ *
+ * Must be called after a successful pass 2. Returns 0, or -1 with the
+ * error reported through assembler_error.
+ */
+int pgo_train(Assembler *as, uint16_t entry, int frames, RasterSystem system,
+              const char *filename, FILE *report);
+
+/*
+ * Choose the padding of every !pgo_pad from as->profile so that the
+ * profiled branches and abs,X/abs,Y accesses cross as few pages as
+ * possible. Padding moves everything after the !pgo_pad up to the end
+ * of its segment (the next origin) into free memory behind it; a
+ * !pgo_pad that code falls through into is left at 0. Stores the result
+ * in as->layout_pads and as->profile.
+ *
+ * Returns 1 if any padding was chosen, so the source must be assembled
+ * again, or 0.
+ */
+int pgo_plan_layout(Assembler *as);
+
+/*
+ * Write the chosen padding and the estimated cycles saved per frame.
+ */
+void pgo_report(const PgoProfile *profile, FILE *out);
+
+#endif /* PGO_H */
@@ -0,0 +1,87 @@
+/*
+ * raster.h - VIC-II Raster Timing Model and Raster Block Verification
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "assembler.h"
+
+/* Video standard */
+typedef enum {
+    RASTER_PAL,              /* 6569: 63 cycles x 312 lines */
+    RASTER_NTSC              /* 6567R8: 65 cycles x 263 lines */
+} RasterSystem;
+
+/* Badline DMA window (cycles, 1-based) */
+#define RASTER_BADLINE_BA       12      /* BA goes low */
+#define RASTER_BADLINE_END      54      /* Last c-access */
+#define RASTER_FIRST_DMA_LINE   0x30
+#define RASTER_LAST_DMA_LINE    0xF7
+
+/* VIC-II state that decides when the CPU is stopped */
+typedef struct {
+    RasterSystem system;
+    int cycles_per_line;
+    int lines_per_frame;
+    uint8_t d011;            /* Control register 1 (YSCROLL, DEN) */
+    uint8_t d015;            /* Sprite enable mask */
+} RasterModel;
+
+/* A point in the frame; cycle counts from 1 as in the VIC-II literature */
+typedef struct {
+    int line;
+    int cycle;
+} RasterPos;
+
+/* ========== Timing Model ========== */
+
+/*
+ * Set up the model with the display enabled, YSCROLL 3 and no sprites.
+ */
+void raster_model_init(RasterModel *vic, RasterSystem system);
+
+/*
+ * True if the VIC-II fetches character pointers on this line.
+ */
+int raster_is_badline(const RasterModel *vic, int line);
+
+/*
+ * Number of consecutive cycles BA has been low up to and including
+ * this one, or 0 if the bus is available. Sprites in d015 are treated
+ * as displayed on every line.
+ */
+int raster_ba_low(const RasterModel *vic, RasterPos pos);
+
+/*
+ * True if the CPU cannot use the bus in this cycle. Reads stop as soon
+ * as BA is low; up to three writes may still complete.
+ */
+int raster_cpu_stalled(const RasterModel *vic, RasterPos pos, int is_write);
+
+/*
+ * Move pos forward by the given number of cycles, wrapping lines and frames.
+ */
+void raster_advance(const RasterModel *vic, RasterPos *pos, int cycles);
+
+/* ========== Verification ========== */
+
+/*
+ * Step every !raster_block through the 6510 and VIC-II models and
+ * write the raster line and cycle of each store to $D0xx to report
+ * (if not NULL). A run ends at !raster_end, at the RTS or RTI that
+ * leaves the block, or on reaching code that was not assembled; one
+ * still running after two frames is an error. A !raster_block first
+ * reached from another block is a checkpoint: arriving at any other
+ * line or cycle than it declares is reported as drift through
+ * assembler_error.
+ *
+ * Must be called after a successful pass 2. Returns 0 if every block
+ * ran without drift, -1 otherwise.
+ */
+int assembler_check_raster(Assembler *as, RasterSystem system, FILE *report);
+
+#endif /* RASTER_H */
@@ -0,0 +1,47 @@
+/*
+ * rodata.h - Read-Only Data Packing
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef RODATA_H
+#define RODATA_H
+
+#include <stdint.h>
+
+/* One block as its lines would have emitted it */
+typedef struct {
+    const uint8_t *bytes;
+    int length;
+    int align;               /* Power of two its address must be a multiple of */
+} RodataBlock;
+
+/* Packed blocks: data to emit and where each block starts in it */
+typedef struct {
+    uint8_t *data;           /* Owned */
+    int size;
+    int *offsets;            /* Offset of each input block (owned) */
+    int count;
+    int distinct;            /* Blocks left after dropping duplicates */
+    int inside;              /* Distinct blocks stored inside another one */
+    int overlapped;          /* Bytes shared by a block's end and the next one's start */
+    int padding;             /* Zero bytes added for alignment */
+} RodataPack;
+
+/*
+ * Pack count blocks for placement at address. Equal blocks are stored
+ * once and an unaligned block found inside another one points into it.
+ * The rest are chained greedily by the longest overlap of one block's
+ * end with another's start (the usual shortest-common-superstring
+ * heuristic); an aligned block can only start a chain. Chains are laid
+ * out with each aligned one at the next suitable address, and the gap
+ * before it is filled with the longest unaligned chains that fit before
+ * it is padded. An empty block is placed at the end.
+ *
+ * Returns 0, or -1 with *error set.
+ */
+int rodata_pack(const RodataBlock *blocks, int count, uint16_t address,
+                RodataPack *pack, const char **error);
+
+void rodata_free(RodataPack *pack);
+
+#endif /* RODATA_H */
@@ -0,0 +1,45 @@
+/*
+ * run.h - Assembly-Time Execution of 6502 Code
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef RUN_H
+#define RUN_H
+
+#include <stdint.h>
+
+#define RUN_MAX_CYCLES      100000000L  /* Longest run before giving up */
+
+/* What a !run executes and captures */
+typedef struct {
+    uint16_t entry;          /* Address execution starts at */
+    int32_t until;           /* Address that ends the run, or -1 */
+    long cycles;             /* Cycles to run for, or 0 to run until `until` */
+    uint16_t capture;        /* First address of the captured range */
+    int length;              /* Bytes captured (capture + length <= 65536) */
+} RunOptions;
+
+/* How a run ended */
+typedef struct {
+    long cycles;             /* Cycles executed */
+    uint16_t pc;             /* Where execution stopped */
+} RunResult;
+
+/*
+ * Execute code on the 6510 model over a copy of memory, from
+ * options->entry until the PC reaches options->until or, with cycles,
+ * until that many cycles have passed, then copy the captured range to out.
+ * With until, the entry is entered as if called by a JSR from just before
+ * until, so its final RTS ends the run. The I/O area reads as 0 and
+ * writes to it are dropped.
+ *
+ * Returns 0, or -1 with *error set and result->pc at the failing
+ * instruction.
+ */
+int run_execute(const uint8_t *memory, const RunOptions *options, uint8_t *out,
+                RunResult *result, const char **error);
+
+/* Key of a run: a hash of the memory it starts from and the options */
+uint64_t run_cache_key(const uint8_t *memory, const RunOptions *options);
+
+#endif /* RUN_H */
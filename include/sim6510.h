@@ -0,0 +1,74 @@
+/*
+ * sim6510.h - 6510 Instruction and Bus Cycle Model
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef SIM6510_H
+#define SIM6510_H
+
+#include <stdint.h>
+
+/* I/O area: reads go through the read_io callback, writes are reported */
+#define SIM6510_IO_START    0xD000
+#define SIM6510_IO_END      0xDFFF
+
+/* Status register flags */
+#define SIM6510_FLAG_C      0x01
+#define SIM6510_FLAG_Z      0x02
+#define SIM6510_FLAG_I      0x04
+#define SIM6510_FLAG_D      0x08
+#define SIM6510_FLAG_B      0x10
+#define SIM6510_FLAG_U      0x20
+#define SIM6510_FLAG_V      0x40
+#define SIM6510_FLAG_N      0x80
+
+/* A write to the I/O area */
+typedef struct {
+    uint16_t address;
+    uint8_t value;
+    uint8_t cycle;           /* Cycle within the instruction (0-based) */
+} SimWrite;
+
+/* Bus activity of one executed instruction */
+typedef struct {
+    uint16_t pc;             /* Address the opcode was fetched from */
+    uint8_t opcode;
+    int cycles;              /* Cycles taken, including page and branch penalties */
+    uint8_t write_mask;      /* Bit n set if cycle n is a write cycle */
+    SimWrite io_writes[2];   /* Final I/O writes, in cycle order */
+    int io_write_count;
+} SimStep;
+
+/*
+ * Callback for reads from the I/O area. `cycle` is the cycle within
+ * the instruction the read happens on; every earlier cycle of such an
+ * instruction is a read cycle.
+ */
+typedef uint8_t (*SimReadIO)(void *ctx, uint16_t address, int cycle);
+
+/* CPU state */
+typedef struct {
+    uint8_t a, x, y, sp, p;
+    uint16_t pc;
+    uint8_t *memory;         /* 64K of RAM (not owned) */
+    SimReadIO read_io;       /* May be NULL: the I/O area then reads as 0 */
+    void *ctx;
+} Sim6510;
+
+/*
+ * Reset registers and point the CPU at memory, starting at pc.
+ * The stack pointer starts at $FF and interrupts are disabled.
+ * The opcode tables must already be built (opcodes_init).
+ */
+void sim6510_init(Sim6510 *cpu, uint8_t *memory, uint16_t pc);
+
+/*
+ * Execute one instruction and describe its bus cycles in step.
+ * RAM writes outside the I/O area are applied to memory; I/O writes
+ * are only reported. Decimal mode follows the NMOS 6502.
+ * Returns 0, or -1 for an opcode the model does not implement
+ * (JAM and the unstable illegal opcodes); the CPU is not advanced then.
+ */
+int sim6510_step(Sim6510 *cpu, SimStep *step);
+
+#endif /* SIM6510_H */
@@ -0,0 +1,65 @@
+/*
+ * strpool.h - String Pooling and Dictionary Compression
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef STRPOOL_H
+#define STRPOOL_H
+
+#include <stdint.h>
+
+#define STRPOOL_MAX_WORD        12      /* Longest dictionary entry in bytes */
+#define STRPOOL_DECODER_SIZE    55      /* Bytes of the generated decoder */
+
+/* How a pool is built */
+typedef struct {
+    int compress;            /* Dictionary-compress and put a decoder first */
+    uint16_t output;         /* Routine the decoder calls with each byte in A */
+    uint8_t zp;              /* First of the four zero page bytes the decoder uses */
+} StrPoolOptions;
+
+/* One string as the directive would have emitted it */
+typedef struct {
+    const uint8_t *bytes;
+    int length;
+} PoolString;
+
+/* A built pool: data to emit and where each string starts in it */
+typedef struct {
+    uint8_t *data;           /* Owned */
+    int size;
+    int *offsets;            /* Offset of each input string (owned) */
+    int count;
+    int distinct;            /* Strings left after dropping duplicates */
+    int shared;              /* Distinct strings stored inside another one */
+    int words;               /* Dictionary entries */
+} StrPool;
+
+/*
+ * Pool count strings for placement at address. Equal strings are stored
+ * once and a string found inside one already placed (for null-terminated
+ * strings, a tail) points into it; the longest strings are placed first.
+ *
+ * With compress, every string must end in its only zero byte. Byte values
+ * above the largest one in the strings become codes for dictionary entries
+ * of up to STRPOOL_MAX_WORD bytes, chosen greedily by the bytes they save.
+ * The pool then holds, in order: the decoder, the low and high bytes of
+ * each entry's address, the zero-terminated entries and the encoded
+ * strings. The decoder takes a string's address in A (low) and X (high)
+ * and calls output with each byte up to the terminator; output may change
+ * A, X and Y but not the four zero page bytes from zp.
+ *
+ * Returns 0, or -1 with *error set.
+ */
+int strpool_build(const PoolString *strings, int count, const StrPoolOptions *options,
+                  uint16_t address, StrPool *pool, const char **error);
+
+/*
+ * Point the output calls of a decoder copied from the start of a
+ * compressed pool at another routine.
+ */
+void strpool_set_output(uint8_t *decoder, uint16_t output);
+
+void strpool_free(StrPool *pool);
+
+#endif /* STRPOOL_H */
@@ -18,7 +18,8 @@ typedef enum {
     SYM_REFERENCED  = 0x08,  /* Has been referenced in code */
     SYM_LOCAL       = 0x10,  /* Local label (starts with .) */
     SYM_EXPORTED    = 0x20,  /* Should appear in symbol file */
-    SYM_FORCE_UPDATE = 0x40  /* Force update even if constant (for loops/pass2) */
+    SYM_FORCE_UPDATE = 0x40, /* Force update even if constant (for loops/pass2) */
+    SYM_SMC         = 0x80   /* Names self-modifying operand bytes (:@name) */
 } SymbolFlags;
 
 /* Symbol entry */
@@ -29,6 +30,9 @@ typedef struct Symbol {
     uint8_t flags;           /* SymbolFlags bitmask */
     const char *file;        /* File where defined */
     int line;                /* Line where defined */
+    int *def_lines;          /* Stored line indices that define it (owned) */
+    int def_count;
+    int def_capacity;
     struct Symbol *next;     /* Hash chain pointer */
 } Symbol;
 
@@ -37,6 +41,8 @@ typedef struct {
     Symbol **buckets;        /* Hash buckets */
     int size;                /* Number of buckets */
     int count;               /* Number of symbols */
+    struct ExprFunctions *functions;    /* !func definitions (set and freed by the owner) */
+    struct ExprLists *lists;            /* !let lists (set and freed by the owner) */
 } SymbolTable;
 
 /* Scope entry for zone/macro scoping */
@@ -106,6 +112,12 @@ int symbol_is_defined(SymbolTable *table, const char *name);
 Symbol *symbol_reference(SymbolTable *table, const char *name,
                          const char *file, int line);
 
+/*
+ * Record that the stored line at index line_index defines a symbol.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int symbol_add_definer(Symbol *sym, int line_index);
+
 /*
  * Check for undefined symbols that were referenced.
  * Calls error_fn for each undefined symbol.
@@ -189,6 +201,12 @@ void anon_free(AnonLabels *anon);
  */
 void anon_reset_pass(AnonLabels *anon);
 
+/*
+ * Copy anonymous label state (labels, counts and forward cursor).
+ * Returns NULL on allocation failure.
+ */
+AnonLabels *anon_clone(const AnonLabels *anon);
+
 /*
  * Clear all anonymous labels (for new assembly).
  */
@@ -0,0 +1,50 @@
+/*
+ * threadpool.h - Fixed-size Worker Thread Pool
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+/* Task callback: called once for each index in [0, count) */
+typedef void (*ThreadTask)(void *arg, int index);
+
+/* Opaque pool of worker threads */
+typedef struct ThreadPool ThreadPool;
+
+/* ========== Pool Lifecycle ========== */
+
+/*
+ * Create a pool that runs tasks on `threads` threads in total.
+ * The calling thread counts as one of them, so threads <= 1 creates
+ * no workers and runs everything inline.
+ * Returns NULL on failure.
+ */
+ThreadPool *threadpool_create(int threads);
+
+/*
+ * Stop and join all workers, then free the pool.
+ */
+void threadpool_free(ThreadPool *pool);
+
+/* ========== Task Execution ========== */
+
+/*
+ * Run task(arg, i) for every i in [0, count) and wait for all of them.
+ * Indices are handed out in ascending order; the calling thread also
+ * executes tasks. Not reentrant: tasks must not call threadpool_run
+ * on the same pool.
+ */
+void threadpool_run(ThreadPool *pool, ThreadTask task, void *arg, int count);
+
+/*
+ * Number of threads (including the caller) the pool runs tasks on.
+ */
+int threadpool_size(const ThreadPool *pool);
+
+/*
+ * Number of online processors, or 1 if it cannot be determined.
+ */
+int threadpool_cpu_count(void);
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,54 @@
+/*
+ * transform.h - Data Transforms for !binary
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <stdint.h>
+
+/* Steps of a !binary transform= chain */
+typedef enum {
+    TRANSFORM_REVERSE,       /* reverse: last byte first */
+    TRANSFORM_BITREVERSE,    /* bitreverse: bit 7 <-> bit 0 in every byte */
+    TRANSFORM_MIRROR,        /* mirror(w [, bits]): flip rows of w bytes left to right */
+    TRANSFORM_TRANSPOSE,     /* transpose(w, h): h rows of w bytes -> w columns of h bytes */
+    TRANSFORM_INTERLEAVE,    /* interleave(n): n tables -> one entry of each in turn */
+    TRANSFORM_DEINTERLEAVE,  /* deinterleave(n): every n-th byte -> n tables */
+    TRANSFORM_DELTA,         /* delta: each byte minus the one before */
+    TRANSFORM_NIBBLEPACK,    /* nibblepack: low nibbles of byte pairs -> one byte */
+    TRANSFORM_XOR,           /* xor(v): exclusive-or every byte with v */
+    TRANSFORM_ADD,           /* add(v): add v to every byte */
+    TRANSFORM_KIND_COUNT
+} TransformKind;
+
+/* A step with its evaluated arguments */
+typedef struct {
+    TransformKind kind;
+    int args[2];
+    int arg_count;
+} BinaryTransform;
+
+/*
+ * Name of a transform as written in transform=, and the reverse.
+ * transform_lookup returns -1 for an unknown name.
+ */
+const char *transform_name(TransformKind kind);
+int transform_lookup(const char *name);
+
+/* Fewest and most arguments a transform takes */
+void transform_arg_range(TransformKind kind, int *min, int *max);
+
+/*
+ * Apply one step to *length bytes at *data, which may be replaced by a
+ * new buffer of a new length (caller frees). Per-byte steps run as plain
+ * loops over the buffer that the compiler can vectorize.
+ *
+ * Returns 0, or -1 with *error set if the arguments or the length do not
+ * suit the step.
+ */
+int transform_apply(const BinaryTransform *step, uint8_t **data, int *length,
+                    const char **error);
+
+#endif /* TRANSFORM_H */
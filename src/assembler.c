@@ -9,6 +9,15 @@
 #include "expr.h"
 #include "opcodes.h"
 #include "util.h"
+#include "pgo.h"
+#include "delay.h"
+#include "image.h"
+#include "charmap.h"
+#include "transform.h"
+#include "strpool.h"
+#include "rodata.h"
+#include "run.h"
+#include "optimize.h"
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
@@ -24,6 +33,97 @@ static char *path_join(const char *dir, const char *file);
 static char *get_directory(const char *filepath);
 static char *read_file_content(const char *filename, long *size_out);
 
+/* Forward declarations for inline subroutines */
+static int inline_begin(Assembler *as, const char *name);
+static void inline_collect(Assembler *as, Statement *stmt, const char *source_line);
+static int inline_call(Assembler *as, Statement *stmt, const char *source_line);
+static void inline_routine_drop(Assembler *as);
+static void inline_calls_free(Assembler *as);
+static void inline_report_missed(Assembler *as);
+static void inline_routines_free(Assembler *as);
+
+/* Forward declaration for built charmaps */
+static void free_charmaps(Assembler *as);
+
+/* Forward declaration for string pools */
+static void free_strpools(Assembler *as);
+
+/* Forward declaration for read-only data */
+static void free_rodata(Assembler *as);
+
+/* ========== Source Line Index ========== */
+
+/*
+ * Offsets of each line start in a source buffer. Built once per source
+ * (incrementally when streaming) so listing text can be captured per
+ * statement without rescanning the buffer from the top.
+ */
+typedef struct {
+    size_t *starts;
+    int count;
+    int capacity;
+} LineIndex;
+
+static int line_index_add(LineIndex *index, size_t offset) {
+    if (index->count >= index->capacity) {
+        int new_cap = index->capacity ? index->capacity * 2 : 1024;
+        size_t *new_starts = realloc(index->starts, new_cap * sizeof(size_t));
+        if (!new_starts) return -1;
+        index->starts = new_starts;
+        index->capacity = new_cap;
+    }
+    index->starts[index->count++] = offset;
+    return 0;
+}
+
+static int line_index_init(LineIndex *index) {
+    index->starts = NULL;
+    index->count = 0;
+    index->capacity = 0;
+    return line_index_add(index, 0);
+}
+
+/* Record line starts for newlines in buf[from..to) */
+static int line_index_scan(LineIndex *index, const char *buf, size_t from, size_t to) {
+    for (size_t i = from; i < to; i++) {
+        if (buf[i] == '\n' && line_index_add(index, i + 1) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void line_index_free(LineIndex *index) {
+    free(index->starts);
+    index->starts = NULL;
+    index->count = 0;
+    index->capacity = 0;
+}
+
+/* Copy a source line, trimmed of surrounding whitespace (NULL if blank) */
+static char *line_index_capture(const LineIndex *index, const char *source, int line) {
+    if (line < 1 || line > index->count) return NULL;
+
+    const char *line_start = source + index->starts[line - 1];
+    while (*line_start == ' ' || *line_start == '\t') line_start++;
+    const char *line_end = line_start;
+    while (*line_end && *line_end != '\n') line_end++;
+    int line_len = (int)(line_end - line_start);
+    /* Strip trailing whitespace */
+    while (line_len > 0 && (line_start[line_len-1] == ' ' ||
+           line_start[line_len-1] == '\t' || line_start[line_len-1] == '\r')) {
+        line_len--;
+    }
+    if (line_len <= 0) return NULL;
+
+    char *text = malloc(line_len + 1);
+    if (text) {
+        memcpy(text, line_start, line_len);
+        text[line_len] = '\0';
+    }
+    return text;
+}
+
 /* ========== Assembler Lifecycle ========== */
 
 Assembler *assembler_create(void) {
@@ -38,7 +138,8 @@ Assembler *assembler_create(void) {
     }
 
     as->symbols = symbol_table_create(1024);
-    if (!as->symbols) {
+    if (!as->symbols || !(as->symbols->functions = expr_functions_create()) ||
+        !(as->symbols->lists = expr_lists_create())) {
         assembler_free(as);
         return NULL;
     }
@@ -81,6 +182,11 @@ Assembler *assembler_create(void) {
     /* Initialize zone for local labels */
     as->current_zone = NULL;
 
+    /* Serial code generation unless configured otherwise */
+    as->threads = 1;
+
+    as->balanced_open = -1;
+
     return as;
 }
 
@@ -90,16 +196,47 @@ void assembler_free(Assembler *as) {
     free(as->memory);
     free(as->written);
     free(as->current_zone);
+    if (as->symbols) {
+        expr_functions_free(as->symbols->functions);
+        expr_lists_free(as->symbols->lists);
+    }
     symbol_table_free(as->symbols);
     scope_free(as->scope);
     anon_free(as->anon_labels);
     macro_table_free(as->macros);
+    threadpool_free(as->pool);
+    free(as->claimed);
+    free(as->layout_pads);
+    free(as->balanced);
+    free(as->balance_pads);
+    free(as->opt_edits);
+    inline_routines_free(as);
+    free(as->image_cache_dir);
+    free(as->run_cache_dir);
+    while (as->run_captures) {
+        RunCapture *next = as->run_captures->next;
+        free(as->run_captures->data);
+        free(as->run_captures);
+        as->run_captures = next;
+    }
+    while (as->images) {
+        ConvertedImage *next = as->images->next;
+        free(as->images->data);
+        free(as->images);
+        as->images = next;
+    }
+    free_charmaps(as);
+    free_strpools(as);
+    free_rodata(as);
 
     /* Free assembled lines */
     for (int i = 0; i < as->line_count; i++) {
         statement_free(as->lines[i].stmt);
         free(as->lines[i].source_text);
         free(as->lines[i].zone);
+        free(as->lines[i].reads);
+        free(as->lines[i].generated);
+        free(as->lines[i].run);
     }
     free(as->lines);
 
@@ -119,6 +256,11 @@ void assembler_free(Assembler *as) {
         free(as->cmdline_defines[i]);
     }
 
+    for (int i = 0; i < as->file_name_count; i++) {
+        free(as->file_names[i]);
+    }
+    free(as->file_names);
+
     free(as);
 }
 
@@ -128,8 +270,14 @@ void assembler_reset(Assembler *as) {
     memset(as->memory, 0, ASM_MEMORY_SIZE);
     memset(as->written, 0, ASM_MEMORY_SIZE);
 
+    expr_functions_free(as->symbols->functions);
+    expr_lists_free(as->symbols->lists);
     symbol_table_free(as->symbols);
     as->symbols = symbol_table_create(1024);
+    if (as->symbols) {
+        as->symbols->functions = expr_functions_create();
+        as->symbols->lists = expr_lists_create();
+    }
 
     scope_free(as->scope);
     as->scope = scope_create();
@@ -140,10 +288,17 @@ void assembler_reset(Assembler *as) {
 
     anon_clear(as->anon_labels);
 
+    /* Built charmaps and pools belong to the statements freed below */
+    free_charmaps(as);
+    free_strpools(as);
+    free_rodata(as);
     for (int i = 0; i < as->line_count; i++) {
         statement_free(as->lines[i].stmt);
         free(as->lines[i].source_text);
         free(as->lines[i].zone);
+        free(as->lines[i].reads);
+        free(as->lines[i].generated);
+        free(as->lines[i].run);
     }
     free(as->lines);
     as->lines = NULL;
@@ -159,6 +314,25 @@ void assembler_reset(Assembler *as) {
     as->pass = 1;
     as->errors = 0;
     as->warnings = 0;
+    as->anon_zone_counter = 0;
+    as->pass2_chunks = 0;
+    as->pass2_revisited = 0;
+    as->pass2_skipped = 0;
+    as->reuse_pass1 = as->incremental;
+    as->layout_slot = 0;
+    as->stored_line = NULL;
+    as->balanced_count = 0;
+    as->balanced_open = -1;
+    as->balance_changed = 0;
+    as->opt_slot = 0;
+    as->inline_open = NULL;
+    as->inline_forward = 0;
+    inline_calls_free(as);
+    as->expansion_depth = 0;
+    as->frames = NULL;
+    if (as->claimed) {
+        memset(as->claimed, 0, ASM_MEMORY_SIZE);
+    }
 
     /* Clear include stack (keep include_paths) */
     for (int i = 0; i < as->include_depth; i++) {
@@ -203,37 +377,160 @@ void assembler_reset(Assembler *as) {
     }
 }
 
+/* ========== Source Names ========== */
+
+/*
+ * Stored statements point at the name of the file they came from, so the
+ * names of include files and macro/loop pseudo-files are kept here until
+ * the assembler is freed. Returns NULL if out of memory.
+ */
+static const char *intern_file_name(Assembler *as, const char *name) {
+    for (int i = 0; i < as->file_name_count; i++) {
+        if (strcmp(as->file_names[i], name) == 0) return as->file_names[i];
+    }
+
+    char **names = realloc(as->file_names, (as->file_name_count + 1) * sizeof(char *));
+    if (!names) return NULL;
+    as->file_names = names;
+
+    char *copy = str_dup(name);
+    if (!copy) return NULL;
+    names[as->file_name_count++] = copy;
+    return copy;
+}
+
+/*
+ * Enter a macro, loop or inline expansion for line attribution; frame is
+ * added to the frame path unless NULL. Returns the path to restore with
+ * expansion_leave.
+ */
+static const char *expansion_enter(Assembler *as, const char *frame) {
+    const char *saved = as->frames;
+
+    if (as->expansion_depth++ == 0) {
+        as->origin_file = as->current_file;
+        as->origin_zone = intern_file_name(as, as->current_zone ? as->current_zone : "");
+    }
+    if (frame) {
+        char path[1024];
+        if (saved) {
+            snprintf(path, sizeof(path), "%s;%s", saved, frame);
+        } else {
+            snprintf(path, sizeof(path), "%s", frame);
+        }
+        const char *interned = intern_file_name(as, path);
+        if (interned) as->frames = interned;
+    }
+    return saved;
+}
+
+static void expansion_leave(Assembler *as, const char *saved) {
+    as->expansion_depth--;
+    as->frames = saved;
+}
+
 /* ========== Error Handling ========== */
 
+/* Append a formatted diagnostic to a buffer (parallel pass 2 workers) */
+static void diag_append(DiagBuffer *diag, int is_error, const char *prefix,
+                        const char *fmt, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int msg_len = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+    if (msg_len < 0) return;
+
+    size_t prefix_len = strlen(prefix);
+    char *text = malloc(prefix_len + (size_t)msg_len + 1);
+    if (!text) return;
+    memcpy(text, prefix, prefix_len);
+    vsnprintf(text + prefix_len, (size_t)msg_len + 1, fmt, args);
+
+    if (diag->count >= diag->capacity) {
+        int new_cap = diag->capacity ? diag->capacity * 2 : 16;
+        Diagnostic *items = realloc(diag->items, new_cap * sizeof(Diagnostic));
+        if (!items) {
+            free(text);
+            return;
+        }
+        diag->items = items;
+        diag->capacity = new_cap;
+    }
+    diag->items[diag->count].is_error = is_error;
+    diag->items[diag->count].text = text;
+    diag->count++;
+}
+
+static void report(Assembler *as, int is_error, const char *fmt, va_list args) {
+    char prefix[512];
+    snprintf(prefix, sizeof(prefix), "%s:%d: %s: ",
+             as->current_file ? as->current_file : "<input>",
+             as->current_line, is_error ? "error" : "warning");
+
+    if (as->diag) {
+        diag_append(as->diag, is_error, prefix, fmt, args);
+        return;
+    }
+
+    fputs(prefix, stderr);
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+}
+
+/* Print buffered diagnostics (already counted) and empty the buffer */
+static void diag_replay(Assembler *as, DiagBuffer *diag) {
+    for (int i = 0; i < diag->count; i++) {
+        if (as->diag) {
+            DiagBuffer *outer = as->diag;
+            if (outer->count >= outer->capacity) {
+                int new_cap = outer->capacity ? outer->capacity * 2 : 16;
+                Diagnostic *items = realloc(outer->items, new_cap * sizeof(Diagnostic));
+                if (items) {
+                    outer->items = items;
+                    outer->capacity = new_cap;
+                }
+            }
+            if (outer->count < outer->capacity) {
+                outer->items[outer->count++] = diag->items[i];
+                continue;
+            }
+        } else {
+            fprintf(stderr, "%s\n", diag->items[i].text);
+        }
+        free(diag->items[i].text);
+    }
+    free(diag->items);
+    memset(diag, 0, sizeof(*diag));
+}
+
+/* Drop buffered diagnostics */
+static void diag_discard(DiagBuffer *diag) {
+    for (int i = 0; i < diag->count; i++) {
+        free(diag->items[i].text);
+    }
+    free(diag->items);
+    memset(diag, 0, sizeof(*diag));
+}
+
 void assembler_error(Assembler *as, const char *fmt, ...) {
     if (as->errors >= ASM_MAX_ERRORS) return;
 
-    fprintf(stderr, "%s:%d: error: ",
-            as->current_file ? as->current_file : "<input>",
-            as->current_line);
-
     va_list args;
     va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
+    report(as, 1, fmt, args);
     va_end(args);
 
-    fprintf(stderr, "\n");
     as->errors++;
 }
 
 void assembler_warning(Assembler *as, const char *fmt, ...) {
     if (as->warnings >= ASM_MAX_WARNINGS) return;
 
-    fprintf(stderr, "%s:%d: warning: ",
-            as->current_file ? as->current_file : "<input>",
-            as->current_line);
-
     va_list args;
     va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
+    report(as, 0, fmt, args);
     va_end(args);
 
-    fprintf(stderr, "\n");
     as->warnings++;
 }
 
@@ -251,9 +548,18 @@ int assembler_warning_count(Assembler *as) {
 
 /* ========== Code Emission ========== */
 
+int assembler_emitting(Assembler *as) {
+    return as->pass == 2 || as->emit_pass1;
+}
+
+/* Output position: real_pc inside !pseudopc, pc otherwise */
+static uint16_t output_pc(Assembler *as) {
+    return as->in_pseudopc ? as->real_pc : as->pc;
+}
+
 void assembler_emit_byte(Assembler *as, uint8_t byte) {
     /* Use real_pc for actual output position when in pseudopc mode */
-    uint16_t output_addr = as->in_pseudopc ? as->real_pc : as->pc;
+    uint16_t output_addr = output_pc(as);
 
     if (output_addr < as->lowest_addr) as->lowest_addr = output_addr;
     if (output_addr > as->highest_addr) as->highest_addr = output_addr;
@@ -324,6 +630,17 @@ int assembler_is_zeropage(int32_t addr) {
 
 /* ========== Line Storage ========== */
 
+/* Operand bytes (bit n = byte n) an instruction's :@ label names */
+static uint8_t operand_label_mask(const InstructionInfo *info) {
+    if (!info->operand_label) return 0;
+    switch (info->operand_part) {
+        case OPERAND_LABEL_LO: return 0x02;
+        case OPERAND_LABEL_HI: return 0x04;
+        case OPERAND_LABEL_ALL: break;
+    }
+    return info->size >= 3 ? 0x06 : 0x02;
+}
+
 static int add_assembled_line(Assembler *as, Statement *stmt, uint16_t address,
                               const char *source_text) {
     if (as->line_count >= as->line_capacity) {
@@ -343,18 +660,79 @@ static int add_assembled_line(Assembler *as, Statement *stmt, uint16_t address,
     line->address = address;
     line->source_text = source_text ? str_dup(source_text) : NULL;
     line->zone = as->current_zone ? str_dup(as->current_zone) : NULL;
+    line->real_address = as->real_pc;
+    line->in_pseudopc = as->in_pseudopc;
+    line->origin_file = as->expansion_depth ? as->origin_file : as->current_file;
+    line->origin_zone = as->expansion_depth ? as->origin_zone : NULL;
+    line->frames = as->frames;
 
     /* Extract cycle info from instruction if available */
     if (stmt && stmt->type == STMT_INSTRUCTION) {
         line->cycles = stmt->data.instruction.cycles;
         line->page_penalty = stmt->data.instruction.page_penalty;
+        line->smc = operand_label_mask(&stmt->data.instruction);
     }
+    line->cpu = as->cpu_type;
 
     return as->line_count - 1;
 }
 
 /* ========== Label Handling ========== */
 
+/* Mangle a local label name with the current zone (caller frees) */
+static char *local_label_name(Assembler *as, const char *name) {
+    const char *local_part = name;
+    if (local_part[0] == '.') local_part++;
+
+    char *mangled;
+    if (as->current_zone) {
+        size_t len = strlen(as->current_zone) + 1 + strlen(local_part) + 1;
+        mangled = malloc(len);
+        if (mangled) {
+            snprintf(mangled, len, "%s.%s", as->current_zone, local_part);
+        }
+    } else {
+        size_t len = strlen(local_part) + 10;
+        mangled = malloc(len);
+        if (mangled) {
+            snprintf(mangled, len, "_global.%s", local_part);
+        }
+    }
+    return mangled;
+}
+
+/* Symbol of a named label in the current zone, or NULL */
+static Symbol *label_symbol(Assembler *as, const LabelInfo *label) {
+    if (!label->is_local) return symbol_lookup(as->symbols, label->name);
+
+    char *mangled = local_label_name(as, label->name);
+    Symbol *sym = mangled ? symbol_lookup(as->symbols, mangled) : NULL;
+    free(mangled);
+    return sym;
+}
+
+/* Define a :@ label at the operand bytes of the instruction at the PC */
+static void define_operand_label(Assembler *as, const InstructionInfo *info) {
+    LabelInfo *label = info->operand_label;
+    uint16_t address = (uint16_t)(as->pc + (info->operand_part == OPERAND_LABEL_HI ? 2 : 1));
+    uint8_t flags = SYM_DEFINED | SYM_SMC;
+    if (assembler_is_zeropage(address)) {
+        flags |= SYM_ZEROPAGE;
+    }
+
+    if (label->is_local) {
+        char *mangled = local_label_name(as, label->name);
+        if (mangled) {
+            symbol_define(as->symbols, mangled, address, flags,
+                         as->current_file, as->current_line);
+            free(mangled);
+        }
+    } else {
+        symbol_define(as->symbols, label->name, address, flags,
+                     as->current_file, as->current_line);
+    }
+}
+
 static void define_label(Assembler *as, LabelInfo *label) {
     if (!label) return;
 
@@ -368,25 +746,7 @@ static void define_label(Assembler *as, LabelInfo *label) {
     } else if (label->is_anon_back) {
         anon_define_backward(as->anon_labels, as->pc, as->current_file, as->current_line);
     } else if (label->is_local) {
-        /* Mangle local label name with current zone */
-        const char *local_part = label->name;
-        if (local_part[0] == '.') local_part++;
-
-        char *mangled;
-        if (as->current_zone) {
-            size_t len = strlen(as->current_zone) + 1 + strlen(local_part) + 1;
-            mangled = malloc(len);
-            if (mangled) {
-                snprintf(mangled, len, "%s.%s", as->current_zone, local_part);
-            }
-        } else {
-            size_t len = strlen(local_part) + 10;
-            mangled = malloc(len);
-            if (mangled) {
-                snprintf(mangled, len, "_global.%s", local_part);
-            }
-        }
-
+        char *mangled = local_label_name(as, label->name);
         if (mangled) {
             symbol_define(as->symbols, mangled, as->pc, flags,
                          as->current_file, as->current_line);
@@ -403,14 +763,32 @@ static void define_label(Assembler *as, LabelInfo *label) {
     }
 }
 
+/* Report a value an expression could not give: a failed !func call names
+ * the function, a bad list index says so, anything else gets the message */
+static void report_undefined(Assembler *as, const ExprResult *result, const char *message) {
+    if (result->error && result->function) {
+        assembler_error(as, "function '%s': %s", result->function, result->error);
+    } else if (result->error) {
+        assembler_error(as, "%s", result->error);
+    } else {
+        assembler_error(as, "%s", message);
+    }
+}
+
 /* ========== Instruction Assembly ========== */
 
 int assembler_assemble_instruction(Assembler *as, Statement *stmt) {
     InstructionInfo *info = &stmt->data.instruction;
 
+    /* Removed by the optimizer: nothing to generate */
+    if (as->stored_line && as->stored_line->stmt == stmt &&
+        as->stored_line->optimized == OPT_REMOVE) {
+        return 0;
+    }
+
     /* Accumulator and implied modes don't need operand evaluation */
     if (info->mode == ADDR_ACCUMULATOR || info->mode == ADDR_IMPLIED) {
-        if (as->pass == 2) {
+        if (assembler_emitting(as)) {
             assembler_emit_byte(as, info->opcode);
         } else {
             assembler_advance_pc(as, 1);
@@ -427,15 +805,42 @@ int assembler_assemble_instruction(Assembler *as, Statement *stmt) {
         operand_value = result.value;
         value_defined = result.defined;
 
-        if (as->pass == 2 && !value_defined) {
-            assembler_error(as, "undefined symbol in operand");
+        if (assembler_emitting(as) && !value_defined) {
+            report_undefined(as, &result, "undefined symbol in operand");
             return -1;
         }
     }
 
+    /* Bit branches (BBR/BBS): zero-page operand, then a branch offset */
+    if (info->mode == ADDR_ZP_RELATIVE) {
+        if (assembler_emitting(as)) {
+            ExprResult target = expr_eval(info->target, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+            if (!target.defined) {
+                report_undefined(as, &target, "undefined symbol in branch target");
+                return -1;
+            }
+            if (!assembler_is_zeropage(operand_value)) {
+                assembler_error(as, "%s needs a zero page address", info->mnemonic);
+                return -1;
+            }
+            /* The offset counts from the end of the 3-byte instruction */
+            int offset = assembler_calc_branch_offset((uint16_t)target.value, (uint16_t)(as->pc + 1));
+            if (offset == INT_MIN) {
+                assembler_error(as, "branch target out of range");
+                return -1;
+            }
+            assembler_emit_byte(as, info->opcode);
+            assembler_emit_byte(as, (uint8_t)operand_value);
+            assembler_emit_byte(as, (uint8_t)(offset & 0xFF));
+        } else {
+            assembler_advance_pc(as, 3);
+        }
+        return 0;
+    }
+
     /* Handle relative branches */
     if (info->mode == ADDR_RELATIVE) {
-        if (as->pass == 2) {
+        if (assembler_emitting(as)) {
             int offset = assembler_calc_branch_offset(operand_value, as->pc);
             if (offset == INT_MIN) {
                 assembler_error(as, "branch target out of range");
@@ -450,24 +855,24 @@ int assembler_assemble_instruction(Assembler *as, Statement *stmt) {
     }
 
     /* Re-evaluate addressing mode in pass 2 if operand is now known */
-    if (as->pass == 2 && value_defined) {
+    if (assembler_emitting(as) && value_defined) {
         AddressingMode new_mode = info->mode;
 
         /* Check if we can use zero-page mode now that value is known */
         if (assembler_is_zeropage(operand_value)) {
             switch (info->mode) {
                 case ADDR_ABSOLUTE:
-                    if (opcode_find(info->mnemonic, ADDR_ZEROPAGE)) {
+                    if (opcode_find_cpu(as->cpu_type, info->mnemonic, ADDR_ZEROPAGE)) {
                         new_mode = ADDR_ZEROPAGE;
                     }
                     break;
                 case ADDR_ABSOLUTE_X:
-                    if (opcode_find(info->mnemonic, ADDR_ZEROPAGE_X)) {
+                    if (opcode_find_cpu(as->cpu_type, info->mnemonic, ADDR_ZEROPAGE_X)) {
                         new_mode = ADDR_ZEROPAGE_X;
                     }
                     break;
                 case ADDR_ABSOLUTE_Y:
-                    if (opcode_find(info->mnemonic, ADDR_ZEROPAGE_Y)) {
+                    if (opcode_find_cpu(as->cpu_type, info->mnemonic, ADDR_ZEROPAGE_Y)) {
                         new_mode = ADDR_ZEROPAGE_Y;
                     }
                     break;
@@ -478,7 +883,7 @@ int assembler_assemble_instruction(Assembler *as, Statement *stmt) {
 
         /* If mode changed, verify the new opcode */
         if (new_mode != info->mode) {
-            const OpcodeEntry *op = opcode_find(info->mnemonic, new_mode);
+            const OpcodeEntry *op = opcode_find_cpu(as->cpu_type, info->mnemonic, new_mode);
             if (op && op->size == info->size) {
                 /* Mode changed but size stayed same - update info */
                 info->mode = new_mode;
@@ -489,7 +894,7 @@ int assembler_assemble_instruction(Assembler *as, Statement *stmt) {
     }
 
     /* Emit the instruction */
-    if (as->pass == 2) {
+    if (assembler_emitting(as)) {
         assembler_emit_byte(as, info->opcode);
 
         switch (info->size) {
@@ -520,17 +925,72 @@ int assembler_assemble_instruction(Assembler *as, Statement *stmt) {
 
 /* ========== Directive Assembly ========== */
 
+/* The !let list a !byte or !word argument names, alone or under < or >,
+ * to emit all its elements; *op is that operator or -1 */
+static const ExprList *bulk_list(Assembler *as, const Expr *arg, int *op) {
+    *op = -1;
+    if (arg->type == EXPR_UNARY &&
+        (arg->data.unary.op == UNARY_LOW || arg->data.unary.op == UNARY_HIGH)) {
+        *op = arg->data.unary.op;
+        arg = arg->data.unary.operand;
+    }
+    if (arg->type != EXPR_SYMBOL) return NULL;
+    return expr_list_find(as->symbols->lists, arg->data.symbol);
+}
+
+static int32_t bulk_value(const ExprList *list, int op, int i) {
+    int32_t value = expr_list_get(list, i);
+    if (op == UNARY_LOW) return value & 0xFF;
+    if (op == UNARY_HIGH) return (value >> 8) & 0xFF;
+    return value;
+}
+
+/* Emit every element of list as size-byte values */
+static int emit_bulk_list(Assembler *as, const ExprList *list, int op, int size) {
+    /* Pass 1 took a name it did not know yet for a single symbol */
+    if (as->pass == 2 && as->stored_line &&
+        expr_list_tag(list) > (int)(as->stored_line - as->lines)) {
+        assembler_error(as, "list '%s' is emitted before its !let", expr_list_name(list));
+        return -1;
+    }
+
+    int length = expr_list_length(list);
+    if (!assembler_emitting(as)) {
+        assembler_advance_pc(as, length * size);
+        return 0;
+    }
+    for (int i = 0; i < length; i++) {
+        int32_t value = bulk_value(list, op, i);
+        if (size == 2) {
+            assembler_emit_word(as, value & 0xFFFF);
+        } else {
+            if (value < -128 || value > 255) {
+                assembler_warning(as, "byte value $%X truncated", value);
+            }
+            assembler_emit_byte(as, value & 0xFF);
+        }
+    }
+    return 0;
+}
+
 static int assemble_byte_directive(Assembler *as, Statement *stmt) {
     DirectiveInfo *dir = &stmt->data.directive;
 
     for (int i = 0; i < dir->arg_count; i++) {
+        int op;
+        const ExprList *list = bulk_list(as, dir->args[i], &op);
+        if (list) {
+            if (emit_bulk_list(as, list, op, 1) < 0) return -1;
+            continue;
+        }
+
         ExprResult result = expr_eval(dir->args[i], as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
-        if (as->pass == 2 && !result.defined) {
-            assembler_error(as, "undefined symbol in !byte directive");
+        if (assembler_emitting(as) && !result.defined) {
+            report_undefined(as, &result, "undefined symbol in !byte directive");
             return -1;
         }
 
-        if (as->pass == 2) {
+        if (assembler_emitting(as)) {
             if (result.value < -128 || result.value > 255) {
                 assembler_warning(as, "byte value $%X truncated", result.value);
             }
@@ -547,13 +1007,20 @@ static int assemble_word_directive(Assembler *as, Statement *stmt) {
     DirectiveInfo *dir = &stmt->data.directive;
 
     for (int i = 0; i < dir->arg_count; i++) {
+        int op;
+        const ExprList *list = bulk_list(as, dir->args[i], &op);
+        if (list) {
+            if (emit_bulk_list(as, list, op, 2) < 0) return -1;
+            continue;
+        }
+
         ExprResult result = expr_eval(dir->args[i], as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
-        if (as->pass == 2 && !result.defined) {
-            assembler_error(as, "undefined symbol in !word directive");
+        if (assembler_emitting(as) && !result.defined) {
+            report_undefined(as, &result, "undefined symbol in !word directive");
             return -1;
         }
 
-        if (as->pass == 2) {
+        if (assembler_emitting(as)) {
             assembler_emit_word(as, result.value & 0xFFFF);
         } else {
             assembler_advance_pc(as, 2);
@@ -572,7 +1039,7 @@ static int assemble_text_directive(Assembler *as, Statement *stmt) {
     }
 
     int len = strlen(dir->string_arg);
-    if (as->pass == 2) {
+    if (assembler_emitting(as)) {
         assembler_emit_bytes(as, (const uint8_t *)dir->string_arg, len);
     } else {
         assembler_advance_pc(as, len);
@@ -604,14 +1071,14 @@ static int assemble_fill_directive(Assembler *as, Statement *stmt) {
     uint8_t fill_value = 0;
     if (dir->arg_count >= 2) {
         ExprResult value_result = expr_eval(dir->args[1], as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
-        if (as->pass == 2 && !value_result.defined) {
+        if (assembler_emitting(as) && !value_result.defined) {
             assembler_error(as, "!fill value must be defined");
             return -1;
         }
         fill_value = value_result.value & 0xFF;
     }
 
-    if (as->pass == 2) {
+    if (assembler_emitting(as)) {
         for (int i = 0; i < count; i++) {
             assembler_emit_byte(as, fill_value);
         }
@@ -784,7 +1251,7 @@ static int assemble_pet_directive(Assembler *as, Statement *stmt) {
     }
 
     int len = strlen(dir->string_arg);
-    if (as->pass == 2) {
+    if (assembler_emitting(as)) {
         for (int i = 0; i < len; i++) {
             assembler_emit_byte(as, ascii_to_petscii((uint8_t)dir->string_arg[i]));
         }
@@ -804,7 +1271,7 @@ static int assemble_scr_directive(Assembler *as, Statement *stmt) {
     }
 
     int len = strlen(dir->string_arg);
-    if (as->pass == 2) {
+    if (assembler_emitting(as)) {
         for (int i = 0; i < len; i++) {
             assembler_emit_byte(as, ascii_to_screencode((uint8_t)dir->string_arg[i]));
         }
@@ -824,7 +1291,7 @@ static int assemble_null_directive(Assembler *as, Statement *stmt) {
     }
 
     int len = strlen(dir->string_arg);
-    if (as->pass == 2) {
+    if (assembler_emitting(as)) {
         assembler_emit_bytes(as, (const uint8_t *)dir->string_arg, len);
         assembler_emit_byte(as, 0x00); /* Null terminator */
     } else {
@@ -940,7 +1407,54 @@ static int assemble_binary_directive(Assembler *as, Statement *stmt) {
         offset = r.value;
     }
 
-    return assembler_include_binary(as, dir->string_arg, offset, length);
+    if (dir->transform_count < 0) {
+        assembler_error(as, "!binary transform= must be steps like name or name(args) separated by |");
+        return -1;
+    }
+    BinaryTransform *steps = NULL;
+    if (dir->transform_count > 0) {
+        steps = malloc(dir->transform_count * sizeof(BinaryTransform));
+        if (!steps) {
+            assembler_error(as, "out of memory for !binary transforms");
+            return -1;
+        }
+    }
+    for (int i = 0; i < dir->transform_count; i++) {
+        const TransformStep *step = &dir->transforms[i];
+        int kind = transform_lookup(step->name);
+        if (kind < 0) {
+            assembler_error(as, "unknown !binary transform: %s", step->name);
+            free(steps);
+            return -1;
+        }
+        int min, max;
+        transform_arg_range((TransformKind)kind, &min, &max);
+        if (step->arg_count < min || step->arg_count > max) {
+            if (min == max) {
+                assembler_error(as, "!binary transform %s takes %d argument(s)", step->name, min);
+            } else {
+                assembler_error(as, "!binary transform %s takes %d to %d arguments", step->name, min, max);
+            }
+            free(steps);
+            return -1;
+        }
+        steps[i].kind = (TransformKind)kind;
+        steps[i].arg_count = step->arg_count;
+        for (int a = 0; a < step->arg_count; a++) {
+            ExprResult r = expr_eval(step->args[a], as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+            if (!r.defined) {
+                assembler_error(as, "!binary transform %s arguments must be constant", step->name);
+                free(steps);
+                return -1;
+            }
+            steps[i].args[a] = r.value;
+        }
+    }
+
+    int result = assembler_include_binary(as, dir->string_arg, offset, length,
+                                          steps, dir->transform_count);
+    free(steps);
+    return result;
 }
 
 /* !basic directive - generate BASIC stub that SYS's to machine code
@@ -1052,35 +1566,1962 @@ static int assemble_basic_directive(Assembler *as, Statement *stmt) {
     return 0;
 }
 
-int assembler_assemble_directive(Assembler *as, Statement *stmt) {
+/* Named arguments parse as "name = value" comparisons */
+static const char *named_arg_name(const Expr *arg) {
+    if (arg && arg->type == EXPR_BINARY && arg->data.binary.op == BINARY_EQ &&
+        arg->data.binary.left->type == EXPR_SYMBOL) {
+        return arg->data.binary.left->data.symbol;
+    }
+    return NULL;
+}
+
+Expr *assembler_directive_arg(const Statement *stmt, const char *name) {
+    const DirectiveInfo *dir = &stmt->data.directive;
+    for (int i = 0; i < dir->arg_count; i++) {
+        const char *arg_name = named_arg_name(dir->args[i]);
+        if (arg_name && strcasecmp(arg_name, name) == 0) {
+            return dir->args[i]->data.binary.right;
+        }
+    }
+    return NULL;
+}
+
+/* !raster_block line=, cycle= [, sprites=] [, yscroll=] and !raster_end
+ * mark code for assembler_check_raster; they generate nothing */
+static int assemble_raster_directive(Assembler *as, Statement *stmt) {
+    static const char *const names[] = { "line", "cycle", "sprites", "yscroll" };
+    static const int32_t limits[] = { 311, 65, 255, 7 };
     DirectiveInfo *dir = &stmt->data.directive;
-    const char *name = dir->name;
+    int is_end = strcmp(dir->name, "raster_end") == 0;
 
-    /* Byte data */
-    if (strcmp(name, "byte") == 0 || strcmp(name, "by") == 0 ||
-        strcmp(name, "db") == 0 || strcmp(name, "08") == 0) {
-        return assemble_byte_directive(as, stmt);
+    if (as->pass != 2) return 0;
+
+    if (as->in_pseudopc) {
+        assembler_error(as, "!%s is not supported inside !pseudopc", dir->name);
+        return -1;
     }
-    /* Word data */
-    if (strcmp(name, "word") == 0 || strcmp(name, "wo") == 0 ||
-        strcmp(name, "dw") == 0 || strcmp(name, "16") == 0) {
-        return assemble_word_directive(as, stmt);
+    if (is_end) {
+        if (dir->arg_count > 0) {
+            assembler_error(as, "!raster_end takes no arguments");
+            return -1;
+        }
+        return 0;
     }
-    /* Text/string data */
-    if (strcmp(name, "text") == 0 || strcmp(name, "tx") == 0) {
-        return assemble_text_directive(as, stmt);
+
+    for (int i = 0; i < dir->arg_count; i++) {
+        const char *arg_name = named_arg_name(dir->args[i]);
+        int known = 0;
+        for (int n = 0; arg_name && n < 4; n++) {
+            if (strcasecmp(arg_name, names[n]) == 0) known = 1;
+        }
+        if (!known) {
+            assembler_error(as, "!raster_block arguments must be line=, cycle=, sprites= or yscroll=");
+            return -1;
+        }
     }
-    /* PETSCII string */
-    if (strcmp(name, "pet") == 0) {
-        return assemble_pet_directive(as, stmt);
+
+    for (int n = 0; n < 4; n++) {
+        Expr *arg = assembler_directive_arg(stmt, names[n]);
+        if (!arg) {
+            if (n < 2) {
+                assembler_error(as, "!raster_block requires %s=", names[n]);
+                return -1;
+            }
+            continue;
+        }
+        ExprResult r = expr_eval(arg, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+        if (!r.defined) {
+            assembler_error(as, "!raster_block %s must be a defined value", names[n]);
+            return -1;
+        }
+        if (r.value < (n == 1 ? 1 : 0) || r.value > limits[n]) {
+            assembler_error(as, "!raster_block %s out of range", names[n]);
+            return -1;
+        }
     }
-    /* Screen codes */
-    if (strcmp(name, "scr") == 0) {
-        return assemble_scr_directive(as, stmt);
+    return 0;
+}
+
+/* !irq handler [, kernal=1], !irq_end and !irq_mark delimit code for
+ * assembler_irq_report; they generate nothing */
+static int assemble_irq_directive(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+
+    if (as->pass != 2) return 0;
+
+    if (strcmp(dir->name, "irq") != 0) {
+        if (dir->arg_count > 0) {
+            assembler_error(as, "!%s takes no arguments", dir->name);
+            return -1;
+        }
+        return 0;
     }
-    /* Null-terminated string */
-    if (strcmp(name, "null") == 0) {
-        return assemble_null_directive(as, stmt);
+
+    if (dir->arg_count < 1 || named_arg_name(dir->args[0])) {
+        assembler_error(as, "!irq requires a handler address");
+        return -1;
+    }
+    for (int i = 1; i < dir->arg_count; i++) {
+        const char *arg_name = named_arg_name(dir->args[i]);
+        if (!arg_name || strcasecmp(arg_name, "kernal") != 0) {
+            assembler_error(as, "!irq takes a handler address and kernal=");
+            return -1;
+        }
+    }
+    ExprResult r = expr_eval(dir->args[0], as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+    if (!r.defined) {
+        assembler_error(as, "!irq handler must be a defined address");
+        return -1;
+    }
+    return 0;
+}
+
+/* !pgo_pad [max=n] marks a point between routines where profile-guided
+ * layout may insert up to n fill bytes; pass 1 takes the padding from
+ * layout_pads and pass 2 repeats it */
+static int assemble_pgo_pad_directive(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+    AssembledLine *line = as->stored_line;
+
+    for (int i = 0; i < dir->arg_count && as->pass == 2; i++) {
+        const char *arg_name = named_arg_name(dir->args[i]);
+        if (!arg_name || strcasecmp(arg_name, "max") != 0) {
+            assembler_error(as, "!pgo_pad takes only max=");
+            return -1;
+        }
+    }
+    Expr *max = assembler_directive_arg(stmt, "max");
+    if (max && as->pass == 2) {
+        ExprResult r = expr_eval(max, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+        if (!r.defined) {
+            assembler_error(as, "!pgo_pad max must be a defined value");
+            return -1;
+        }
+        if (r.value < 0 || r.value > PGO_PAD_MAX) {
+            assembler_error(as, "!pgo_pad max out of range");
+            return -1;
+        }
+    }
+
+    if (as->pass == 2) {
+        int pad = line ? line->pad : 0;
+        for (int i = 0; i < pad; i++) {
+            assembler_emit_byte(as, 0);
+        }
+    } else {
+        int pad = 0;
+        if (as->layout_slot < as->layout_pad_count) {
+            pad = as->layout_pads[as->layout_slot];
+        }
+        as->layout_slot++;
+        if (line) line->pad = (uint16_t)pad;
+        assembler_advance_pc(as, pad);
+    }
+    return 0;
+}
+
+/* Lay out a !soa statement's tables, defining their labels if define is set */
+static int soa_place(Assembler *as, const Statement *stmt, uint16_t address,
+                     SoaLayout *layout, int define) {
+    const DirectiveInfo *dir = &stmt->data.directive;
+
+    memset(layout, 0, sizeof(*layout));
+    if (dir->arg_count < 1 || !dir->args[0] || dir->args[0]->type != EXPR_SYMBOL ||
+        dir->block_start < 1) {
+        assembler_error(as, "!soa requires a name and a field list { name[:size], ... }");
+        return -1;
+    }
+    const char *name = dir->args[0]->data.symbol;
+
+    for (int i = 1; i < dir->block_start; i++) {
+        const char *arg_name = named_arg_name(dir->args[i]);
+        if (!arg_name || strcasecmp(arg_name, "count") != 0) {
+            assembler_error(as, "!soa takes a name, count= and a field list");
+            return -1;
+        }
+    }
+    Expr *count = assembler_directive_arg(stmt, "count");
+    ExprResult r = { 0, 0, 0, NULL, NULL };
+    if (count) {
+        r = expr_eval(count, as->symbols, as->anon_labels, address, as->pass, as->current_zone);
+    }
+    if (!r.defined || r.value < 1 || r.value > 256) {
+        assembler_error(as, "!soa count must be a constant from 1 to 256");
+        return -1;
+    }
+    layout->count = r.value;
+
+    /* Tables are all the same size, so placing them in order and moving to
+     * the next page whenever one would cross is as tight as it gets */
+    int32_t addr = address;
+    for (int i = dir->block_start; i < dir->arg_count; i++) {
+        const Expr *field = dir->args[i];
+        int size = 1;
+        if (field->type == EXPR_BINARY) {
+            ExprResult sr = expr_eval(field->data.binary.right, as->symbols, as->anon_labels,
+                                      address, as->pass, as->current_zone);
+            if (!sr.defined || sr.value < 1 || sr.value > ASM_SOA_MAX_FIELD_SIZE) {
+                assembler_error(as, "!soa field size must be a constant from 1 to %d",
+                                ASM_SOA_MAX_FIELD_SIZE);
+                return -1;
+            }
+            size = sr.value;
+            field = field->data.binary.left;
+        }
+
+        for (int b = 0; b < size; b++) {
+            if ((addr & 0xFF) + layout->count > 0x100) {
+                layout->waste += 0x100 - (addr & 0xFF);
+                addr = (addr | 0xFF) + 1;
+            }
+            if (addr + layout->count > ASM_MEMORY_SIZE) {
+                assembler_error(as, "!soa %s tables do not fit in memory", name);
+                return -1;
+            }
+
+            if (define) {
+                char label[256];
+                if (size == 1) {
+                    snprintf(label, sizeof(label), "%s_%s", name, field->data.symbol);
+                } else if (size == 2) {
+                    snprintf(label, sizeof(label), "%s_%s_%s", name, field->data.symbol,
+                             b == 0 ? "lo" : "hi");
+                } else {
+                    snprintf(label, sizeof(label), "%s_%s_%d", name, field->data.symbol, b);
+                }
+                uint8_t flags = SYM_DEFINED;
+                if (assembler_is_zeropage(addr)) flags |= SYM_ZEROPAGE;
+                symbol_define(as->symbols, label, addr, flags, as->current_file, as->current_line);
+            }
+            addr += layout->count;
+            layout->tables++;
+        }
+    }
+
+    layout->end = addr;
+    return 0;
+}
+
+int assembler_soa_layout(Assembler *as, const Statement *stmt, uint16_t address,
+                         SoaLayout *layout) {
+    return soa_place(as, stmt, address, layout, 0);
+}
+
+/* !soa name, count=n { field[:size], ... } reserves one table of n bytes
+ * per field byte like !skip, none crossing a page, and defines name_field
+ * (name_field_lo/_hi for 2-byte fields, name_field_0.. for wider ones) */
+static int assemble_soa_directive(Assembler *as, Statement *stmt) {
+    SoaLayout layout;
+    if (soa_place(as, stmt, as->pc, &layout, as->pass == 1) < 0) return -1;
+    assembler_advance_pc(as, (int)(layout.end - as->pc));
+    return 0;
+}
+
+/* !delay n [, preserve=letters] generates code that takes exactly n
+ * cycles at its address, leaving the registers and flags named by
+ * preserve= untouched; pass 2 runs it in the 6510 model to check */
+static int assemble_delay_directive(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+    unsigned keep = 0;
+
+    if (dir->arg_count < 1 || named_arg_name(dir->args[0])) {
+        assembler_error(as, "!delay requires a cycle count");
+        return -1;
+    }
+    for (int i = 1; i < dir->arg_count; i++) {
+        const char *arg_name = named_arg_name(dir->args[i]);
+        if (!arg_name || strcasecmp(arg_name, "preserve") != 0) {
+            assembler_error(as, "!delay takes a cycle count and preserve=");
+            return -1;
+        }
+    }
+
+    ExprResult r = expr_eval(dir->args[0], as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+    if (!r.defined || r.value < 0 || r.value > DELAY_MAX_CYCLES) {
+        assembler_error(as, "!delay cycles must be a constant from 0 to %d", DELAY_MAX_CYCLES);
+        return -1;
+    }
+    Expr *preserve = assembler_directive_arg(stmt, "preserve");
+    if (preserve && (preserve->type != EXPR_SYMBOL ||
+                     delay_parse_keep(preserve->data.symbol, &keep) < 0)) {
+        assembler_error(as, "!delay preserve= takes letters from a, x, y, n, v, z, c, s and p");
+        return -1;
+    }
+
+    DelayCode code;
+    if (delay_generate(r.value, keep, as->cpu_type == CPU_6510, as->pc, &code) < 0) {
+        assembler_error(as, "!delay cannot take exactly %d cycle(s)", r.value);
+        return -1;
+    }
+
+    if (assembler_emitting(as)) {
+        int cycles = -1;
+        if (delay_measure(&code, as->pc, keep, &cycles) < 0 || cycles != r.value) {
+            assembler_error(as, "!delay %d: generated code takes %d cycles", r.value, cycles);
+            delay_code_free(&code);
+            return -1;
+        }
+        assembler_emit_bytes(as, code.bytes, code.length);
+    } else {
+        assembler_advance_pc(as, code.length);
+    }
+    delay_code_free(&code);
+    return 0;
+}
+
+/* ========== Cycle-Balanced Blocks ========== */
+
+/* !balanced cond runs the first path when cond would branch, so the
+ * branch over it is the opposite one */
+static const struct {
+    const char *cond;
+    const char *skip;
+} balance_branches[] = {
+    { "bcc", "BCS" }, { "bcs", "BCC" }, { "beq", "BNE" }, { "bne", "BEQ" },
+    { "bmi", "BPL" }, { "bpl", "BMI" }, { "bvc", "BVS" }, { "bvs", "BVC" }
+};
+
+/* Block with a marker on line index, or NULL */
+static BalancedBlock *balance_find(Assembler *as, int index) {
+    for (int i = 0; i < as->balanced_count; i++) {
+        BalancedBlock *block = &as->balanced[i];
+        if (block->start == index || block->middle == index || block->end == index) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+/* Bytes of padding that takes cycles at address, or -1 if none does */
+static int balance_pad_size(const BalancedBlock *block, int cycles, int illegal,
+                            uint16_t address) {
+    DelayCode code;
+    if (delay_generate(cycles, block->keep, illegal, address, &code) < 0) return -1;
+    int length = code.length;
+    delay_code_free(&code);
+    return length;
+}
+
+/* Padding of a marker line's pad cycles at its address */
+static int balance_line_pad_size(const BalancedBlock *block, const AssembledLine *line) {
+    return balance_pad_size(block, line->pad, line->cpu == CPU_6510, line->address);
+}
+
+/* JMP, JSR, returns and the like leave a path, so its cycles would not add up */
+static int balance_leaves_path(const InstructionInfo *info) {
+    static const char *const names[] = { "JMP", "JSR", "RTS", "RTI", "BRK", "JAM", "KIL", "STP", "WAI" };
+
+    if (info->mode == ADDR_RELATIVE || info->mode == ADDR_ZP_RELATIVE) return 1;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcasecmp(info->mnemonic, names[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+/* An indexed read can only be ruled out of a page-crossing cycle when
+ * its base address starts a page */
+static int balance_may_cross(Assembler *as, const AssembledLine *line) {
+    const InstructionInfo *info = &line->stmt->data.instruction;
+
+    if (!line->page_penalty) return 0;
+    if (info->mode != ADDR_ABSOLUTE_X && info->mode != ADDR_ABSOLUTE_Y) return 1;
+    ExprResult r = expr_eval(info->operand, as->symbols, as->anon_labels, line->address, 2, line->zone);
+    return !r.defined || (r.value & 0xFF) != 0;
+}
+
+/* Cycles of the code on lines first to last - 1, or -1 after an error.
+ * Pass 2 also rules out page-crossing cycles, once operands are known */
+static int balance_path_cycles(Assembler *as, int first, int last) {
+    int cycles = 0;
+
+    for (int i = first; i < last; i++) {
+        const AssembledLine *line = &as->lines[i];
+        const Statement *stmt = line->stmt;
+        const char *file = stmt->file ? stmt->file : "<input>";
+
+        if (stmt->type == STMT_INSTRUCTION) {
+            const InstructionInfo *info = &stmt->data.instruction;
+            if (balance_leaves_path(info)) {
+                assembler_error(as, "!balanced paths must be straight-line code (%s at %s:%d)",
+                                info->mnemonic, file, stmt->line);
+                return -1;
+            }
+            if (as->pass == 2 && balance_may_cross(as, line)) {
+                assembler_error(as, "!balanced path has a %s that may cross a page (%s:%d)",
+                                info->mnemonic, file, stmt->line);
+                return -1;
+            }
+            cycles += line->cycles;
+        } else if (stmt->type == STMT_DIRECTIVE && strcmp(stmt->data.directive.name, "delay") == 0) {
+            const DirectiveInfo *dir = &stmt->data.directive;
+            ExprResult r = { 0, 0, 0, NULL, NULL };
+            if (dir->arg_count > 0) {
+                r = expr_eval(dir->args[0], as->symbols, as->anon_labels, line->address,
+                              as->pass, line->zone);
+            }
+            if (!r.defined || r.value < 0) return -1;
+            cycles += r.value;
+        } else if (as->lines[i + 1].address != line->address) {
+            assembler_error(as, "!balanced paths may hold only instructions and !delay (%s:%d)",
+                            file, stmt->line);
+            return -1;
+        }
+    }
+    return cycles;
+}
+
+/*
+ * Choose padding for a block whose paths take cycles_a and cycles_b.
+ * The first path is the branch not taken, its code, pad_a and a JMP past
+ * the second; the second is the branch taken (one cycle more if it
+ * crosses a page), its code and pad_b. pad_a goes at middle and the
+ * second path's size_b bytes follow the JMP. Sets the pair with the
+ * fewest bytes that fits max= and the branch's reach, with pad_a held at
+ * fixed_a unless that is negative. Returns 0, or -1 if there is none.
+ */
+static int balance_plan(const BalancedBlock *block, int illegal, uint16_t start,
+                        uint16_t middle, int size_b, int cycles_a, int cycles_b,
+                        int fixed_a, int *pad_a, int *pad_b) {
+    /* Cheap padding is either on the first path alone or mostly on the
+     * second, so search a little past each */
+    int need = cycles_b - cycles_a - 2;
+    int best = -1;
+
+    for (int window = 0; window < 2; window++) {
+        int from = window == 0 ? 0 : need - 1;
+        int to = window == 0 ? 8 : need + 8;
+        if (fixed_a >= 0) from = to = fixed_a;
+        if (from < 0) from = 0;
+        if (to > DELAY_MAX_CYCLES) to = DELAY_MAX_CYCLES;
+
+        for (int a = from; a <= to; a++) {
+            int size_a = balance_pad_size(block, a, illegal, middle);
+            if (size_a < 0) continue;
+            int32_t target = middle + size_a + 3;
+            if (target - (start + 2) > 127) continue;
+            int cross = ((start + 2) & 0xFF00) != (target & 0xFF00);
+            int b = (2 + cycles_a + a + 3) - (3 + cross + cycles_b);
+            if (b < 0 || b > DELAY_MAX_CYCLES) continue;
+            int size_pad_b = balance_pad_size(block, b, illegal, (uint16_t)(target + size_b));
+            if (size_pad_b < 0) continue;
+            int cost = size_a + size_pad_b;
+            if (block->max >= 0 && cost > block->max) continue;
+            if (best < 0 || cost < best) {
+                best = cost;
+                *pad_a = a;
+                *pad_b = b;
+            }
+        }
+    }
+    return best < 0 ? -1 : 0;
+}
+
+/* Emit padding of cycles at the PC, or reserve its bytes */
+static int balance_pad(Assembler *as, const BalancedBlock *block, int cycles) {
+    DelayCode code;
+    if (delay_generate(cycles, block->keep, as->cpu_type == CPU_6510, as->pc, &code) < 0) {
+        assembler_error(as, "!balanced cannot pad by exactly %d cycle(s)", cycles);
+        return -1;
+    }
+
+    if (assembler_emitting(as)) {
+        int taken = -1;
+        if (delay_measure(&code, as->pc, block->keep, &taken) < 0 || taken != cycles) {
+            assembler_error(as, "!balanced padding of %d cycles takes %d", cycles, taken);
+            delay_code_free(&code);
+            return -1;
+        }
+        assembler_emit_bytes(as, code.bytes, code.length);
+    } else {
+        assembler_advance_pc(as, code.length);
+    }
+    delay_code_free(&code);
+    return 0;
+}
+
+/* !balanced cond [, preserve=letters] [, max=n]: pass 1 opens a block;
+ * both passes place the branch over the first path */
+static int balance_open(Assembler *as, Statement *stmt, int index) {
+    DirectiveInfo *dir = &stmt->data.directive;
+
+    if (as->pass == 2) {
+        BalancedBlock *block = balance_find(as, index);
+        if (!block) return 0;
+        const AssembledLine *middle = &as->lines[block->middle];
+        int size_a = balance_line_pad_size(block, middle);
+        int offset = assembler_calc_branch_offset((uint16_t)(middle->address + size_a + 3), as->pc);
+        if (size_a < 0 || offset == INT_MIN) {
+            assembler_error(as, "!balanced first path is too long for a branch");
+            return -1;
+        }
+        assembler_emit_byte(as, block->branch);
+        assembler_emit_byte(as, (uint8_t)(offset & 0xFF));
+        return 0;
+    }
+
+    if (as->balanced_open >= 0) {
+        assembler_error(as, "!balanced blocks cannot be nested");
+        return -1;
+    }
+    int branch = -1;
+    if (dir->arg_count >= 1 && dir->args[0]->type == EXPR_SYMBOL) {
+        for (size_t i = 0; i < sizeof(balance_branches) / sizeof(balance_branches[0]); i++) {
+            if (strcasecmp(dir->args[0]->data.symbol, balance_branches[i].cond) == 0) {
+                const OpcodeEntry *op = opcode_find_cpu(as->cpu_type, balance_branches[i].skip,
+                                                        ADDR_RELATIVE);
+                if (op) branch = op->opcode;
+            }
+        }
+    }
+    if (branch < 0) {
+        assembler_error(as, "!balanced requires a branch condition (bcc, bcs, beq, bne, bmi, bpl, bvc or bvs)");
+        return -1;
+    }
+    for (int i = 1; i < dir->arg_count; i++) {
+        const char *arg_name = named_arg_name(dir->args[i]);
+        if (!arg_name || (strcasecmp(arg_name, "preserve") != 0 &&
+                          strcasecmp(arg_name, "max") != 0)) {
+            assembler_error(as, "!balanced takes a branch condition, preserve= and max=");
+            return -1;
+        }
+    }
+
+    unsigned keep = DELAY_KEEP_A | DELAY_KEEP_X | DELAY_KEEP_Y | DELAY_KEEP_FLAGS;
+    Expr *preserve = assembler_directive_arg(stmt, "preserve");
+    if (preserve && (preserve->type != EXPR_SYMBOL ||
+                     delay_parse_keep(preserve->data.symbol, &keep) < 0)) {
+        assembler_error(as, "!balanced preserve= takes letters from a, x, y, n, v, z, c, s and p");
+        return -1;
+    }
+    int max = -1;
+    Expr *max_arg = assembler_directive_arg(stmt, "max");
+    if (max_arg) {
+        ExprResult r = expr_eval(max_arg, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+        if (!r.defined || r.value < 0 || r.value > 255) {
+            assembler_error(as, "!balanced max must be a constant from 0 to 255");
+            return -1;
+        }
+        max = r.value;
+    }
+
+    if (as->balanced_count >= as->balanced_capacity) {
+        int capacity = as->balanced_capacity ? as->balanced_capacity * 2 : 16;
+        BalancedBlock *blocks = realloc(as->balanced, (size_t)capacity * sizeof(BalancedBlock));
+        if (!blocks) {
+            assembler_error(as, "out of memory for !balanced");
+            return -1;
+        }
+        as->balanced = blocks;
+        as->balanced_capacity = capacity;
+    }
+    BalancedBlock *block = &as->balanced[as->balanced_count];
+    block->filename = as->current_file;
+    block->line_number = as->current_line;
+    block->start = index;
+    block->middle = -1;
+    block->end = -1;
+    block->branch = (uint8_t)branch;
+    block->keep = keep;
+    block->max = max;
+    as->balanced_open = as->balanced_count++;
+
+    assembler_advance_pc(as, 2);
+    return 0;
+}
+
+/* !balanced_else: the first path's padding, then a JMP past the second */
+static int balance_middle(Assembler *as, int index) {
+    AssembledLine *line = &as->lines[index];
+    BalancedBlock *block;
+
+    if (as->pass == 2) {
+        block = balance_find(as, index);
+        if (!block) return 0;
+        const AssembledLine *end = &as->lines[block->end];
+        if (balance_pad(as, block, line->pad) < 0) return -1;
+        int size_b = balance_line_pad_size(block, end);
+        assembler_emit_byte(as, 0x4C);
+        assembler_emit_word(as, (uint16_t)(end->address + (size_b > 0 ? size_b : 0)));
+        return 0;
+    }
+
+    if (as->balanced_open < 0) {
+        assembler_error(as, "!balanced_else without !balanced");
+        return -1;
+    }
+    block = &as->balanced[as->balanced_open];
+    if (block->middle >= 0) {
+        assembler_error(as, "!balanced block already has a !balanced_else");
+        return -1;
+    }
+    block->middle = index;
+
+    /* Padding from the previous pass 1 run, if any */
+    int slot = as->balanced_open;
+    line->pad = (uint16_t)(slot < as->balance_pad_count ? as->balance_pads[slot] : 0);
+    if (balance_pad(as, block, line->pad) < 0) return -1;
+    assembler_advance_pc(as, 3);
+    return 0;
+}
+
+/* !balanced_end: pass 1 measures both paths and pads the second here;
+ * pass 2 checks the timing with final operands */
+static int balance_close(Assembler *as, int index) {
+    AssembledLine *line = &as->lines[index];
+    BalancedBlock *block;
+    int slot = -1;
+
+    if (as->pass == 2) {
+        block = balance_find(as, index);
+        if (!block) return 0;
+    } else {
+        if (as->balanced_open < 0) {
+            assembler_error(as, "!balanced_end without !balanced");
+            return -1;
+        }
+        slot = as->balanced_open;
+        block = &as->balanced[slot];
+        as->balanced_open = -1;
+        if (block->middle < 0) {
+            assembler_error(as, "!balanced block has no !balanced_else");
+            return -1;
+        }
+        block->end = index;
+    }
+
+    int cycles_a = balance_path_cycles(as, block->start + 1, block->middle);
+    int cycles_b = balance_path_cycles(as, block->middle + 1, index);
+    if (cycles_a < 0 || cycles_b < 0) return -1;
+
+    const AssembledLine *start = &as->lines[block->start];
+    const AssembledLine *middle = &as->lines[block->middle];
+    int illegal = middle->cpu == CPU_6510;
+    int size_a = balance_line_pad_size(block, middle);
+    int32_t target = middle->address + size_a + 3;
+    int size_b = (uint16_t)(line->address - target);
+
+    if (as->pass == 2) {
+        int cross = ((start->address + 2) & 0xFF00) != (target & 0xFF00);
+        int taken_a = 2 + cycles_a + middle->pad + 3;
+        int taken_b = 3 + cross + cycles_b + line->pad;
+        if (taken_a != taken_b) {
+            assembler_error(as, "!balanced paths take %d and %d cycles", taken_a, taken_b);
+            return -1;
+        }
+        return balance_pad(as, block, line->pad);
+    }
+
+    int pad_a, pad_b;
+    if (balance_plan(block, illegal, start->address, middle->address, size_b,
+                     cycles_a, cycles_b, -1, &pad_a, &pad_b) < 0) {
+        if (block->max >= 0) {
+            assembler_error(as, "!balanced cannot balance paths of %d and %d cycles within max=%d bytes",
+                            cycles_a, cycles_b, block->max);
+        } else {
+            assembler_error(as, "!balanced cannot balance paths of %d and %d cycles", cycles_a, cycles_b);
+        }
+        return -1;
+    }
+
+    /* Other padding on the first path moves the second, so pass 1 has to
+     * run again with it; meanwhile pad what this run laid out if it can */
+    if (pad_a != middle->pad) {
+        if (slot >= as->balance_pad_count) {
+            int *pads = realloc(as->balance_pads, (size_t)(slot + 1) * sizeof(int));
+            if (!pads) {
+                assembler_error(as, "out of memory for !balanced");
+                return -1;
+            }
+            for (int i = as->balance_pad_count; i <= slot; i++) pads[i] = 0;
+            as->balance_pads = pads;
+            as->balance_pad_count = slot + 1;
+        }
+        as->balance_pads[slot] = pad_a;
+        as->balance_changed = 1;
+        if (balance_plan(block, illegal, start->address, middle->address, size_b,
+                         cycles_a, cycles_b, middle->pad, &pad_a, &pad_b) < 0) {
+            pad_b = 0;
+        }
+    }
+    line->pad = (uint16_t)pad_b;
+    return balance_pad(as, block, pad_b);
+}
+
+/* !balanced cond ... !balanced_else ... !balanced_end pads two paths of
+ * straight-line code to the same number of cycles */
+static int assemble_balanced_directive(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+
+    if (!as->stored_line) {
+        assembler_error(as, "!%s cannot be used here", dir->name);
+        return -1;
+    }
+    int index = (int)(as->stored_line - as->lines);
+
+    if (strcmp(dir->name, "balanced") == 0) {
+        return balance_open(as, stmt, index);
+    }
+    if (dir->arg_count > 0 || dir->string_arg) {
+        assembler_error(as, "!%s takes no arguments", dir->name);
+        return -1;
+    }
+    if (strcmp(dir->name, "balanced_else") == 0) {
+        return balance_middle(as, index);
+    }
+    return balance_close(as, index);
+}
+
+/* !run entry, until=address | cycles=n, capture=start..end reserves the
+ * captured range at the PC; pass 2 records the run on its line and
+ * execute_runs fills the range in once all code is generated */
+static int assemble_run_directive(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+
+    if (dir->arg_count < 1 || named_arg_name(dir->args[0])) {
+        assembler_error(as, "!run requires an entry address");
+        return -1;
+    }
+    for (int i = 1; i < dir->arg_count; i++) {
+        const char *arg_name = named_arg_name(dir->args[i]);
+        if (!arg_name || (strcasecmp(arg_name, "until") != 0 &&
+                          strcasecmp(arg_name, "cycles") != 0 &&
+                          strcasecmp(arg_name, "capture") != 0)) {
+            assembler_error(as, "!run takes an entry address, until= or cycles=, and capture=");
+            return -1;
+        }
+    }
+
+    Expr *capture = assembler_directive_arg(stmt, "capture");
+    if (!capture || !dir->range_end || dir->range_arg < 0 ||
+        dir->args[dir->range_arg]->data.binary.right != capture) {
+        assembler_error(as, "!run requires capture=start..end");
+        return -1;
+    }
+    ExprResult first = expr_eval(capture, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+    ExprResult last = expr_eval(dir->range_end, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+    if (!first.defined || !last.defined) {
+        report_undefined(as, first.defined ? &last : &first,
+                         "!run capture= range must be known when !run is reached");
+        return -1;
+    }
+    if (first.value < 0 || last.value > 0xFFFF || last.value < first.value) {
+        assembler_error(as, "!run capture= must be an address range from $0000 to $FFFF");
+        return -1;
+    }
+    int length = last.value - first.value + 1;
+
+    if (as->pass == 2) {
+        Expr *until = assembler_directive_arg(stmt, "until");
+        Expr *cycles = assembler_directive_arg(stmt, "cycles");
+        if (!until == !cycles) {
+            assembler_error(as, "!run requires either until= or cycles=");
+            return -1;
+        }
+
+        RunOptions options = { 0, -1, 0, (uint16_t)first.value, length };
+        ExprResult r = expr_eval(dir->args[0], as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+        if (!r.defined || r.value < 0 || r.value > 0xFFFF) {
+            report_undefined(as, &r, "!run entry must be a defined address");
+            return -1;
+        }
+        options.entry = (uint16_t)r.value;
+        if (until) {
+            r = expr_eval(until, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+            if (!r.defined || r.value < 0 || r.value > 0xFFFF) {
+                report_undefined(as, &r, "!run until= must be a defined address");
+                return -1;
+            }
+            options.until = r.value;
+        } else {
+            r = expr_eval(cycles, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+            if (!r.defined) {
+                report_undefined(as, &r, "!run cycles= must be a defined count");
+                return -1;
+            }
+            if (r.value < 1 || r.value > RUN_MAX_CYCLES) {
+                assembler_error(as, "!run cycles= must be from 1 to %ld", RUN_MAX_CYCLES);
+                return -1;
+            }
+            options.cycles = r.value;
+        }
+
+        AssembledLine *line = as->stored_line;
+        if (line) {
+            free(line->run);
+            line->run = malloc(sizeof(RunOptions));
+            if (!line->run) {
+                assembler_error(as, "out of memory for !run");
+                return -1;
+            }
+            *line->run = options;
+        }
+    }
+
+    /* Zeros hold the place until execute_runs */
+    if (assembler_emitting(as)) {
+        for (int i = 0; i < length; i++) assembler_emit_byte(as, 0);
+    } else {
+        assembler_advance_pc(as, length);
+    }
+    return 0;
+}
+
+/* Captured bytes of a run: from this assembly, the cache directory, or a
+ * fresh execution. Returns NULL with the error reported. */
+static const RunCapture *run_capture(Assembler *as, const RunOptions *options) {
+    uint64_t key = run_cache_key(as->memory, options);
+    for (RunCapture *capture = as->run_captures; capture; capture = capture->next) {
+        if (capture->key == key) {
+            as->run_cache_hits++;
+            return capture;
+        }
+    }
+
+    RunCapture *capture = calloc(1, sizeof(RunCapture));
+    if (!capture) {
+        assembler_error(as, "out of memory for !run");
+        return NULL;
+    }
+    capture->key = key;
+
+    /* The cache directory holds entries in the !image cache format */
+    int length = 0;
+    if (as->run_cache_dir &&
+        image_cache_load(as->run_cache_dir, key, &capture->data, &length) == 0 &&
+        length == options->length) {
+        as->run_cache_hits++;
+    } else {
+        free(capture->data);
+        capture->data = malloc((size_t)options->length);
+        if (!capture->data) {
+            free(capture);
+            assembler_error(as, "out of memory for !run");
+            return NULL;
+        }
+        RunResult result;
+        const char *error = NULL;
+        if (run_execute(as->memory, options, capture->data, &result, &error) < 0) {
+            assembler_error(as, "!run $%04X: %s (stopped at $%04X after %ld cycles)",
+                            options->entry, error, result.pc, result.cycles);
+            free(capture->data);
+            free(capture);
+            return NULL;
+        }
+        as->runs++;
+        if (as->run_cache_dir &&
+            image_cache_store(as->run_cache_dir, key, capture->data, options->length) < 0) {
+            assembler_warning(as, "cannot write run cache in %s", as->run_cache_dir);
+        }
+    }
+    capture->length = options->length;
+    capture->next = as->run_captures;
+    as->run_captures = capture;
+    return capture;
+}
+
+/* Execute every !run in source order over the generated memory, so a
+ * run sees the code after it and the bytes earlier runs captured */
+static void execute_runs(Assembler *as) {
+    for (int i = 0; i < as->line_count && as->errors == 0; i++) {
+        AssembledLine *line = &as->lines[i];
+        if (!line->run) continue;
+
+        as->stored_line = line;
+        if (line->stmt->file) as->current_file = line->stmt->file;
+        as->current_line = line->stmt->line;
+
+        const RunCapture *capture = run_capture(as, line->run);
+        if (!capture) continue;
+        for (int b = 0; b < capture->length; b++) {
+            as->memory[(uint16_t)(line->real_address + b)] = capture->data[b];
+        }
+
+        line->byte_count = capture->length < 8 ? capture->length : 8;
+        memcpy(line->bytes, capture->data, (size_t)line->byte_count);
+    }
+}
+
+/* Converted data of a PNG: from this run, the cache directory, or a
+ * fresh conversion. Pass 1 keeps it for pass 2; *owned is set when the
+ * caller must free *data. */
+static int image_data(Assembler *as, const char *filename, const ImageOptions *options,
+                      uint8_t **data, int *length, int *owned) {
+    char *path = assembler_find_include(as, filename);
+    if (!path) {
+        assembler_error(as, "cannot find image file: %s", filename);
+        return -1;
+    }
+    size_t size;
+    uint8_t *file = (uint8_t *)file_read(path, &size);
+    free(path);
+    if (!file) {
+        assembler_error(as, "cannot read image file: %s", filename);
+        return -1;
+    }
+
+    uint64_t key = image_cache_key(file, size, options);
+    *owned = 0;
+    for (ConvertedImage *image = as->images; image; image = image->next) {
+        if (image->key == key) {
+            free(file);
+            *data = image->data;
+            *length = image->length;
+            return 0;
+        }
+    }
+
+    if (as->image_cache_dir && image_cache_load(as->image_cache_dir, key, data, length) == 0) {
+        as->image_cache_hits++;
+    } else {
+        C64Image image;
+        const char *error = NULL;
+        ThreadPool *pool = NULL;
+        /* Pass 2 workers share the context; only pass 1 owns the pool */
+        if (as->pass == 1) {
+            if (!as->pool) as->pool = threadpool_create(as->threads);
+            pool = as->pool;
+        }
+        if (image_load(file, size, &image, &error) < 0 ||
+            image_convert(&image, options, pool, data, length, &error) < 0) {
+            assembler_error(as, "!image %s: %s", filename, error);
+            image_free(&image);
+            free(file);
+            return -1;
+        }
+        image_free(&image);
+        if (as->image_cache_dir &&
+            image_cache_store(as->image_cache_dir, key, *data, *length) < 0) {
+            assembler_warning(as, "cannot write image cache in %s", as->image_cache_dir);
+        }
+    }
+    free(file);
+
+    ConvertedImage *kept = as->pass == 1 ? malloc(sizeof(ConvertedImage)) : NULL;
+    if (!kept) {
+        *owned = 1;
+        return 0;
+    }
+    kept->key = key;
+    kept->data = *data;
+    kept->length = *length;
+    kept->next = as->images;
+    as->images = kept;
+    return 0;
+}
+
+/* !image "file.png", mode=koala|hires|sprites|charset [, background=n]
+ * converts a PNG to C64 data and emits it */
+static int assemble_image_directive(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+    ImageOptions options = { IMAGE_KOALA, -1 };
+
+    if (!dir->string_arg) {
+        assembler_error(as, "!image requires a filename argument");
+        return -1;
+    }
+    for (int i = 0; i < dir->arg_count; i++) {
+        const char *arg_name = named_arg_name(dir->args[i]);
+        if (!arg_name || (strcasecmp(arg_name, "mode") != 0 &&
+                          strcasecmp(arg_name, "background") != 0)) {
+            assembler_error(as, "!image takes a filename, mode= and background=");
+            return -1;
+        }
+    }
+
+    Expr *mode = assembler_directive_arg(stmt, "mode");
+    int mode_index = mode && mode->type == EXPR_SYMBOL ? image_mode_lookup(mode->data.symbol) : -1;
+    if (mode_index < 0) {
+        assembler_error(as, "!image mode= must be koala, hires, sprites or charset");
+        return -1;
+    }
+    options.mode = (ImageMode)mode_index;
+
+    Expr *background = assembler_directive_arg(stmt, "background");
+    if (background) {
+        ExprResult r = expr_eval(background, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+        if (!r.defined || r.value < 0 || r.value >= IMAGE_COLORS) {
+            assembler_error(as, "!image background must be a color from 0 to 15");
+            return -1;
+        }
+        options.background = r.value;
+    }
+
+    uint8_t *data;
+    int length, owned;
+    if (image_data(as, dir->string_arg, &options, &data, &length, &owned) < 0) return -1;
+
+    if (assembler_emitting(as)) {
+        assembler_emit_bytes(as, data, length);
+    } else {
+        assembler_advance_pc(as, length);
+    }
+    if (owned) free(data);
+    return 0;
+}
+
+/* Constant integer argument name= of a directive, or fallback when absent.
+ * Returns -1 if it is not a constant from min to max. */
+static int directive_int_arg(Assembler *as, Statement *stmt, const char *name,
+                             int min, int max, int fallback, int *value) {
+    Expr *arg = assembler_directive_arg(stmt, name);
+    *value = fallback;
+    if (!arg) return 0;
+    ExprResult r = expr_eval(arg, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+    if (!r.defined || r.value < min || r.value > max) return -1;
+    *value = r.value;
+    return 0;
+}
+
+/* Build a !charmap's charset and maps from a raw bitmap or a PNG */
+static BuiltCharmap *build_charmap(Assembler *as, Statement *stmt) {
+    static const char *const names[] = { "width", "height", "tolerance", "invert", "background" };
+    DirectiveInfo *dir = &stmt->data.directive;
+    int width, height, tolerance, invert, background;
+
+    if (!dir->string_arg) {
+        assembler_error(as, "!charmap requires a filename argument");
+        return NULL;
+    }
+    for (int i = 0; i < dir->arg_count; i++) {
+        const char *arg_name = named_arg_name(dir->args[i]);
+        size_t n = 0;
+        while (arg_name && n < sizeof(names) / sizeof(names[0]) &&
+               strcasecmp(arg_name, names[n]) != 0) {
+            n++;
+        }
+        if (!arg_name || n == sizeof(names) / sizeof(names[0])) {
+            assembler_error(as, "!charmap takes a filename, width=, height=, tolerance=, invert= and background=");
+            return NULL;
+        }
+    }
+    if (directive_int_arg(as, stmt, "width", 1, 0xFFFF, 0, &width) < 0 ||
+        directive_int_arg(as, stmt, "height", 1, 0xFFFF, 0, &height) < 0) {
+        assembler_error(as, "!charmap width and height must be constants from 1 to 65535");
+        return NULL;
+    }
+    if (directive_int_arg(as, stmt, "tolerance", 0, 63, 0, &tolerance) < 0) {
+        assembler_error(as, "!charmap tolerance must be a constant from 0 to 63");
+        return NULL;
+    }
+    if (directive_int_arg(as, stmt, "invert", 0, 1, 0, &invert) < 0) {
+        assembler_error(as, "!charmap invert must be 0 or 1");
+        return NULL;
+    }
+    if (directive_int_arg(as, stmt, "background", 0, IMAGE_COLORS - 1, -1, &background) < 0) {
+        assembler_error(as, "!charmap background must be a color from 0 to 15");
+        return NULL;
+    }
+
+    char *path = assembler_find_include(as, dir->string_arg);
+    if (!path) {
+        assembler_error(as, "cannot find charmap file: %s", dir->string_arg);
+        return NULL;
+    }
+    size_t size;
+    uint8_t *file = (uint8_t *)file_read(path, &size);
+    free(path);
+    if (!file) {
+        assembler_error(as, "cannot read charmap file: %s", dir->string_arg);
+        return NULL;
+    }
+
+    /* A PNG gives its own size and a color per cell */
+    uint64_t *cells = NULL;
+    uint8_t *colors = NULL;
+    const char *error = NULL;
+    int result;
+    if (size >= 8 && memcmp(file, "\x89PNG", 4) == 0) {
+        C64Image image;
+        result = image_load(file, size, &image, &error);
+        if (result == 0) {
+            result = charmap_cells_from_image(&image, background, &cells, &colors, &error);
+            if (result == 0 && ((width && width != image.width / 8) ||
+                                (height && height != image.height / 8))) {
+                error = "width and height differ from the image size in cells";
+                result = -1;
+            }
+            width = image.width / 8;
+            height = image.height / 8;
+        }
+        image_free(&image);
+    } else if (!width || !height) {
+        error = "a raw bitmap needs width= and height= in cells";
+        result = -1;
+    } else {
+        result = charmap_cells_from_bitmap(file, size, width, height, &cells, &error);
+    }
+    free(file);
+
+    Charmap map;
+    CharmapOptions options = { tolerance, invert };
+    memset(&map, 0, sizeof(map));
+    if (result == 0) {
+        result = charmap_build(cells, colors, width, height, &options, &map, &error);
+        colors = NULL;
+        if (result < 0 && map.chars > map.limit) {
+            assembler_error(as, "!charmap %s: %d distinct cells need more than %d characters",
+                            dir->string_arg, map.unique, map.limit);
+            error = NULL;
+        }
+    }
+    free(cells);
+    free(colors);
+    if (result < 0) {
+        if (error) assembler_error(as, "!charmap %s: %s", dir->string_arg, error);
+        charmap_free(&map);
+        return NULL;
+    }
+
+    BuiltCharmap *built = calloc(1, sizeof(BuiltCharmap));
+    int map_size = width * height;
+    int length = map.charset_size + map_size * (map.colors ? 2 : 1);
+    if (built) built->data = malloc((size_t)length);
+    if (!built || !built->data) {
+        free(built);
+        charmap_free(&map);
+        assembler_error(as, "out of memory for !charmap");
+        return NULL;
+    }
+    memcpy(built->data, map.charset, (size_t)map.charset_size);
+    memcpy(built->data + map.charset_size, map.screen, (size_t)map_size);
+    if (map.colors) memcpy(built->data + map.charset_size + map_size, map.colors, (size_t)map_size);
+    built->stmt = stmt;
+    built->charset_size = map.charset_size;
+    built->map_size = map_size;
+    built->has_colors = map.colors != NULL;
+    built->width = width;
+    built->height = height;
+    built->chars = map.chars;
+    built->unique = map.unique;
+    built->limit = map.limit;
+    charmap_free(&map);
+    return built;
+}
+
+static void free_charmaps(Assembler *as) {
+    while (as->charmaps) {
+        BuiltCharmap *next = as->charmaps->next;
+        free(as->charmaps->data);
+        free(as->charmaps);
+        as->charmaps = next;
+    }
+}
+
+/* Define label_suffix, when the directive's line has a global label */
+static void define_label_suffix(Assembler *as, const Statement *stmt, const char *suffix,
+                                int32_t value) {
+    const LabelInfo *label = stmt->label;
+    if (!label || label->is_local || label->is_anon_fwd || label->is_anon_back) return;
+
+    char name[256];
+    snprintf(name, sizeof(name), "%s_%s", label->name, suffix);
+    uint8_t flags = SYM_DEFINED;
+    if (assembler_is_zeropage(value)) flags |= SYM_ZEROPAGE;
+    symbol_define(as->symbols, name, value, flags, as->current_file, as->current_line);
+}
+
+/* !charmap "file", width=, height= [, tolerance=n] [, invert=1] [, background=n]
+ * cuts a raw 1-bit bitmap or a PNG into 8x8 cells and emits the smallest
+ * charset drawing it, the screen map and, for a PNG, the color map. A
+ * label on the line also names them label_chars, label_screen,
+ * label_colors and label_count. Pass 1 builds; pass 2 reuses the result. */
+static int assemble_charmap_directive(Assembler *as, Statement *stmt) {
+    BuiltCharmap *built = as->charmaps;
+    while (built && built->stmt != stmt) built = built->next;
+
+    int owned = 0;
+    if (!built) {
+        built = build_charmap(as, stmt);
+        if (!built) return -1;
+        /* Pass 2 workers share the context, so only pass 1 keeps results */
+        if (as->pass == 1) {
+            built->next = as->charmaps;
+            as->charmaps = built;
+        } else {
+            owned = 1;
+        }
+    }
+
+    int length = built->charset_size + built->map_size * (built->has_colors ? 2 : 1);
+    if (as->pass == 1) {
+        define_label_suffix(as, stmt, "chars", as->pc);
+        define_label_suffix(as, stmt, "screen", as->pc + built->charset_size);
+        if (built->has_colors) {
+            define_label_suffix(as, stmt, "colors", as->pc + built->charset_size + built->map_size);
+        }
+        define_label_suffix(as, stmt, "count", built->chars);
+    }
+
+    if (assembler_emitting(as)) {
+        assembler_emit_bytes(as, built->data, length);
+    } else {
+        assembler_advance_pc(as, length);
+    }
+    if (owned) {
+        free(built->data);
+        free(built);
+    }
+    return 0;
+}
+
+/* ========== String Pools ========== */
+
+static int is_string_directive(const char *name) {
+    return strcmp(name, "text") == 0 || strcmp(name, "tx") == 0 ||
+           strcmp(name, "pet") == 0 || strcmp(name, "scr") == 0 ||
+           strcmp(name, "null") == 0;
+}
+
+/* Lines a !strpool region may hold besides its strings */
+static int strpool_accepts(const Statement *stmt) {
+    switch (stmt->type) {
+        case STMT_EMPTY:
+            return stmt->label == NULL;
+        case STMT_ASSIGNMENT:
+            return 1;
+        case STMT_DIRECTIVE:
+            return is_string_directive(stmt->data.directive.name) ||
+                   strcmp(stmt->data.directive.name, "strpool") == 0 ||
+                   strcmp(stmt->data.directive.name, "strpool_end") == 0;
+        default:
+            return 0;
+    }
+}
+
+static void free_strpools(Assembler *as) {
+    while (as->strpools) {
+        StringPool *next = as->strpools->next;
+        for (int i = 0; i < as->strpools->count; i++) {
+            free(as->strpools->strings[i].bytes);
+        }
+        free(as->strpools->strings);
+        strpool_free(&as->strpools->pool);
+        free(as->strpools);
+        as->strpools = next;
+    }
+    as->strpool_open = NULL;
+}
+
+/* Bytes a string directive generates, plus a zero terminator if terminate
+ * and it has none (caller frees) */
+static uint8_t *string_directive_bytes(const DirectiveInfo *dir, int terminate, int *length) {
+    int len = (int)strlen(dir->string_arg);
+    uint8_t *bytes = malloc((size_t)len + 1);
+    if (!bytes) return NULL;
+
+    for (int i = 0; i < len; i++) {
+        uint8_t c = (uint8_t)dir->string_arg[i];
+        if (strcmp(dir->name, "pet") == 0) {
+            c = ascii_to_petscii(c);
+        } else if (strcmp(dir->name, "scr") == 0) {
+            c = ascii_to_screencode(c);
+        }
+        bytes[i] = c;
+    }
+    *length = len;
+    if (terminate || strcmp(dir->name, "null") == 0) {
+        bytes[(*length)++] = 0x00;
+    }
+    return bytes;
+}
+
+/* Pass 1 adds a string inside a !strpool region to the region; its own
+ * line then generates nothing in either pass */
+static int pool_string(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+    StringPool *sp = as->strpool_open;
+
+    if (as->pass != 1) return 0;
+
+    if (!dir->string_arg) {
+        assembler_error(as, "!%s requires a string argument", dir->name);
+        return -1;
+    }
+    if (stmt->label && (stmt->label->is_anon_fwd || stmt->label->is_anon_back)) {
+        assembler_error(as, "!strpool strings cannot have anonymous labels");
+        return -1;
+    }
+
+    int length;
+    uint8_t *bytes = string_directive_bytes(dir, sp->options.compress, &length);
+    if (!bytes) {
+        assembler_error(as, "out of memory for !strpool");
+        return -1;
+    }
+    if (sp->options.compress && memchr(bytes, 0x00, (size_t)length - 1)) {
+        free(bytes);
+        assembler_error(as, "!%s string has a zero byte, which would end it in a compressed !strpool",
+                        dir->name);
+        return -1;
+    }
+    if (sp->count >= sp->capacity) {
+        int new_capacity = sp->capacity ? sp->capacity * 2 : 16;
+        PooledString *strings = realloc(sp->strings, new_capacity * sizeof(PooledString));
+        if (!strings) {
+            free(bytes);
+            assembler_error(as, "out of memory for !strpool");
+            return -1;
+        }
+        sp->strings = strings;
+        sp->capacity = new_capacity;
+    }
+
+    PooledString *ps = &sp->strings[sp->count++];
+    ps->bytes = bytes;
+    ps->length = length;
+    ps->symbol = stmt->label ? label_symbol(as, stmt->label) : NULL;
+    sp->input_size += (int)strlen(dir->string_arg) + (strcmp(dir->name, "null") == 0);
+    if (as->stored_line) as->stored_line->pooled = 1;
+    return 0;
+}
+
+/* Decoder output routine of a compressed pool: output= of its !strpool,
+ * which may be a label defined later */
+static int strpool_output(Assembler *as, const StringPool *sp, uint16_t *output) {
+    Expr *arg = assembler_directive_arg(sp->stmt, "output");
+    *output = 0xFFD2;
+    if (!arg) return 0;
+
+    ExprResult r = expr_eval(arg, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+    if (!r.defined) {
+        if (as->pass == 1) {
+            *output = 0;
+            return 0;
+        }
+    } else if (r.value >= 0 && r.value <= 0xFFFF) {
+        *output = (uint16_t)r.value;
+        return 0;
+    }
+    assembler_error(as, "!strpool output must be a defined address");
+    return -1;
+}
+
+/* !strpool_end: pass 1 pools the open region's strings here and moves
+ * their labels onto the pooled copies; pass 2 emits the pool */
+static int place_strpool(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+
+    if (dir->arg_count > 0 || dir->string_arg) {
+        assembler_error(as, "!strpool_end takes no arguments");
+        return -1;
+    }
+
+    if (as->pass == 2) {
+        StringPool *sp = as->strpools;
+        while (sp && sp->end != stmt) sp = sp->next;
+        if (!sp) return 0;
+
+        const uint8_t *data = sp->pool.data;
+        int size = sp->pool.size;
+        if (sp->options.compress) {
+            uint8_t decoder[STRPOOL_DECODER_SIZE];
+            uint16_t output;
+            if (strpool_output(as, sp, &output) < 0) return -1;
+            memcpy(decoder, data, STRPOOL_DECODER_SIZE);
+            strpool_set_output(decoder, output);
+            assembler_emit_bytes(as, decoder, STRPOOL_DECODER_SIZE);
+            data += STRPOOL_DECODER_SIZE;
+            size -= STRPOOL_DECODER_SIZE;
+        }
+        assembler_emit_bytes(as, data, size);
+        return 0;
+    }
+
+    StringPool *sp = as->strpool_open;
+    if (!sp) {
+        assembler_error(as, "!strpool_end without !strpool");
+        return -1;
+    }
+    as->strpool_open = NULL;
+
+    PoolString *strings = malloc((size_t)(sp->count > 0 ? sp->count : 1) * sizeof(PoolString));
+    if (!strings) {
+        assembler_error(as, "out of memory for !strpool");
+        return -1;
+    }
+    for (int i = 0; i < sp->count; i++) {
+        strings[i].bytes = sp->strings[i].bytes;
+        strings[i].length = sp->strings[i].length;
+    }
+    uint16_t output;
+    const char *error = NULL;
+    int result = strpool_output(as, sp, &output);
+    if (result == 0) {
+        sp->options.output = output;
+        result = strpool_build(strings, sp->count, &sp->options, as->pc, &sp->pool, &error);
+        if (result < 0) assembler_error(as, "!strpool: %s", error);
+    }
+    free(strings);
+    if (result < 0) return -1;
+
+    sp->end = stmt;
+    sp->address = as->pc;
+    for (int i = 0; i < sp->count; i++) {
+        Symbol *sym = sp->strings[i].symbol;
+        if (!sym) continue;
+        sym->value = (uint16_t)(as->pc + sp->pool.offsets[i]);
+        sym->flags &= ~SYM_ZEROPAGE;
+        if (assembler_is_zeropage(sym->value)) sym->flags |= SYM_ZEROPAGE;
+    }
+    if (sp->options.compress) {
+        define_label_suffix(as, sp->stmt, "decode", as->pc);
+    }
+    assembler_advance_pc(as, sp->pool.size);
+    return 0;
+}
+
+/* label !strpool [compress=1 [, output=routine] [, zp=addr]] ... !strpool_end
+ * pools the !text, !null, !pet and !scr strings in between: duplicates
+ * and strings found inside others are stored once, and the labels of
+ * their lines point into the pool. compress=1 also dictionary-compresses
+ * them behind a decoder, named label_decode, that takes a string's
+ * address in A/X and calls output (default $FFD2) with each byte */
+static int assemble_strpool_directive(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+
+    if (strcmp(dir->name, "strpool_end") == 0) {
+        return place_strpool(as, stmt);
+    }
+    if (as->pass != 1) return 0;
+
+    if (as->strpool_open) {
+        assembler_error(as, "!strpool regions cannot be nested");
+        return -1;
+    }
+    for (int i = 0; i < dir->arg_count; i++) {
+        const char *arg_name = named_arg_name(dir->args[i]);
+        if (!arg_name || (strcasecmp(arg_name, "compress") != 0 &&
+                          strcasecmp(arg_name, "output") != 0 &&
+                          strcasecmp(arg_name, "zp") != 0)) {
+            assembler_error(as, "!strpool takes compress=, output= and zp=");
+            return -1;
+        }
+    }
+    if (dir->string_arg) {
+        assembler_error(as, "!strpool takes compress=, output= and zp=");
+        return -1;
+    }
+
+    int compress, zp;
+    if (directive_int_arg(as, stmt, "compress", 0, 1, 0, &compress) < 0) {
+        assembler_error(as, "!strpool compress must be 0 or 1");
+        return -1;
+    }
+    if (directive_int_arg(as, stmt, "zp", 0, 0xFC, 0xFB, &zp) < 0) {
+        assembler_error(as, "!strpool zp must be a constant from $00 to $FC");
+        return -1;
+    }
+    if (!compress && (assembler_directive_arg(stmt, "output") ||
+                      assembler_directive_arg(stmt, "zp"))) {
+        assembler_error(as, "!strpool output= and zp= need compress=1");
+        return -1;
+    }
+
+    StringPool *sp = calloc(1, sizeof(StringPool));
+    if (!sp) {
+        assembler_error(as, "out of memory for !strpool");
+        return -1;
+    }
+    sp->stmt = stmt;
+    sp->filename = as->current_file;
+    sp->line_number = as->current_line;
+    sp->options.compress = compress;
+    sp->options.zp = (uint8_t)zp;
+    sp->next = as->strpools;
+    as->strpools = sp;
+    as->strpool_open = sp;
+    return 0;
+}
+
+/* ========== Read-Only Data ========== */
+
+static int is_rodata_directive(const char *name) {
+    return strcmp(name, "byte") == 0 || strcmp(name, "by") == 0 ||
+           strcmp(name, "db") == 0 || strcmp(name, "08") == 0 ||
+           strcmp(name, "word") == 0 || strcmp(name, "wo") == 0 ||
+           strcmp(name, "dw") == 0 || strcmp(name, "16") == 0 ||
+           is_string_directive(name) ||
+           strcmp(name, "fill") == 0 || strcmp(name, "fi") == 0;
+}
+
+/* Lines a !rodata region may hold besides its data */
+static int rodata_accepts(const Statement *stmt) {
+    switch (stmt->type) {
+        case STMT_EMPTY:
+        case STMT_LABEL:
+        case STMT_ASSIGNMENT:
+            return 1;
+        case STMT_DIRECTIVE:
+            return is_rodata_directive(stmt->data.directive.name) ||
+                   strcmp(stmt->data.directive.name, "align") == 0 ||
+                   strcmp(stmt->data.directive.name, "rodata") == 0 ||
+                   strcmp(stmt->data.directive.name, "rodata_end") == 0;
+        default:
+            return 0;
+    }
+}
+
+static void free_rodata(Assembler *as) {
+    while (as->rodata) {
+        RodataRegion *next = as->rodata->next;
+        for (int i = 0; i < as->rodata->count; i++) {
+            free(as->rodata->blocks[i].bytes);
+        }
+        free(as->rodata->blocks);
+        free(as->rodata->labels);
+        rodata_free(&as->rodata->pack);
+        free(as->rodata);
+        as->rodata = next;
+    }
+    as->rodata_open = NULL;
+}
+
+/* Start a block, taking the alignment of a preceding !align */
+static int rodata_new_block(Assembler *as, RodataRegion *rp) {
+    if (rp->count >= rp->capacity) {
+        int new_capacity = rp->capacity ? rp->capacity * 2 : 16;
+        RodataEntry *blocks = realloc(rp->blocks, new_capacity * sizeof(RodataEntry));
+        if (!blocks) {
+            assembler_error(as, "out of memory for !rodata");
+            return -1;
+        }
+        rp->blocks = blocks;
+        rp->capacity = new_capacity;
+    }
+    RodataEntry *block = &rp->blocks[rp->count++];
+    memset(block, 0, sizeof(*block));
+    block->align = rp->align ? rp->align : 1;
+    rp->align = 0;
+    return 0;
+}
+
+/* Pass 1 points a label inside a !rodata region into its block: a global
+ * label starts a block, a local one marks a place in the current one */
+static int rodata_label(Assembler *as, const LabelInfo *label) {
+    RodataRegion *rp = as->rodata_open;
+
+    if (label->is_anon_fwd || label->is_anon_back) {
+        assembler_error(as, "!rodata data cannot have anonymous labels");
+        return -1;
+    }
+    if ((!label->is_local || rp->count == 0 || rp->align) && rodata_new_block(as, rp) < 0) {
+        return -1;
+    }
+    if (rp->label_count >= rp->label_capacity) {
+        int new_capacity = rp->label_capacity ? rp->label_capacity * 2 : 16;
+        RodataLabel *labels = realloc(rp->labels, new_capacity * sizeof(RodataLabel));
+        if (!labels) {
+            assembler_error(as, "out of memory for !rodata");
+            return -1;
+        }
+        rp->labels = labels;
+        rp->label_capacity = new_capacity;
+    }
+    RodataLabel *rl = &rp->labels[rp->label_count++];
+    rl->symbol = label_symbol(as, label);
+    rl->block = rp->count - 1;
+    rl->offset = rp->blocks[rp->count - 1].length;
+    return 0;
+}
+
+/* Finds a label of the open region an expression reads (expr_visit_symbols
+ * callback state) */
+typedef struct {
+    Assembler *as;
+    const char *name;
+} RodataReader;
+
+static void find_rodata_read(const char *name, void *userdata) {
+    RodataReader *reader = userdata;
+    RodataRegion *rp = reader->as->rodata_open;
+
+    if (reader->name || strncmp(name, "__anon_", 7) == 0) return;
+    Symbol *sym = symbol_lookup(reader->as->symbols, name);
+    for (int i = 0; sym && i < rp->label_count; i++) {
+        if (rp->labels[i].symbol == sym) {
+            reader->name = sym->name;
+            return;
+        }
+    }
+}
+
+/* Value of a !rodata data expression, which must be known in pass 1 and
+ * cannot use the addresses inside the region that packing will change */
+static int rodata_value(Assembler *as, Expr *expr, int32_t *value) {
+    RodataReader reader = { as, NULL };
+
+    expr_visit_symbols(expr, as->current_zone, find_rodata_read, &reader);
+    if (reader.name) {
+        assembler_error(as, "!rodata data cannot use '%s', whose address packing changes",
+                        reader.name);
+        return -1;
+    }
+    ExprResult r = expr_eval(expr, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+    if (!r.defined) {
+        assembler_error(as, "!rodata data must be known when it is read");
+        return -1;
+    }
+    *value = r.value;
+    return 0;
+}
+
+/* Bytes of a data directive inside a !rodata region (caller frees) */
+static uint8_t *rodata_directive_bytes(Assembler *as, Statement *stmt, int *length) {
+    DirectiveInfo *dir = &stmt->data.directive;
+    const char *name = dir->name;
+    uint8_t *bytes = NULL;
+    int32_t value;
+
+    if (is_string_directive(name)) {
+        if (!dir->string_arg) {
+            assembler_error(as, "!%s requires a string argument", name);
+            return NULL;
+        }
+        bytes = string_directive_bytes(dir, 0, length);
+    } else if (strcmp(name, "fill") == 0 || strcmp(name, "fi") == 0) {
+        int32_t fill = 0;
+        if (dir->arg_count < 1) {
+            assembler_error(as, "!fill requires count argument");
+            return NULL;
+        }
+        if (rodata_value(as, dir->args[0], &value) < 0 ||
+            (dir->arg_count >= 2 && rodata_value(as, dir->args[1], &fill) < 0)) {
+            return NULL;
+        }
+        if (value < 0 || value > 65536) {
+            assembler_error(as, "!fill count out of range");
+            return NULL;
+        }
+        *length = value;
+        bytes = malloc((size_t)(value > 0 ? value : 1));
+        if (bytes) memset(bytes, fill & 0xFF, (size_t)value);
+    } else {
+        int word = strcmp(name, "word") == 0 || strcmp(name, "wo") == 0 ||
+                   strcmp(name, "dw") == 0 || strcmp(name, "16") == 0;
+        int op, values = 0;
+        for (int i = 0; i < dir->arg_count; i++) {
+            const ExprList *list = bulk_list(as, dir->args[i], &op);
+            values += list ? expr_list_length(list) : 1;
+        }
+        *length = 0;
+        bytes = malloc((size_t)(values > 0 ? values : 1) * 2);
+        if (!bytes) {
+            assembler_error(as, "out of memory for !rodata");
+            return NULL;
+        }
+        for (int i = 0; i < dir->arg_count; i++) {
+            const ExprList *list = bulk_list(as, dir->args[i], &op);
+            for (int e = 0; list && e < expr_list_length(list); e++) {
+                value = bulk_value(list, op, e);
+                if (!word && (value < -128 || value > 255)) {
+                    assembler_warning(as, "byte value $%X truncated", value);
+                }
+                bytes[(*length)++] = value & 0xFF;
+                if (word) bytes[(*length)++] = (value >> 8) & 0xFF;
+            }
+            if (list) continue;
+            if (rodata_value(as, dir->args[i], &value) < 0) {
+                free(bytes);
+                return NULL;
+            }
+            if (!word && (value < -128 || value > 255)) {
+                assembler_warning(as, "byte value $%X truncated", value);
+            }
+            bytes[(*length)++] = value & 0xFF;
+            if (word) bytes[(*length)++] = (value >> 8) & 0xFF;
+        }
+    }
+    if (!bytes) assembler_error(as, "out of memory for !rodata");
+    return bytes;
+}
+
+/* Pass 1 adds the data of a line inside a !rodata region to the current
+ * block; its own line then generates nothing in either pass */
+static int rodata_data(Assembler *as, Statement *stmt) {
+    RodataRegion *rp = as->rodata_open;
+
+    if (as->pass != 1) return 0;
+
+    int length;
+    uint8_t *bytes = rodata_directive_bytes(as, stmt, &length);
+    if (!bytes) return -1;
+    if ((rp->count == 0 || rp->align) && rodata_new_block(as, rp) < 0) {
+        free(bytes);
+        return -1;
+    }
+
+    RodataEntry *block = &rp->blocks[rp->count - 1];
+    if (block->length + length > block->capacity) {
+        int new_capacity = block->capacity ? block->capacity : 64;
+        while (new_capacity < block->length + length) new_capacity *= 2;
+        uint8_t *grown = realloc(block->bytes, (size_t)new_capacity);
+        if (!grown) {
+            free(bytes);
+            assembler_error(as, "out of memory for !rodata");
+            return -1;
+        }
+        block->bytes = grown;
+        block->capacity = new_capacity;
+    }
+    memcpy(block->bytes + block->length, bytes, (size_t)length);
+    block->length += length;
+    rp->input_size += length;
+    free(bytes);
+    if (as->stored_line) as->stored_line->pooled = 1;
+    return 0;
+}
+
+/* !align n inside a !rodata region aligns the next block rather than
+ * padding in place */
+static int rodata_align(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+
+    if (as->pass != 1) return 0;
+
+    ExprResult r = { 0 };
+    if (dir->arg_count == 1) {
+        r = expr_eval(dir->args[0], as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+    }
+    if (!r.defined || r.value < 1 || r.value > 0x8000 || (r.value & (r.value - 1)) != 0) {
+        assembler_error(as, "!align inside !rodata takes one constant power of 2 up to $8000");
+        return -1;
+    }
+    if (r.value > as->rodata_open->align) as->rodata_open->align = r.value;
+    if (as->stored_line) as->stored_line->pooled = 1;
+    return 0;
+}
+
+/* !rodata_end: pass 1 packs the open region's blocks here and moves their
+ * labels onto the packed copies; pass 2 emits the packed data */
+static int place_rodata(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+
+    if (dir->arg_count > 0 || dir->string_arg) {
+        assembler_error(as, "!rodata_end takes no arguments");
+        return -1;
+    }
+
+    if (as->pass == 2) {
+        RodataRegion *rp = as->rodata;
+        while (rp && rp->end != stmt) rp = rp->next;
+        if (!rp) return 0;
+        if (as->pc != rp->address) {
+            assembler_error(as, "!rodata moved from $%04X to $%04X after packing",
+                            rp->address, as->pc);
+            return -1;
+        }
+        assembler_emit_bytes(as, rp->pack.data, rp->pack.size);
+        return 0;
+    }
+
+    RodataRegion *rp = as->rodata_open;
+    if (!rp) {
+        assembler_error(as, "!rodata_end without !rodata");
+        return -1;
+    }
+    as->rodata_open = NULL;
+
+    RodataBlock *blocks = malloc((size_t)(rp->count > 0 ? rp->count : 1) * sizeof(RodataBlock));
+    if (!blocks) {
+        assembler_error(as, "out of memory for !rodata");
+        return -1;
+    }
+    for (int i = 0; i < rp->count; i++) {
+        blocks[i].bytes = rp->blocks[i].bytes;
+        blocks[i].length = rp->blocks[i].length;
+        blocks[i].align = rp->blocks[i].align;
+    }
+    const char *error = NULL;
+    int result = rodata_pack(blocks, rp->count, as->pc, &rp->pack, &error);
+    free(blocks);
+    if (result < 0) {
+        assembler_error(as, "!rodata: %s", error);
+        return -1;
+    }
+
+    rp->end = stmt;
+    rp->address = as->pc;
+    for (int i = 0; i < rp->label_count; i++) {
+        Symbol *sym = rp->labels[i].symbol;
+        if (!sym) continue;
+        sym->value = (uint16_t)(as->pc + rp->pack.offsets[rp->labels[i].block] +
+                                rp->labels[i].offset);
+        sym->flags &= ~SYM_ZEROPAGE;
+        if (assembler_is_zeropage(sym->value)) sym->flags |= SYM_ZEROPAGE;
+    }
+    assembler_advance_pc(as, rp->pack.size);
+    return 0;
+}
+
+/* !rodata ... !rodata_end packs the data in between: each global label
+ * starts a block that runs to the next one, equal blocks and blocks found
+ * inside others are stored once, and the rest overlap where one ends the
+ * way another starts. !align n in between aligns the next block */
+static int assemble_rodata_directive(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+
+    if (strcmp(dir->name, "rodata_end") == 0) {
+        return place_rodata(as, stmt);
+    }
+    if (as->pass != 1) return 0;
+
+    if (as->rodata_open) {
+        assembler_error(as, "!rodata regions cannot be nested");
+        return -1;
+    }
+    if (dir->arg_count > 0 || dir->string_arg) {
+        assembler_error(as, "!rodata takes no arguments");
+        return -1;
+    }
+
+    RodataRegion *rp = calloc(1, sizeof(RodataRegion));
+    if (!rp) {
+        assembler_error(as, "out of memory for !rodata");
+        return -1;
+    }
+    rp->stmt = stmt;
+    rp->filename = as->current_file;
+    rp->line_number = as->current_line;
+    rp->next = as->rodata;
+    as->rodata = rp;
+    as->rodata_open = rp;
+    return 0;
+}
+
+/* name !inline marks the routine at name for inlining; pass 1 then
+ * collects its body up to the first RTS */
+static int assemble_inline_directive(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+    LabelInfo *label = stmt->label;
+
+    if (as->pass != 1) return 0;
+
+    if (dir->arg_count > 0 || dir->string_arg) {
+        assembler_error(as, "!inline takes no arguments");
+        return -1;
+    }
+    if (!label || label->is_local || label->is_anon_fwd || label->is_anon_back) {
+        assembler_error(as, "!inline needs a global routine label on its line");
+        return -1;
+    }
+    if (as->macro_depth > 0 || as->loop_depth > 0) {
+        assembler_error(as, "!inline routine '%s' cannot be defined in a macro or loop",
+                        label->name);
+        return -1;
+    }
+    return inline_begin(as, label->name);
+}
+
+/* !func name(params) = body defines a function in pass 1; the parser
+ * gives the name, each parameter and the body as arguments */
+static int assemble_func_directive(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+
+    if (as->pass != 1) return 0;
+
+    if (dir->arg_count < 2) {
+        assembler_error(as, "!func needs name(params) = expression");
+        return -1;
+    }
+    const char *name = dir->args[0]->data.symbol;
+    const char *params[EXPR_MAX_PARAMS];
+    int param_count = dir->arg_count - 2;
+    for (int i = 0; i < param_count && i < EXPR_MAX_PARAMS; i++) {
+        params[i] = dir->args[i + 1]->data.symbol;
+    }
+
+    const char *error = NULL;
+    if (expr_function_define(as->symbols->functions, name, params, param_count,
+                             dir->args[dir->arg_count - 1], &error) < 0) {
+        assembler_error(as, "function '%s': %s", name, error);
+        return -1;
+    }
+    return 0;
+}
+
+/* !let name = list defines a list in pass 1 from elements known there;
+ * the parser gives the name and the list as arguments */
+static int assemble_let_directive(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+
+    if (as->pass != 1) return 0;
+
+    if (dir->arg_count != 2) {
+        assembler_error(as, "!let needs name = [elements] or [expression for var, start, end]");
+        return -1;
+    }
+    const char *name = dir->args[0]->data.symbol;
+    Symbol *sym = symbol_lookup(as->symbols, name);
+    if (sym && (sym->flags & SYM_DEFINED)) {
+        assembler_error(as, "list '%s': already a symbol", name);
+        return -1;
+    }
+
+    int32_t *values;
+    int count;
+    ExprResult failed;
+    if (expr_list_eval(dir->args[1], as->symbols, as->anon_labels, as->pc, 1,
+                       as->current_zone, &values, &count, &failed) < 0) {
+        if (failed.error && failed.function) {
+            report_undefined(as, &failed, NULL);
+        } else {
+            assembler_error(as, "list '%s': %s", name,
+                            failed.error ? failed.error : "elements must be known when !let is reached");
+        }
+        return -1;
+    }
+
+    const char *error = NULL;
+    int tag = as->stored_line ? (int)(as->stored_line - as->lines) : as->line_count;
+    int result = expr_list_define(as->symbols->lists, name, values, count, tag, &error);
+    free(values);
+    if (result < 0) {
+        assembler_error(as, "list '%s': %s", name, error);
+        return -1;
+    }
+    return 0;
+}
+
+int assembler_assemble_directive(Assembler *as, Statement *stmt) {
+    DirectiveInfo *dir = &stmt->data.directive;
+    const char *name = dir->name;
+
+    /* Strings of a !strpool region go to its pool */
+    if (is_string_directive(name) &&
+        (as->strpool_open || (as->pass == 2 && as->stored_line && as->stored_line->pooled))) {
+        return pool_string(as, stmt);
+    }
+    /* Data of a !rodata region goes to its blocks */
+    if ((is_rodata_directive(name) || strcmp(name, "align") == 0) &&
+        (as->rodata_open || (as->pass == 2 && as->stored_line && as->stored_line->pooled))) {
+        return strcmp(name, "align") == 0 ? rodata_align(as, stmt) : rodata_data(as, stmt);
+    }
+
+    /* Byte data */
+    if (strcmp(name, "byte") == 0 || strcmp(name, "by") == 0 ||
+        strcmp(name, "db") == 0 || strcmp(name, "08") == 0) {
+        return assemble_byte_directive(as, stmt);
+    }
+    /* Word data */
+    if (strcmp(name, "word") == 0 || strcmp(name, "wo") == 0 ||
+        strcmp(name, "dw") == 0 || strcmp(name, "16") == 0) {
+        return assemble_word_directive(as, stmt);
+    }
+    /* Text/string data */
+    if (strcmp(name, "text") == 0 || strcmp(name, "tx") == 0) {
+        return assemble_text_directive(as, stmt);
+    }
+    /* PETSCII string */
+    if (strcmp(name, "pet") == 0) {
+        return assemble_pet_directive(as, stmt);
+    }
+    /* Screen codes */
+    if (strcmp(name, "scr") == 0) {
+        return assemble_scr_directive(as, stmt);
+    }
+    /* Null-terminated string */
+    if (strcmp(name, "null") == 0) {
+        return assemble_null_directive(as, stmt);
     }
     /* Fill bytes */
     if (strcmp(name, "fill") == 0 || strcmp(name, "fi") == 0) {
@@ -1102,6 +3543,22 @@ int assembler_assemble_directive(Assembler *as, Statement *stmt) {
     if (strcmp(name, "binary") == 0 || strcmp(name, "bin") == 0) {
         return assemble_binary_directive(as, stmt);
     }
+    /* PNG import */
+    if (strcmp(name, "image") == 0) {
+        return assemble_image_directive(as, stmt);
+    }
+    /* Charset deduplication and screen maps */
+    if (strcmp(name, "charmap") == 0) {
+        return assemble_charmap_directive(as, stmt);
+    }
+    /* String pools */
+    if (strcmp(name, "strpool") == 0 || strcmp(name, "strpool_end") == 0) {
+        return assemble_strpool_directive(as, stmt);
+    }
+    /* Read-only data packing */
+    if (strcmp(name, "rodata") == 0 || strcmp(name, "rodata_end") == 0) {
+        return assemble_rodata_directive(as, stmt);
+    }
     /* BASIC stub generator */
     if (strcmp(name, "basic") == 0) {
         return assemble_basic_directive(as, stmt);
@@ -1120,6 +3577,15 @@ int assembler_assemble_directive(Assembler *as, Statement *stmt) {
     /* Loop-related directives handled in pass1 */
     if (strcmp(name, "for") == 0 || strcmp(name, "while") == 0 ||
         strcmp(name, "end") == 0) {
+        /* A data-only !for loop stands for its pass 1 output */
+        AssembledLine *line = as->stored_line;
+        if (line && line->generated) {
+            if (assembler_emitting(as)) {
+                assembler_emit_bytes(as, line->generated, line->generated_size);
+            } else {
+                assembler_advance_pc(as, line->generated_size);
+            }
+        }
         return 0;
     }
 
@@ -1145,6 +3611,7 @@ int assembler_assemble_directive(Assembler *as, Statement *stmt) {
     /* CPU selection - accepts string "6502", "6510", "65c02" or number */
     if (strcmp(name, "cpu") == 0) {
         const char *cpu_name = NULL;
+        char num_buf[16];
 
         /* Check for string argument first */
         if (dir->string_arg) {
@@ -1156,7 +3623,6 @@ int assembler_assemble_directive(Assembler *as, Statement *stmt) {
                 cpu_name = arg->data.symbol;
             } else if (arg->type == EXPR_NUMBER) {
                 /* Handle numeric cpu types like 6502, 6510 */
-                static char num_buf[16];
                 snprintf(num_buf, sizeof(num_buf), "%d", (int)arg->data.number);
                 cpu_name = num_buf;
             }
@@ -1190,14 +3656,63 @@ int assembler_assemble_directive(Assembler *as, Statement *stmt) {
             as->current_zone = strdup(zone_name);
         } else {
             /* Anonymous zone - use unique name */
-            static int anon_zone_counter = 0;
             char buf[32];
-            snprintf(buf, sizeof(buf), "_zone_%d", ++anon_zone_counter);
+            snprintf(buf, sizeof(buf), "_zone_%d", ++as->anon_zone_counter);
             as->current_zone = strdup(buf);
         }
         return 0;
     }
 
+    /* Raster timing annotations */
+    if (strcmp(name, "raster_block") == 0 || strcmp(name, "raster_end") == 0) {
+        return assemble_raster_directive(as, stmt);
+    }
+
+    /* IRQ latency annotations */
+    if (strcmp(name, "irq") == 0 || strcmp(name, "irq_end") == 0 ||
+        strcmp(name, "irq_mark") == 0) {
+        return assemble_irq_directive(as, stmt);
+    }
+
+    /* Profile-guided padding */
+    if (strcmp(name, "pgo_pad") == 0) {
+        return assemble_pgo_pad_directive(as, stmt);
+    }
+
+    /* Struct-of-arrays tables */
+    if (strcmp(name, "soa") == 0) {
+        return assemble_soa_directive(as, stmt);
+    }
+
+    /* Exact-cycle delays */
+    if (strcmp(name, "delay") == 0) {
+        return assemble_delay_directive(as, stmt);
+    }
+
+    /* Cycle-balanced blocks */
+    if (strcmp(name, "balanced") == 0 || strcmp(name, "balanced_else") == 0 ||
+        strcmp(name, "balanced_end") == 0) {
+        return assemble_balanced_directive(as, stmt);
+    }
+
+    /* Assembly-time runs */
+    if (strcmp(name, "run") == 0) {
+        return assemble_run_directive(as, stmt);
+    }
+
+    /* Inline subroutines */
+    if (strcmp(name, "inline") == 0) {
+        return assemble_inline_directive(as, stmt);
+    }
+
+    /* Expression functions and lists */
+    if (strcmp(name, "func") == 0) {
+        return assemble_func_directive(as, stmt);
+    }
+    if (strcmp(name, "let") == 0) {
+        return assemble_let_directive(as, stmt);
+    }
+
     /* Error/warning messages */
     if (strcmp(name, "error") == 0) {
         /* Get message from string argument */
@@ -1229,6 +3744,10 @@ static int assemble_assignment(Assembler *as, Statement *stmt) {
     AssignmentInfo *assign = &stmt->data.assignment;
 
     ExprResult result = expr_eval(assign->value, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
+    if (result.error && as->pass == 2) {
+        report_undefined(as, &result, result.error);
+        return -1;
+    }
 
     /* Determine flags for the symbol definition:
      * - In pass 1 outside loops: SYM_CONSTANT (traditional behavior)
@@ -1255,11 +3774,21 @@ static int assemble_assignment(Assembler *as, Statement *stmt) {
 int assembler_assemble_statement(Assembler *as, Statement *stmt) {
     as->current_line = stmt->line;
 
+    if (as->pass == 1 && as->strpool_open && !strpool_accepts(stmt)) {
+        assembler_error(as, "only strings and assignments can go between !strpool and !strpool_end");
+        return -1;
+    }
+    if (as->pass == 1 && as->rodata_open && !rodata_accepts(stmt)) {
+        assembler_error(as, "only data, !align and assignments can go between !rodata and !rodata_end");
+        return -1;
+    }
+
     /* Handle label first */
     if (stmt->label) {
         if (as->pass == 1) {
             /* Define symbols in pass 1 */
             define_label(as, stmt->label);
+            if (as->rodata_open && rodata_label(as, stmt->label) < 0) return -1;
         } else {
             /* In pass 2, still need to track zone for local label resolution */
             if (!stmt->label->is_local && !stmt->label->is_anon_fwd && !stmt->label->is_anon_back) {
@@ -1270,6 +3799,10 @@ int assembler_assemble_statement(Assembler *as, Statement *stmt) {
         }
     }
 
+    if (as->pass == 1 && stmt->type == STMT_INSTRUCTION && stmt->data.instruction.operand_label) {
+        define_operand_label(as, &stmt->data.instruction);
+    }
+
     /* Process statement based on type */
     switch (stmt->type) {
         case STMT_EMPTY:
@@ -1299,6 +3832,284 @@ int assembler_assemble_statement(Assembler *as, Statement *stmt) {
     return 0;
 }
 
+/* ========== Dependency Tracking ========== */
+
+/* Directives whose handler evaluates every argument once, in order */
+static int evaluates_args_in_order(const char *name) {
+    return strcmp(name, "byte") == 0 || strcmp(name, "by") == 0 ||
+           strcmp(name, "db") == 0 || strcmp(name, "08") == 0 ||
+           strcmp(name, "word") == 0 || strcmp(name, "wo") == 0 ||
+           strcmp(name, "dw") == 0 || strcmp(name, "16") == 0;
+}
+
+/* Collects the symbols a line reads (expr_visit_symbols callback state) */
+typedef struct {
+    Assembler *as;
+    AssembledLine *line;
+    int capacity;
+    int unresolved;          /* Some input is not known yet */
+} ReadCollector;
+
+static void collect_read(const char *name, void *userdata) {
+    ReadCollector *rc = userdata;
+
+    if (strncmp(name, "__anon_", 7) == 0) {
+        /* Backward references resolve identically in both passes;
+         * forward ones only in pass 2 */
+        if (strncmp(name, "__anon_fwd_", 11) == 0) {
+            rc->unresolved = 1;
+        }
+        return;
+    }
+
+    /* A pure function's value depends only on its arguments, which are
+     * visited on their own; any other one reads symbols we cannot see */
+    if (strncmp(name, "__call_", 7) == 0) {
+        if (!expr_function_is_pure(rc->as->symbols->functions, name + 7)) {
+            rc->unresolved = 1;
+        }
+        return;
+    }
+    /* Lists never change once defined */
+    if (strncmp(name, "__list_", 7) == 0) {
+        if (!expr_list_find(rc->as->symbols->lists, name + 7)) rc->unresolved = 1;
+        return;
+    }
+
+    Symbol *sym = symbol_lookup(rc->as->symbols, name);
+    if (!sym || !(sym->flags & SYM_DEFINED)) {
+        rc->unresolved = 1;
+        return;
+    }
+
+    AssembledLine *line = rc->line;
+    if (line->read_count >= rc->capacity) {
+        int new_capacity = rc->capacity ? rc->capacity * 2 : 4;
+        LineRead *reads = realloc(line->reads, new_capacity * sizeof(LineRead));
+        if (!reads) {
+            rc->unresolved = 1;
+            return;
+        }
+        line->reads = reads;
+        rc->capacity = new_capacity;
+    }
+    line->reads[line->read_count].symbol = sym;
+    line->reads[line->read_count].value = sym->value;
+    line->read_count++;
+}
+
+/* Record the symbols a statement's expressions read, evaluated in zone */
+static void collect_reads(Statement *stmt, const char *zone, ReadCollector *rc) {
+    switch (stmt->type) {
+        case STMT_INSTRUCTION: {
+            InstructionInfo *info = &stmt->data.instruction;
+            if (info->mode != ADDR_ACCUMULATOR && info->mode != ADDR_IMPLIED) {
+                expr_visit_symbols(info->operand, zone, collect_read, rc);
+                expr_visit_symbols(info->target, zone, collect_read, rc);
+            }
+            break;
+        }
+        case STMT_DIRECTIVE: {
+            DirectiveInfo *dir = &stmt->data.directive;
+            for (int i = 0; i < dir->arg_count; i++) {
+                expr_visit_symbols(dir->args[i], zone, collect_read, rc);
+            }
+            break;
+        }
+        case STMT_ASSIGNMENT:
+            expr_visit_symbols(stmt->data.assignment.value, zone, collect_read, rc);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Statements whose bytes depend only on their inputs, so pass 1 may
+ * generate them once those inputs are known */
+static int pass1_can_emit(Statement *stmt) {
+    if (stmt->type == STMT_INSTRUCTION) return 1;
+    if (stmt->type != STMT_DIRECTIVE) return 0;
+
+    const char *name = stmt->data.directive.name;
+    return evaluates_args_in_order(name) ||
+           strcmp(name, "text") == 0 || strcmp(name, "tx") == 0 ||
+           strcmp(name, "pet") == 0 || strcmp(name, "scr") == 0 ||
+           strcmp(name, "null") == 0 ||
+           strcmp(name, "fill") == 0 || strcmp(name, "fi") == 0;
+}
+
+static int is_org_directive(Statement *stmt) {
+    return stmt->type == STMT_DIRECTIVE && strcmp(stmt->data.directive.name, "org") == 0;
+}
+
+/* Keep up to 8 generated bytes for the listing */
+static void capture_line_bytes(Assembler *as, AssembledLine *line, uint16_t start) {
+    int byte_count = output_pc(as) - start;
+    if (byte_count > 8) {
+        /* For long data, just show first 8 bytes */
+        byte_count = 8;
+    }
+    if (byte_count > 0) {
+        line->byte_count = byte_count;
+        for (int j = 0; j < byte_count; j++) {
+            line->bytes[j] = as->memory[start + j];
+        }
+    }
+}
+
+/* Note which symbol a stored line defines */
+static void record_definition(Assembler *as, int line_idx) {
+    AssembledLine *line = &as->lines[line_idx];
+    Statement *stmt = line->stmt;
+    LabelInfo *label = stmt->label;
+
+    if (label && !label->is_anon_fwd && !label->is_anon_back) {
+        Symbol *sym = label_symbol(as, label);
+        if (sym && symbol_add_definer(sym, line_idx) == 0) {
+            line->defines = sym;
+        }
+    }
+    if (stmt->type == STMT_ASSIGNMENT) {
+        Symbol *sym = symbol_lookup(as->symbols, stmt->data.assignment.name);
+        if (sym && symbol_add_definer(sym, line_idx) == 0) {
+            line->defines = sym;
+        }
+    }
+}
+
+/*
+ * Make the optimizer's change to a freshly stored line, if one was
+ * planned for it. Changes are matched by line index and checked against
+ * the statement, so one planned for a line the reassembly no longer
+ * stores there is simply not made (and later dropped).
+ */
+static void optimize_apply(Assembler *as, int line_idx) {
+    while (as->opt_slot < as->opt_edit_count && as->opt_edits[as->opt_slot].line < line_idx) {
+        as->opt_slot++;
+    }
+    if (as->opt_slot >= as->opt_edit_count) return;
+
+    OptEdit *edit = &as->opt_edits[as->opt_slot];
+    AssembledLine *line = &as->lines[line_idx];
+    Statement *stmt = line->stmt;
+    if (edit->line != line_idx || stmt->type != STMT_INSTRUCTION ||
+        stmt->line != edit->source_line ||
+        strcmp(stmt->file ? stmt->file : "", edit->file ? edit->file : "") != 0 ||
+        strcasecmp(stmt->data.instruction.mnemonic, edit->mnemonic) != 0) {
+        return;
+    }
+
+    InstructionInfo *info = &stmt->data.instruction;
+    if (edit->kind == OPT_BRANCH) {
+        const OpcodeEntry *op = opcode_find_by_opcode_cpu(as->cpu_type, edit->opcode);
+        char *mnemonic = op ? str_dup(op->mnemonic) : NULL;
+        if (!mnemonic || info->mode != ADDR_ABSOLUTE) {
+            free(mnemonic);
+            return;
+        }
+        free(info->mnemonic);
+        info->mnemonic = mnemonic;
+        info->mode = ADDR_RELATIVE;
+        info->opcode = op->opcode;
+        info->size = op->size;
+        info->cycles = op->cycles;
+        info->page_penalty = op->page_penalty;
+    } else {
+        info->cycles = 0;
+        info->page_penalty = 0;
+    }
+    line->cycles = info->cycles;
+    line->page_penalty = info->page_penalty;
+    line->optimized = edit->kind;
+    edit->applied = 1;
+}
+
+/*
+ * Assemble a freshly stored line in pass 1. In incremental mode this also
+ * records its inputs and, when all of them are already known, generates
+ * its bytes right away so pass 2 can skip it.
+ */
+static void pass1_line(Assembler *as, int line_idx) {
+    AssembledLine *line = &as->lines[line_idx];
+    Statement *stmt = line->stmt;
+
+    as->stored_line = line;
+    if (as->opt_edit_count > 0) optimize_apply(as, line_idx);
+    if (!as->incremental) {
+        assembler_assemble_statement(as, stmt);
+        return;
+    }
+
+    if (!as->claimed) {
+        as->claimed = calloc(ASM_MEMORY_SIZE, 1);
+        if (!as->claimed) as->reuse_pass1 = 0;
+    }
+
+    /* Inputs are read in the zone the statement is evaluated in */
+    const char *zone = as->current_zone;
+    if (stmt->label && !stmt->label->is_local &&
+        !stmt->label->is_anon_fwd && !stmt->label->is_anon_back) {
+        zone = stmt->label->name;
+    }
+    ReadCollector rc = { as, line, 0, 0 };
+    collect_reads(stmt, zone, &rc);
+
+    uint16_t start = output_pc(as);
+    if (!rc.unresolved && pass1_can_emit(stmt)) {
+        uint16_t pc = as->pc;
+        uint16_t real_pc = as->real_pc;
+        int errors = as->errors;
+        int warnings = as->warnings;
+        DiagBuffer diag = { NULL, 0, 0 };
+        DiagBuffer *outer = as->diag;
+
+        as->diag = &diag;
+        as->emit_pass1 = 1;
+        int result = assembler_assemble_statement(as, stmt);
+        as->emit_pass1 = 0;
+        as->diag = outer;
+
+        if (result == 0 && as->errors == errors) {
+            diag_replay(as, &diag);
+            capture_line_bytes(as, line, start);
+            line->resolved = 1;
+        } else {
+            /* Leave the line to pass 2, which reports its errors */
+            diag_discard(&diag);
+            as->errors = errors;
+            as->warnings = warnings;
+            as->pc = pc;
+            as->real_pc = real_pc;
+            LabelInfo *label = stmt->label;
+            stmt->label = NULL;
+            assembler_assemble_statement(as, stmt);
+            stmt->label = label;
+        }
+    } else {
+        assembler_assemble_statement(as, stmt);
+        if (!rc.unresolved && (stmt->type == STMT_ASSIGNMENT ||
+                               stmt->type == STMT_LABEL || stmt->type == STMT_EMPTY)) {
+            line->resolved = 1;
+        }
+    }
+
+    record_definition(as, line_idx);
+
+    /* Skipped lines keep their pass 1 bytes, which is only safe when no
+     * two lines write the same address */
+    line->size = is_org_directive(stmt) ? 0 : (uint16_t)(output_pc(as) - start);
+    if (as->claimed) {
+        for (int b = 0; b < line->size; b++) {
+            uint16_t addr = (uint16_t)(start + b);
+            if (as->claimed[addr]) {
+                as->reuse_pass1 = 0;
+                break;
+            }
+            as->claimed[addr] = 1;
+        }
+    }
+}
+
 /* ========== Pass 1 Implementation ========== */
 
 /* Check if statement is a source include directive */
@@ -1558,7 +4369,8 @@ static int process_loop_directive(Assembler *as, Statement *stmt, Lexer *lexer,
         ExprResult end_result = expr_eval(dir->args[2], as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
 
         if (!start_result.defined || !end_result.defined) {
-            assembler_error(as, "!for start and end must be defined values");
+            report_undefined(as, start_result.defined ? &end_result : &start_result,
+                             "!for start and end must be defined values");
             return -1;
         }
 
@@ -1664,7 +4476,8 @@ static int process_conditional_directive(Assembler *as, Statement *stmt) {
 }
 
 /* Internal recursive pass1 implementation */
-static int assembler_pass1_internal(Assembler *as, const char *source, const char *filename);
+static int assembler_pass1_internal(Assembler *as, const char *source,
+                                    const LineIndex *index, const char *filename);
 
 int assembler_include_file(Assembler *as, const char *filename) {
     /* Check include depth */
@@ -1689,6 +4502,15 @@ int assembler_include_file(Assembler *as, const char *filename) {
         return -1;
     }
 
+    /* Statements from the file outlive path */
+    const char *name = intern_file_name(as, path);
+    if (!name) {
+        assembler_error(as, "out of memory reading include file: %s", path);
+        free(content);
+        free(path);
+        return -1;
+    }
+
     /* Push onto include stack */
     IncludeEntry *entry = &as->include_stack[as->include_depth];
     entry->filename = strdup(as->current_file ? as->current_file : "<input>");
@@ -1700,7 +4522,15 @@ int assembler_include_file(Assembler *as, const char *filename) {
     const char *saved_file = as->current_file;
 
     /* Process included file */
-    int result = assembler_pass1_internal(as, content, path);
+    LineIndex index;
+    int result = -1;
+    if (line_index_init(&index) < 0 ||
+        line_index_scan(&index, content, 0, (size_t)size) < 0) {
+        assembler_error(as, "out of memory reading include file: %s", path);
+    } else {
+        result = assembler_pass1_internal(as, content, &index, name);
+    }
+    line_index_free(&index);
 
     /* Restore state */
     as->current_file = saved_file;
@@ -1716,9 +4546,14 @@ int assembler_include_file(Assembler *as, const char *filename) {
     return result;
 }
 
-static int assembler_pass1_internal(Assembler *as, const char *source, const char *filename) {
+static int assembler_pass1_internal(Assembler *as, const char *source,
+                                    const LineIndex *index, const char *filename) {
     as->pass = 1;
     as->current_file = filename;
+    InlineRoutine *inline_open = as->inline_open;
+    StringPool *strpool_open = as->strpool_open;
+    RodataRegion *rodata_open = as->rodata_open;
+    int balanced_open = as->balanced_open;
 
     Lexer lexer;
     Parser parser;
@@ -1732,40 +4567,14 @@ static int assembler_pass1_internal(Assembler *as, const char *source, const cha
     while (1) {
         uint16_t line_pc = as->pc;
 
+        parser_set_cpu(&parser, as->cpu_type);
         Statement *stmt = parser_parse_line(&parser);
         if (!stmt) {
             break;
         }
 
-        /* Capture source line for listings by finding it in the source buffer */
-        char *source_line = NULL;
-        if (stmt->line > 0) {
-            /* Find the line in source */
-            const char *p = source;
-            int current_line = 1;
-            while (*p && current_line < stmt->line) {
-                if (*p == '\n') current_line++;
-                p++;
-            }
-            /* p now points to start of the line */
-            const char *line_start = p;
-            while (*line_start == ' ' || *line_start == '\t') line_start++;
-            const char *line_end = line_start;
-            while (*line_end && *line_end != '\n') line_end++;
-            int line_len = (int)(line_end - line_start);
-            /* Strip trailing whitespace */
-            while (line_len > 0 && (line_start[line_len-1] == ' ' ||
-                   line_start[line_len-1] == '\t' || line_start[line_len-1] == '\r')) {
-                line_len--;
-            }
-            if (line_len > 0) {
-                source_line = malloc(line_len + 1);
-                if (source_line) {
-                    memcpy(source_line, line_start, line_len);
-                    source_line[line_len] = '\0';
-                }
-            }
-        }
+        /* Capture source line for listings via the line index */
+        char *source_line = line_index_capture(index, source, stmt->line);
 
         /* Update parser PC for expression evaluation */
         parser_set_pc(&parser, as->pc);
@@ -1788,91 +4597,488 @@ static int assembler_pass1_internal(Assembler *as, const char *source, const cha
             continue;
         }
 
-        /* Check for source include directive - process immediately */
-        if (is_source_directive(stmt)) {
-            DirectiveInfo *dir = &stmt->data.directive;
-            if (!dir->string_arg) {
-                assembler_error(as, "!source requires a filename argument");
-            } else {
-                assembler_include_file(as, dir->string_arg);
+        /* Collect the body of an !inline routine */
+        if (as->inline_open) {
+            inline_collect(as, stmt, source_line);
+        }
+
+        /* Check for source include directive - process immediately */
+        if (is_source_directive(stmt)) {
+            DirectiveInfo *dir = &stmt->data.directive;
+            if (!dir->string_arg) {
+                assembler_error(as, "!source requires a filename argument");
+            } else {
+                assembler_include_file(as, dir->string_arg);
+            }
+            statement_free(stmt);
+            free(source_line);
+            continue;
+        }
+
+        /* Check for macro definition - process immediately */
+        if (is_macro_directive(stmt)) {
+            process_macro_directive(as, stmt, &lexer, &parser);
+            statement_free(stmt);
+            free(source_line);
+            continue;
+        }
+
+        /* Check for loop directive - process immediately */
+        if (is_loop_directive(stmt)) {
+            process_loop_directive(as, stmt, &lexer, &parser);
+            statement_free(stmt);
+            free(source_line);
+            continue;
+        }
+
+        /* Check for macro invocation */
+        if (stmt->type == STMT_MACRO_CALL) {
+            MacroCallInfo *call = &stmt->data.macro_call;
+            macro_expand(as, call->name, call->args, call->arg_count);
+            statement_free(stmt);
+            free(source_line);
+            continue;
+        }
+
+        /* Check for a call to replace with an !inline routine body */
+        if (inline_call(as, stmt, source_line)) {
+            free(source_line);
+            continue;
+        }
+
+        /* Store for pass 2 - transfers ownership of source_line */
+        int line_idx = add_assembled_line(as, stmt, line_pc, source_line);
+        free(source_line);  /* add_assembled_line makes a copy */
+        if (line_idx < 0) {
+            return -1;
+        }
+
+        /* Assemble statement (for size determination) */
+        pass1_line(as, line_idx);
+
+        /* Check for EOF */
+        if (stmt->type == STMT_EMPTY && *lexer.current == '\0') {
+            break;
+        }
+
+        /* Stop on too many errors */
+        if (as->errors >= ASM_MAX_ERRORS) {
+            assembler_error(as, "too many errors, stopping");
+            break;
+        }
+    }
+
+    /* Check for unclosed conditionals */
+    if (as->cond_depth > 0) {
+        CondEntry *entry = &as->cond_stack[as->cond_depth - 1];
+        assembler_error(as, "unterminated !if (started at %s:%d)",
+                       entry->filename ? entry->filename : "<input>",
+                       entry->line_number);
+    }
+
+    /* A routine must end in the file it starts in */
+    if (as->inline_open && !inline_open) {
+        assembler_error(as, "!inline routine '%s' has no RTS", as->inline_open->name);
+        inline_routine_drop(as);
+    }
+
+    /* So must a string pool region */
+    if (as->strpool_open && !strpool_open) {
+        assembler_error(as, "unterminated !strpool (started at %s:%d)",
+                        as->strpool_open->filename ? as->strpool_open->filename : "<input>",
+                        as->strpool_open->line_number);
+        as->strpool_open = NULL;
+    }
+    if (as->rodata_open && !rodata_open) {
+        assembler_error(as, "unterminated !rodata (started at %s:%d)",
+                        as->rodata_open->filename ? as->rodata_open->filename : "<input>",
+                        as->rodata_open->line_number);
+        as->rodata_open = NULL;
+    }
+    if (as->balanced_open >= 0 && balanced_open < 0) {
+        BalancedBlock *block = &as->balanced[as->balanced_open];
+        assembler_error(as, "unterminated !balanced (started at %s:%d)",
+                        block->filename ? block->filename : "<input>", block->line_number);
+        as->balanced_open = -1;
+    }
+
+    return as->errors > 0 ? -1 : 0;
+}
+
+static int assembler_pass1_indexed(Assembler *as, const char *source,
+                                   const LineIndex *index, const char *filename) {
+    as->pc = as->org;
+    return assembler_pass1_internal(as, source, index, filename);
+}
+
+int assembler_pass1(Assembler *as, const char *source, const char *filename) {
+    LineIndex index;
+    if (line_index_init(&index) < 0 ||
+        line_index_scan(&index, source, 0, strlen(source)) < 0) {
+        line_index_free(&index);
+        assembler_error(as, "out of memory indexing source");
+        return -1;
+    }
+    int result = assembler_pass1_indexed(as, source, &index, filename);
+    line_index_free(&index);
+    return result;
+}
+
+/* ========== Pass 2 Implementation ========== */
+
+/*
+ * True if pass 1 already generated a line's final output: it was resolved
+ * then and every symbol it read still has the value it had. Assignments
+ * must also be their symbol's only definition, since replaying them is
+ * what restores the symbol's value for the lines that follow.
+ */
+static int pass2_can_skip(Assembler *as, AssembledLine *line) {
+    if (!as->reuse_pass1 || !line->resolved) return 0;
+    if (line->stmt->type == STMT_ASSIGNMENT &&
+        (!line->defines || line->defines->def_count != 1)) {
+        return 0;
+    }
+    for (int i = 0; i < line->read_count; i++) {
+        Symbol *sym = line->reads[i].symbol;
+        if (!(sym->flags & SYM_DEFINED) || sym->value != line->reads[i].value) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Generate code for one stored line. Returns -1 if a revisited line
+ * changed size, so the bytes kept from pass 1 can no longer be trusted.
+ */
+static int pass2_line(Assembler *as, AssembledLine *line) {
+    Statement *stmt = line->stmt;
+
+    as->current_line = stmt->line;
+    as->stored_line = line;
+    /* Restore PC to stored address for symbol resolution
+     * The real_pc tracks actual output position separately when in pseudopc */
+    as->pc = line->address;
+    uint16_t start_pc = output_pc(as);
+
+    /* Restore zone for local label resolution */
+    free(as->current_zone);
+    as->current_zone = line->zone ? str_dup(line->zone) : NULL;
+
+    /* Re-define labels for anonymous label tracking */
+    if (stmt->label) {
+        if (stmt->label->is_anon_fwd) {
+            anon_define_forward(as->anon_labels, as->pc, as->current_file, stmt->line);
+        } else if (stmt->label->is_anon_back) {
+            anon_define_backward(as->anon_labels, as->pc, as->current_file, stmt->line);
+        }
+    }
+
+    if (pass2_can_skip(as, line)) {
+        /* Keep the pass 1 bytes; just track zone and addresses */
+        if (stmt->label && !stmt->label->is_local &&
+            !stmt->label->is_anon_fwd && !stmt->label->is_anon_back) {
+            free(as->current_zone);
+            as->current_zone = str_dup(stmt->label->name);
+        }
+        as->pc = (uint16_t)(line->address + line->size);
+        as->real_pc = (uint16_t)(as->real_pc + line->size);
+        line->emitted = line->size;
+        as->pass2_skipped++;
+        return 0;
+    }
+    as->pass2_revisited++;
+
+    if (assembler_assemble_statement(as, stmt) < 0) {
+        /* Error already reported */
+    }
+
+    /* Capture generated bytes for listing */
+    capture_line_bytes(as, line, start_pc);
+    line->emitted = is_org_directive(stmt) ? 0 : (uint16_t)(output_pc(as) - start_pc);
+
+    /* Update cycle info from instruction */
+    if (stmt->type == STMT_INSTRUCTION) {
+        line->cycles = stmt->data.instruction.cycles;
+        line->page_penalty = stmt->data.instruction.page_penalty;
+    }
+
+    if (as->reuse_pass1 && !is_org_directive(stmt) &&
+        (uint16_t)(output_pc(as) - start_pc) != line->size) {
+        return -1;
+    }
+    return 0;
+}
+
+/* One contiguous run of lines generated by a worker thread */
+typedef struct {
+    Assembler *as;              /* Shared context (read-only during the run) */
+    int first;                  /* First line index */
+    int last;                   /* One past the last line index */
+    AnonLabels *anon;           /* Anonymous label state at chunk start */
+    DiagBuffer diag;            /* Diagnostics in source order */
+    int errors;
+    int warnings;
+    uint16_t lowest_addr;
+    uint16_t highest_addr;
+    /* State after the last line, checked against the next chunk's start */
+    uint16_t end_pc;
+    uint16_t end_real_pc;
+    int end_in_pseudopc;
+    char *end_zone;
+    CpuType end_cpu;
+    int revisited;
+    int skipped;
+    int resized;                /* A revisited line changed size */
+} Pass2Chunk;
+
+/*
+ * Count forward anonymous label references in an expression, or -1 if
+ * the count depends on a value (an if() branch that holds one).
+ */
+static int count_anon_fwd(const Expr *expr) {
+    if (!expr) return 0;
+    switch (expr->type) {
+        case EXPR_SYMBOL:
+            return strncmp(expr->data.symbol, "__anon_fwd_", 11) == 0;
+        case EXPR_UNARY:
+            return count_anon_fwd(expr->data.unary.operand);
+        case EXPR_BINARY: {
+            int left = count_anon_fwd(expr->data.binary.left);
+            int right = count_anon_fwd(expr->data.binary.right);
+            return left < 0 || right < 0 ? -1 : left + right;
+        }
+        case EXPR_CALL: {
+            /* if() evaluates only one of its branches */
+            int is_if = strcmp(expr->data.call.name, "if") == 0;
+            int uses = 0;
+            for (int i = 0; i < expr->data.call.arg_count; i++) {
+                int n = count_anon_fwd(expr->data.call.args[i]);
+                if (n < 0 || (is_if && i > 0 && n > 0)) return -1;
+                uses += n;
             }
-            statement_free(stmt);
-            free(source_line);
-            continue;
+            return uses;
         }
+        case EXPR_INDEX:
+            return count_anon_fwd(expr->data.index.index);
+        default:
+            return 0;
+    }
+}
 
-        /* Check for macro definition - process immediately */
-        if (is_macro_directive(stmt)) {
-            process_macro_directive(as, stmt, &lexer, &parser);
-            statement_free(stmt);
-            free(source_line);
-            continue;
-        }
+/* True if an expression references any anonymous label */
+static int has_anon_ref(const Expr *expr) {
+    if (!expr) return 0;
+    switch (expr->type) {
+        case EXPR_SYMBOL:
+            return strncmp(expr->data.symbol, "__anon_", 7) == 0;
+        case EXPR_UNARY:
+            return has_anon_ref(expr->data.unary.operand);
+        case EXPR_BINARY:
+            return has_anon_ref(expr->data.binary.left) ||
+                   has_anon_ref(expr->data.binary.right);
+        case EXPR_CALL:
+            for (int i = 0; i < expr->data.call.arg_count; i++) {
+                if (has_anon_ref(expr->data.call.args[i])) return 1;
+            }
+            return 0;
+        case EXPR_INDEX:
+            return has_anon_ref(expr->data.index.index);
+        default:
+            return 0;
+    }
+}
 
-        /* Check for loop directive - process immediately */
-        if (is_loop_directive(stmt)) {
-            process_loop_directive(as, stmt, &lexer, &parser);
-            statement_free(stmt);
-            free(source_line);
-            continue;
+/*
+ * Number of forward anonymous references pass 2 resolves for a statement,
+ * or -1 if the count cannot be known without running it.
+ */
+static int pass2_anon_fwd_uses(const Statement *stmt) {
+    switch (stmt->type) {
+        case STMT_INSTRUCTION: {
+            const InstructionInfo *info = &stmt->data.instruction;
+            if (info->mode == ADDR_ACCUMULATOR || info->mode == ADDR_IMPLIED) {
+                return 0;
+            }
+            int operand = count_anon_fwd(info->operand);
+            int target = count_anon_fwd(info->target);
+            return operand < 0 || target < 0 ? -1 : operand + target;
         }
-
-        /* Check for macro invocation */
-        if (stmt->type == STMT_MACRO_CALL) {
-            MacroCallInfo *call = &stmt->data.macro_call;
-            macro_expand(as, call->name, call->args, call->arg_count);
-            statement_free(stmt);
-            free(source_line);
-            continue;
+        case STMT_DIRECTIVE: {
+            const DirectiveInfo *dir = &stmt->data.directive;
+            int uses = 0;
+            for (int i = 0; i < dir->arg_count; i++) {
+                int n = count_anon_fwd(dir->args[i]);
+                if (n < 0) return -1;
+                uses += n;
+            }
+            if (uses > 0 && !evaluates_args_in_order(dir->name)) {
+                return -1;
+            }
+            return uses;
         }
+        case STMT_ASSIGNMENT:
+            return has_anon_ref(stmt->data.assignment.value) ? -1 : 0;
+        default:
+            return 0;
+    }
+}
 
-        /* Store for pass 2 - transfers ownership of source_line */
-        int line_idx = add_assembled_line(as, stmt, line_pc, source_line);
-        free(source_line);  /* add_assembled_line makes a copy */
-        if (line_idx < 0) {
-            return -1;
-        }
+/* Output bytes a line occupied in pass 1 (0 for origin changes) */
+static int pass1_line_size(Assembler *as, int index, uint16_t pass1_end) {
+    AssembledLine *line = &as->lines[index];
+    Statement *stmt = line->stmt;
+    if (stmt->type == STMT_DIRECTIVE && strcmp(stmt->data.directive.name, "org") == 0) {
+        return 0;
+    }
+    uint16_t next = (index + 1 < as->line_count) ?
+                    as->lines[index + 1].real_address : pass1_end;
+    return (uint16_t)(next - line->real_address);
+}
 
-        /* Assemble statement (for size determination) */
-        if (assembler_assemble_statement(as, stmt) < 0) {
-            /* Error already reported */
+/*
+ * Re-evaluate an assignment as pass 2 would, returning 1 if its value
+ * is unchanged from the end of pass 1 (so every chunk sees the same value).
+ */
+static int pass2_assignment_stable(Assembler *as, AssembledLine *line) {
+    AssignmentInfo *assign = &line->stmt->data.assignment;
+    if (line->stmt->label) return 0;
+
+    ExprResult result = expr_eval(assign->value, as->symbols, as->anon_labels,
+                                  line->address, 2, line->zone);
+    Symbol *sym = symbol_lookup(as->symbols, assign->name);
+    return result.defined && sym && (sym->flags & SYM_DEFINED) &&
+           sym->value == result.value;
+}
+
+/*
+ * Check that the stored lines can be split into the given chunks and
+ * record each chunk's anonymous label state. Returns 0 if safe.
+ */
+static int pass2_prepare_chunks(Assembler *as, Pass2Chunk *chunks, int chunk_count,
+                                uint16_t pass1_end) {
+    AnonLabels *sim = anon_clone(as->anon_labels);
+    uint16_t *owner = calloc(ASM_MEMORY_SIZE, sizeof(uint16_t));
+    int safe = (sim && owner);
+    int c = 0;
+
+    for (int i = 0; safe && i < as->line_count; i++) {
+        AssembledLine *line = &as->lines[i];
+        Statement *stmt = line->stmt;
+
+        if (c < chunk_count && i == chunks[c].first) {
+            chunks[c].anon = anon_clone(sim);
+            if (!chunks[c].anon) {
+                safe = 0;
+                break;
+            }
+            c++;
         }
 
-        /* Check for EOF */
-        if (stmt->type == STMT_EMPTY && *lexer.current == '\0') {
+        /* Symbols must not change value while chunks run */
+        if (stmt->type == STMT_ASSIGNMENT && !pass2_assignment_stable(as, line)) {
+            safe = 0;
             break;
         }
 
-        /* Stop on too many errors */
-        if (as->errors >= ASM_MAX_ERRORS) {
-            assembler_error(as, "too many errors, stopping");
+        /* Mirror the anonymous label updates pass2_line makes */
+        if (stmt->label && stmt->label->is_anon_fwd) {
+            anon_define_forward(sim, line->address, as->current_file, stmt->line);
+        } else if (stmt->label && stmt->label->is_anon_back) {
+            anon_define_backward(sim, line->address, as->current_file, stmt->line);
+        }
+        int uses = pass2_anon_fwd_uses(stmt);
+        if (uses < 0) {
+            safe = 0;
             break;
         }
-    }
+        for (int u = 0; u < uses; u++) {
+            anon_advance_forward(sim);
+        }
 
-    /* Check for unclosed conditionals */
-    if (as->cond_depth > 0) {
-        CondEntry *entry = &as->cond_stack[as->cond_depth - 1];
-        assembler_error(as, "unterminated !if (started at %s:%d)",
-                       entry->filename ? entry->filename : "<input>",
-                       entry->line_number);
+        /* Chunks write straight into shared memory, so no byte may be
+         * claimed by two different chunks */
+        int size = pass1_line_size(as, i, pass1_end);
+        for (int b = 0; b < size; b++) {
+            uint16_t addr = (uint16_t)(line->real_address + b);
+            if (owner[addr] && owner[addr] != c) {
+                safe = 0;
+                break;
+            }
+            owner[addr] = (uint16_t)c;
+        }
     }
 
-    return as->errors > 0 ? -1 : 0;
+    anon_free(sim);
+    free(owner);
+    return safe ? 0 : -1;
 }
 
-int assembler_pass1(Assembler *as, const char *source, const char *filename) {
-    as->pc = as->org;
-    return assembler_pass1_internal(as, source, filename);
+static void pass2_chunk_task(void *arg, int index) {
+    Pass2Chunk *chunk = &((Pass2Chunk *)arg)[index];
+    Assembler *as = chunk->as;
+
+    /* Private copy of the mutable per-line state */
+    Assembler worker = *as;
+    worker.anon_labels = chunk->anon;
+    worker.current_zone = NULL;
+    worker.errors = 0;
+    worker.warnings = 0;
+    worker.lowest_addr = 0xFFFF;
+    worker.highest_addr = 0;
+    worker.diag = &chunk->diag;
+    worker.pool = NULL;
+    worker.pass2_revisited = 0;
+    worker.pass2_skipped = 0;
+    worker.real_pc = as->lines[chunk->first].real_address;
+    worker.in_pseudopc = as->lines[chunk->first].in_pseudopc;
+    worker.cpu_type = as->lines[chunk->first].cpu;
+
+    for (int i = chunk->first; i < chunk->last; i++) {
+        /* Assignments were replayed before the chunks started */
+        if (as->lines[i].stmt->type == STMT_ASSIGNMENT) continue;
+
+        if (pass2_line(&worker, &as->lines[i]) < 0) {
+            chunk->resized = 1;
+            break;
+        }
+        if (worker.errors >= ASM_MAX_ERRORS) break;
+    }
+
+    chunk->errors = worker.errors;
+    chunk->warnings = worker.warnings;
+    chunk->lowest_addr = worker.lowest_addr;
+    chunk->highest_addr = worker.highest_addr;
+    chunk->end_pc = worker.pc;
+    chunk->end_real_pc = worker.real_pc;
+    chunk->end_in_pseudopc = worker.in_pseudopc;
+    chunk->end_zone = worker.current_zone;
+    chunk->end_cpu = worker.cpu_type;
+    chunk->revisited = worker.pass2_revisited;
+    chunk->skipped = worker.pass2_skipped;
 }
 
-/* ========== Pass 2 Implementation ========== */
+static void pass2_chunks_free(Pass2Chunk *chunks, int chunk_count) {
+    for (int c = 0; c < chunk_count; c++) {
+        anon_free(chunks[c].anon);
+        for (int d = 0; d < chunks[c].diag.count; d++) {
+            free(chunks[c].diag.items[d].text);
+        }
+        free(chunks[c].diag.items);
+        free(chunks[c].end_zone);
+    }
+    free(chunks);
+}
 
-int assembler_pass2(Assembler *as) {
+/* Put the context back to the start of pass 2 */
+static void pass2_begin(Assembler *as) {
     as->pass = 2;
     as->pc = as->org;
     as->real_pc = as->org;
     as->in_pseudopc = 0;
+    as->pass2_chunks = 0;
+    as->pass2_revisited = 0;
+    as->pass2_skipped = 0;
 
     /* Reset zone tracking for pass 2 */
     free(as->current_zone);
@@ -1883,55 +5089,217 @@ int assembler_pass2(Assembler *as) {
 
     /* Reset anonymous label tracking for pass 2 */
     anon_reset_pass(as->anon_labels);
+}
 
-    /* Re-process all stored statements */
+/* Forget everything generated so far, including bytes kept from pass 1 */
+static void pass2_discard_output(Assembler *as) {
+    memset(as->memory, 0, ASM_MEMORY_SIZE);
+    memset(as->written, 0, ASM_MEMORY_SIZE);
+    as->lowest_addr = 0xFFFF;
+    as->highest_addr = 0;
+    as->reuse_pass1 = 0;
+    as->pass2_revisited = 0;
+    as->pass2_skipped = 0;
+}
+
+/*
+ * Generate code on the thread pool. Returns 0 if pass 2 was completed,
+ * or -1 if the program must be generated serially instead (nothing has
+ * been emitted in that case).
+ */
+static int pass2_parallel(Assembler *as, uint16_t pass1_end) {
+    int chunk_count = as->threads * 4;
+    if (chunk_count > as->line_count / ASM_PASS2_MIN_CHUNK) {
+        chunk_count = as->line_count / ASM_PASS2_MIN_CHUNK;
+    }
+    if (chunk_count < 2) return -1;
+
+    Pass2Chunk *chunks = calloc(chunk_count, sizeof(Pass2Chunk));
+    if (!chunks) return -1;
+    for (int c = 0; c < chunk_count; c++) {
+        chunks[c].as = as;
+        chunks[c].first = (int)((long)as->line_count * c / chunk_count);
+        chunks[c].last = (int)((long)as->line_count * (c + 1) / chunk_count);
+    }
+
+    if (pass2_prepare_chunks(as, chunks, chunk_count, pass1_end) < 0) {
+        pass2_chunks_free(chunks, chunk_count);
+        return -1;
+    }
+
+    if (!as->pool) {
+        as->pool = threadpool_create(as->threads);
+    }
+
+    /* Replay assignments up front; their values were checked to be unchanged */
     for (int i = 0; i < as->line_count; i++) {
         AssembledLine *line = &as->lines[i];
-        Statement *stmt = line->stmt;
-
-        as->current_line = stmt->line;
-        /* Restore PC to stored address for symbol resolution
-         * The real_pc tracks actual output position separately when in pseudopc */
+        if (line->stmt->type != STMT_ASSIGNMENT) continue;
+        if (pass2_can_skip(as, line)) {
+            as->pass2_skipped++;
+            continue;
+        }
+        as->pass2_revisited++;
         as->pc = line->address;
-        uint16_t start_pc = as->in_pseudopc ? as->real_pc : as->pc;
-
-        /* Restore zone for local label resolution */
+        as->current_line = line->stmt->line;
         free(as->current_zone);
         as->current_zone = line->zone ? str_dup(line->zone) : NULL;
+        assembler_assemble_statement(as, line->stmt);
+    }
+
+    threadpool_run(as->pool, pass2_chunk_task, chunks, chunk_count);
+
+    /* Each chunk must end in the state the next one assumed. This fails
+     * only if a line's pass 2 size differs from pass 1; regenerate
+     * serially in that case so output still matches serial mode. */
+    for (int c = 0; c < chunk_count; c++) {
+        AssembledLine *next = (c + 1 < chunk_count) ? &as->lines[chunks[c + 1].first] : NULL;
+        if (chunks[c].resized ||
+            (next && (chunks[c].end_in_pseudopc != next->in_pseudopc ||
+                      chunks[c].end_cpu != next->cpu ||
+                      (next->in_pseudopc && chunks[c].end_real_pc != next->real_address)))) {
+            pass2_chunks_free(chunks, chunk_count);
+            pass2_discard_output(as);
+            return -1;
+        }
+    }
 
-        /* Re-define labels for anonymous label tracking */
-        if (stmt->label) {
-            if (stmt->label->is_anon_fwd) {
-                anon_define_forward(as->anon_labels, as->pc, as->current_file, stmt->line);
-            } else if (stmt->label->is_anon_back) {
-                anon_define_backward(as->anon_labels, as->pc, as->current_file, stmt->line);
+    /* Merge results and replay diagnostics in source order */
+    for (int c = 0; c < chunk_count; c++) {
+        Pass2Chunk *chunk = &chunks[c];
+        as->pass2_revisited += chunk->revisited;
+        as->pass2_skipped += chunk->skipped;
+        if (chunk->lowest_addr < as->lowest_addr) as->lowest_addr = chunk->lowest_addr;
+        if (chunk->highest_addr > as->highest_addr) as->highest_addr = chunk->highest_addr;
+
+        for (int d = 0; d < chunk->diag.count; d++) {
+            Diagnostic *diag = &chunk->diag.items[d];
+            if (diag->is_error && as->errors < ASM_MAX_ERRORS) {
+                fprintf(stderr, "%s\n", diag->text);
+                as->errors++;
+            } else if (!diag->is_error && as->warnings < ASM_MAX_WARNINGS) {
+                fprintf(stderr, "%s\n", diag->text);
+                as->warnings++;
             }
         }
+    }
+
+    /* Leave the context as serial pass 2 would */
+    Pass2Chunk *tail = &chunks[chunk_count - 1];
+    as->pc = tail->end_pc;
+    as->real_pc = tail->end_real_pc;
+    as->in_pseudopc = tail->end_in_pseudopc;
+    as->cpu_type = tail->end_cpu;
+    free(as->current_zone);
+    as->current_zone = tail->end_zone;
+    tail->end_zone = NULL;
+    anon_free(as->anon_labels);
+    as->anon_labels = tail->anon;
+    tail->anon = NULL;
+    as->pass2_chunks = chunk_count;
+
+    pass2_chunks_free(chunks, chunk_count);
+    return 0;
+}
+
+void assembler_set_image_cache(Assembler *as, const char *dir) {
+    free(as->image_cache_dir);
+    as->image_cache_dir = dir ? str_dup(dir) : NULL;
+}
+
+void assembler_set_run_cache(Assembler *as, const char *dir) {
+    free(as->run_cache_dir);
+    as->run_cache_dir = dir ? str_dup(dir) : NULL;
+}
 
-        if (assembler_assemble_statement(as, stmt) < 0) {
-            /* Error already reported */
+void assembler_set_threads(Assembler *as, int threads) {
+    if (threads <= 0) {
+        threads = threadpool_cpu_count();
+    }
+    if (threads > ASM_MAX_THREADS) {
+        threads = ASM_MAX_THREADS;
+    }
+    if (threads != as->threads) {
+        threadpool_free(as->pool);
+        as->pool = NULL;
+    }
+    as->threads = threads;
+}
+
+/* State an incremental pass 2 may have to roll back to */
+typedef struct {
+    int errors;
+    int warnings;
+    CpuType cpu_type;
+    int32_t *values;            /* Value of each assignment line's symbol */
+    uint8_t *flags;
+} Pass2Snapshot;
+
+static void pass2_snapshot(Assembler *as, Pass2Snapshot *snap) {
+    snap->errors = as->errors;
+    snap->warnings = as->warnings;
+    snap->cpu_type = as->cpu_type;
+    snap->values = malloc(as->line_count * sizeof(int32_t) + 1);
+    snap->flags = malloc(as->line_count + 1);
+    if (!snap->values || !snap->flags) {
+        free(snap->values);
+        free(snap->flags);
+        snap->values = NULL;
+        snap->flags = NULL;
+        return;
+    }
+    for (int i = 0; i < as->line_count; i++) {
+        Symbol *sym = as->lines[i].defines;
+        snap->values[i] = sym ? sym->value : 0;
+        snap->flags[i] = sym ? sym->flags : 0;
+    }
+}
+
+static void pass2_restore(Assembler *as, Pass2Snapshot *snap) {
+    as->errors = snap->errors;
+    as->warnings = snap->warnings;
+    as->cpu_type = snap->cpu_type;
+    for (int i = 0; i < as->line_count; i++) {
+        Symbol *sym = as->lines[i].defines;
+        if (sym && as->lines[i].stmt->type == STMT_ASSIGNMENT) {
+            sym->value = snap->values[i];
+            sym->flags = snap->flags[i];
         }
+    }
+}
 
-        /* Capture generated bytes for listing */
-        uint16_t end_pc = as->in_pseudopc ? as->real_pc : as->pc;
-        int byte_count = end_pc - start_pc;
-        if (byte_count > 0 && byte_count <= 8) {
-            line->byte_count = byte_count;
-            for (int j = 0; j < byte_count; j++) {
-                line->bytes[j] = as->memory[start_pc + j];
-            }
-        } else if (byte_count > 8) {
-            /* For long data, just show first 8 bytes */
-            line->byte_count = 8;
-            for (int j = 0; j < 8; j++) {
-                line->bytes[j] = as->memory[start_pc + j];
-            }
+int assembler_pass2(Assembler *as) {
+    uint16_t pass1_end = as->real_pc;
+
+    pass2_begin(as);
+
+    if (as->threads > 1 && pass2_parallel(as, pass1_end) == 0) {
+        return as->errors > 0 ? -1 : 0;
+    }
+
+    /* Diagnostics are held back while pass 1 output is reused, in case
+     * a resized line forces everything to be generated again */
+    Pass2Snapshot snap = { 0, 0, CPU_6510, NULL, NULL };
+    DiagBuffer diag = { NULL, 0, 0 };
+    if (as->reuse_pass1) {
+        pass2_snapshot(as, &snap);
+        if (!snap.values) {
+            pass2_discard_output(as);
+        } else {
+            as->diag = &diag;
         }
+    }
 
-        /* Update cycle info from instruction */
-        if (stmt->type == STMT_INSTRUCTION) {
-            line->cycles = stmt->data.instruction.cycles;
-            line->page_penalty = stmt->data.instruction.page_penalty;
+    /* Re-process all stored statements */
+    for (int i = 0; i < as->line_count; i++) {
+        if (pass2_line(as, &as->lines[i]) < 0) {
+            diag_discard(&diag);
+            as->diag = NULL;
+            pass2_restore(as, &snap);
+            pass2_discard_output(as);
+            pass2_begin(as);
+            i = -1;
+            continue;
         }
 
         if (as->errors >= ASM_MAX_ERRORS) {
@@ -1939,19 +5307,58 @@ int assembler_pass2(Assembler *as) {
         }
     }
 
+    if (as->diag == &diag) {
+        as->diag = NULL;
+        diag_replay(as, &diag);
+    }
+    free(snap.values);
+    free(snap.flags);
+
     return as->errors > 0 ? -1 : 0;
 }
 
 /* ========== Main Assembly Function ========== */
 
-int assembler_assemble_string(Assembler *as, const char *source, const char *filename) {
+static int assemble_passes(Assembler *as, const char *source,
+                           const LineIndex *index, const char *filename) {
     assembler_reset(as);
+    inline_routines_free(as);
+    CpuType start_cpu = as->cpu_type;
 
     /* Pass 1: Symbol collection and size determination */
     if (as->verbose) {
         fprintf(stderr, "Pass 1: Parsing and symbol collection...\n");
     }
-    if (assembler_pass1(as, source, filename) < 0) {
+    DiagBuffer diag = { NULL, 0, 0 };
+    DiagBuffer *outer = as->diag;
+    as->diag = &diag;
+    int pass1 = assembler_pass1_indexed(as, source, index, filename);
+
+    /* Calls met before their !inline routine, or !balanced padding that
+     * moved the code after it: run pass 1 again with what this run found */
+    int inline_again = as->inline_forward && as->inline_count > 0;
+    for (int again = 0; (inline_again || as->balance_changed) && as->errors == 0; again++) {
+        if (again == ASM_BALANCE_PASSES) {
+            assembler_error(as, "!balanced padding did not settle after %d passes", again + 1);
+            pass1 = -1;
+            break;
+        }
+        diag_discard(&diag);
+        assembler_reset(as);
+        as->cpu_type = start_cpu;
+        if (as->verbose) {
+            fprintf(stderr, inline_again ?
+                    "Pass 1: Again for calls to !inline routines defined later...\n" :
+                    "Pass 1: Again for !balanced padding...\n");
+        }
+        inline_again = 0;
+        pass1 = assembler_pass1_indexed(as, source, index, filename);
+    }
+    as->diag = outer;
+    diag_replay(as, &diag);
+    inline_report_missed(as);
+
+    if (pass1 < 0) {
         if (as->verbose) {
             fprintf(stderr, "Pass 1 completed with %d error(s)\n", as->errors);
         }
@@ -1968,6 +5375,8 @@ int assembler_assemble_string(Assembler *as, const char *source, const char *fil
     if (as->verbose) {
         fprintf(stderr, "Pass 2: Code generation...\n");
     }
+    /* !cpu is replayed from the start, so sizes that depend on it match */
+    as->cpu_type = start_cpu;
     if (assembler_pass2(as) < 0) {
         if (as->verbose) {
             fprintf(stderr, "Pass 2 completed with %d error(s)\n", as->errors);
@@ -1978,214 +5387,176 @@ int assembler_assemble_string(Assembler *as, const char *source, const char *fil
         fprintf(stderr, "Pass 2: Generated %d bytes ($%04X-$%04X)\n",
                 code_size, as->lowest_addr, as->highest_addr);
     }
-
-    return as->errors;
-}
-
-int assembler_assemble_file(Assembler *as, const char *filename) {
-    FILE *f = fopen(filename, "r");
-    if (!f) {
-        assembler_error(as, "cannot open file: %s", filename);
-        return -1;
+    if (as->verbose && as->incremental) {
+        fprintf(stderr, "Pass 2: %d line(s) revisited, %d reused from pass 1\n",
+                as->pass2_revisited, as->pass2_skipped);
     }
 
-    /* Get file size */
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    /* Read entire file */
-    char *source = malloc(size + 1);
-    if (!source) {
-        fclose(f);
-        assembler_error(as, "out of memory reading file");
-        return -1;
+    if (as->errors == 0) {
+        execute_runs(as);
     }
 
-    size_t read = fread(source, 1, size, f);
-    fclose(f);
-    source[read] = '\0';
-
-    int result = assembler_assemble_string(as, source, filename);
-
-    free(source);
-    return result;
+    return as->errors;
 }
 
-/* ========== Output Functions ========== */
-
-const uint8_t *assembler_get_output(Assembler *as, uint16_t *start_addr, int *size) {
-    if (as->lowest_addr > as->highest_addr) {
-        /* No output */
-        *start_addr = as->org;
-        *size = 0;
-        return as->memory;
-    }
+/*
+ * Assemble with the optimizer's planned changes until every change the
+ * assembly made still holds against the code it produced: a change can
+ * move what comes after it and so a label an immediate or a branch
+ * reads. If the changed program does not assemble, fall back to the
+ * program as written.
+ */
+static int assemble_optimized(Assembler *as, const char *source,
+                              const LineIndex *index, const char *filename) {
+    DiagBuffer diag = { NULL, 0, 0 };
+    DiagBuffer *outer = as->diag;
+    int errors = 0;
 
-    *start_addr = as->lowest_addr;
-    *size = as->highest_addr - as->lowest_addr + 1;
-    return &as->memory[as->lowest_addr];
+    for (int round = 0; round < OPT_MAX_ROUNDS && as->opt_edit_count > 0; round++) {
+        if (as->verbose) {
+            fprintf(stderr, "Reassembling with %d optimizer change(s)...\n", as->opt_edit_count);
+        }
+        as->diag = &diag;
+        errors = assemble_passes(as, source, index, filename);
+        as->diag = outer;
+        if (errors > 0) break;
+        diag_discard(&diag);
+        if (optimize_verify(as) == 0) return 0;
+    }
+    const char *why = errors > 0 ? "the changed program does not assemble" :
+                      as->opt_edit_count > 0 ? "they did not settle" : NULL;
+
+    /* Assemble the program as written */
+    diag_discard(&diag);
+    as->opt_edit_count = 0;
+    as->diag = &diag;
+    errors = assemble_passes(as, source, index, filename);
+    as->diag = outer;
+    if (errors > 0) {
+        diag_replay(as, &diag);
+        return errors;
+    }
+    diag_discard(&diag);
+    if (why) assembler_warning(as, "optimizer changes dropped: %s", why);
+    return 0;
 }
 
-int assembler_write_output(Assembler *as, const char *filename) {
-    if (as->lowest_addr > as->highest_addr) {
-        assembler_warning(as, "no output generated");
-        return 0;
+static int assemble_indexed(Assembler *as, const char *source,
+                            const LineIndex *index, const char *filename) {
+    as->opt_edit_count = 0;
+    if (as->profile) {
+        free(as->layout_pads);
+        as->layout_pads = NULL;
+        as->layout_pad_count = 0;
     }
+    int errors = assemble_passes(as, source, index, filename);
 
-    FILE *f = fopen(filename, "wb");
-    if (!f) {
-        assembler_error(as, "cannot create output file: %s", filename);
-        return -1;
+    /* Lay out !pgo_pad against the profile, then assemble with that padding */
+    if (errors == 0 && as->profile && pgo_plan_layout(as) > 0) {
+        if (as->verbose) {
+            fprintf(stderr, "Reassembling with profile-guided padding...\n");
+        }
+        errors = assemble_passes(as, source, index, filename);
     }
 
-    /* Write load address header for PRG format */
-    if (as->format == OUTPUT_PRG) {
-        uint8_t header[2];
-        header[0] = as->lowest_addr & 0xFF;
-        header[1] = (as->lowest_addr >> 8) & 0xFF;
-        fwrite(header, 1, 2, f);
+    /* Make the optimizer's changes, then assemble with them */
+    if (errors == 0 && as->optimize && optimize_plan(as) > 0) {
+        errors = assemble_optimized(as, source, index, filename);
     }
-
-    /* Write code */
-    int size = as->highest_addr - as->lowest_addr + 1;
-    fwrite(&as->memory[as->lowest_addr], 1, size, f);
-
-    fclose(f);
-    return 0;
+    return errors;
 }
 
-int assembler_write_symbols(Assembler *as, const char *filename) {
-    FILE *fp = fopen(filename, "w");
-    if (!fp) {
-        assembler_error(as, "cannot create symbol file: %s", filename);
+int assembler_assemble_string(Assembler *as, const char *source, const char *filename) {
+    LineIndex index;
+    if (line_index_init(&index) < 0 ||
+        line_index_scan(&index, source, 0, strlen(source)) < 0) {
+        line_index_free(&index);
+        assembler_error(as, "out of memory indexing source");
         return -1;
     }
-    int result = symbol_write_vice(as->symbols, fp);
-    fclose(fp);
+    int result = assemble_indexed(as, source, &index, filename);
+    line_index_free(&index);
     return result;
 }
 
-int assembler_write_listing(Assembler *as, const char *filename) {
-    FILE *fp = fopen(filename, "w");
-    if (!fp) {
-        assembler_error(as, "cannot create listing file: %s", filename);
-        return -1;
-    }
+int assembler_assemble_stream(Assembler *as, FILE *fp, const char *filename) {
+    size_t capacity = 65536;
+    size_t length = 0;
+    char *source = malloc(capacity);
+    LineIndex index;
 
-    /* Write header */
-    fprintf(fp, "; ASM64 Listing File\n");
-    fprintf(fp, "; Generated from assembled source\n");
-    fprintf(fp, ";\n");
-    if (as->show_cycles) {
-        fprintf(fp, "; Address  Bytes         Cycles  Source\n");
-        fprintf(fp, "; -------  ----------    ------  ------\n");
-    } else {
-        fprintf(fp, "; Address  Bytes         Source\n");
-        fprintf(fp, "; -------  ----------    ------\n");
+    if (!source || line_index_init(&index) < 0) {
+        free(source);
+        assembler_error(as, "out of memory reading %s", filename);
+        return -1;
     }
-    fprintf(fp, "\n");
-
-    /* Write each assembled line */
-    for (int i = 0; i < as->line_count; i++) {
-        AssembledLine *line = &as->lines[i];
-        Statement *stmt = line->stmt;
-
-        /* Skip empty statements without source */
-        if (stmt && stmt->type == STMT_EMPTY && !line->source_text) {
-            continue;
-        }
-
-        /* Check if this is an ORG directive (doesn't generate bytes) */
-        int is_org = 0;
-        if (line->source_text && line->source_text[0] == '*' &&
-            strchr(line->source_text, '=')) {
-            is_org = 1;
-        }
-
-        /* Format address - show new address for ORG, otherwise current address */
-        if (line->byte_count > 0 && !is_org) {
-            fprintf(fp, "%04X  ", line->address);
-        } else if (stmt && stmt->type == STMT_LABEL) {
-            fprintf(fp, "%04X  ", line->address);
-        } else if (stmt && stmt->type == STMT_DIRECTIVE) {
-            /* Don't show address for assignments and some directives */
-            const char *name = stmt->data.directive.name;
-            if (strcmp(name, "=") != 0) {
-                fprintf(fp, "      ");
-            } else {
-                fprintf(fp, "      ");
-            }
-        } else {
-            fprintf(fp, "      ");
-        }
 
-        /* Format hex bytes (up to 4 bytes on the line, more if needed) */
-        /* Skip bytes display for ORG directives */
-        char hex_buf[32] = "";
-        int hex_len = 0;
-        if (!is_org) {
-            int bytes_shown = line->byte_count > 4 ? 4 : line->byte_count;
-            for (int j = 0; j < bytes_shown; j++) {
-                hex_len += snprintf(hex_buf + hex_len, sizeof(hex_buf) - hex_len,
-                                   "%02X ", line->bytes[j]);
+    /* Read in chunks, indexing each chunk's line starts as it arrives */
+    while (1) {
+        if (capacity - length < 4096) {
+            char *grown = realloc(source, capacity * 2);
+            if (!grown) {
+                free(source);
+                line_index_free(&index);
+                assembler_error(as, "out of memory reading %s", filename);
+                return -1;
             }
+            source = grown;
+            capacity *= 2;
         }
-        /* Pad to fixed width */
-        fprintf(fp, "%-12s", hex_buf);
 
-        /* Format cycle count if enabled */
-        if (as->show_cycles) {
-            if (line->cycles > 0) {
-                if (line->page_penalty) {
-                    fprintf(fp, "  %2d+   ", line->cycles);
-                } else {
-                    fprintf(fp, "  %2d    ", line->cycles);
-                }
-            } else {
-                fprintf(fp, "        ");
-            }
+        size_t n = fread(source + length, 1, capacity - length - 1, fp);
+        if (n == 0) break;
+        if (line_index_scan(&index, source, length, length + n) < 0) {
+            free(source);
+            line_index_free(&index);
+            assembler_error(as, "out of memory reading %s", filename);
+            return -1;
         }
+        length += n;
+    }
 
-        /* Source text */
-        if (line->source_text) {
-            fprintf(fp, "  %s", line->source_text);
-        } else if (stmt && stmt->type == STMT_INSTRUCTION) {
-            /* Generate instruction text if source not available */
-            fprintf(fp, "  %s", stmt->data.instruction.mnemonic);
-        }
+    if (ferror(fp)) {
+        free(source);
+        line_index_free(&index);
+        assembler_error(as, "cannot read file: %s", filename);
+        return -1;
+    }
+    source[length] = '\0';
 
-        fprintf(fp, "\n");
+    int result = assemble_indexed(as, source, &index, filename);
 
-        /* If more than 4 bytes, continue on next lines (skip for ORG) */
-        if (line->byte_count > 4 && !is_org) {
-            int pos = 4;
-            while (pos < line->byte_count) {
-                fprintf(fp, "%04X  ", line->address + pos);
-                hex_buf[0] = '\0';
-                hex_len = 0;
-                int count = (line->byte_count - pos) > 4 ? 4 : (line->byte_count - pos);
-                for (int j = 0; j < count; j++) {
-                    hex_len += snprintf(hex_buf + hex_len, sizeof(hex_buf) - hex_len,
-                                       "%02X ", line->bytes[pos + j]);
-                }
-                fprintf(fp, "%-12s", hex_buf);
-                if (as->show_cycles) {
-                    fprintf(fp, "        ");
-                }
-                fprintf(fp, "\n");
-                pos += count;
-            }
-        }
+    free(source);
+    line_index_free(&index);
+    return result;
+}
+
+int assembler_assemble_file(Assembler *as, const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        assembler_error(as, "cannot open file: %s", filename);
+        return -1;
     }
 
-    /* Write symbol table summary */
-    fprintf(fp, "\n; Symbol Table\n");
-    fprintf(fp, "; ------------\n");
-    symbol_write_vice(as->symbols, fp);
+    int result = assembler_assemble_stream(as, f, filename);
 
-    fclose(fp);
-    return 0;
+    fclose(f);
+    return result;
+}
+
+/* ========== Output Functions ========== */
+
+const uint8_t *assembler_get_output(Assembler *as, uint16_t *start_addr, int *size) {
+    if (as->lowest_addr > as->highest_addr) {
+        /* No output */
+        *start_addr = as->org;
+        *size = 0;
+        return as->memory;
+    }
+
+    *start_addr = as->lowest_addr;
+    *size = as->highest_addr - as->lowest_addr + 1;
+    return &as->memory[as->lowest_addr];
 }
 
 /* ========== Include Path Functions ========== */
@@ -2390,8 +5761,8 @@ char *assembler_get_include_trace(Assembler *as) {
     return trace;
 }
 
-int assembler_include_binary(Assembler *as, const char *filename,
-                             int offset, int length) {
+int assembler_include_binary(Assembler *as, const char *filename, int offset, int length,
+                             const BinaryTransform *transforms, int transform_count) {
     char *path = assembler_find_include(as, filename);
     if (!path) {
         assembler_error(as, "cannot find binary file: %s", filename);
@@ -2445,11 +5816,21 @@ int assembler_include_binary(Assembler *as, const char *filename,
     fclose(f);
     free(path);
 
+    int size = (int)actual;
+    for (int i = 0; i < transform_count; i++) {
+        const char *error;
+        if (transform_apply(&transforms[i], &buffer, &size, &error) < 0) {
+            assembler_error(as, "!binary transform %s: %s", transform_name(transforms[i].kind), error);
+            free(buffer);
+            return -1;
+        }
+    }
+
     /* Emit bytes */
     if (as->pass == 2) {
-        assembler_emit_bytes(as, buffer, actual);
+        assembler_emit_bytes(as, buffer, size);
     } else {
-        assembler_advance_pc(as, actual);
+        assembler_advance_pc(as, size);
     }
 
     free(buffer);
@@ -2757,15 +6138,18 @@ int macro_expand(Assembler *as, const char *name, char **args, int arg_count) {
     int saved_line = as->current_line;
     char *saved_zone = as->current_zone;
 
+    /* Create a pseudo-filename for error messages */
+    char macro_name[256];
+    snprintf(macro_name, sizeof(macro_name), "<%s>", name);
+    const char *macro_file = intern_file_name(as, macro_name);
+    if (!macro_file) macro_file = "<macro>";
+    const char *saved_frames = expansion_enter(as, macro_file);
+
     /* Create unique zone for this macro expansion */
     char macro_zone[64];
     snprintf(macro_zone, sizeof(macro_zone), "_macro_%d", exp->unique_id);
     as->current_zone = strdup(macro_zone);
 
-    /* Create a pseudo-filename for error messages */
-    char macro_file[256];
-    snprintf(macro_file, sizeof(macro_file), "<%s>", name);
-
     Lexer lexer;
     Parser parser;
     lexer_init(&lexer, expanded, macro_file);
@@ -2775,6 +6159,7 @@ int macro_expand(Assembler *as, const char *name, char **args, int arg_count) {
 
     /* Parse and assemble each line */
     while (*lexer.current) {
+        parser_set_cpu(&parser, as->cpu_type);
         Statement *stmt = parser_parse_line(&parser);
         if (!stmt) break;
 
@@ -2810,11 +6195,16 @@ int macro_expand(Assembler *as, const char *name, char **args, int arg_count) {
         /* Handle statement (label definitions, instructions, etc.) */
         if (as->pass == 1) {
             /* Store for pass 2 - macro source not captured for listings */
-            add_assembled_line(as, stmt, as->pc, NULL);
+            if (!inline_call(as, stmt, NULL)) {
+                int line_idx = add_assembled_line(as, stmt, as->pc, NULL);
+                if (line_idx >= 0) {
+                    pass1_line(as, line_idx);
+                }
+            }
+        } else {
+            assembler_assemble_statement(as, stmt);
         }
 
-        assembler_assemble_statement(as, stmt);
-
         if (as->pass == 2) {
             statement_free(stmt);
         }
@@ -2829,6 +6219,7 @@ int macro_expand(Assembler *as, const char *name, char **args, int arg_count) {
     as->current_line = saved_line;
     free(as->current_zone);
     as->current_zone = saved_zone;
+    expansion_leave(as, saved_frames);
 
     /* Pop expansion context */
     as->macro_depth--;
@@ -2850,6 +6241,425 @@ int assembler_macro_unique_id(Assembler *as) {
     return as->macro_stack[as->macro_depth - 1]->unique_id;
 }
 
+/* ========== Inline Subroutines ========== */
+
+InlineRoutine *inline_lookup(Assembler *as, const char *name) {
+    for (int i = 0; i < as->inline_count; i++) {
+        if (strcasecmp(as->inlines[i].name, name) == 0) {
+            return &as->inlines[i];
+        }
+    }
+    return NULL;
+}
+
+/* Start collecting the body of the routine labelled name */
+static int inline_begin(Assembler *as, const char *name) {
+    /* Pass 1 runs again when calls precede their routine */
+    InlineRoutine *routine = inline_lookup(as, name);
+    if (routine) {
+        routine->body_length = 0;
+        if (routine->body) routine->body[0] = '\0';
+        routine->filename = as->current_file;
+        routine->line_number = as->current_line;
+        routine->address = as->pc;
+        routine->size = -1;
+        as->inline_open = routine;
+        return 0;
+    }
+
+    if (as->inline_count >= as->inline_capacity) {
+        int new_capacity = as->inline_capacity ? as->inline_capacity * 2 : 16;
+        InlineRoutine *new_inlines = realloc(as->inlines, new_capacity * sizeof(InlineRoutine));
+        if (!new_inlines) {
+            assembler_error(as, "out of memory");
+            return -1;
+        }
+        as->inlines = new_inlines;
+        as->inline_capacity = new_capacity;
+    }
+
+    routine = &as->inlines[as->inline_count];
+    memset(routine, 0, sizeof(InlineRoutine));
+    routine->name = str_dup(name);
+    routine->filename = as->current_file;
+    routine->line_number = as->current_line;
+    routine->address = as->pc;
+    routine->size = -1;
+    if (!routine->name) {
+        assembler_error(as, "out of memory");
+        return -1;
+    }
+
+    as->inline_count++;
+    as->inline_open = routine;
+    return 0;
+}
+
+/* Stop collecting after an error; calls to the routine stay JSRs */
+static void inline_routine_drop(Assembler *as) {
+    as->inline_open->size = -1;
+    as->inline_open = NULL;
+}
+
+static void inline_calls_free(Assembler *as) {
+    free(as->inline_calls);
+    as->inline_calls = NULL;
+    as->inline_call_count = 0;
+    as->inline_call_capacity = 0;
+}
+
+static void inline_routines_free(Assembler *as) {
+    for (int i = 0; i < as->inline_count; i++) {
+        free(as->inlines[i].name);
+        free(as->inlines[i].body);
+    }
+    free(as->inlines);
+    as->inlines = NULL;
+    as->inline_count = 0;
+    as->inline_capacity = 0;
+    as->inline_open = NULL;
+    inline_calls_free(as);
+}
+
+/* Append text and a newline to a routine body */
+static int inline_append(InlineRoutine *routine, const char *text) {
+    size_t len = strlen(text);
+    while (routine->body_length + len + 2 > routine->body_capacity) {
+        size_t new_capacity = routine->body_capacity ? routine->body_capacity * 2 : 256;
+        char *new_body = realloc(routine->body, new_capacity);
+        if (!new_body) return -1;
+        routine->body = new_body;
+        routine->body_capacity = new_capacity;
+    }
+    memcpy(routine->body + routine->body_length, text, len);
+    routine->body_length += len;
+    routine->body[routine->body_length++] = '\n';
+    routine->body[routine->body_length] = '\0';
+    return 0;
+}
+
+/* Local labels a collected body defines, and the first one it uses
+ * without defining */
+typedef struct {
+    const char *zone;           /* Prefix of mangled local names */
+    char **defined;
+    int count;
+    int capacity;
+    char *missing;
+} InlineLabels;
+
+static void inline_label_use(const char *name, void *userdata) {
+    InlineLabels *labels = userdata;
+    size_t length = strlen(labels->zone);
+    if (labels->missing || strncmp(name, labels->zone, length) != 0 || name[length] != '.') {
+        return;
+    }
+    for (int i = 0; i < labels->count; i++) {
+        if (strcmp(labels->defined[i], name) == 0) return;
+    }
+    labels->missing = str_dup(name);
+}
+
+/*
+ * Check that every local label the body of the routine just collected
+ * refers to is inside it. A label past the first RTS is not copied, so
+ * each copy would fail with an undefined symbol. Returns 0, or -1 after
+ * reporting the first one missing.
+ */
+static int inline_check_body(Assembler *as, InlineRoutine *routine) {
+    InlineLabels labels = { as->current_zone ? as->current_zone : "_global", NULL, 0, 0, NULL };
+    int missing_line = 0;
+
+    for (int scan = 0; scan < 2 && !labels.missing; scan++) {
+        Lexer lexer;
+        Parser parser;
+        lexer_init(&lexer, routine->body, routine->filename);
+        parser_init(&parser, &lexer, as->symbols);
+        parser_set_pass(&parser, 1);
+
+        while (!labels.missing && (*lexer.current || parser.current.type != TOK_EOF)) {
+            parser_set_cpu(&parser, as->cpu_type);
+            Statement *stmt = parser_parse_line(&parser);
+            if (!stmt) break;
+            int done = stmt->type == STMT_EMPTY && parser.current.type == TOK_EOF;
+
+            if (scan == 0 && stmt->label && stmt->label->is_local) {
+                char *name = local_label_name(as, stmt->label->name);
+                if (labels.count >= labels.capacity) {
+                    int new_capacity = labels.capacity ? labels.capacity * 2 : 16;
+                    char **grown = realloc(labels.defined, new_capacity * sizeof(char *));
+                    if (grown) {
+                        labels.defined = grown;
+                        labels.capacity = new_capacity;
+                    }
+                }
+                if (name && labels.count < labels.capacity) {
+                    labels.defined[labels.count++] = name;
+                } else {
+                    free(name);
+                }
+            } else if (scan == 1) {
+                if (stmt->type == STMT_INSTRUCTION) {
+                    expr_visit_symbols(stmt->data.instruction.operand, as->current_zone,
+                                       inline_label_use, &labels);
+                    expr_visit_symbols(stmt->data.instruction.target, as->current_zone,
+                                       inline_label_use, &labels);
+                } else if (stmt->type == STMT_DIRECTIVE) {
+                    DirectiveInfo *dir = &stmt->data.directive;
+                    for (int i = 0; i < dir->arg_count; i++) {
+                        expr_visit_symbols(dir->args[i], as->current_zone,
+                                           inline_label_use, &labels);
+                    }
+                }
+                if (labels.missing) missing_line = stmt->line;
+            }
+            statement_free(stmt);
+            if (done) break;
+        }
+    }
+
+    int result = 0;
+    if (labels.missing) {
+        int saved_line = as->current_line;
+        as->current_line = routine->line_number + missing_line;
+        assembler_error(as, "'.%s' is not in !inline routine '%s', whose body ends at its first RTS",
+                        labels.missing + strlen(labels.zone) + 1, routine->name);
+        as->current_line = saved_line;
+        result = -1;
+    }
+    for (int i = 0; i < labels.count; i++) free(labels.defined[i]);
+    free(labels.defined);
+    free(labels.missing);
+    return result;
+}
+
+/*
+ * Add a pass 1 line to the routine being collected, up to its first RTS.
+ * Body line n is source line line_number + n, so blank lines keep copies
+ * reporting the routine's own line numbers.
+ */
+static void inline_collect(Assembler *as, Statement *stmt, const char *source_line) {
+    InlineRoutine *routine = as->inline_open;
+    LabelInfo *label = stmt->label;
+
+    if (is_source_directive(stmt) || is_macro_directive(stmt) || is_loop_directive(stmt) ||
+        (stmt->type == STMT_DIRECTIVE && strcmp(stmt->data.directive.name, "inline") == 0)) {
+        assembler_error(as, "!%s is not allowed in !inline routine '%s'",
+                        stmt->data.directive.name, routine->name);
+        inline_routine_drop(as);
+        return;
+    }
+    if (label && (label->is_anon_fwd || label->is_anon_back)) {
+        assembler_error(as, "anonymous label in !inline routine '%s' (use a local label)",
+                        routine->name);
+        inline_routine_drop(as);
+        return;
+    }
+    if (label && !label->is_local) {
+        assembler_error(as, "global label '%s' in !inline routine '%s' (use a local label)",
+                        label->name, routine->name);
+        inline_routine_drop(as);
+        return;
+    }
+    if (stmt->type == STMT_INSTRUCTION && stmt->data.instruction.operand_label) {
+        /* Code that patches the routine would miss every inlined copy */
+        assembler_error(as, "self-modifying operand in !inline routine '%s'", routine->name);
+        inline_routine_drop(as);
+        return;
+    }
+
+    int is_rts = stmt->type == STMT_INSTRUCTION &&
+                 strcasecmp(stmt->data.instruction.mnemonic, "RTS") == 0;
+    const char *text = is_rts ? (label ? label->name : NULL) : source_line;
+    if (text) {
+        int lines = 0;
+        for (size_t i = 0; i < routine->body_length; i++) {
+            if (routine->body[i] == '\n') lines++;
+        }
+        int failed = 0;
+        while (!failed && lines < stmt->line - routine->line_number - 1) {
+            failed = inline_append(routine, "") < 0;
+            lines++;
+        }
+        if (failed || inline_append(routine, text) < 0) {
+            assembler_error(as, "out of memory");
+            inline_routine_drop(as);
+            return;
+        }
+    }
+
+    if (is_rts) {
+        if (!routine->body) routine->body = str_dup("");
+        if (inline_check_body(as, routine) < 0) {
+            inline_routine_drop(as);
+            return;
+        }
+        routine->size = (uint16_t)(as->pc - routine->address);
+        as->inline_open = NULL;
+    }
+}
+
+/* Copy line n (1-based) of text, or NULL if it is empty */
+static char *inline_body_line(const char *text, int n) {
+    while (--n > 0 && *text) {
+        const char *eol = strchr(text, '\n');
+        if (!eol) return NULL;
+        text = eol + 1;
+    }
+    size_t len = strcspn(text, "\n");
+    if (len == 0) return NULL;
+    char *line = malloc(len + 1);
+    if (line) {
+        memcpy(line, text, len);
+        line[len] = '\0';
+    }
+    return line;
+}
+
+/* Warn about jsr+ calls that pass 1 left as JSRs */
+static void inline_report_missed(Assembler *as) {
+    for (int i = 0; i < as->line_count; i++) {
+        Statement *stmt = as->lines[i].stmt;
+        if (stmt->type != STMT_INSTRUCTION || !stmt->data.instruction.inline_call) continue;
+        /* A routine dropped after an error has been reported already */
+        const Expr *target = stmt->data.instruction.operand;
+        if (target && target->type == EXPR_SYMBOL && inline_lookup(as, target->data.symbol)) continue;
+        as->current_file = stmt->file;
+        as->current_line = stmt->line;
+        assembler_warning(as, "jsr+ target is not an !inline routine; assembling a normal JSR");
+    }
+}
+
+/* Assemble a copy of the routine body in place of the call in pass 1 */
+static void inline_expand(Assembler *as, InlineRoutine *routine, Statement *call,
+                          const char *source_line) {
+    /* The call keeps its label and listing line but generates nothing */
+    free(call->data.instruction.mnemonic);
+    expr_free(call->data.instruction.operand);
+    expr_free(call->data.instruction.target);
+    memset(&call->data, 0, sizeof(call->data));
+    call->type = call->label ? STMT_LABEL : STMT_EMPTY;
+
+    int call_idx = add_assembled_line(as, call, as->pc, source_line);
+    if (call_idx < 0) {
+        statement_free(call);
+        return;
+    }
+    pass1_line(as, call_idx);
+
+    uint16_t start = as->pc;
+    int call_line = call->line;
+    const char *saved_file = as->current_file;
+    int saved_line = as->current_line;
+    char *saved_zone = as->current_zone;
+    const char *saved_frames = expansion_enter(as, NULL);
+
+    /* Local labels get a zone of their own in every copy */
+    char zone[64];
+    snprintf(zone, sizeof(zone), "_inline_%d", ++as->macro_unique_counter);
+    as->current_zone = str_dup(zone);
+
+    Lexer lexer;
+    Parser parser;
+    lexer_init(&lexer, routine->body, routine->filename);
+    parser_init(&parser, &lexer, as->symbols);
+    parser_set_pc(&parser, as->pc);
+    parser_set_pass(&parser, as->pass);
+
+    while (*lexer.current || parser.current.type != TOK_EOF) {
+        parser_set_cpu(&parser, as->cpu_type);
+        Statement *stmt = parser_parse_line(&parser);
+        if (!stmt) break;
+
+        if (stmt->type == STMT_EMPTY && parser.current.type == TOK_EOF) {
+            statement_free(stmt);
+            break;
+        }
+        if (stmt->type == STMT_EMPTY && !stmt->label) {
+            statement_free(stmt);
+            continue;
+        }
+
+        int body_line = stmt->line;
+        stmt->line += routine->line_number;
+        as->current_file = routine->filename;
+        as->current_line = stmt->line;
+
+        if (stmt->type == STMT_MACRO_CALL) {
+            MacroCallInfo *macro_call = &stmt->data.macro_call;
+            macro_expand(as, macro_call->name, macro_call->args, macro_call->arg_count);
+            statement_free(stmt);
+            continue;
+        }
+
+        char *text = inline_body_line(routine->body, body_line);
+        if (!inline_call(as, stmt, text)) {
+            int line_idx = add_assembled_line(as, stmt, as->pc, text);
+            if (line_idx >= 0) {
+                pass1_line(as, line_idx);
+            }
+        }
+        free(text);
+
+        if (as->errors >= ASM_MAX_ERRORS) break;
+    }
+
+    as->current_file = saved_file;
+    as->current_line = saved_line;
+    free(as->current_zone);
+    as->current_zone = saved_zone;
+    expansion_leave(as, saved_frames);
+
+    if (as->inline_call_count >= as->inline_call_capacity) {
+        int new_capacity = as->inline_call_capacity ? as->inline_call_capacity * 2 : 16;
+        InlineCall *new_calls = realloc(as->inline_calls, new_capacity * sizeof(InlineCall));
+        if (!new_calls) {
+            assembler_error(as, "out of memory");
+            return;
+        }
+        as->inline_calls = new_calls;
+        as->inline_call_capacity = new_capacity;
+    }
+    InlineCall *record = &as->inline_calls[as->inline_call_count++];
+    record->routine = routine->name;
+    record->filename = saved_file;
+    record->line_number = call_line;
+    record->address = start;
+    record->size = (uint16_t)(as->pc - start);
+}
+
+/*
+ * Replace a pass 1 JSR to an !inline routine by a copy of its body if it
+ * is written jsr+ or the body fits the --inline-threshold budget. Calls
+ * to routines further down set inline_forward so pass 1 can run again.
+ * Returns 1 if the call was inlined (the statement is then stored).
+ */
+static int inline_call(Assembler *as, Statement *stmt, const char *source_line) {
+    if (stmt->type != STMT_INSTRUCTION ||
+        strcasecmp(stmt->data.instruction.mnemonic, "JSR") != 0) {
+        return 0;
+    }
+
+    InstructionInfo *info = &stmt->data.instruction;
+    InlineRoutine *routine = NULL;
+    if (info->operand && info->operand->type == EXPR_SYMBOL) {
+        routine = inline_lookup(as, info->operand->data.symbol);
+    }
+    if (!routine || routine->size < 0) {
+        if (!routine && (info->inline_call || as->inline_threshold > 0)) {
+            as->inline_forward = 1;
+        }
+        return 0;
+    }
+    if (!info->inline_call &&
+        (as->inline_threshold <= 0 || routine->size > as->inline_threshold)) {
+        return 0;
+    }
+
+    inline_expand(as, routine, stmt, source_line);
+    return 1;
+}
+
 /* ========== Loop Functions ========== */
 
 /* Free a loop entry */
@@ -2868,12 +6678,15 @@ static int execute_loop_body(Assembler *as, LoopEntry *loop) {
     int saved_line = as->current_line;
 
     /* Create a pseudo-filename for error messages */
-    char loop_file[256];
+    char loop_name[256];
     if (loop->type == LOOP_FOR) {
-        snprintf(loop_file, sizeof(loop_file), "<for %s>", loop->var_name);
+        snprintf(loop_name, sizeof(loop_name), "<for %s>", loop->var_name);
     } else {
-        snprintf(loop_file, sizeof(loop_file), "<while>");
+        snprintf(loop_name, sizeof(loop_name), "<while>");
     }
+    const char *loop_file = intern_file_name(as, loop_name);
+    if (!loop_file) loop_file = "<loop>";
+    const char *saved_frames = expansion_enter(as, loop_file);
 
     Lexer lexer;
     Parser parser;
@@ -2884,6 +6697,7 @@ static int execute_loop_body(Assembler *as, LoopEntry *loop) {
 
     /* Parse and assemble each line */
     while (*lexer.current || parser.current.type != TOK_EOF) {
+        parser_set_cpu(&parser, as->cpu_type);
         Statement *stmt = parser_parse_line(&parser);
         if (!stmt) break;
 
@@ -2926,11 +6740,16 @@ static int execute_loop_body(Assembler *as, LoopEntry *loop) {
         /* Handle statement (label definitions, instructions, etc.) */
         if (as->pass == 1) {
             /* Loop body source not captured for listings */
-            add_assembled_line(as, stmt, as->pc, NULL);
+            if (!inline_call(as, stmt, NULL)) {
+                int line_idx = add_assembled_line(as, stmt, as->pc, NULL);
+                if (line_idx >= 0) {
+                    pass1_line(as, line_idx);
+                }
+            }
+        } else {
+            assembler_assemble_statement(as, stmt);
         }
 
-        assembler_assemble_statement(as, stmt);
-
         if (as->pass == 2) {
             statement_free(stmt);
         }
@@ -2941,6 +6760,7 @@ static int execute_loop_body(Assembler *as, LoopEntry *loop) {
     /* Restore file/line */
     as->current_file = saved_file;
     as->current_line = saved_line;
+    expansion_leave(as, saved_frames);
 
     return 0;
 }
@@ -2997,6 +6817,239 @@ static char *substitute_loop_var(const char *body, const char *var_name, int32_t
     return result;
 }
 
+/* A data-only !for loop: one !byte/!word statement list evaluated per value */
+typedef struct {
+    Assembler *as;
+    Expr **args;                /* Bound arguments, in emission order (owned) */
+    uint8_t *sizes;             /* Bytes each argument emits */
+    int arg_count;
+    int per_value;              /* Bytes one iteration emits */
+    int32_t start;
+    int32_t step;
+    int value_count;
+    uint16_t pc;
+    uint8_t *out;
+    int chunk_count;
+    int failed;                 /* Some value was not known or did not fit */
+} DataLoop;
+
+/* Checks the names a bound argument reads (expr_visit_symbols callback) */
+typedef struct {
+    const ExprFunctions *functions;
+    const char *var;
+    int ok;
+} DataLoopNames;
+
+static void data_loop_name(const char *name, void *userdata) {
+    DataLoopNames *names = userdata;
+
+    /* Anonymous labels and zone-local names depend on where each copy of
+     * the body would be; a call or list named like the variable would
+     * have been substituted away */
+    if (strncmp(name, "__anon_", 7) == 0 || strchr(name, '.')) {
+        names->ok = 0;
+    } else if (strncmp(name, "__call_", 7) == 0) {
+        if (strcasecmp(name + 7, names->var) == 0 ||
+            !expr_function_is_pure(names->functions, name + 7)) {
+            names->ok = 0;
+        }
+    } else if (strncmp(name, "__list_", 7) == 0) {
+        if (strcasecmp(name + 7, names->var) == 0) names->ok = 0;
+    }
+}
+
+static void data_loop_task(void *arg, int index) {
+    DataLoop *dl = arg;
+    int first = (int)((long)dl->value_count * index / dl->chunk_count);
+    int last = (int)((long)dl->value_count * (index + 1) / dl->chunk_count);
+
+    for (int n = first; n < last && !dl->failed; n++) {
+        int offset = n * dl->per_value;
+        for (int a = 0; a < dl->arg_count; a++) {
+            /* Pass 2 evaluation only reads the symbol table */
+            ExprResult r = expr_eval_bound(dl->args[a], dl->as->symbols, dl->as->anon_labels,
+                                           (uint16_t)(dl->pc + offset), 2,
+                                           dl->as->current_zone, dl->start + n * dl->step);
+            if (!r.defined || r.error ||
+                (dl->sizes[a] == 1 && (r.value < -128 || r.value > 255))) {
+                dl->failed = 1;
+                return;
+            }
+            dl->out[offset++] = (uint8_t)(r.value & 0xFF);
+            if (dl->sizes[a] == 2) dl->out[offset++] = (uint8_t)((r.value >> 8) & 0xFF);
+        }
+    }
+}
+
+/* Bind the arguments of a body made only of !byte and !word lines.
+ * Returns 0, or -1 if the body is anything else. */
+static int data_loop_parse(Assembler *as, const char *var_name, const char *body,
+                           DataLoop *dl) {
+    Lexer lexer;
+    Parser parser;
+    lexer_init(&lexer, body, as->current_file);
+    parser_init(&parser, &lexer, as->symbols);
+    parser_set_pc(&parser, as->pc);
+    parser_set_pass(&parser, as->pass);
+    parser_set_cpu(&parser, as->cpu_type);
+
+    int capacity = 0;
+    int ok = 1;
+    while (ok && (*lexer.current || parser.current.type != TOK_EOF)) {
+        Statement *stmt = parser_parse_line(&parser);
+        if (!stmt) {
+            ok = 0;
+            break;
+        }
+        if (stmt->type == STMT_EMPTY && !stmt->label) {
+            int done = parser.current.type == TOK_EOF;
+            statement_free(stmt);
+            if (done) break;
+            continue;
+        }
+
+        DirectiveInfo *dir = &stmt->data.directive;
+        if (stmt->type != STMT_DIRECTIVE || stmt->label ||
+            !evaluates_args_in_order(dir->name) || dir->string_arg ||
+            strcasecmp(dir->name, var_name) == 0) {
+            statement_free(stmt);
+            ok = 0;
+            break;
+        }
+        int size = strcmp(dir->name, "word") == 0 || strcmp(dir->name, "wo") == 0 ||
+                   strcmp(dir->name, "dw") == 0 || strcmp(dir->name, "16") == 0 ? 2 : 1;
+
+        for (int i = 0; i < dir->arg_count; i++) {
+            int op;
+            if (!dir->args[i] || bulk_list(as, dir->args[i], &op)) {
+                ok = 0;
+                break;
+            }
+            if (dl->arg_count >= capacity) {
+                capacity = capacity ? capacity * 2 : 8;
+                Expr **args = realloc(dl->args, capacity * sizeof(Expr *));
+                uint8_t *sizes = realloc(dl->sizes, capacity);
+                if (args) dl->args = args;
+                if (sizes) dl->sizes = sizes;
+                if (!args || !sizes) {
+                    ok = 0;
+                    break;
+                }
+            }
+            Expr *bound = expr_bind(dir->args[i], var_name);
+            DataLoopNames names = { as->symbols->functions, var_name, bound != NULL };
+            if (bound) expr_visit_symbols(bound, as->current_zone, data_loop_name, &names);
+            if (!names.ok) {
+                if (bound) expr_free(bound);
+                ok = 0;
+                break;
+            }
+            dl->args[dl->arg_count] = bound;
+            dl->sizes[dl->arg_count++] = (uint8_t)size;
+            dl->per_value += size;
+        }
+        statement_free(stmt);
+    }
+    return ok && dl->arg_count > 0 ? 0 : -1;
+}
+
+static void data_loop_free(DataLoop *dl) {
+    for (int i = 0; i < dl->arg_count; i++) expr_free(dl->args[i]);
+    free(dl->args);
+    free(dl->sizes);
+    free(dl->out);
+}
+
+/*
+ * Generate a long !for loop whose body is only !byte and !word lines
+ * without parsing the body once per value: its arguments are bound to the
+ * variable once and evaluated for every value on the worker pool. The
+ * bytes are stored on one line standing for the whole loop. Returns 1 if
+ * the loop was generated, or 0 to expand it line by line, which is also
+ * how any value that is not known yet or does not fit is reported.
+ */
+static int generate_data_loop(Assembler *as, const char *var_name,
+                              int32_t start, int32_t end, const char *body) {
+    if (as->pass != 1 || as->strpool_open || as->rodata_open || as->inline_open) return 0;
+
+    /* Decimal text for negative values can read differently once
+     * substituted, and a hex-digit name would be replaced after a '$' */
+    if (start < 0 || end < 0) return 0;
+    long value_count = (long)(start <= end ? end - start : start - end) + 1;
+    if (value_count < ASM_DATA_LOOP_MIN || value_count > ASM_MEMORY_SIZE) return 0;
+    if (strpbrk(body, "\"'")) return 0;
+    if (strchr(body, '$') && strspn(var_name, "0123456789abcdefABCDEF") == strlen(var_name)) {
+        return 0;
+    }
+
+    DataLoop dl;
+    memset(&dl, 0, sizeof(dl));
+    if (data_loop_parse(as, var_name, body, &dl) < 0) {
+        data_loop_free(&dl);
+        return 0;
+    }
+    long total = value_count * dl.per_value;
+    if (as->pc + total > ASM_MEMORY_SIZE) {
+        data_loop_free(&dl);
+        return 0;
+    }
+
+    dl.as = as;
+    dl.start = start;
+    dl.step = start <= end ? 1 : -1;
+    dl.value_count = (int)value_count;
+    dl.pc = as->pc;
+    dl.out = malloc((size_t)total);
+    if (!dl.out) {
+        data_loop_free(&dl);
+        return 0;
+    }
+    if (as->threads > 1 && !as->pool) as->pool = threadpool_create(as->threads);
+    dl.chunk_count = as->pool ? threadpool_size(as->pool) * 4 : 1;
+    if (dl.chunk_count > dl.value_count) dl.chunk_count = dl.value_count;
+    threadpool_run(as->pool, data_loop_task, &dl, dl.chunk_count);
+    if (dl.failed) {
+        data_loop_free(&dl);
+        return 0;
+    }
+
+    /* One !for line carries the bytes, where the first copy would be */
+    char loop_name[256];
+    snprintf(loop_name, sizeof(loop_name), "<for %s>", var_name);
+    const char *loop_file = intern_file_name(as, loop_name);
+    if (!loop_file) loop_file = "<loop>";
+    Lexer lexer;
+    Parser parser;
+    lexer_init(&lexer, "!for", loop_file);
+    parser_init(&parser, &lexer, as->symbols);
+    Statement *stmt = parser_parse_line(&parser);
+    if (!stmt || stmt->type != STMT_DIRECTIVE) {
+        if (stmt) statement_free(stmt);
+        data_loop_free(&dl);
+        return 0;
+    }
+
+    const char *saved_frames = expansion_enter(as, loop_file);
+    int line_idx = add_assembled_line(as, stmt, as->pc, NULL);
+    if (line_idx >= 0) {
+        as->lines[line_idx].generated = dl.out;
+        as->lines[line_idx].generated_size = (int)total;
+        dl.out = NULL;
+        pass1_line(as, line_idx);
+    } else {
+        statement_free(stmt);
+    }
+    expansion_leave(as, saved_frames);
+
+    as->data_loops++;
+
+    /* The variable ends on its last value, as after expanding */
+    symbol_define(as->symbols, var_name, end, SYM_DEFINED,
+                  as->current_file, as->current_line);
+    data_loop_free(&dl);
+    return 1;
+}
+
 int assembler_loop_for(Assembler *as, const char *var_name,
                        int32_t start, int32_t end, const char *body) {
     /* Check nesting depth */
@@ -3005,6 +7058,8 @@ int assembler_loop_for(Assembler *as, const char *var_name,
         return -1;
     }
 
+    if (generate_data_loop(as, var_name, start, end, body)) return 0;
+
     /* Determine direction */
     int32_t step = (start <= end) ? 1 : -1;
 
@@ -3078,7 +7133,7 @@ int assembler_loop_while(Assembler *as, Expr *condition, const char *body) {
         /* Evaluate condition */
         ExprResult result = expr_eval(entry->condition, as->symbols, as->anon_labels, as->pc, as->pass, as->current_zone);
         if (!result.defined) {
-            assembler_error(as, "undefined symbol in !while condition");
+            report_undefined(as, &result, "undefined symbol in !while condition");
             break;
         }
         if (result.value == 0) {
@@ -3182,27 +7237,5 @@ CpuType assembler_get_cpu(Assembler *as) {
 }
 
 int assembler_opcode_valid_for_cpu(Assembler *as, uint8_t opcode) {
-    /* Get opcode info */
-    const OpcodeEntry *entry = opcode_find_by_opcode(opcode);
-    if (!entry) return 0;
-
-    /* Check if the mnemonic is an illegal opcode */
-    int is_illegal = opcode_is_illegal(entry->mnemonic);
-
-    switch (as->cpu_type) {
-        case CPU_6502:
-            /* Standard 6502: no illegal opcodes */
-            return !is_illegal;
-
-        case CPU_6510:
-            /* 6510: all opcodes including illegal */
-            return 1;
-
-        case CPU_65C02:
-            /* 65C02: standard + extended, no illegal */
-            /* For now, just disallow illegal opcodes */
-            return !is_illegal;
-    }
-
-    return 0;
+    return opcode_find_by_opcode_cpu(as->cpu_type, opcode) != NULL;
 }
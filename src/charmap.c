@@ -0,0 +1,275 @@
+/*
+ * charmap.c - Charset Deduplication and Screen Map Building
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#include "charmap.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* ========== Cells ========== */
+
+int charmap_cells_from_bitmap(const uint8_t *data, size_t size, int width, int height,
+                              uint64_t **cells, const char **error) {
+    if (width < 1 || height < 1 || (long)width * height > CHARMAP_MAX_CELLS) {
+        *error = "width and height must give 1 to 1048576 cells";
+        return -1;
+    }
+    if (size != (size_t)width * height * 8) {
+        *error = "file size is not width * height * 8 bytes";
+        return -1;
+    }
+
+    *cells = malloc((size_t)width * height * sizeof(uint64_t));
+    if (!*cells) {
+        *error = "out of memory";
+        return -1;
+    }
+    for (int cy = 0; cy < height; cy++) {
+        for (int cx = 0; cx < width; cx++) {
+            uint64_t cell = 0;
+            for (int y = 0; y < 8; y++) {
+                cell = (cell << 8) | data[((size_t)cy * 8 + y) * width + cx];
+            }
+            (*cells)[(size_t)cy * width + cx] = cell;
+        }
+    }
+    return 0;
+}
+
+int charmap_cells_from_image(const C64Image *image, int background,
+                             uint64_t **cells, uint8_t **colors, const char **error) {
+    if (image->width % 8 != 0 || image->height % 8 != 0) {
+        *error = "image width and height must be multiples of 8";
+        return -1;
+    }
+    int width = image->width / 8, height = image->height / 8;
+    if ((long)width * height > CHARMAP_MAX_CELLS) {
+        *error = "image has more than 1048576 cells";
+        return -1;
+    }
+
+    size_t count = (size_t)image->width * image->height;
+    if (background < 0) {
+        long counts[IMAGE_COLORS] = { 0 };
+        for (size_t i = 0; i < count; i++) {
+            if (image->pixels[i] != IMAGE_TRANSPARENT) counts[image->pixels[i]]++;
+        }
+        background = 0;
+        for (int c = 1; c < IMAGE_COLORS; c++) {
+            if (counts[c] > counts[background]) background = c;
+        }
+    }
+
+    *cells = malloc((size_t)width * height * sizeof(uint64_t));
+    *colors = malloc((size_t)width * height);
+    if (!*cells || !*colors) {
+        free(*cells);
+        free(*colors);
+        *error = "out of memory";
+        return -1;
+    }
+    for (int cy = 0; cy < height; cy++) {
+        for (int cx = 0; cx < width; cx++) {
+            int counts[IMAGE_COLORS] = { 0 };
+            uint64_t cell = 0;
+            for (int y = 0; y < 8; y++) {
+                const uint8_t *row = image->pixels + ((size_t)cy * 8 + y) * image->width + cx * 8;
+                for (int x = 0; x < 8; x++) {
+                    int set = row[x] != IMAGE_TRANSPARENT && row[x] != background;
+                    cell = (cell << 1) | (uint64_t)set;
+                    if (set) counts[row[x]]++;
+                }
+            }
+            int color = 0;
+            for (int c = 1; c < IMAGE_COLORS; c++) {
+                if (counts[c] > counts[color]) color = c;
+            }
+            (*cells)[(size_t)cy * width + cx] = cell;
+            (*colors)[(size_t)cy * width + cx] = (uint8_t)color;
+        }
+    }
+    return 0;
+}
+
+/* ========== Matching ========== */
+
+static int popcount64(uint64_t v) {
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((v * 0x0101010101010101ULL) >> 56);
+}
+
+/* Distinct cells, in order of first appearance */
+typedef struct {
+    uint64_t *values;
+    int *counts;             /* Cells equal to each distinct value */
+    int *of_cell;            /* Distinct index of every cell */
+    int count;
+} Distinct;
+
+static int find_distinct(const uint64_t *cells, int count, Distinct *distinct) {
+    int bits = 1;
+    while ((1 << bits) < count * 2) bits++;
+    size_t slots = (size_t)1 << bits;
+    int *table = calloc(slots, sizeof(int));     /* Distinct index + 1, 0 = empty */
+
+    distinct->values = malloc((size_t)count * sizeof(uint64_t));
+    distinct->counts = malloc((size_t)count * sizeof(int));
+    distinct->of_cell = malloc((size_t)count * sizeof(int));
+    distinct->count = 0;
+    if (!table || !distinct->values || !distinct->counts || !distinct->of_cell) {
+        free(table);
+        free(distinct->values);
+        free(distinct->counts);
+        free(distinct->of_cell);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        size_t slot = (size_t)((cells[i] * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+        while (table[slot] && distinct->values[table[slot] - 1] != cells[i]) {
+            slot = (slot + 1) & (slots - 1);
+        }
+        if (!table[slot]) {
+            distinct->values[distinct->count] = cells[i];
+            distinct->counts[distinct->count] = 0;
+            table[slot] = ++distinct->count;
+        }
+        distinct->counts[table[slot] - 1]++;
+        distinct->of_cell[i] = table[slot] - 1;
+    }
+    free(table);
+    return 0;
+}
+
+static const Distinct *sort_distinct;
+
+/* Most frequent first, then first seen */
+static int compare_frequency(const void *a, const void *b) {
+    int ia = *(const int *)a, ib = *(const int *)b;
+    int ca = sort_distinct->counts[ia], cb = sort_distinct->counts[ib];
+    if (ca != cb) return cb - ca;
+    return ia - ib;
+}
+
+/* Give each distinct cell a screen code; returns the characters used, or
+ * limit + 1 once they run out */
+static int assign_codes(const Distinct *distinct, const CharmapOptions *options, int limit,
+                        uint64_t *chars, int *code) {
+    int used = 0;
+
+    if (options->tolerance == 0 && !options->invert) {
+        for (int i = 0; i < distinct->count && i < limit; i++) {
+            chars[i] = distinct->values[i];
+            code[i] = i;
+        }
+        return distinct->count > limit ? limit + 1 : distinct->count;
+    }
+
+    int *order = malloc((size_t)distinct->count * sizeof(int));
+    if (!order) return -1;
+    for (int i = 0; i < distinct->count; i++) order[i] = i;
+    sort_distinct = distinct;
+    qsort(order, (size_t)distinct->count, sizeof(int), compare_frequency);
+
+    for (int n = 0; n < distinct->count; n++) {
+        int u = order[n];
+        uint64_t value = distinct->values[u];
+        int best = -1, best_distance = options->tolerance + 1;
+        for (int c = 0; c < used && best_distance > 0; c++) {
+            int d = popcount64(value ^ chars[c]);
+            if (d < best_distance) {
+                best = c;
+                best_distance = d;
+            }
+            if (options->invert) {
+                d = popcount64(~value ^ chars[c]);
+                if (d < best_distance) {
+                    best = c + 128;
+                    best_distance = d;
+                }
+            }
+        }
+        if (best < 0) {
+            if (used == limit) {
+                used = limit + 1;
+                break;
+            }
+            chars[used] = value;
+            best = used++;
+        }
+        code[u] = best;
+    }
+    free(order);
+    return used;
+}
+
+/* ========== Building ========== */
+
+static void put_char(uint8_t *out, uint64_t cell) {
+    for (int y = 0; y < 8; y++) {
+        out[y] = (uint8_t)(cell >> (56 - 8 * y));
+    }
+}
+
+int charmap_build(const uint64_t *cells, uint8_t *colors, int width, int height,
+                  const CharmapOptions *options, Charmap *map, const char **error) {
+    int count = width * height;
+    Distinct distinct;
+
+    memset(map, 0, sizeof(*map));
+    map->width = width;
+    map->height = height;
+    map->colors = colors;
+    map->limit = options->invert ? CHARMAP_MAX_CHARS / 2 : CHARMAP_MAX_CHARS;
+
+    uint64_t chars[CHARMAP_MAX_CHARS];
+    int *code = malloc((size_t)count * sizeof(int));
+    if (!code || find_distinct(cells, count, &distinct) < 0) {
+        free(code);
+        *error = "out of memory";
+        return -1;
+    }
+    map->unique = distinct.count;
+    map->chars = assign_codes(&distinct, options, map->limit, chars, code);
+
+    int result = 0;
+    if (map->chars < 0) {
+        *error = "out of memory";
+        result = -1;
+    } else if (map->chars > map->limit) {
+        *error = "the map needs more characters than fit";
+        result = -1;
+    } else {
+        map->charset_size = options->invert ? CHARMAP_MAX_CHARS * 8 : map->chars * 8;
+        map->charset = calloc((size_t)map->charset_size > 0 ? map->charset_size : 1, 1);
+        map->screen = malloc((size_t)count);
+        if (!map->charset || !map->screen) {
+            *error = "out of memory";
+            result = -1;
+        } else {
+            for (int c = 0; c < map->chars; c++) {
+                put_char(map->charset + c * 8, chars[c]);
+                if (options->invert) put_char(map->charset + (c + 128) * 8, ~chars[c]);
+            }
+            for (int i = 0; i < count; i++) {
+                map->screen[i] = (uint8_t)code[distinct.of_cell[i]];
+            }
+        }
+    }
+
+    free(code);
+    free(distinct.values);
+    free(distinct.counts);
+    free(distinct.of_cell);
+    return result;
+}
+
+void charmap_free(Charmap *map) {
+    free(map->charset);
+    free(map->screen);
+    free(map->colors);
+    map->charset = map->screen = map->colors = NULL;
+}
@@ -0,0 +1,387 @@
+/*
+ * delay.c - Exact-Cycle Delay Code Generation
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#include "delay.h"
+#include "opcodes.h"
+#include "sim6510.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Most instructions delay_measure runs before giving up */
+#define DELAY_MAX_STEPS     (DELAY_MAX_CYCLES + 1)
+
+int delay_parse_keep(const char *letters, unsigned *keep) {
+    *keep = 0;
+    for (const char *c = letters; *c; c++) {
+        switch (*c) {
+            case 'a': case 'A': *keep |= DELAY_KEEP_A; break;
+            case 'x': case 'X': *keep |= DELAY_KEEP_X; break;
+            case 'y': case 'Y': *keep |= DELAY_KEEP_Y; break;
+            case 'n': case 'N': *keep |= DELAY_KEEP_N; break;
+            case 'v': case 'V': *keep |= DELAY_KEEP_V; break;
+            case 'z': case 'Z': *keep |= DELAY_KEEP_Z; break;
+            case 'c': case 'C': *keep |= DELAY_KEEP_C; break;
+            case 's': case 'S': *keep |= DELAY_KEEP_STACK; break;
+            case 'p': case 'P': *keep |= DELAY_KEEP_FLAGS; break;
+            default: return -1;
+        }
+    }
+    return 0;
+}
+
+/* ========== Building Blocks ========== */
+
+/* Most instructions saving and restoring around the loops */
+#define DELAY_MAX_WRAP      3
+
+/* Instructions a delay may use under a given keep mask */
+typedef struct {
+    const OpcodeEntry *nop;
+    const OpcodeEntry *three;    /* 3-cycle filler */
+    const OpcodeEntry *php;      /* PHP/PLP pair, or NULL */
+    const OpcodeEntry *plp;
+    const OpcodeEntry *load;     /* Loop counter: LDX/LDY #, DEX/DEY, BNE; or NULL */
+    const OpcodeEntry *dec;
+    const OpcodeEntry *bne;
+    const OpcodeEntry *outer_load;   /* LDY #, DEY counting X loops; or NULL */
+    const OpcodeEntry *outer_dec;
+    const OpcodeEntry *save[DELAY_MAX_WRAP];     /* Before the loops, in order */
+    const OpcodeEntry *restore[DELAY_MAX_WRAP];  /* After them, in order */
+    int wrap;
+} DelayParts;
+
+/* Save something the loops change with before and restore it with after */
+static void wrap_loops(DelayParts *parts, const char *before, const char *after) {
+    for (int i = parts->wrap; i > 0; i--) {
+        parts->restore[i] = parts->restore[i - 1];
+    }
+    parts->save[parts->wrap] = opcode_find(before, ADDR_IMPLIED);
+    parts->restore[0] = opcode_find(after, ADDR_IMPLIED);
+    parts->wrap++;
+}
+
+static void delay_parts(unsigned keep, int illegal, DelayParts *parts) {
+    memset(parts, 0, sizeof(*parts));
+    parts->nop = opcode_find("NOP", ADDR_IMPLIED);
+
+    if (illegal) {
+        parts->three = opcode_find("DOP", ADDR_ZEROPAGE);
+    } else if (!(keep & (DELAY_KEEP_N | DELAY_KEEP_V | DELAY_KEEP_Z))) {
+        parts->three = opcode_find("BIT", ADDR_ZEROPAGE);
+    } else {
+        parts->three = opcode_find("JMP", ADDR_ABSOLUTE);
+    }
+
+    if (!(keep & DELAY_KEEP_STACK)) {
+        parts->php = opcode_find("PHP", ADDR_IMPLIED);
+        parts->plp = opcode_find("PLP", ADDR_IMPLIED);
+    }
+
+    /* The countdown leaves N and Z set by the last DEX/DEY, so they are
+     * saved with PHP; with X and Y both kept, X is held in A while the
+     * loops count it down (and A on the stack if it is kept too) */
+    int flags = keep & (DELAY_KEEP_N | DELAY_KEEP_Z);
+    int both = (keep & DELAY_KEEP_X) && (keep & DELAY_KEEP_Y);
+    if ((flags || (both && (keep & DELAY_KEEP_A))) && !parts->php) return;
+    if (flags) wrap_loops(parts, "PHP", "PLP");
+    if (both && (keep & DELAY_KEEP_A)) wrap_loops(parts, "PHA", "PLA");
+    if (both) wrap_loops(parts, "TXA", "TAX");
+
+    if (!(keep & DELAY_KEEP_X) || both) {
+        parts->load = opcode_find("LDX", ADDR_IMMEDIATE);
+        parts->dec = opcode_find("DEX", ADDR_IMPLIED);
+    } else {
+        parts->load = opcode_find("LDY", ADDR_IMMEDIATE);
+        parts->dec = opcode_find("DEY", ADDR_IMPLIED);
+    }
+    parts->bne = opcode_find("BNE", ADDR_RELATIVE);
+
+    /* With X and Y both free, Y can count the X loop itself */
+    if (!(keep & (DELAY_KEEP_X | DELAY_KEEP_Y))) {
+        parts->outer_load = opcode_find("LDY", ADDR_IMMEDIATE);
+        parts->outer_dec = opcode_find("DEY", ADDR_IMPLIED);
+    }
+}
+
+static int loop_size(const DelayParts *parts) {
+    return parts->load->size + parts->dec->size + parts->bne->size;
+}
+
+/* Bytes and cycles of the saving before the loops and restoring after */
+static int wrap_size(const DelayParts *parts) {
+    int size = 0;
+    for (int i = 0; i < parts->wrap; i++) {
+        size += parts->save[i]->size + parts->restore[i]->size;
+    }
+    return size;
+}
+
+static int wrap_cycles(const DelayParts *parts) {
+    int cycles = 0;
+    for (int i = 0; i < parts->wrap; i++) {
+        cycles += parts->save[i]->cycles + parts->restore[i]->cycles;
+    }
+    return cycles;
+}
+
+/* Cycles of a k-iteration loop at address; taken branches pay one more
+ * cycle, and another if they cross a page */
+static int loop_cycles(const DelayParts *parts, int k, uint16_t address) {
+    uint16_t target = (uint16_t)(address + parts->load->size);
+    uint16_t next = (uint16_t)(address + loop_size(parts));
+    int taken = parts->bne->cycles + 1 + (((target ^ next) & 0xFF00) ? 1 : 0);
+    return parts->load->cycles + k * parts->dec->cycles +
+           (k - 1) * taken + parts->bne->cycles;
+}
+
+/* LDX #n, LDY #m, then DEX/BNE back to DEX and DEY/BNE back to DEX */
+static int nested_size(const DelayParts *parts) {
+    return loop_size(parts) + parts->outer_load->size + parts->outer_dec->size + parts->bne->size;
+}
+
+/* Cycles of the nested loops at address: the X loop runs n times on the
+ * first pass and, starting from 0, 256 times on each of the other m - 1 */
+static int nested_cycles(const DelayParts *parts, int m, int n, uint16_t address) {
+    uint16_t target = (uint16_t)(address + parts->load->size + parts->outer_load->size);
+    uint16_t inner_next = (uint16_t)(target + parts->dec->size + parts->bne->size);
+    uint16_t next = (uint16_t)(address + nested_size(parts));
+    int inner_taken = parts->bne->cycles + 1 + (((target ^ inner_next) & 0xFF00) ? 1 : 0);
+    int outer_taken = parts->bne->cycles + 1 + (((target ^ next) & 0xFF00) ? 1 : 0);
+    int first = n * parts->dec->cycles + (n - 1) * inner_taken + parts->bne->cycles;
+    int full = DELAY_MAX_LOOP * parts->dec->cycles + (DELAY_MAX_LOOP - 1) * inner_taken +
+               parts->bne->cycles;
+    return parts->load->cycles + parts->outer_load->cycles + first + (m - 1) * full +
+           m * parts->outer_dec->cycles + (m - 1) * outer_taken + parts->bne->cycles;
+}
+
+/* Straight-line code: PHP/PLP pairs, at most one 3-cycle filler, NOPs */
+typedef struct {
+    int pairs;
+    int threes;
+    int nops;
+    int bytes;
+} StraightPlan;
+
+/* Fewest bytes taking exactly cycles without a loop; -1 if impossible */
+static int straight_plan(const DelayParts *parts, int cycles, StraightPlan *plan) {
+    int pair_cycles = parts->php ? parts->php->cycles + parts->plp->cycles : 0;
+    int pair_size = parts->php ? parts->php->size + parts->plp->size : 0;
+    int max_pairs = pair_cycles ? cycles / pair_cycles : 0;
+    int best = -1;
+
+    /* Two fillers are never shorter than three NOPs, and a pair beats
+     * any 7 cycles of filler and NOPs, so the best leaves under 16
+     * cycles to them */
+    for (int pairs = max_pairs > 3 ? max_pairs - 3 : 0; pairs <= max_pairs; pairs++) {
+        for (int threes = 0; threes <= 1; threes++) {
+            int rest = cycles - pairs * pair_cycles - threes * parts->three->cycles;
+            if (rest < 0 || rest % parts->nop->cycles != 0) continue;
+            int nops = rest / parts->nop->cycles;
+            int bytes = pairs * pair_size + threes * parts->three->size + nops * parts->nop->size;
+            if (best < 0 || bytes < best) {
+                best = bytes;
+                plan->pairs = pairs;
+                plan->threes = threes;
+                plan->nops = nops;
+                plan->bytes = bytes;
+            }
+        }
+    }
+    return best;
+}
+
+/* ========== Generation ========== */
+
+static uint8_t *emit_op(uint8_t *out, const OpcodeEntry *entry) {
+    *out++ = entry->opcode;
+    return out;
+}
+
+int delay_generate(int cycles, unsigned keep, int illegal, uint16_t address, DelayCode *code) {
+    DelayParts parts;
+    StraightPlan plan, best_plan;
+    int best = -1, best_loops = 0, last_count = 0;
+    int outer_count = 0;    /* Nonzero when the best code nests two loops */
+
+    memset(code, 0, sizeof(*code));
+    if (cycles < 0 || cycles > DELAY_MAX_CYCLES) return -1;
+    delay_parts(keep, illegal, &parts);
+
+    if (straight_plan(&parts, cycles, &plan) >= 0) {
+        best = plan.bytes;
+        best_plan = plan;
+    }
+
+    /* m loops: all but the last run the full DELAY_MAX_LOOP iterations,
+     * the last is sized so the straight-line remainder is shortest */
+    int saved = 0;
+    for (int i = 0; i < parts.wrap; i++) saved += parts.save[i]->size;
+    for (int loops = 1; parts.load; loops++) {
+        int used = wrap_cycles(&parts);
+        uint16_t at = (uint16_t)(address + saved);
+        for (int i = 0; i < loops - 1; i++) {
+            used += loop_cycles(&parts, DELAY_MAX_LOOP, at);
+            at = (uint16_t)(at + loop_size(&parts));
+        }
+        if (used + loop_cycles(&parts, 1, at) > cycles) break;
+
+        for (int k = 1; k <= DELAY_MAX_LOOP; k++) {
+            int rest = cycles - used - loop_cycles(&parts, k, at);
+            if (rest < 0) break;
+            int base = wrap_size(&parts) + loops * loop_size(&parts);
+            /* No straight-line code beats 2 bytes per 7 cycles */
+            if (best >= 0 && base + rest * 2 / 7 >= best) continue;
+            if (straight_plan(&parts, rest, &plan) < 0) continue;
+            int bytes = base + plan.bytes;
+            if (best < 0 || bytes < best) {
+                best = bytes;
+                best_plan = plan;
+                best_loops = loops;
+                last_count = k;
+            }
+        }
+    }
+
+    /* Two nested loops: for each outer count, the first-pass counts
+     * leaving the two smallest remainders (a 1-cycle one cannot be filled) */
+    if (parts.outer_load) {
+        uint16_t at = (uint16_t)(address + saved);
+        int base = wrap_size(&parts) + nested_size(&parts);
+        int used = wrap_cycles(&parts);
+        for (int m = 1; m <= DELAY_MAX_LOOP; m++) {
+            int once = nested_cycles(&parts, m, 1, at);
+            int step = nested_cycles(&parts, m, 2, at) - once;
+            if (used + once > cycles) break;
+            int n = 1 + (cycles - used - once) / step;
+            if (n > DELAY_MAX_LOOP) n = DELAY_MAX_LOOP;
+            for (int k = n; k >= 1 && k >= n - 1; k--) {
+                int rest = cycles - used - nested_cycles(&parts, m, k, at);
+                if (straight_plan(&parts, rest, &plan) < 0) continue;
+                if (best < 0 || base + plan.bytes < best) {
+                    best = base + plan.bytes;
+                    best_plan = plan;
+                    best_loops = 2;
+                    outer_count = m;
+                    last_count = k;
+                }
+            }
+        }
+    }
+    if (best < 0) return -1;
+    if (best == 0) return 0;
+
+    code->bytes = malloc((size_t)best);
+    if (!code->bytes) return -1;
+    code->length = best;
+    code->loops = best_loops;
+
+    uint8_t *out = code->bytes;
+    for (int i = 0; best_loops && i < parts.wrap; i++) {
+        out = emit_op(out, parts.save[i]);
+    }
+    if (outer_count) {
+        out = emit_op(out, parts.load);
+        *out++ = (uint8_t)(last_count & 0xFF);
+        out = emit_op(out, parts.outer_load);
+        *out++ = (uint8_t)(outer_count & 0xFF);
+        out = emit_op(out, parts.dec);
+        out = emit_op(out, parts.bne);
+        *out++ = (uint8_t)-(parts.dec->size + parts.bne->size);
+        out = emit_op(out, parts.outer_dec);
+        out = emit_op(out, parts.bne);
+        *out++ = (uint8_t)-(parts.dec->size + parts.bne->size + parts.outer_dec->size +
+                            parts.bne->size);
+    }
+    for (int i = 0; !outer_count && i < best_loops; i++) {
+        int k = i == best_loops - 1 ? last_count : DELAY_MAX_LOOP;
+        out = emit_op(out, parts.load);
+        *out++ = (uint8_t)(k & 0xFF);
+        out = emit_op(out, parts.dec);
+        out = emit_op(out, parts.bne);
+        *out++ = (uint8_t)-(parts.dec->size + parts.bne->size);
+    }
+    for (int i = 0; best_loops && i < parts.wrap; i++) {
+        out = emit_op(out, parts.restore[i]);
+    }
+    for (int i = 0; i < best_plan.pairs; i++) {
+        out = emit_op(out, parts.php);
+        out = emit_op(out, parts.plp);
+    }
+    if (best_plan.threes) {
+        uint16_t next = (uint16_t)(address + (out - code->bytes) + parts.three->size);
+        out = emit_op(out, parts.three);
+        if (parts.three->mode == ADDR_ABSOLUTE) {
+            *out++ = (uint8_t)(next & 0xFF);
+            *out++ = (uint8_t)(next >> 8);
+        } else {
+            *out++ = 0x00;
+        }
+    }
+    for (int i = 0; i < best_plan.nops; i++) {
+        out = emit_op(out, parts.nop);
+    }
+    return 0;
+}
+
+/* ========== Verification ========== */
+
+int delay_measure(const DelayCode *code, uint16_t address, unsigned keep, int *cycles) {
+    uint8_t *memory = calloc(65536, 1);
+    uint8_t stack[256];
+    if (!memory) return -1;
+
+    for (int i = 0; i < code->length; i++) {
+        memory[(uint16_t)(address + i)] = code->bytes[i];
+    }
+
+    Sim6510 cpu;
+    sim6510_init(&cpu, memory, address);
+    cpu.a = 0x55;
+    cpu.x = 0xAA;
+    cpu.y = 0x33;
+    cpu.p = SIM6510_FLAG_N | SIM6510_FLAG_V | SIM6510_FLAG_C | SIM6510_FLAG_I | SIM6510_FLAG_U;
+    Sim6510 before = cpu;
+    memcpy(stack, memory + 0x100, sizeof(stack));
+
+    uint16_t end = (uint16_t)(address + code->length);
+    int total = 0;
+    int result = 0;
+    for (int steps = 0; cpu.pc != end; steps++) {
+        SimStep step;
+        if (steps >= DELAY_MAX_STEPS || sim6510_step(&cpu, &step) < 0) {
+            result = -1;
+            break;
+        }
+        total += step.cycles;
+    }
+
+    static const struct {
+        unsigned keep;
+        uint8_t flag;
+    } flags[] = {
+        { DELAY_KEEP_N, SIM6510_FLAG_N }, { DELAY_KEEP_V, SIM6510_FLAG_V },
+        { DELAY_KEEP_Z, SIM6510_FLAG_Z }, { DELAY_KEEP_C, SIM6510_FLAG_C }
+    };
+    if ((keep & DELAY_KEEP_A) && cpu.a != before.a) result = -1;
+    if ((keep & DELAY_KEEP_X) && cpu.x != before.x) result = -1;
+    if ((keep & DELAY_KEEP_Y) && cpu.y != before.y) result = -1;
+    for (int i = 0; i < 4; i++) {
+        if ((keep & flags[i].keep) && ((cpu.p ^ before.p) & flags[i].flag)) result = -1;
+    }
+    if (cpu.sp != before.sp) result = -1;
+    if ((keep & DELAY_KEEP_STACK) && memcmp(stack, memory + 0x100, sizeof(stack)) != 0) {
+        result = -1;
+    }
+
+    free(memory);
+    *cycles = total;
+    return result;
+}
+
+void delay_code_free(DelayCode *code) {
+    free(code->bytes);
+    code->bytes = NULL;
+    code->length = 0;
+}
@@ -16,6 +16,7 @@
 #include "expr.h"
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>  /* For strcasecmp */
 #include <stdio.h>
 
 /* ========== Expression Creation ========== */
@@ -81,6 +82,67 @@ Expr *expr_current(void) {
     return e;
 }
 
+Expr *expr_call(const char *name, Expr **args, int arg_count) {
+    Expr *e = malloc(sizeof(Expr));
+    char *copy = name ? malloc(strlen(name) + 1) : NULL;
+    if (!e || !copy) {
+        for (int i = 0; i < arg_count; i++) expr_free(args[i]);
+        free(args);
+        free(copy);
+        free(e);
+        return NULL;
+    }
+    strcpy(copy, name);
+    e->type = EXPR_CALL;
+    e->data.call.name = copy;
+    e->data.call.args = args;
+    e->data.call.arg_count = arg_count;
+    return e;
+}
+
+static Expr *expr_param(int index) {
+    Expr *e = malloc(sizeof(Expr));
+    if (!e) return NULL;
+    e->type = EXPR_PARAM;
+    e->data.param = index;
+    return e;
+}
+
+/* name[index]; takes ownership of index */
+static Expr *expr_index(const char *name, Expr *index) {
+    Expr *e = index ? malloc(sizeof(Expr)) : NULL;
+    char *copy = e ? malloc(strlen(name) + 1) : NULL;
+    if (!copy) {
+        free(e);
+        expr_free(index);
+        return NULL;
+    }
+    strcpy(copy, name);
+    e->type = EXPR_INDEX;
+    e->data.index.name = copy;
+    e->data.index.index = index;
+    return e;
+}
+
+/* List of items, or comprehension over var when var is set; takes
+ * ownership of items and its expressions */
+static Expr *expr_list(Expr **items, int count, const char *var) {
+    Expr *e = malloc(sizeof(Expr));
+    char *copy = (e && var) ? malloc(strlen(var) + 1) : NULL;
+    if (!e || (var && !copy)) {
+        for (int i = 0; i < count; i++) expr_free(items[i]);
+        free(items);
+        free(e);
+        return NULL;
+    }
+    if (copy) strcpy(copy, var);
+    e->type = EXPR_LIST;
+    e->data.list.items = items;
+    e->data.list.count = count;
+    e->data.list.var = copy;
+    return e;
+}
+
 void expr_free(Expr *expr) {
     if (!expr) return;
     switch (expr->type) {
@@ -94,6 +156,24 @@ void expr_free(Expr *expr) {
             expr_free(expr->data.binary.left);
             expr_free(expr->data.binary.right);
             break;
+        case EXPR_CALL:
+            free(expr->data.call.name);
+            for (int i = 0; i < expr->data.call.arg_count; i++) {
+                expr_free(expr->data.call.args[i]);
+            }
+            free(expr->data.call.args);
+            break;
+        case EXPR_INDEX:
+            free(expr->data.index.name);
+            expr_free(expr->data.index.index);
+            break;
+        case EXPR_LIST:
+            for (int i = 0; i < expr->data.list.count; i++) {
+                expr_free(expr->data.list.items[i]);
+            }
+            free(expr->data.list.items);
+            free(expr->data.list.var);
+            break;
         default:
             break;
     }
@@ -121,6 +201,31 @@ Expr *expr_clone(Expr *expr) {
             return expr_binary(expr->data.binary.op,
                                expr_clone(expr->data.binary.left),
                                expr_clone(expr->data.binary.right));
+
+        case EXPR_CALL:
+        case EXPR_LIST: {
+            int is_call = (expr->type == EXPR_CALL);
+            int count = is_call ? expr->data.call.arg_count : expr->data.list.count;
+            Expr **from = is_call ? expr->data.call.args : expr->data.list.items;
+            Expr **args = malloc((size_t)(count > 0 ? count : 1) * sizeof(Expr *));
+            if (!args) return NULL;
+            for (int i = 0; i < count; i++) {
+                args[i] = expr_clone(from[i]);
+                if (!args[i]) {
+                    for (int j = 0; j < i; j++) expr_free(args[j]);
+                    free(args);
+                    return NULL;
+                }
+            }
+            return is_call ? expr_call(expr->data.call.name, args, count)
+                           : expr_list(args, count, expr->data.list.var);
+        }
+
+        case EXPR_PARAM:
+            return expr_param(expr->data.param);
+
+        case EXPR_INDEX:
+            return expr_index(expr->data.index.name, expr_clone(expr->data.index.index));
     }
     return NULL;
 }
@@ -420,7 +525,60 @@ static Expr *parse_unary(ExprParser *parser) {
     return parse_primary(parser);
 }
 
-/* Primary: number, symbol, *, (expr) */
+/* Arguments of a call to name, from the opening parenthesis */
+static Expr *parse_call(ExprParser *parser, const char *name) {
+    Expr **args = NULL;
+    int arg_count = 0;
+
+    parser_advance(parser);  /* Skip ( */
+    if (!parser_check(parser, TOK_RPAREN)) {
+        for (;;) {
+            Expr *arg = parse_or(parser);
+            Expr **grown = arg ? realloc(args, (size_t)(arg_count + 1) * sizeof(Expr *)) : NULL;
+            if (!grown) {
+                expr_free(arg);
+                for (int i = 0; i < arg_count; i++) expr_free(args[i]);
+                free(args);
+                if (!parser->error) parser->error = "out of memory";
+                return NULL;
+            }
+            args = grown;
+            args[arg_count++] = arg;
+            if (!parser_check(parser, TOK_COMMA)) break;
+            parser_advance(parser);
+        }
+    }
+    if (!parser_check(parser, TOK_RPAREN)) {
+        for (int i = 0; i < arg_count; i++) expr_free(args[i]);
+        free(args);
+        parser->error = "expected ')' after function arguments";
+        return NULL;
+    }
+    parser_advance(parser);
+
+    Expr *e = expr_call(name, args, arg_count);
+    if (!e) parser->error = "out of memory";
+    return e;
+}
+
+/* Element of list name, from the opening bracket */
+static Expr *parse_index(ExprParser *parser, const char *name) {
+    parser_advance(parser);  /* Skip [ */
+    Expr *index = parse_or(parser);
+    if (!index) return NULL;
+    if (!parser_check(parser, TOK_RBRACKET)) {
+        expr_free(index);
+        parser->error = "expected ']' after list index";
+        return NULL;
+    }
+    parser_advance(parser);
+
+    Expr *e = expr_index(name, index);
+    if (!e) parser->error = "out of memory";
+    return e;
+}
+
+/* Primary: number, symbol, call, list element, *, (expr) */
 static Expr *parse_primary(ExprParser *parser) {
     /* Number literal */
     if (parser_check(parser, TOK_NUMBER)) {
@@ -436,7 +594,7 @@ static Expr *parse_primary(ExprParser *parser) {
         return expr_number(value);
     }
 
-    /* Symbol/identifier */
+    /* Symbol/identifier, or a function call name(args) */
     if (parser_check(parser, TOK_IDENTIFIER)) {
         char *name = token_to_string(&parser->current);
         if (!name) {
@@ -444,7 +602,14 @@ static Expr *parse_primary(ExprParser *parser) {
             return NULL;
         }
         parser_advance(parser);
-        Expr *e = expr_symbol(name);
+        Expr *e;
+        if (parser_check(parser, TOK_LPAREN)) {
+            e = parse_call(parser, name);
+        } else if (parser_check(parser, TOK_LBRACKET)) {
+            e = parse_index(parser, name);
+        } else {
+            e = expr_symbol(name);
+        }
         free(name);
         return e;
     }
@@ -509,6 +674,528 @@ Expr *expr_parse_primary(ExprParser *parser) {
     return parse_primary(parser);
 }
 
+/* "for" after the first element makes a list a comprehension */
+static int at_for(ExprParser *parser) {
+    if (!parser_check(parser, TOK_IDENTIFIER)) return 0;
+    Token *tok = &parser->current;
+    return tok->length == 3 && strncmp(tok->start, "for", 3) == 0;
+}
+
+Expr *expr_parse_list(ExprParser *parser) {
+    if (!parser_check(parser, TOK_LBRACKET)) {
+        return parse_or(parser);
+    }
+    parser_advance(parser);  /* Skip [ */
+
+    Expr **items = NULL;
+    int count = 0;
+    char *var = NULL;
+    const char *error = NULL;
+
+    while (!error && !parser_check(parser, TOK_RBRACKET)) {
+        if (count > 0 && !var) {
+            if (!parser_check(parser, TOK_COMMA)) {
+                error = "expected ',' or ']' in list";
+                break;
+            }
+            parser_advance(parser);
+        }
+        Expr *item = parse_or(parser);
+        Expr **grown = item ? realloc(items, (size_t)(count + 1) * sizeof(Expr *)) : NULL;
+        if (!grown) {
+            expr_free(item);
+            error = parser->error ? parser->error : "out of memory";
+            break;
+        }
+        items = grown;
+        items[count++] = item;
+
+        if (count == 1 && at_for(parser)) {
+            /* [body for var, start, end] */
+            parser_advance(parser);
+            if (!parser_check(parser, TOK_IDENTIFIER)) {
+                error = "expected a variable after 'for'";
+                break;
+            }
+            var = token_to_string(&parser->current);
+            parser_advance(parser);
+            if (!var || !parser_check(parser, TOK_COMMA)) {
+                error = var ? "expected ', start, end' after the variable" : "out of memory";
+                break;
+            }
+            parser_advance(parser);
+        } else if (var && count == 3) {
+            if (!parser_check(parser, TOK_RBRACKET)) error = "expected ']' after the end value";
+            break;
+        } else if (var) {
+            if (!parser_check(parser, TOK_COMMA)) {
+                error = "expected ', start, end' after the variable";
+                break;
+            }
+            parser_advance(parser);
+        }
+    }
+    if (!error && var && count != 3) error = "expected ', start, end' after the variable";
+    if (!error && !parser_check(parser, TOK_RBRACKET)) error = "expected ']' after list";
+
+    if (error) {
+        for (int i = 0; i < count; i++) expr_free(items[i]);
+        free(items);
+        free(var);
+        parser->error = error;
+        return NULL;
+    }
+    parser_advance(parser);
+
+    Expr *e = expr_list(items, count, var);
+    free(var);
+    if (!e) parser->error = "out of memory";
+    return e;
+}
+
+/* ========== User Functions ========== */
+
+#define FUNCTION_BUCKETS 64
+
+/* Remembered results of a pure function, keyed by its arguments */
+typedef struct {
+    int32_t *keys;           /* param_count arguments per slot */
+    int32_t *values;
+    uint8_t *used;
+    size_t mask;
+    size_t count;
+} Memo;
+
+typedef struct ExprFunction {
+    char *name;
+    int param_count;
+    Expr *body;              /* Parameters are EXPR_PARAM slots */
+    int pure;
+    Memo memo;
+    struct ExprFunction *next;
+} ExprFunction;
+
+struct ExprFunctions {
+    ExprFunction *buckets[FUNCTION_BUCKETS];
+    int count;
+};
+
+static unsigned function_bucket(const char *name) {
+    unsigned h = 5381;
+    while (*name) h = h * 33 + (unsigned char)*name++;
+    return h % FUNCTION_BUCKETS;
+}
+
+static ExprFunction *function_lookup(const ExprFunctions *functions, const char *name) {
+    if (!functions) return NULL;
+    for (ExprFunction *fn = functions->buckets[function_bucket(name)]; fn; fn = fn->next) {
+        if (strcmp(fn->name, name) == 0) return fn;
+    }
+    return NULL;
+}
+
+ExprFunctions *expr_functions_create(void) {
+    return calloc(1, sizeof(ExprFunctions));
+}
+
+void expr_functions_free(ExprFunctions *functions) {
+    if (!functions) return;
+    for (int b = 0; b < FUNCTION_BUCKETS; b++) {
+        ExprFunction *fn = functions->buckets[b];
+        while (fn) {
+            ExprFunction *next = fn->next;
+            free(fn->name);
+            expr_free(fn->body);
+            free(fn->memo.keys);
+            free(fn->memo.values);
+            free(fn->memo.used);
+            free(fn);
+            fn = next;
+        }
+    }
+    free(functions);
+}
+
+static int is_builtin_if(const Expr *call) {
+    return strcmp(call->data.call.name, "if") == 0;
+}
+
+/* Copy of body with each parameter replaced by its slot; nocase matches
+ * names the way !for substitutes its variable */
+static Expr *compile_body(const Expr *body, const char *const *params, int param_count,
+                          int nocase) {
+    switch (body->type) {
+        case EXPR_SYMBOL:
+            for (int i = 0; i < param_count; i++) {
+                if ((nocase ? strcasecmp(body->data.symbol, params[i])
+                            : strcmp(body->data.symbol, params[i])) == 0) {
+                    return expr_param(i);
+                }
+            }
+            return expr_symbol(body->data.symbol);
+
+        case EXPR_UNARY: {
+            Expr *operand = compile_body(body->data.unary.operand, params, param_count, nocase);
+            return operand ? expr_unary(body->data.unary.op, operand) : NULL;
+        }
+
+        case EXPR_BINARY: {
+            Expr *left = compile_body(body->data.binary.left, params, param_count, nocase);
+            Expr *right = left ? compile_body(body->data.binary.right, params, param_count, nocase) : NULL;
+            return right ? expr_binary(body->data.binary.op, left, right) : (expr_free(left), NULL);
+        }
+
+        case EXPR_CALL: {
+            int count = body->data.call.arg_count;
+            Expr **args = malloc((size_t)(count > 0 ? count : 1) * sizeof(Expr *));
+            if (!args) return NULL;
+            for (int i = 0; i < count; i++) {
+                args[i] = compile_body(body->data.call.args[i], params, param_count, nocase);
+                if (!args[i]) {
+                    for (int j = 0; j < i; j++) expr_free(args[j]);
+                    free(args);
+                    return NULL;
+                }
+            }
+            return expr_call(body->data.call.name, args, count);
+        }
+
+        case EXPR_INDEX: {
+            Expr *index = compile_body(body->data.index.index, params, param_count, nocase);
+            return index ? expr_index(body->data.index.name, index) : NULL;
+        }
+
+        default:
+            return expr_clone((Expr *)body);
+    }
+}
+
+/* Check the calls in a compiled body of name and clear *pure if it reads
+ * anything but its parameters; returns NULL or an error */
+static const char *check_body(const ExprFunctions *functions, const Expr *body,
+                              const char *name, int param_count, int *pure) {
+    switch (body->type) {
+        case EXPR_SYMBOL:
+        case EXPR_CURRENT:
+            *pure = 0;
+            return NULL;
+
+        case EXPR_UNARY:
+            return check_body(functions, body->data.unary.operand, name, param_count, pure);
+
+        case EXPR_INDEX:
+            /* Lists never change once defined */
+            return check_body(functions, body->data.index.index, name, param_count, pure);
+
+        case EXPR_BINARY: {
+            const char *error = check_body(functions, body->data.binary.left, name, param_count, pure);
+            return error ? error : check_body(functions, body->data.binary.right, name,
+                                              param_count, pure);
+        }
+
+        case EXPR_CALL: {
+            const char *callee = body->data.call.name;
+            int count = body->data.call.arg_count;
+            if (strcmp(callee, "if") == 0) {
+                if (count != 3) return "if() in its body takes 3 arguments";
+            } else if (strcmp(callee, "len") == 0) {
+                if (count != 1 || body->data.call.args[0]->type != EXPR_SYMBOL) {
+                    return "len() in its body takes a list name";
+                }
+                return NULL;
+            } else if (strcmp(callee, name) == 0) {
+                if (count != param_count) return "wrong number of arguments in a recursive call";
+            } else {
+                const ExprFunction *fn = function_lookup(functions, callee);
+                if (!fn || !fn->pure) *pure = 0;
+                if (fn && count != fn->param_count) {
+                    return "wrong number of arguments in a call in its body";
+                }
+            }
+            for (int i = 0; i < count; i++) {
+                const char *error = check_body(functions, body->data.call.args[i], name,
+                                               param_count, pure);
+                if (error) return error;
+            }
+            return NULL;
+        }
+
+        default:
+            return NULL;
+    }
+}
+
+int expr_function_define(ExprFunctions *functions, const char *name,
+                         const char *const *params, int param_count,
+                         Expr *body, const char **error) {
+    if (strcmp(name, "if") == 0 || strcmp(name, "len") == 0) {
+        *error = "if() and len() are built in";
+        return -1;
+    }
+    if (function_lookup(functions, name)) {
+        *error = "already defined";
+        return -1;
+    }
+    if (param_count > EXPR_MAX_PARAMS) {
+        *error = "more than 8 parameters";
+        return -1;
+    }
+    for (int i = 0; i < param_count; i++) {
+        for (int j = 0; j < i; j++) {
+            if (strcmp(params[i], params[j]) == 0) {
+                *error = "a parameter is named twice";
+                return -1;
+            }
+        }
+    }
+
+    ExprFunction *fn = calloc(1, sizeof(ExprFunction));
+    if (fn) fn->name = malloc(strlen(name) + 1);
+    if (fn && fn->name) fn->body = compile_body(body, params, param_count, 0);
+    if (!fn || !fn->name || !fn->body) {
+        if (fn) free(fn->name);
+        free(fn);
+        *error = "out of memory";
+        return -1;
+    }
+    strcpy(fn->name, name);
+    fn->param_count = param_count;
+    fn->pure = 1;
+    *error = check_body(functions, fn->body, name, param_count, &fn->pure);
+    if (*error) {
+        expr_free(fn->body);
+        free(fn->name);
+        free(fn);
+        return -1;
+    }
+
+    unsigned b = function_bucket(name);
+    fn->next = functions->buckets[b];
+    functions->buckets[b] = fn;
+    functions->count++;
+    return 0;
+}
+
+int expr_function_is_pure(const ExprFunctions *functions, const char *name) {
+    if (strcmp(name, "if") == 0 || strcmp(name, "len") == 0) return 1;
+    const ExprFunction *fn = function_lookup(functions, name);
+    return fn && fn->pure;
+}
+
+int expr_function_count(const ExprFunctions *functions) {
+    return functions ? functions->count : 0;
+}
+
+long expr_function_memo_count(const ExprFunctions *functions) {
+    long count = 0;
+    for (int b = 0; functions && b < FUNCTION_BUCKETS; b++) {
+        for (const ExprFunction *fn = functions->buckets[b]; fn; fn = fn->next) {
+            count += (long)fn->memo.count;
+        }
+    }
+    return count;
+}
+
+/* ========== Memoization ========== */
+
+static size_t memo_slot(const Memo *memo, const int32_t *args, int count) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < count; i++) {
+        h = (h ^ (uint32_t)args[i]) * 16777619u;
+    }
+    return h & memo->mask;
+}
+
+static int memo_find(const ExprFunction *fn, const int32_t *args, int32_t *value) {
+    const Memo *memo = &fn->memo;
+    if (!memo->used) return 0;
+    for (size_t slot = memo_slot(memo, args, fn->param_count); memo->used[slot];
+         slot = (slot + 1) & memo->mask) {
+        if (memcmp(&memo->keys[slot * fn->param_count], args,
+                   (size_t)fn->param_count * sizeof(int32_t)) == 0) {
+            *value = memo->values[slot];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void memo_store(ExprFunction *fn, const int32_t *args, int32_t value) {
+    Memo *memo = &fn->memo;
+    int n = fn->param_count;
+
+    if (memo->count >= EXPR_MEMO_LIMIT) return;
+    if (!memo->used || (memo->count + 1) * 2 > memo->mask + 1) {
+        Memo grown = { NULL, NULL, NULL, memo->used ? memo->mask * 2 + 1 : 63, 0 };
+        grown.keys = malloc((grown.mask + 1) * (size_t)(n > 0 ? n : 1) * sizeof(int32_t));
+        grown.values = malloc((grown.mask + 1) * sizeof(int32_t));
+        grown.used = calloc(grown.mask + 1, 1);
+        if (!grown.keys || !grown.values || !grown.used) {
+            free(grown.keys);
+            free(grown.values);
+            free(grown.used);
+            return;
+        }
+        for (size_t old = 0; memo->used && old <= memo->mask; old++) {
+            if (!memo->used[old]) continue;
+            size_t slot = memo_slot(&grown, &memo->keys[old * n], n);
+            while (grown.used[slot]) slot = (slot + 1) & grown.mask;
+            memcpy(&grown.keys[slot * n], &memo->keys[old * n], (size_t)n * sizeof(int32_t));
+            grown.values[slot] = memo->values[old];
+            grown.used[slot] = 1;
+            grown.count++;
+        }
+        free(memo->keys);
+        free(memo->values);
+        free(memo->used);
+        *memo = grown;
+    }
+
+    size_t slot = memo_slot(memo, args, n);
+    while (memo->used[slot]) slot = (slot + 1) & memo->mask;
+    memcpy(&memo->keys[slot * n], args, (size_t)n * sizeof(int32_t));
+    memo->values[slot] = value;
+    memo->used[slot] = 1;
+    memo->count++;
+}
+
+/* ========== Lists ========== */
+
+#define LIST_BUCKETS 64
+
+struct ExprList {
+    char *name;
+    void *data;              /* length elements of width bytes */
+    int length;
+    int width;               /* 1 and 2 are unsigned, 4 is int32_t */
+    int tag;
+    struct ExprList *next;
+};
+
+struct ExprLists {
+    ExprList *buckets[LIST_BUCKETS];
+    ExprList **order;        /* In definition order */
+    int count;
+    int capacity;
+};
+
+static unsigned list_bucket(const char *name) {
+    unsigned h = 5381;
+    while (*name) h = h * 33 + (unsigned char)*name++;
+    return h % LIST_BUCKETS;
+}
+
+ExprLists *expr_lists_create(void) {
+    return calloc(1, sizeof(ExprLists));
+}
+
+void expr_lists_free(ExprLists *lists) {
+    if (!lists) return;
+    for (int i = 0; i < lists->count; i++) {
+        free(lists->order[i]->name);
+        free(lists->order[i]->data);
+        free(lists->order[i]);
+    }
+    free(lists->order);
+    free(lists);
+}
+
+const ExprList *expr_list_find(const ExprLists *lists, const char *name) {
+    if (!lists) return NULL;
+    for (const ExprList *list = lists->buckets[list_bucket(name)]; list; list = list->next) {
+        if (strcmp(list->name, name) == 0) return list;
+    }
+    return NULL;
+}
+
+int expr_list_define(ExprLists *lists, const char *name, const int32_t *values,
+                     int count, int tag, const char **error) {
+    if (expr_list_find(lists, name)) {
+        *error = "already defined";
+        return -1;
+    }
+    if (count > EXPR_MAX_LIST) {
+        *error = "more than 65536 elements";
+        return -1;
+    }
+
+    int32_t min = 0, max = 0;
+    for (int i = 0; i < count; i++) {
+        if (values[i] < min) min = values[i];
+        if (values[i] > max) max = values[i];
+    }
+    int width = (min < 0 || max > 0xFFFF) ? 4 : (max > 0xFF ? 2 : 1);
+
+    if (lists->count == lists->capacity) {
+        int capacity = lists->capacity ? lists->capacity * 2 : 16;
+        ExprList **order = realloc(lists->order, (size_t)capacity * sizeof(ExprList *));
+        if (!order) {
+            *error = "out of memory";
+            return -1;
+        }
+        lists->order = order;
+        lists->capacity = capacity;
+    }
+    ExprList *list = calloc(1, sizeof(ExprList));
+    if (list) list->name = malloc(strlen(name) + 1);
+    if (list && list->name) list->data = malloc((size_t)(count > 0 ? count : 1) * (size_t)width);
+    if (!list || !list->name || !list->data) {
+        if (list) free(list->name);
+        free(list);
+        *error = "out of memory";
+        return -1;
+    }
+    strcpy(list->name, name);
+    list->length = count;
+    list->width = width;
+    list->tag = tag;
+    for (int i = 0; i < count; i++) {
+        if (width == 1) ((uint8_t *)list->data)[i] = (uint8_t)values[i];
+        else if (width == 2) ((uint16_t *)list->data)[i] = (uint16_t)values[i];
+        else ((int32_t *)list->data)[i] = values[i];
+    }
+
+    unsigned b = list_bucket(name);
+    list->next = lists->buckets[b];
+    lists->buckets[b] = list;
+    lists->order[lists->count++] = list;
+    return 0;
+}
+
+const char *expr_list_name(const ExprList *list) {
+    return list->name;
+}
+
+int expr_list_length(const ExprList *list) {
+    return list->length;
+}
+
+int32_t expr_list_get(const ExprList *list, int index) {
+    if (list->width == 1) return ((const uint8_t *)list->data)[index];
+    if (list->width == 2) return ((const uint16_t *)list->data)[index];
+    return ((const int32_t *)list->data)[index];
+}
+
+int expr_list_tag(const ExprList *list) {
+    return list->tag;
+}
+
+int expr_list_count(const ExprLists *lists) {
+    return lists ? lists->count : 0;
+}
+
+const ExprList *expr_list_at(const ExprLists *lists, int i) {
+    return lists->order[i];
+}
+
+long expr_list_bytes(const ExprLists *lists) {
+    long bytes = 0;
+    for (int i = 0; i < expr_list_count(lists); i++) {
+        bytes += (long)lists->order[i]->length * lists->order[i]->width;
+    }
+    return bytes;
+}
+
 /* ========== Expression Evaluation ========== */
 
 /* Helper to mangle local label name with zone */
@@ -539,8 +1226,146 @@ static char *mangle_local_name(const char *name, const char *zone) {
     return mangled;
 }
 
+/* What an expression is evaluated against; args are those of the
+ * function whose body is being evaluated */
+typedef struct {
+    SymbolTable *symbols;
+    AnonLabels *anon;
+    uint16_t pc;
+    int pass;
+    const char *current_zone;
+    const int32_t *args;
+    int depth;               /* Calls entered */
+} EvalContext;
+
+static ExprResult eval(Expr *expr, const EvalContext *ctx);
+
+/* The list called name; a missing one is unknown in pass 1 and an error
+ * after that */
+static const ExprList *eval_list(const char *name, const EvalContext *ctx, ExprResult *result) {
+    const ExprList *list = expr_list_find(ctx->symbols ? ctx->symbols->lists : NULL, name);
+    if (!list && ctx->pass != 1) result->error = "no list of that name";
+    return list;
+}
+
+static ExprResult eval_list_length(const char *name, const EvalContext *ctx) {
+    ExprResult result = { 0, 0, 0, NULL, NULL };
+    const ExprList *list = eval_list(name, ctx, &result);
+    if (list) {
+        result.value = expr_list_length(list);
+        result.defined = 1;
+        result.is_zeropage = (result.value <= 0xFF);
+    }
+    return result;
+}
+
+/* name[index]; a negative index counts back from the end */
+static ExprResult eval_index(Expr *expr, const EvalContext *ctx) {
+    ExprResult index = eval(expr->data.index.index, ctx);
+    if (!index.defined) return index;
+
+    ExprResult result = { 0, 0, 0, NULL, NULL };
+    const ExprList *list = eval_list(expr->data.index.name, ctx, &result);
+    if (!list) return result;
+    int length = expr_list_length(list);
+    int32_t i = index.value < 0 ? index.value + length : index.value;
+    if (i < 0 || i >= length) {
+        result.error = "list index out of range";
+        return result;
+    }
+    result.value = expr_list_get(list, i);
+    result.defined = 1;
+    result.is_zeropage = (result.value >= 0 && result.value <= 0xFF);
+    return result;
+}
+
+/* Value of a call: if() picks one argument to evaluate, anything else
+ * binds the argument values to a function's parameter slots */
+static ExprResult eval_call(Expr *expr, const EvalContext *ctx) {
+    ExprResult result = { 0, 0, 0, NULL, NULL };
+    const char *name = expr->data.call.name;
+    int count = expr->data.call.arg_count;
+
+    if (is_builtin_if(expr)) {
+        if (count != 3) {
+            result.error = "if() takes 3 arguments";
+            result.function = name;
+            return result;
+        }
+        ExprResult cond = eval(expr->data.call.args[0], ctx);
+        if (!cond.defined) return cond;
+        return eval(expr->data.call.args[cond.value ? 1 : 2], ctx);
+    }
+    if (strcmp(name, "len") == 0) {
+        if (count != 1 || expr->data.call.args[0]->type != EXPR_SYMBOL) {
+            result.error = "len() takes a list name";
+            result.function = name;
+            return result;
+        }
+        return eval_list_length(expr->data.call.args[0]->data.symbol, ctx);
+    }
+
+    ExprFunction *fn = function_lookup(ctx->symbols ? ctx->symbols->functions : NULL, name);
+    if (!fn) {
+        /* Like a symbol, a function may be defined later in pass 1 */
+        if (ctx->pass != 1) {
+            result.error = "not defined";
+            result.function = name;
+        }
+        return result;
+    }
+    if (count != fn->param_count) {
+        result.error = "wrong number of arguments";
+        result.function = name;
+        return result;
+    }
+
+    int32_t args[EXPR_MAX_PARAMS];
+    int defined = 1;
+    for (int i = 0; i < count; i++) {
+        ExprResult arg = eval(expr->data.call.args[i], ctx);
+        if (arg.error) return arg;
+        defined = defined && arg.defined;
+        args[i] = arg.value;
+    }
+    /* An unknown argument makes the value unknown without running the body */
+    if (!defined) return result;
+
+    if (fn->pure && memo_find(fn, args, &result.value)) {
+        result.defined = 1;
+        result.is_zeropage = (result.value >= 0 && result.value <= 0xFF);
+        return result;
+    }
+    if (ctx->depth >= EXPR_MAX_CALL_DEPTH) {
+        result.error = "calls nested deeper than 256";
+        result.function = name;
+        return result;
+    }
+
+    EvalContext inner = *ctx;
+    inner.args = args;
+    inner.depth = ctx->depth + 1;
+    result = eval(fn->body, &inner);
+
+    /* Pass 2 may run on several threads at once, so only pass 1 remembers */
+    if (fn->pure && result.defined && !result.error && ctx->pass == 1) {
+        memo_store(fn, args, result.value);
+    }
+    return result;
+}
+
 ExprResult expr_eval(Expr *expr, SymbolTable *symbols, AnonLabels *anon, uint16_t pc, int pass, const char *current_zone) {
-    ExprResult result = { 0, 1, 0 };  /* Default: value=0, defined=true */
+    EvalContext ctx = { symbols, anon, pc, pass, current_zone, NULL, 0 };
+    return eval(expr, &ctx);
+}
+
+static ExprResult eval(Expr *expr, const EvalContext *ctx) {
+    SymbolTable *symbols = ctx->symbols;
+    AnonLabels *anon = ctx->anon;
+    uint16_t pc = ctx->pc;
+    int pass = ctx->pass;
+    const char *current_zone = ctx->current_zone;
+    ExprResult result = { 0, 1, 0, NULL, NULL };  /* Default: value=0, defined=true */
 
     if (!expr) {
         result.defined = 0;
@@ -631,9 +1456,30 @@ ExprResult expr_eval(Expr *expr, SymbolTable *symbols, AnonLabels *anon, uint16_
             break;
         }
 
+        case EXPR_CALL:
+            result = eval_call(expr, ctx);
+            break;
+
+        case EXPR_PARAM:
+            result.value = ctx->args ? ctx->args[expr->data.param] : 0;
+            result.defined = ctx->args != NULL;
+            result.is_zeropage = (result.value >= 0 && result.value <= 0xFF);
+            break;
+
+        case EXPR_INDEX:
+            result = eval_index(expr, ctx);
+            break;
+
+        case EXPR_LIST:
+            result.defined = 0;
+            result.error = "a list is not a number";
+            break;
+
         case EXPR_UNARY: {
-            ExprResult operand = expr_eval(expr->data.unary.operand, symbols, anon, pc, pass, current_zone);
+            ExprResult operand = eval(expr->data.unary.operand, ctx);
             result.defined = operand.defined;
+            result.error = operand.error;
+            result.function = operand.function;
 
             switch (expr->data.unary.op) {
                 case UNARY_NEG:
@@ -658,9 +1504,11 @@ ExprResult expr_eval(Expr *expr, SymbolTable *symbols, AnonLabels *anon, uint16_
         }
 
         case EXPR_BINARY: {
-            ExprResult left = expr_eval(expr->data.binary.left, symbols, anon, pc, pass, current_zone);
-            ExprResult right = expr_eval(expr->data.binary.right, symbols, anon, pc, pass, current_zone);
+            ExprResult left = eval(expr->data.binary.left, ctx);
+            ExprResult right = eval(expr->data.binary.right, ctx);
             result.defined = left.defined && right.defined;
+            result.error = left.error ? left.error : right.error;
+            result.function = left.error ? left.function : right.function;
 
             switch (expr->data.binary.op) {
                 case BINARY_ADD:
@@ -733,6 +1581,111 @@ ExprResult expr_eval(Expr *expr, SymbolTable *symbols, AnonLabels *anon, uint16_
     return result;
 }
 
+int expr_list_eval(Expr *list, SymbolTable *symbols, AnonLabels *anon, uint16_t pc,
+                   int pass, const char *current_zone,
+                   int32_t **values, int *count, ExprResult *failed) {
+    EvalContext ctx = { symbols, anon, pc, pass, current_zone, NULL, 0 };
+    ExprResult none = { 0, 0, 0, NULL, NULL };
+    *failed = none;
+    *values = NULL;
+    *count = 0;
+
+    /* Another list by name */
+    if (list->type == EXPR_SYMBOL) {
+        const ExprList *from = eval_list(list->data.symbol, &ctx, failed);
+        if (!from) {
+            if (!failed->error) failed->error = "a list must be known where it is copied";
+            return -1;
+        }
+        int n = expr_list_length(from);
+        *values = malloc((size_t)(n > 0 ? n : 1) * sizeof(int32_t));
+        if (!*values) {
+            failed->error = "out of memory";
+            return -1;
+        }
+        for (int i = 0; i < n; i++) (*values)[i] = expr_list_get(from, i);
+        *count = n;
+        return 0;
+    }
+    if (list->type != EXPR_LIST) {
+        failed->error = "expected a list";
+        return -1;
+    }
+
+    Expr **items = list->data.list.items;
+    if (!list->data.list.var) {
+        int n = list->data.list.count;
+        *values = malloc((size_t)(n > 0 ? n : 1) * sizeof(int32_t));
+        if (!*values) {
+            failed->error = "out of memory";
+            return -1;
+        }
+        for (int i = 0; i < n; i++) {
+            ExprResult r = eval(items[i], &ctx);
+            if (!r.defined) {
+                *failed = r;
+                free(*values);
+                *values = NULL;
+                return -1;
+            }
+            (*values)[i] = r.value;
+        }
+        *count = n;
+        return 0;
+    }
+
+    /* [body for var, start, end] counts like !for */
+    ExprResult start = eval(items[1], &ctx);
+    ExprResult end = eval(items[2], &ctx);
+    if (!start.defined || !end.defined) {
+        *failed = start.defined ? end : start;
+        return -1;
+    }
+    int64_t n = (int64_t)end.value - start.value;
+    n = (n < 0 ? -n : n) + 1;
+    if (n > EXPR_MAX_LIST) {
+        failed->error = "more than 65536 elements";
+        return -1;
+    }
+    const char *var = list->data.list.var;
+    Expr *body = compile_body(items[0], &var, 1, 0);
+    *values = malloc((size_t)n * sizeof(int32_t));
+    if (!body || !*values) {
+        expr_free(body);
+        free(*values);
+        *values = NULL;
+        failed->error = "out of memory";
+        return -1;
+    }
+    int32_t step = start.value <= end.value ? 1 : -1;
+    int32_t i = start.value;
+    ctx.args = &i;
+    for (int k = 0; k < n; k++, i += step) {
+        ExprResult r = eval(body, &ctx);
+        if (!r.defined) {
+            *failed = r;
+            expr_free(body);
+            free(*values);
+            *values = NULL;
+            return -1;
+        }
+        (*values)[k] = r.value;
+    }
+    expr_free(body);
+    *count = (int)n;
+    return 0;
+}
+
+Expr *expr_bind(const Expr *expr, const char *var) {
+    return compile_body(expr, &var, 1, 1);
+}
+
+ExprResult expr_eval_bound(Expr *expr, SymbolTable *symbols, AnonLabels *anon, uint16_t pc,
+                           int pass, const char *current_zone, int32_t value) {
+    EvalContext ctx = { symbols, anon, pc, pass, current_zone, &value, 0 };
+    return eval(expr, &ctx);
+}
+
 int32_t expr_eval_value(Expr *expr, SymbolTable *symbols, uint16_t pc) {
     ExprResult result = expr_eval(expr, symbols, NULL, pc, 2, NULL);
     return result.value;
@@ -752,10 +1705,84 @@ int expr_has_symbols(Expr *expr) {
         case EXPR_BINARY:
             return expr_has_symbols(expr->data.binary.left) ||
                    expr_has_symbols(expr->data.binary.right);
+        case EXPR_CALL:
+        case EXPR_INDEX:
+        case EXPR_LIST:
+            /* The body may read symbols; a list is looked up by name */
+            return 1;
+        case EXPR_PARAM:
+            return 0;
     }
     return 0;
 }
 
+void expr_visit_symbols(Expr *expr, const char *current_zone,
+                        void (*fn)(const char *name, void *userdata),
+                        void *userdata) {
+    if (!expr) return;
+
+    switch (expr->type) {
+        case EXPR_NUMBER:
+        case EXPR_CURRENT:
+            break;
+        case EXPR_SYMBOL: {
+            const char *name = expr->data.symbol;
+            if (name[0] == '.') {
+                char *mangled = mangle_local_name(name, current_zone);
+                fn(mangled ? mangled : name, userdata);
+                free(mangled);
+            } else {
+                fn(name, userdata);
+            }
+            break;
+        }
+        case EXPR_UNARY:
+            expr_visit_symbols(expr->data.unary.operand, current_zone, fn, userdata);
+            break;
+        case EXPR_BINARY:
+            expr_visit_symbols(expr->data.binary.left, current_zone, fn, userdata);
+            expr_visit_symbols(expr->data.binary.right, current_zone, fn, userdata);
+            break;
+        case EXPR_CALL: {
+            /* len(name) reads a list, not a symbol */
+            int is_len = strcmp(expr->data.call.name, "len") == 0 &&
+                         expr->data.call.arg_count == 1 &&
+                         expr->data.call.args[0]->type == EXPR_SYMBOL;
+            const char *target = is_len ? expr->data.call.args[0]->data.symbol
+                                        : expr->data.call.name;
+            size_t len = strlen(target) + 8;
+            char *name = malloc(len);
+            if (name) {
+                snprintf(name, len, is_len ? "__list_%s" : "__call_%s", target);
+                fn(name, userdata);
+                free(name);
+            }
+            for (int i = 0; !is_len && i < expr->data.call.arg_count; i++) {
+                expr_visit_symbols(expr->data.call.args[i], current_zone, fn, userdata);
+            }
+            break;
+        }
+        case EXPR_INDEX: {
+            size_t len = strlen(expr->data.index.name) + 8;
+            char *name = malloc(len);
+            if (name) {
+                snprintf(name, len, "__list_%s", expr->data.index.name);
+                fn(name, userdata);
+                free(name);
+            }
+            expr_visit_symbols(expr->data.index.index, current_zone, fn, userdata);
+            break;
+        }
+        case EXPR_LIST:
+            for (int i = 0; i < expr->data.list.count; i++) {
+                expr_visit_symbols(expr->data.list.items[i], current_zone, fn, userdata);
+            }
+            break;
+        case EXPR_PARAM:
+            break;
+    }
+}
+
 int expr_is_simple_number(Expr *expr) {
     return expr && expr->type == EXPR_NUMBER;
 }
@@ -818,6 +1845,29 @@ static void expr_print_internal(Expr *expr, int depth) {
             expr_print_internal(expr->data.binary.left, depth + 1);
             expr_print_internal(expr->data.binary.right, depth + 1);
             break;
+        case EXPR_CALL:
+            printf("CALL: %s\n", expr->data.call.name);
+            for (int i = 0; i < expr->data.call.arg_count; i++) {
+                expr_print_internal(expr->data.call.args[i], depth + 1);
+            }
+            break;
+        case EXPR_PARAM:
+            printf("PARAM: %d\n", expr->data.param);
+            break;
+        case EXPR_INDEX:
+            printf("INDEX: %s\n", expr->data.index.name);
+            expr_print_internal(expr->data.index.index, depth + 1);
+            break;
+        case EXPR_LIST:
+            if (expr->data.list.var) {
+                printf("LIST: for %s\n", expr->data.list.var);
+            } else {
+                printf("LIST: %d items\n", expr->data.list.count);
+            }
+            for (int i = 0; i < expr->data.list.count; i++) {
+                expr_print_internal(expr->data.list.items[i], depth + 1);
+            }
+            break;
     }
 }
 
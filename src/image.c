@@ -0,0 +1,894 @@
+/*
+ * image.c - PNG Import and C64 Graphics Conversion
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ *
+ * A self-contained PNG decoder (zlib inflate, scanline filters, every
+ * color type), matching to the C64 palette, and conversion to koala,
+ * hires, sprite and charset data with an on-disk cache of the results.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "image.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char *const mode_names[IMAGE_MODE_COUNT] = {
+    "koala", "hires", "sprites", "charset"
+};
+
+const char *image_mode_name(ImageMode mode) {
+    return (unsigned)mode < IMAGE_MODE_COUNT ? mode_names[mode] : "unknown";
+}
+
+int image_mode_lookup(const char *name) {
+    for (int i = 0; i < IMAGE_MODE_COUNT; i++) {
+        if (strcasecmp(mode_names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+/* ========== Inflate ========== */
+
+#define HUFF_MAX_BITS   15
+#define HUFF_MAX_LEN    286     /* Literal/length codes in a dynamic block */
+#define HUFF_MAX_DIST   30
+#define HUFF_FIXED_LEN  288
+
+typedef struct {
+    const uint8_t *in;
+    size_t in_size;
+    size_t in_pos;
+    uint32_t bit_buf;
+    int bit_count;
+    uint8_t *out;
+    size_t out_size;
+    size_t out_pos;
+} Inflate;
+
+/* Canonical Huffman code: code counts per length and symbols in code order */
+typedef struct {
+    short count[HUFF_MAX_BITS + 1];
+    short symbol[HUFF_FIXED_LEN];
+} Huffman;
+
+/* Next `need` bits, least significant first; -1 past the end of input */
+static int inflate_bits(Inflate *s, int need) {
+    uint32_t value = s->bit_buf;
+    while (s->bit_count < need) {
+        if (s->in_pos >= s->in_size) return -1;
+        value |= (uint32_t)s->in[s->in_pos++] << s->bit_count;
+        s->bit_count += 8;
+    }
+    s->bit_buf = value >> need;
+    s->bit_count -= need;
+    return (int)(value & ((1u << need) - 1));
+}
+
+/*
+ * Build a decoding table from code lengths. Returns 0 for a complete
+ * code, a positive number for an incomplete one, -1 if oversubscribed.
+ */
+static int huff_build(Huffman *h, const short *lengths, int n) {
+    short offsets[HUFF_MAX_BITS + 1];
+
+    for (int len = 0; len <= HUFF_MAX_BITS; len++) h->count[len] = 0;
+    for (int sym = 0; sym < n; sym++) h->count[lengths[sym]]++;
+    if (h->count[0] == n) return 0;
+
+    int left = 1;
+    for (int len = 1; len <= HUFF_MAX_BITS; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) return -1;
+    }
+
+    offsets[1] = 0;
+    for (int len = 1; len < HUFF_MAX_BITS; len++) {
+        offsets[len + 1] = (short)(offsets[len] + h->count[len]);
+    }
+    for (int sym = 0; sym < n; sym++) {
+        if (lengths[sym] != 0) h->symbol[offsets[lengths[sym]]++] = (short)sym;
+    }
+    return left;
+}
+
+static int huff_decode(Inflate *s, const Huffman *h) {
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= HUFF_MAX_BITS; len++) {
+        int bit = inflate_bits(s, 1);
+        if (bit < 0) return -1;
+        code |= bit;
+        int count = h->count[len];
+        if (code - count < first) return h->symbol[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static int inflate_stored(Inflate *s) {
+    s->bit_buf = 0;
+    s->bit_count = 0;
+    if (s->in_pos + 4 > s->in_size) return -1;
+
+    unsigned len = s->in[s->in_pos] | (s->in[s->in_pos + 1] << 8);
+    unsigned nlen = s->in[s->in_pos + 2] | (s->in[s->in_pos + 3] << 8);
+    s->in_pos += 4;
+    if (len != (~nlen & 0xFFFF)) return -1;
+    if (s->in_pos + len > s->in_size || s->out_pos + len > s->out_size) return -1;
+
+    memcpy(s->out + s->out_pos, s->in + s->in_pos, len);
+    s->in_pos += len;
+    s->out_pos += len;
+    return 0;
+}
+
+static int inflate_codes(Inflate *s, const Huffman *lencode, const Huffman *distcode) {
+    static const short len_base[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const short len_extra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static const short dist_base[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+        8193, 12289, 16385, 24577
+    };
+    static const short dist_extra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+
+    for (;;) {
+        int sym = huff_decode(s, lencode);
+        if (sym < 0) return -1;
+        if (sym < 256) {
+            if (s->out_pos >= s->out_size) return -1;
+            s->out[s->out_pos++] = (uint8_t)sym;
+            continue;
+        }
+        if (sym == 256) return 0;
+
+        sym -= 257;
+        if (sym >= 29) return -1;
+        int extra = inflate_bits(s, len_extra[sym]);
+        if (extra < 0) return -1;
+        size_t len = (size_t)(len_base[sym] + extra);
+
+        sym = huff_decode(s, distcode);
+        if (sym < 0 || sym >= 30) return -1;
+        extra = inflate_bits(s, dist_extra[sym]);
+        if (extra < 0) return -1;
+        size_t dist = (size_t)(dist_base[sym] + extra);
+
+        if (dist > s->out_pos || s->out_pos + len > s->out_size) return -1;
+        /* Byte by byte: the copy may overlap what it writes */
+        for (size_t i = 0; i < len; i++) {
+            s->out[s->out_pos] = s->out[s->out_pos - dist];
+            s->out_pos++;
+        }
+    }
+}
+
+static int inflate_fixed(Inflate *s) {
+    Huffman lencode, distcode;
+    short lengths[HUFF_FIXED_LEN];
+
+    for (int i = 0; i < 144; i++) lengths[i] = 8;
+    for (int i = 144; i < 256; i++) lengths[i] = 9;
+    for (int i = 256; i < 280; i++) lengths[i] = 7;
+    for (int i = 280; i < HUFF_FIXED_LEN; i++) lengths[i] = 8;
+    huff_build(&lencode, lengths, HUFF_FIXED_LEN);
+
+    for (int i = 0; i < HUFF_MAX_DIST; i++) lengths[i] = 5;
+    huff_build(&distcode, lengths, HUFF_MAX_DIST);
+
+    return inflate_codes(s, &lencode, &distcode);
+}
+
+static int inflate_dynamic(Inflate *s) {
+    static const short order[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+    short lengths[HUFF_MAX_LEN + HUFF_MAX_DIST];
+    Huffman lencode, distcode;
+
+    int nlen = inflate_bits(s, 5);
+    int ndist = inflate_bits(s, 5);
+    int ncode = inflate_bits(s, 4);
+    if (nlen < 0 || ndist < 0 || ncode < 0) return -1;
+    nlen += 257;
+    ndist += 1;
+    ncode += 4;
+    if (nlen > HUFF_MAX_LEN || ndist > HUFF_MAX_DIST) return -1;
+
+    /* Code lengths of the code-length code */
+    for (int i = 0; i < 19; i++) lengths[order[i]] = 0;
+    for (int i = 0; i < ncode; i++) {
+        int len = inflate_bits(s, 3);
+        if (len < 0) return -1;
+        lengths[order[i]] = (short)len;
+    }
+    if (huff_build(&lencode, lengths, 19) != 0) return -1;
+
+    /* Literal/length and distance code lengths */
+    for (int index = 0; index < nlen + ndist;) {
+        int sym = huff_decode(s, &lencode);
+        if (sym < 0) return -1;
+        if (sym < 16) {
+            lengths[index++] = (short)sym;
+            continue;
+        }
+
+        short len = 0;
+        int repeat;
+        if (sym == 16) {
+            if (index == 0) return -1;
+            len = lengths[index - 1];
+            repeat = inflate_bits(s, 2);
+            if (repeat < 0) return -1;
+            repeat += 3;
+        } else if (sym == 17) {
+            repeat = inflate_bits(s, 3);
+            if (repeat < 0) return -1;
+            repeat += 3;
+        } else {
+            repeat = inflate_bits(s, 7);
+            if (repeat < 0) return -1;
+            repeat += 11;
+        }
+        if (index + repeat > nlen + ndist) return -1;
+        while (repeat--) lengths[index++] = len;
+    }
+    if (lengths[256] == 0) return -1;
+
+    /* Incomplete codes are only allowed for a single code */
+    int err = huff_build(&lencode, lengths, nlen);
+    if (err < 0 || (err > 0 && nlen - lencode.count[0] != 1)) return -1;
+    err = huff_build(&distcode, lengths + nlen, ndist);
+    if (err < 0 || (err > 0 && ndist - distcode.count[0] != 1)) return -1;
+
+    return inflate_codes(s, &lencode, &distcode);
+}
+
+/* Inflate a zlib stream into exactly out_size bytes */
+static int zlib_inflate(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size) {
+    if (in_size < 2) return -1;
+    if ((in[0] & 0x0F) != 8 || ((in[0] << 8) | in[1]) % 31 != 0 || (in[1] & 0x20)) {
+        return -1;
+    }
+
+    Inflate s;
+    memset(&s, 0, sizeof(s));
+    s.in = in;
+    s.in_size = in_size;
+    s.in_pos = 2;
+    s.out = out;
+    s.out_size = out_size;
+
+    int last;
+    do {
+        last = inflate_bits(&s, 1);
+        int type = inflate_bits(&s, 2);
+        int result;
+        switch (type) {
+            case 0: result = inflate_stored(&s); break;
+            case 1: result = inflate_fixed(&s); break;
+            case 2: result = inflate_dynamic(&s); break;
+            default: result = -1; break;
+        }
+        if (last < 0 || result < 0) return -1;
+    } while (!last);
+
+    return s.out_pos == out_size ? 0 : -1;
+}
+
+/* ========== PNG ========== */
+
+static uint32_t read_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+/* Undo the per-row filters in place; rows are stride bytes after a filter byte */
+static int png_unfilter(uint8_t *data, int height, size_t stride, int bpp) {
+    uint8_t *prev = NULL;
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = data + (size_t)y * (stride + 1);
+        int filter = row[0];
+        uint8_t *cur = row + 1;
+        for (size_t i = 0; i < stride; i++) {
+            int a = i >= (size_t)bpp ? cur[i - bpp] : 0;
+            int b = prev ? prev[i] : 0;
+            int c = prev && i >= (size_t)bpp ? prev[i - bpp] : 0;
+            switch (filter) {
+                case 0: break;
+                case 1: cur[i] = (uint8_t)(cur[i] + a); break;
+                case 2: cur[i] = (uint8_t)(cur[i] + b); break;
+                case 3: cur[i] = (uint8_t)(cur[i] + ((a + b) >> 1)); break;
+                case 4: cur[i] = (uint8_t)(cur[i] + paeth(a, b, c)); break;
+                default: return -1;
+            }
+        }
+        prev = cur;
+    }
+    return 0;
+}
+
+/* Sample x of a row at depth bits, as the top 8 bits of its value */
+static int png_sample(const uint8_t *row, int x, int depth) {
+    switch (depth) {
+        case 16: return row[x * 2];
+        case 8: return row[x];
+        default: {
+            int per_byte = 8 / depth;
+            int shift = 8 - depth * (x % per_byte + 1);
+            return (row[x / per_byte] >> shift) & ((1 << depth) - 1);
+        }
+    }
+}
+
+int image_png_decode(const uint8_t *data, size_t size, int *width, int *height,
+                     uint8_t **rgba, const char **error) {
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    uint8_t palette[256][4];
+    int palette_size = 0;
+    int trns_key[3] = { -1, -1, -1 };
+    int w = 0, h = 0, depth = 0, color_type = -1;
+    uint8_t *idat = NULL;
+    size_t idat_size = 0;
+
+    *rgba = NULL;
+    if (size < 8 || memcmp(data, signature, 8) != 0) {
+        *error = "not a PNG file";
+        return -1;
+    }
+    for (int i = 0; i < 256; i++) {
+        palette[i][0] = palette[i][1] = palette[i][2] = 0;
+        palette[i][3] = 0xFF;
+    }
+
+    /* Chunks: length, type, data, CRC */
+    size_t pos = 8;
+    int seen_end = 0;
+    while (pos + 12 <= size && !seen_end) {
+        uint32_t length = read_be32(data + pos);
+        const uint8_t *type = data + pos + 4;
+        const uint8_t *body = data + pos + 8;
+        if (length > size - pos - 12) {
+            *error = "truncated PNG chunk";
+            free(idat);
+            return -1;
+        }
+
+        if (memcmp(type, "IHDR", 4) == 0 && length >= 13) {
+            w = (int)read_be32(body);
+            h = (int)read_be32(body + 4);
+            depth = body[8];
+            color_type = body[9];
+            if (body[12] != 0) {
+                *error = "interlaced PNG is not supported";
+                free(idat);
+                return -1;
+            }
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            palette_size = (int)(length / 3);
+            if (palette_size > 256) palette_size = 256;
+            for (int i = 0; i < palette_size; i++) {
+                palette[i][0] = body[i * 3];
+                palette[i][1] = body[i * 3 + 1];
+                palette[i][2] = body[i * 3 + 2];
+            }
+        } else if (memcmp(type, "tRNS", 4) == 0) {
+            if (color_type == 3) {
+                for (uint32_t i = 0; i < length && i < 256; i++) palette[i][3] = body[i];
+            } else if (color_type == 0 && length >= 2) {
+                trns_key[0] = (body[0] << 8) | body[1];
+            } else if (color_type == 2 && length >= 6) {
+                for (int c = 0; c < 3; c++) trns_key[c] = (body[c * 2] << 8) | body[c * 2 + 1];
+            }
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            uint8_t *grown = realloc(idat, idat_size + length + 1);
+            if (!grown) {
+                *error = "out of memory";
+                free(idat);
+                return -1;
+            }
+            idat = grown;
+            memcpy(idat + idat_size, body, length);
+            idat_size += length;
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            seen_end = 1;
+        }
+        pos += 12 + length;
+    }
+
+    int channels;
+    switch (color_type) {
+        case 0: channels = 1; break;
+        case 2: channels = 3; break;
+        case 3: channels = 1; break;
+        case 4: channels = 2; break;
+        case 6: channels = 4; break;
+        default:
+            *error = color_type < 0 ? "PNG has no IHDR chunk" : "unknown PNG color type";
+            free(idat);
+            return -1;
+    }
+    int depth_ok = depth == 8 || depth == 16 ||
+                   ((color_type == 0 || color_type == 3) && (depth == 1 || depth == 2 || depth == 4));
+    if (!depth_ok || (color_type == 3 && depth == 16)) {
+        *error = "unsupported PNG bit depth";
+        free(idat);
+        return -1;
+    }
+    if (w <= 0 || h <= 0 || w > IMAGE_MAX_SIZE || h > IMAGE_MAX_SIZE) {
+        *error = "PNG size out of range";
+        free(idat);
+        return -1;
+    }
+    if (!idat) {
+        *error = "PNG has no image data";
+        return -1;
+    }
+
+    int bits = channels * depth;
+    size_t stride = ((size_t)w * bits + 7) / 8;
+    size_t raw_size = (stride + 1) * (size_t)h;
+    uint8_t *raw = malloc(raw_size);
+    uint8_t *out = malloc((size_t)w * h * 4);
+    if (!raw || !out) {
+        *error = "out of memory";
+        free(raw);
+        free(out);
+        free(idat);
+        return -1;
+    }
+    if (zlib_inflate(idat, idat_size, raw, raw_size) < 0) {
+        *error = "corrupt PNG image data";
+        free(raw);
+        free(out);
+        free(idat);
+        return -1;
+    }
+    free(idat);
+    if (png_unfilter(raw, h, stride, bits >= 8 ? bits / 8 : 1) < 0) {
+        *error = "corrupt PNG scanline filter";
+        free(raw);
+        free(out);
+        return -1;
+    }
+
+    /* Scale low-depth gray to 8 bits; 16-bit samples keep the high byte */
+    int gray_scale = depth < 8 ? 255 / ((1 << depth) - 1) : 1;
+    for (int y = 0; y < h; y++) {
+        const uint8_t *row = raw + (size_t)y * (stride + 1) + 1;
+        for (int x = 0; x < w; x++) {
+            uint8_t *px = out + ((size_t)y * w + x) * 4;
+            switch (color_type) {
+                case 0: {
+                    int v = png_sample(row, x, depth);
+                    int key = depth == 16 ? (row[x * 2] << 8) | row[x * 2 + 1] : v;
+                    px[0] = px[1] = px[2] = (uint8_t)(v * gray_scale);
+                    px[3] = key == trns_key[0] ? 0 : 0xFF;
+                    break;
+                }
+                case 2: {
+                    int key = 1;
+                    for (int c = 0; c < 3; c++) {
+                        px[c] = (uint8_t)png_sample(row, x * 3 + c, depth);
+                        int full = depth == 16 ? (row[(x * 3 + c) * 2] << 8) | row[(x * 3 + c) * 2 + 1]
+                                               : px[c];
+                        if (full != trns_key[c]) key = 0;
+                    }
+                    px[3] = key ? 0 : 0xFF;
+                    break;
+                }
+                case 3: {
+                    int index = png_sample(row, x, depth);
+                    memcpy(px, palette[index], 4);
+                    break;
+                }
+                case 4:
+                    px[0] = px[1] = px[2] = (uint8_t)png_sample(row, x * 2, depth);
+                    px[3] = (uint8_t)png_sample(row, x * 2 + 1, depth);
+                    break;
+                default:
+                    for (int c = 0; c < 4; c++) px[c] = (uint8_t)png_sample(row, x * 4 + c, depth);
+                    break;
+            }
+        }
+    }
+
+    free(raw);
+    *width = w;
+    *height = h;
+    *rgba = out;
+    return 0;
+}
+
+/* ========== Palette ========== */
+
+/* The C64 palette as measured by Pepto */
+static const uint8_t c64_palette[IMAGE_COLORS][3] = {
+    { 0x00, 0x00, 0x00 },    /* 0 black */
+    { 0xFF, 0xFF, 0xFF },    /* 1 white */
+    { 0x68, 0x37, 0x2B },    /* 2 red */
+    { 0x70, 0xA4, 0xB2 },    /* 3 cyan */
+    { 0x6F, 0x3D, 0x86 },    /* 4 purple */
+    { 0x58, 0x8D, 0x43 },    /* 5 green */
+    { 0x35, 0x28, 0x79 },    /* 6 blue */
+    { 0xB8, 0xC7, 0x6F },    /* 7 yellow */
+    { 0x6F, 0x4F, 0x25 },    /* 8 orange */
+    { 0x43, 0x39, 0x00 },    /* 9 brown */
+    { 0x9A, 0x67, 0x59 },    /* 10 light red */
+    { 0x44, 0x44, 0x44 },    /* 11 dark grey */
+    { 0x6C, 0x6C, 0x6C },    /* 12 grey */
+    { 0x9A, 0xD2, 0x84 },    /* 13 light green */
+    { 0x6C, 0x5E, 0xB5 },    /* 14 light blue */
+    { 0x95, 0x95, 0x95 }     /* 15 light grey */
+};
+
+static int color_distance(int a, int b) {
+    int dr = c64_palette[a][0] - c64_palette[b][0];
+    int dg = c64_palette[a][1] - c64_palette[b][1];
+    int db = c64_palette[a][2] - c64_palette[b][2];
+    return dr * dr + dg * dg + db * db;
+}
+
+int image_nearest_color(uint8_t r, uint8_t g, uint8_t b) {
+    int best = 0;
+    long best_distance = -1;
+    for (int i = 0; i < IMAGE_COLORS; i++) {
+        long dr = r - c64_palette[i][0];
+        long dg = g - c64_palette[i][1];
+        long db = b - c64_palette[i][2];
+        long distance = dr * dr + dg * dg + db * db;
+        if (best_distance < 0 || distance < best_distance) {
+            best = i;
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+int image_load(const uint8_t *data, size_t size, C64Image *image, const char **error) {
+    uint8_t *rgba;
+    memset(image, 0, sizeof(*image));
+    if (image_png_decode(data, size, &image->width, &image->height, &rgba, error) < 0) {
+        return -1;
+    }
+
+    size_t count = (size_t)image->width * image->height;
+    image->pixels = malloc(count);
+    if (!image->pixels) {
+        *error = "out of memory";
+        free(rgba);
+        return -1;
+    }
+
+    /* Images use few distinct colors; remember the last match */
+    uint32_t last_rgb = 0xFFFFFFFF;
+    int last_color = 0;
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *px = rgba + i * 4;
+        if (px[3] < 0x80) {
+            image->pixels[i] = IMAGE_TRANSPARENT;
+            continue;
+        }
+        uint32_t rgb = ((uint32_t)px[0] << 16) | ((uint32_t)px[1] << 8) | px[2];
+        if (rgb != last_rgb) {
+            last_rgb = rgb;
+            last_color = image_nearest_color(px[0], px[1], px[2]);
+        }
+        image->pixels[i] = (uint8_t)last_color;
+    }
+
+    free(rgba);
+    return 0;
+}
+
+void image_free(C64Image *image) {
+    free(image->pixels);
+    image->pixels = NULL;
+}
+
+/* ========== Conversion ========== */
+
+int image_output_size(ImageMode mode, int width, int height, const char **error) {
+    switch (mode) {
+        case IMAGE_KOALA:
+            if ((width != 160 && width != 320) || height != 200) {
+                *error = "koala needs a 160x200 or 320x200 image";
+                return -1;
+            }
+            return IMAGE_KOALA_SIZE;
+        case IMAGE_HIRES:
+            if (width != 320 || height != 200) {
+                *error = "hires needs a 320x200 image";
+                return -1;
+            }
+            return IMAGE_HIRES_SIZE;
+        case IMAGE_SPRITES:
+            if (width % 24 != 0 || height % 21 != 0) {
+                *error = "sprites need a width that is a multiple of 24 and a height that is a multiple of 21";
+                return -1;
+            }
+            return (width / 24) * (height / 21) * IMAGE_SPRITE_SIZE;
+        case IMAGE_CHARSET:
+            if (width % 8 != 0 || height % 8 != 0) {
+                *error = "charset needs a width and height that are multiples of 8";
+                return -1;
+            }
+            return (width / 8) * (height / 8) * 8;
+        default:
+            *error = "unknown image mode";
+            return -1;
+    }
+}
+
+typedef struct {
+    const C64Image *image;
+    int background;
+    int cells_across;        /* Cells per row of the image */
+    int x_step;              /* Source pixels per output pixel */
+    uint8_t *out;
+    ImageMode mode;
+} Conversion;
+
+/* Color of source pixel (x, y); transparency shows the background */
+static int pixel_at(const Conversion *conv, int x, int y) {
+    int color = conv->image->pixels[(size_t)y * conv->image->width + x * conv->x_step];
+    return color == IMAGE_TRANSPARENT ? conv->background : color;
+}
+
+/* The `wanted` most used colors other than skip, most used first, then lowest
+ * color first; unused slots are 0 */
+static void top_colors(const int counts[IMAGE_COLORS], int skip, int wanted, int *colors) {
+    int taken[IMAGE_COLORS] = { 0 };
+    for (int n = 0; n < wanted; n++) {
+        int best = -1;
+        for (int c = 0; c < IMAGE_COLORS; c++) {
+            if (c == skip || taken[c] || counts[c] == 0) continue;
+            if (best < 0 || counts[c] > counts[best]) best = c;
+        }
+        colors[n] = best < 0 ? 0 : best;
+        if (best >= 0) taken[best] = 1;
+    }
+}
+
+/* Index of the choice a color is, or of the nearest choice by palette distance */
+static int pick(int color, const int *choices, int count) {
+    int best = 0;
+    for (int i = 0; i < count; i++) {
+        if (choices[i] == color) return i;
+        if (color_distance(color, choices[i]) < color_distance(color, choices[best])) best = i;
+    }
+    return best;
+}
+
+/* One 8x8 (hires) or 4x8 (koala) bitmap cell */
+static void convert_bitmap_cell(const Conversion *conv, int cell) {
+    int cx = cell % 40, cy = cell / 40;
+    int koala = conv->mode == IMAGE_KOALA;
+    int cell_w = koala ? 4 : 8;
+    int counts[IMAGE_COLORS] = { 0 };
+
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < cell_w; x++) {
+            counts[pixel_at(conv, cx * cell_w + x, cy * 8 + y)]++;
+        }
+    }
+
+    int choices[4];
+    uint8_t *bitmap = conv->out + cell * 8;
+    uint8_t *screen = conv->out + IMAGE_BITMAP_SIZE + cell;
+    if (koala) {
+        /* 00 background, 01/10 screen high/low nibble, 11 color RAM */
+        choices[0] = conv->background;
+        top_colors(counts, conv->background, 3, choices + 1);
+        *screen = (uint8_t)((choices[1] << 4) | choices[2]);
+        conv->out[IMAGE_BITMAP_SIZE + IMAGE_SCREEN_SIZE + cell] = (uint8_t)choices[3];
+    } else {
+        /* 0 the most used color (screen low nibble), 1 the next (high nibble) */
+        top_colors(counts, -1, 2, choices);
+        *screen = (uint8_t)((choices[1] << 4) | choices[0]);
+    }
+
+    for (int y = 0; y < 8; y++) {
+        uint8_t byte = 0;
+        for (int x = 0; x < cell_w; x++) {
+            int color = pixel_at(conv, cx * cell_w + x, cy * 8 + y);
+            if (koala) {
+                byte = (uint8_t)((byte << 2) | pick(color, choices, 4));
+            } else {
+                byte = (uint8_t)((byte << 1) | pick(color, choices, 2));
+            }
+        }
+        bitmap[y] = byte;
+    }
+}
+
+/* One sprite or character: a bit for each pixel that is not the background */
+static void convert_shape_cell(const Conversion *conv, int cell) {
+    int sprite = conv->mode == IMAGE_SPRITES;
+    int cell_w = sprite ? 24 : 8, cell_h = sprite ? 21 : 8;
+    int left = (cell % conv->cells_across) * cell_w;
+    int top = (cell / conv->cells_across) * cell_h;
+    uint8_t *out = conv->out + (size_t)cell * (sprite ? IMAGE_SPRITE_SIZE : 8);
+
+    for (int y = 0; y < cell_h; y++) {
+        for (int x = 0; x < cell_w; x++) {
+            if (pixel_at(conv, left + x, top + y) != conv->background) {
+                out[y * (cell_w / 8) + x / 8] |= (uint8_t)(0x80 >> (x % 8));
+            }
+        }
+    }
+}
+
+static void convert_task(void *arg, int index) {
+    const Conversion *conv = arg;
+    if (conv->mode == IMAGE_KOALA || conv->mode == IMAGE_HIRES) {
+        convert_bitmap_cell(conv, index);
+    } else {
+        convert_shape_cell(conv, index);
+    }
+}
+
+int image_convert(const C64Image *image, const ImageOptions *options, ThreadPool *pool,
+                  uint8_t **out, int *length, const char **error) {
+    int size = image_output_size(options->mode, image->width, image->height, error);
+    if (size < 0) return -1;
+
+    Conversion conv;
+    conv.image = image;
+    conv.mode = options->mode;
+    conv.x_step = options->mode == IMAGE_KOALA && image->width == 320 ? 2 : 1;
+    conv.out = calloc((size_t)size, 1);
+    if (!conv.out) {
+        *error = "out of memory";
+        return -1;
+    }
+
+    /* Without a given background, the most common color is it */
+    conv.background = options->background;
+    if (conv.background < 0) {
+        long counts[IMAGE_COLORS] = { 0 };
+        size_t count = (size_t)image->width * image->height;
+        for (size_t i = 0; i < count; i++) {
+            if (image->pixels[i] != IMAGE_TRANSPARENT) counts[image->pixels[i]]++;
+        }
+        conv.background = 0;
+        for (int c = 1; c < IMAGE_COLORS; c++) {
+            if (counts[c] > counts[conv.background]) conv.background = c;
+        }
+    }
+
+    int cells;
+    switch (options->mode) {
+        case IMAGE_KOALA:
+        case IMAGE_HIRES:
+            conv.cells_across = 40;
+            cells = IMAGE_SCREEN_SIZE;
+            break;
+        case IMAGE_SPRITES:
+            conv.cells_across = image->width / 24;
+            cells = size / IMAGE_SPRITE_SIZE;
+            break;
+        default:
+            conv.cells_across = image->width / 8;
+            cells = size / 8;
+            break;
+    }
+
+    if (pool) {
+        threadpool_run(pool, convert_task, &conv, cells);
+    } else {
+        for (int i = 0; i < cells; i++) convert_task(&conv, i);
+    }
+    if (options->mode == IMAGE_KOALA) conv.out[size - 1] = (uint8_t)conv.background;
+
+    *out = conv.out;
+    *length = size;
+    return 0;
+}
+
+/* ========== Conversion Cache ========== */
+
+#define CACHE_MAGIC         "asm64-image 1\n"
+#define CACHE_MAGIC_LEN     14
+
+static uint64_t fnv1a(uint64_t hash, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+uint64_t image_cache_key(const uint8_t *data, size_t size, const ImageOptions *options) {
+    uint8_t params[2] = { (uint8_t)options->mode, (uint8_t)options->background };
+    uint64_t hash = fnv1a(0xCBF29CE484222325ULL, data, size);
+    return fnv1a(hash, params, sizeof(params));
+}
+
+static char *cache_path(const char *dir, uint64_t key, const char *suffix) {
+    size_t size = strlen(dir) + 40;
+    char *path = malloc(size);
+    if (path) {
+        snprintf(path, size, "%s/%08lx%08lx.c64%s", dir, (unsigned long)(key >> 32),
+                 (unsigned long)(key & 0xFFFFFFFF), suffix);
+    }
+    return path;
+}
+
+int image_cache_load(const char *dir, uint64_t key, uint8_t **out, int *length) {
+    char *path = cache_path(dir, key, "");
+    if (!path) return -1;
+    FILE *f = fopen(path, "rb");
+    free(path);
+    if (!f) return -1;
+
+    char magic[CACHE_MAGIC_LEN];
+    uint8_t header[4];
+    int result = -1;
+    if (fread(magic, 1, CACHE_MAGIC_LEN, f) == CACHE_MAGIC_LEN &&
+        memcmp(magic, CACHE_MAGIC, CACHE_MAGIC_LEN) == 0 &&
+        fread(header, 1, 4, f) == 4) {
+        int size = (int)(header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24));
+        uint8_t *data = size > 0 ? malloc((size_t)size) : NULL;
+        if (data && fread(data, 1, (size_t)size, f) == (size_t)size && fgetc(f) == EOF) {
+            *out = data;
+            *length = size;
+            result = 0;
+        } else {
+            free(data);
+        }
+    }
+    fclose(f);
+    return result;
+}
+
+int image_cache_store(const char *dir, uint64_t key, const uint8_t *data, int length) {
+    if (mkdir(dir, 0777) < 0 && errno != EEXIST) return -1;
+
+    /* Write a temporary file and rename it so readers never see half an entry */
+    char *temp = cache_path(dir, key, ".tmp");
+    char *path = cache_path(dir, key, "");
+    if (!temp || !path) {
+        free(temp);
+        free(path);
+        return -1;
+    }
+
+    int result = -1;
+    FILE *f = fopen(temp, "wb");
+    if (f) {
+        uint8_t header[4] = {
+            (uint8_t)length, (uint8_t)(length >> 8), (uint8_t)(length >> 16), (uint8_t)(length >> 24)
+        };
+        int ok = fwrite(CACHE_MAGIC, 1, CACHE_MAGIC_LEN, f) == CACHE_MAGIC_LEN &&
+                 fwrite(header, 1, 4, f) == 4 &&
+                 fwrite(data, 1, (size_t)length, f) == (size_t)length;
+        if (fclose(f) == 0 && ok && rename(temp, path) == 0) result = 0;
+        if (result < 0) unlink(temp);
+    }
+    free(temp);
+    free(path);
+    return result;
+}
@@ -0,0 +1,274 @@
+/*
+ * irq.c - IRQ Entry Latency and Jitter Analysis
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#include "irq.h"
+#include "opcodes.h"
+#include "parser.h"
+#include "expr.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Longest handler path followed before giving up */
+#define IRQ_MAX_PATH    1024
+
+/* ========== Instruction Timing ========== */
+
+int irq_instruction_cycles_cpu(CpuType cpu, const uint8_t *bytes, uint16_t address,
+                               int *best, int *worst) {
+    const OpcodeEntry *entry = opcode_find_by_opcode_cpu(cpu, bytes[0]);
+    if (!entry) return -1;
+
+    *best = entry->cycles;
+    *worst = entry->cycles;
+
+    if (entry->mode == ADDR_RELATIVE || entry->mode == ADDR_ZP_RELATIVE) {
+        int offset = entry->mode == ADDR_RELATIVE ? 1 : 2;
+        uint16_t next = (uint16_t)(address + entry->size);
+        uint16_t target = (uint16_t)(next + (int8_t)bytes[offset]);
+        int cross = ((next ^ target) & 0xFF00) ? 1 : 0;
+        if (strcmp(entry->mnemonic, "BRA") == 0) {
+            /* Always taken; the base count includes it */
+            *best += cross;
+            *worst += cross;
+        } else {
+            *worst = entry->cycles + 1 + cross;
+        }
+    } else if (entry->page_penalty) {
+        /* abs,X/abs,Y with a page-aligned base cannot cross */
+        int aligned = (entry->mode == ADDR_ABSOLUTE_X || entry->mode == ADDR_ABSOLUTE_Y) &&
+                      bytes[1] == 0x00;
+        if (!aligned) (*worst)++;
+    }
+    *worst += opcode_decimal_penalty(cpu, entry);
+    return 0;
+}
+
+int irq_instruction_cycles(const uint8_t *bytes, uint16_t address, int *best, int *worst) {
+    return irq_instruction_cycles_cpu(CPU_6510, bytes, address, best, worst);
+}
+
+/* Cycle range of a stored line; a self-modifying operand can later point
+ * anywhere, so its page crossing is always possible */
+static int line_cycles(const AssembledLine *line, int *best, int *worst) {
+    if (irq_instruction_cycles_cpu(line->cpu, line->bytes, line->address, best, worst) < 0) {
+        return -1;
+    }
+    if (line->smc) {
+        const OpcodeEntry *entry = opcode_find_by_opcode_cpu(line->cpu, line->bytes[0]);
+        int decimal = opcode_decimal_penalty(line->cpu, entry);
+        if (strcmp(entry->mnemonic, "BRA") == 0) {
+            *worst = entry->cycles + 1;
+        } else if (entry->mode == ADDR_RELATIVE || entry->mode == ADDR_ZP_RELATIVE) {
+            *worst = entry->cycles + 2;
+        } else if (entry->page_penalty) {
+            *worst = entry->cycles + 1 + decimal;
+        }
+    }
+    return 0;
+}
+
+/* ========== Annotations ========== */
+
+static int is_directive(const AssembledLine *line, const char *name) {
+    return line->stmt->type == STMT_DIRECTIVE &&
+           strcmp(line->stmt->data.directive.name, name) == 0;
+}
+
+/* First line in source order at each address, or -1 */
+static int *index_lines(Assembler *as) {
+    int *first = malloc(ASM_MEMORY_SIZE * sizeof(int));
+    if (!first) return NULL;
+    for (int i = 0; i < ASM_MEMORY_SIZE; i++) first[i] = -1;
+    for (int i = as->line_count - 1; i >= 0; i--) {
+        first[as->lines[i].address] = i;
+    }
+    return first;
+}
+
+/* ========== Handler Path ========== */
+
+typedef struct {
+    int found;               /* 1 if an !irq_mark was reached */
+    AssembledLine *mark;
+    int best;                /* Cycles from handler entry to the mark */
+    int worst;
+    uint16_t jsr_address;    /* First JSR on the path (not followed), or 0 */
+} IrqPath;
+
+static void walk_handler(Assembler *as, const int *first_at, uint16_t handler, IrqPath *path) {
+    memset(path, 0, sizeof(*path));
+    int i = first_at[handler];
+
+    for (int steps = 0; i >= 0 && i < as->line_count && steps < IRQ_MAX_PATH; steps++) {
+        AssembledLine *line = &as->lines[i];
+        if (is_directive(line, "irq_mark")) {
+            path->found = 1;
+            path->mark = line;
+            return;
+        }
+        if (line->stmt->type != STMT_INSTRUCTION || line->byte_count == 0) {
+            i++;
+            continue;
+        }
+
+        int best, worst;
+        if (line_cycles(line, &best, &worst) < 0) return;
+        const OpcodeEntry *entry = opcode_find_by_opcode_cpu(line->cpu, line->bytes[0]);
+
+        /* The path is the fall-through one; a branch may still be taken */
+        path->best += best;
+        path->worst += worst;
+
+        if (strcmp(entry->mnemonic, "JMP") == 0) {
+            if (entry->mode != ADDR_ABSOLUTE || line->smc) return;
+            i = first_at[(uint16_t)(line->bytes[1] | (line->bytes[2] << 8))];
+            continue;
+        }
+        if (strcmp(entry->mnemonic, "JSR") == 0 && !path->jsr_address) {
+            path->jsr_address = line->address;
+        }
+        if (strcmp(entry->mnemonic, "RTI") == 0 || strcmp(entry->mnemonic, "RTS") == 0) {
+            return;
+        }
+        i++;
+    }
+}
+
+/* ========== Report ========== */
+
+/* Source of a line without indentation or comment */
+static const char *line_text(const AssembledLine *line, char *buf, size_t size) {
+    const char *text = line->source_text ? line->source_text : "";
+    while (*text == ' ' || *text == '\t') text++;
+
+    size_t n = 0;
+    int quoted = 0;
+    for (; text[n] && n < size - 1; n++) {
+        if (text[n] == '"') quoted = !quoted;
+        if (text[n] == ';' && !quoted) break;
+        buf[n] = text[n];
+    }
+    while (n > 0 && (buf[n - 1] == ' ' || buf[n - 1] == '\t' || buf[n - 1] == '\n')) n--;
+    buf[n] = '\0';
+    return buf;
+}
+
+static void suggest(FILE *out, const AssembledLine *line, int worst) {
+    const OpcodeEntry *entry = opcode_find_by_opcode_cpu(line->cpu, line->bytes[0]);
+    char buf[128];
+    const char *text = line_text(line, buf, sizeof(buf));
+
+    if (opcode_is_rmw(entry)) {
+        fprintf(out, "  suggestion: replace %d-cycle RMW at $%04X (%s)\n",
+                worst, line->address, text);
+    } else if (entry->mode == ADDR_RELATIVE || entry->mode == ADDR_ZP_RELATIVE) {
+        fprintf(out, "  suggestion: move branch at $%04X onto its target's page (%d cycles when taken)\n",
+                line->address, worst);
+    } else if (entry->page_penalty && worst > entry->cycles) {
+        fprintf(out, "  suggestion: page-align the indexed access at $%04X to drop its page-crossing cycle\n",
+                line->address);
+    } else {
+        fprintf(out, "  suggestion: replace %d-cycle %s at $%04X (%s)\n",
+                worst, entry->mnemonic, line->address, text);
+    }
+}
+
+static void report_region(Assembler *as, FILE *out, const int *first_at,
+                          int start, int end) {
+    AssembledLine *open = &as->lines[start];
+    Statement *stmt = open->stmt;
+    Expr *handler_expr = stmt->data.directive.arg_count > 0 ? stmt->data.directive.args[0] : NULL;
+    Expr *kernal_expr = assembler_directive_arg(stmt, "kernal");
+
+    ExprResult handler = { 0, 0, 0, NULL, NULL };
+    if (handler_expr) {
+        handler = expr_eval(handler_expr, as->symbols, as->anon_labels, open->address, 2, open->zone);
+    }
+    int kernal = 0;
+    if (kernal_expr) {
+        kernal = expr_eval(kernal_expr, as->symbols, as->anon_labels, open->address, 2, open->zone).value != 0;
+    }
+
+    /* Longest instruction the interrupt may have to wait for */
+    int longest = 0;
+    int count = 0;
+    AssembledLine *longest_line = NULL;
+    for (int i = start + 1; i < end; i++) {
+        AssembledLine *line = &as->lines[i];
+        int best, worst;
+        if (line->stmt->type != STMT_INSTRUCTION || line->byte_count == 0) continue;
+        if (line_cycles(line, &best, &worst) < 0) continue;
+        count++;
+        if (worst > longest) {
+            longest = worst;
+            longest_line = line;
+        }
+    }
+
+    fprintf(out, "%s:%d: IRQ region, handler $%04X%s\n",
+            stmt->file, stmt->line, (uint16_t)handler.value, kernal ? " via KERNAL" : "");
+    if (count == 0) {
+        fprintf(out, "  no instructions in region\n");
+        return;
+    }
+
+    char buf[128];
+    fprintf(out, "  %d instruction(s), longest %d cycles at $%04X (%s)\n",
+            count, longest, longest_line->address, line_text(longest_line, buf, sizeof(buf)));
+    fprintf(out, "  wait for interrupted instruction: 1-%d cycles, jitter %d\n",
+            longest, longest - 1);
+
+    int entry = IRQ_ENTRY_CYCLES + (kernal ? IRQ_KERNAL_CYCLES : 0);
+    IrqPath path;
+    walk_handler(as, first_at, (uint16_t)handler.value, &path);
+    if (path.found) {
+        int min = 1 + entry + path.best;
+        int max = longest + entry + path.worst;
+        fprintf(out, "  latency to mark at %s:%d: %d-%d cycles, jitter %d\n",
+                path.mark->stmt->file, path.mark->stmt->line, min, max, max - min);
+        if (path.jsr_address) {
+            fprintf(out, "  note: JSR at $%04X on the path is counted without its subroutine\n",
+                    path.jsr_address);
+        }
+    } else {
+        fprintf(out, "  latency to handler entry: %d-%d cycles (no !irq_mark reached)\n",
+                1 + entry, longest + entry);
+    }
+
+    if (longest < IRQ_SUGGEST_CYCLES) return;
+    for (int i = start + 1; i < end; i++) {
+        AssembledLine *line = &as->lines[i];
+        int best, worst;
+        if (line->stmt->type != STMT_INSTRUCTION || line->byte_count == 0) continue;
+        if (line_cycles(line, &best, &worst) < 0) continue;
+        if (worst == longest) suggest(out, line, worst);
+    }
+}
+
+void assembler_irq_report(Assembler *as, FILE *out) {
+    int *first_at = NULL;
+
+    for (int i = 0; i < as->line_count; i++) {
+        if (!is_directive(&as->lines[i], "irq")) continue;
+
+        int end = i + 1;
+        while (end < as->line_count && !is_directive(&as->lines[end], "irq") &&
+               !is_directive(&as->lines[end], "irq_end")) {
+            end++;
+        }
+
+        if (!first_at) {
+            first_at = index_lines(as);
+            if (!first_at) {
+                assembler_error(as, "out of memory for IRQ report");
+                return;
+            }
+        }
+        report_region(as, out, first_at, i, end);
+        i = end - 1;
+    }
+
+    free(first_at);
+}
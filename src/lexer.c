@@ -494,9 +494,13 @@ Token lexer_next(Lexer *lex) {
         case '[': return make_token(lex, TOK_LBRACKET, start);
         case ']': return make_token(lex, TOK_RBRACKET, start);
         case ',': return make_token(lex, TOK_COMMA, start);
-        case ':': return make_token(lex, TOK_COLON, start);
+        case ':':
+            if (match(lex, '@')) return make_token(lex, TOK_OPERAND_LABEL, start);
+            return make_token(lex, TOK_COLON, start);
         case '#': return make_token(lex, TOK_HASH, start);
-        case '.': return make_token(lex, TOK_ERROR, start);  /* Lone dot */
+        case '.':
+            if (match(lex, '.')) return make_token(lex, TOK_DOTDOT, start);
+            return make_token(lex, TOK_ERROR, start);  /* Lone dot */
     }
 
     return error_token(lex, "unexpected character");
@@ -557,7 +561,9 @@ const char *token_type_name(TokenType type) {
         case TOK_RBRACKET: return "RBRACKET";
         case TOK_COMMA: return "COMMA";
         case TOK_COLON: return "COLON";
+        case TOK_DOTDOT: return "DOTDOT";
         case TOK_HASH: return "HASH";
+        case TOK_OPERAND_LABEL: return "OPERAND_LABEL";
         case TOK_ERROR: return "ERROR";
         default: return "UNKNOWN";
     }
@@ -607,6 +613,26 @@ int token_is_mnemonic(const Token *tok) {
     return 0;
 }
 
+/* Instructions only the 65C02 has */
+static const char *mnemonics_65c02[] = {
+    "bra", "phx", "phy", "plx", "ply", "stz", "trb", "tsb",
+    "rmb0", "rmb1", "rmb2", "rmb3", "rmb4", "rmb5", "rmb6", "rmb7",
+    "smb0", "smb1", "smb2", "smb3", "smb4", "smb5", "smb6", "smb7",
+    "bbr0", "bbr1", "bbr2", "bbr3", "bbr4", "bbr5", "bbr6", "bbr7",
+    "bbs0", "bbs1", "bbs2", "bbs3", "bbs4", "bbs5", "bbs6", "bbs7",
+    "wai", "stp",
+    NULL
+};
+
+int token_is_65c02_mnemonic(const Token *tok) {
+    if (tok->type != TOK_IDENTIFIER) return 0;
+
+    for (const char **m = mnemonics_65c02; *m; m++) {
+        if (token_equals(tok, *m)) return 1;
+    }
+    return 0;
+}
+
 void token_free(Token *tok) {
     if (tok->type == TOK_STRING && tok->value.string.data) {
         free(tok->value.string.data);
@@ -4,6 +4,12 @@
 #include "util.h"
 #include "error.h"
 #include "assembler.h"
+#include "output.h"
+#include "raster.h"
+#include "irq.h"
+#include "pgo.h"
+#include "perf.h"
+#include "optimize.h"
 
 #define VERSION "1.0.0"
 #define MAX_DEFINES 64
@@ -22,22 +28,67 @@ typedef struct {
     OutputFormat format;
     int verbose;
     int show_cycles;
+    int export_lists;
+    int threads;
+    int direct_io;
+    int show_timings;
+    int incremental;
+    int optimize;
+    int check_raster;
+    int irq_report;
+    RasterSystem raster_system;
+    char *pgo_train;
+    char *pgo_use;
+    char *pgo_entry;
+    int pgo_frames;
+    int inline_threshold;
+    int perf_lint;
+    unsigned perf_disabled;
+    int size_report;
+    char *folded_file;
+    char *image_cache;
+    char *run_cache;
 } Options;
 
 static Options g_options;
 
+/* Stream for verbose messages; stderr when stdout carries output data */
+static FILE *g_info;
+
 static void print_usage(const char *prog) {
     printf("Usage: %s [options] <source.asm>\n", prog);
+    printf("       %s [options] -          (read source from stdin)\n", prog);
     printf("\n");
     printf("Options:\n");
-    printf("  -o <file>       Output filename (default: source.prg)\n");
+    printf("  -o <file>       Output filename (default: source.prg, stdout for -)\n");
     printf("  -f <format>     Output format: prg (default), raw\n");
     printf("  -l <file>       Generate listing file\n");
     printf("  -s <file>       Generate symbol file (VICE format)\n");
+    printf("                  Output files may be '-' (stdout) or fd:N (descriptor N)\n");
     printf("  -D NAME=value   Define symbol from command line\n");
     printf("  -I <path>       Add include search path\n");
+    printf("  -j <n>          Pass 2 worker threads (0 = one per CPU, default 1)\n");
     printf("  -v              Verbose output\n");
     printf("  --cycles        Include cycle counts in listing\n");
+    printf("  --direct        Write output files with O_DIRECT where supported\n");
+    printf("  --export-lists  Write !let list elements to symbol output as name_0, ...\n");
+    printf("  --incremental   Reuse pass 1 output for lines whose inputs are unchanged\n");
+    printf("  --optimize      Drop redundant loads, flag changes and compares; shorten JMPs\n");
+    printf("  --raster <std>  Verify !raster_block timing for pal or ntsc\n");
+    printf("  --irq-report    Report IRQ latency and jitter for !irq regions\n");
+    printf("  --size-report   Report bytes and cycles by file, zone, macro and loop\n");
+    printf("  --size-folded <f> Write bytes per expansion stack to f (flamegraph input)\n");
+    printf("  --pgo-train <f> Profile the program in the 6510 model and write f\n");
+    printf("  --pgo-entry <a> Address or label the profile run calls each frame\n");
+    printf("  --pgo-frames <n> Frames to profile (default %d)\n", PGO_DEFAULT_FRAMES);
+    printf("  --pgo-use <f>   Choose !pgo_pad padding from profile f\n");
+    printf("  --image-cache <dir> Keep !image conversions in dir between runs\n");
+    printf("  --run-cache <dir> Keep !run captures in dir between runs\n");
+    printf("  --inline-threshold <n>\n");
+    printf("                  Also inline plain JSRs to !inline bodies of up to n bytes\n");
+    printf("  -Wperf          Warn about slow code patterns with their cycle cost\n");
+    printf("  -Wno-perf=<ids> Skip the comma-separated -Wperf checks\n");
+    printf("  --timings       Report time spent writing each output file\n");
     printf("  --help          Show this help\n");
     printf("  --version       Show version\n");
 }
@@ -65,10 +116,17 @@ static char *make_output_filename(const char *input) {
     return output;
 }
 
+/* True if an output destination is standard output ("-" or "fd:1") */
+static int writes_stdout(const char *name) {
+    return strcmp(name, "-") == 0 || strcmp(name, "fd:1") == 0;
+}
+
 static int parse_args(int argc, char **argv) {
     /* Initialize defaults */
     memset(&g_options, 0, sizeof(g_options));
+    g_options.threads = 1;
     g_options.format = OUTPUT_PRG;
+    g_options.pgo_frames = PGO_DEFAULT_FRAMES;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--help") == 0) {
@@ -83,6 +141,153 @@ static int parse_args(int argc, char **argv) {
             g_options.show_cycles = 1;
             continue;
         }
+        if (strcmp(argv[i], "--export-lists") == 0) {
+            g_options.export_lists = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--threads") == 0) {
+            char *end;
+            if (++i >= argc) {
+                fprintf(stderr, "error: %s requires an argument\n", argv[i - 1]);
+                return 0;
+            }
+            g_options.threads = (int)strtol(argv[i], &end, 10);
+            if (*end != '\0' || g_options.threads < 0) {
+                fprintf(stderr, "error: invalid thread count '%s'\n", argv[i]);
+                return 0;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--direct") == 0) {
+            g_options.direct_io = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--raster") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "error: --raster requires pal or ntsc\n");
+                return 0;
+            }
+            if (strcmp(argv[i], "pal") == 0) {
+                g_options.raster_system = RASTER_PAL;
+            } else if (strcmp(argv[i], "ntsc") == 0) {
+                g_options.raster_system = RASTER_NTSC;
+            } else {
+                fprintf(stderr, "error: unknown video standard '%s' (use pal or ntsc)\n", argv[i]);
+                return 0;
+            }
+            g_options.check_raster = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--irq-report") == 0) {
+            g_options.irq_report = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--size-report") == 0) {
+            g_options.size_report = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--image-cache") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "error: --image-cache requires an argument\n");
+                return 0;
+            }
+            g_options.image_cache = argv[i];
+            continue;
+        }
+        if (strcmp(argv[i], "--run-cache") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "error: --run-cache requires an argument\n");
+                return 0;
+            }
+            g_options.run_cache = argv[i];
+            continue;
+        }
+        if (strcmp(argv[i], "--size-folded") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "error: --size-folded requires an argument\n");
+                return 0;
+            }
+            g_options.folded_file = argv[i];
+            continue;
+        }
+        if (strcmp(argv[i], "--pgo-train") == 0 || strcmp(argv[i], "--pgo-use") == 0 ||
+            strcmp(argv[i], "--pgo-entry") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "error: %s requires an argument\n", argv[i - 1]);
+                return 0;
+            }
+            if (strcmp(argv[i - 1], "--pgo-train") == 0) {
+                g_options.pgo_train = argv[i];
+            } else if (strcmp(argv[i - 1], "--pgo-use") == 0) {
+                g_options.pgo_use = argv[i];
+            } else {
+                g_options.pgo_entry = argv[i];
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--pgo-frames") == 0) {
+            char *end;
+            if (++i >= argc) {
+                fprintf(stderr, "error: --pgo-frames requires an argument\n");
+                return 0;
+            }
+            g_options.pgo_frames = (int)strtol(argv[i], &end, 10);
+            if (*end != '\0' || g_options.pgo_frames < 1) {
+                fprintf(stderr, "error: invalid frame count '%s'\n", argv[i]);
+                return 0;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--inline-threshold") == 0) {
+            char *end;
+            if (++i >= argc) {
+                fprintf(stderr, "error: --inline-threshold requires an argument\n");
+                return 0;
+            }
+            g_options.inline_threshold = (int)strtol(argv[i], &end, 10);
+            if (*end != '\0' || g_options.inline_threshold < 0) {
+                fprintf(stderr, "error: invalid inline threshold '%s'\n", argv[i]);
+                return 0;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-Wperf") == 0) {
+            g_options.perf_lint = 1;
+            continue;
+        }
+        if (strncmp(argv[i], "-Wno-perf=", 10) == 0) {
+            const char *name = argv[i] + 10;
+            while (*name) {
+                const char *comma = strchr(name, ',');
+                size_t len = comma ? (size_t)(comma - name) : strlen(name);
+                char buf[32];
+                int check = -1;
+                if (len < sizeof(buf)) {
+                    memcpy(buf, name, len);
+                    buf[len] = '\0';
+                    check = perf_check_lookup(buf);
+                }
+                if (check < 0) {
+                    fprintf(stderr, "error: unknown -Wperf check '%.*s'\n", (int)len, name);
+                    return 0;
+                }
+                g_options.perf_disabled |= 1u << check;
+                name += comma ? len + 1 : len;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--incremental") == 0) {
+            g_options.incremental = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--optimize") == 0) {
+            g_options.optimize = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--timings") == 0) {
+            g_options.show_timings = 1;
+            continue;
+        }
         if (strcmp(argv[i], "-v") == 0) {
             g_options.verbose = 1;
             continue;
@@ -168,7 +373,7 @@ static int parse_args(int argc, char **argv) {
             g_options.include_paths[g_options.include_count++] = argv[i] + 2;
             continue;
         }
-        if (argv[i][0] == '-') {
+        if (argv[i][0] == '-' && argv[i][1] != '\0') {
             fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
             return 0;
         }
@@ -186,9 +391,18 @@ static int parse_args(int argc, char **argv) {
         return 0;
     }
 
+    if (g_options.pgo_train && !g_options.pgo_entry) {
+        fprintf(stderr, "error: --pgo-train requires --pgo-entry\n");
+        return 0;
+    }
+
     /* Generate default output filename if not specified */
     if (!g_options.output_file) {
-        g_options.output_file = make_output_filename(g_options.input_file);
+        if (strcmp(g_options.input_file, "-") == 0) {
+            g_options.output_file = "-";
+        } else {
+            g_options.output_file = make_output_filename(g_options.input_file);
+        }
     }
 
     return 1;
@@ -206,20 +420,31 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    int from_stdin = (strcmp(g_options.input_file, "-") == 0);
+
+    /* Keep stdout clean when any output is routed to it */
+    g_info = stdout;
+    if (writes_stdout(g_options.output_file) ||
+        (g_options.listing_file && writes_stdout(g_options.listing_file)) ||
+        (g_options.symbol_file && writes_stdout(g_options.symbol_file)) ||
+        (g_options.folded_file && writes_stdout(g_options.folded_file))) {
+        g_info = stderr;
+    }
+
     if (g_options.verbose) {
-        printf("asm64 %s\n", VERSION);
-        printf("Input:  %s\n", g_options.input_file);
-        printf("Output: %s\n", g_options.output_file);
+        fprintf(g_info, "asm64 %s\n", VERSION);
+        fprintf(g_info, "Input:  %s\n", from_stdin ? "<stdin>" : g_options.input_file);
+        fprintf(g_info, "Output: %s\n", g_options.output_file);
         if (g_options.listing_file) {
-            printf("Listing: %s\n", g_options.listing_file);
+            fprintf(g_info, "Listing: %s\n", g_options.listing_file);
         }
         if (g_options.symbol_file) {
-            printf("Symbols: %s\n", g_options.symbol_file);
+            fprintf(g_info, "Symbols: %s\n", g_options.symbol_file);
         }
     }
 
     /* Check input file exists */
-    if (!file_exists(g_options.input_file)) {
+    if (!from_stdin && !file_exists(g_options.input_file)) {
         fprintf(stderr, "error: cannot open '%s'\n", g_options.input_file);
         return 1;
     }
@@ -235,6 +460,24 @@ int main(int argc, char **argv) {
     as->format = (g_options.format == OUTPUT_PRG) ? OUTPUT_PRG : OUTPUT_RAW;
     as->verbose = g_options.verbose;
     as->show_cycles = g_options.show_cycles;
+    as->export_lists = g_options.export_lists;
+    as->incremental = g_options.incremental;
+    as->optimize = g_options.optimize;
+    as->inline_threshold = g_options.inline_threshold;
+    assembler_set_threads(as, g_options.threads);
+    if (g_options.image_cache) assembler_set_image_cache(as, g_options.image_cache);
+    if (g_options.run_cache) assembler_set_run_cache(as, g_options.run_cache);
+
+    PgoProfile *profile = NULL;
+    if (g_options.pgo_use) {
+        profile = pgo_profile_load(g_options.pgo_use);
+        if (!profile) {
+            fprintf(stderr, "error: cannot read profile '%s'\n", g_options.pgo_use);
+            assembler_free(as);
+            return 1;
+        }
+        as->profile = profile;
+    }
 
     /* Add include paths from environment variable first (lower priority) */
     assembler_add_include_paths_from_env(as, "ASM64_INCLUDE");
@@ -249,16 +492,102 @@ int main(int argc, char **argv) {
         if (assembler_define_symbol(as, g_options.defines[i]) != 0) {
             fprintf(stderr, "error: invalid symbol definition '%s'\n", g_options.defines[i]);
             assembler_free(as);
+            pgo_profile_free(profile);
             return 1;
         }
     }
 
     /* Run assembly */
     if (g_options.verbose) {
-        printf("Assembling %s...\n", g_options.input_file);
+        fprintf(g_info, "Assembling %s...\n", from_stdin ? "<stdin>" : g_options.input_file);
+    }
+
+    int result;
+    if (from_stdin) {
+        result = assembler_assemble_stream(as, stdin, "<stdin>");
+    } else {
+        result = assembler_assemble_file(as, g_options.input_file);
+    }
+
+    if (g_options.verbose && as->image_cache_hits > 0) {
+        fprintf(g_info, "Image cache: %d conversion%s reused\n", as->image_cache_hits,
+                as->image_cache_hits == 1 ? "" : "s");
+    }
+
+    if (g_options.verbose && as->runs + as->run_cache_hits > 0) {
+        fprintf(g_info, "Runs: %d executed, %d reused from cache\n",
+                as->runs, as->run_cache_hits);
     }
 
-    int result = assembler_assemble_file(as, g_options.input_file);
+    if (g_options.verbose && as->data_loops > 0) {
+        fprintf(g_info, "Data loops: %d generated without expansion\n", as->data_loops);
+    }
+
+    if (g_options.verbose && as->strpools) {
+        int saved = 0;
+        for (const StringPool *sp = as->strpools; sp; sp = sp->next) {
+            if (sp->end) saved += sp->input_size - sp->pool.size;
+        }
+        fprintf(g_info, "String pools: %d bytes saved\n", saved);
+    }
+
+    if (g_options.verbose && as->rodata) {
+        int saved = 0, padding = 0;
+        for (const RodataRegion *rp = as->rodata; rp; rp = rp->next) {
+            if (!rp->end) continue;
+            saved += rp->input_size - (rp->pack.size - rp->pack.padding);
+            padding += rp->pack.padding;
+        }
+        fprintf(g_info, "Read-only data: %d bytes saved, %d bytes of alignment padding\n",
+                saved, padding);
+    }
+
+    if (g_options.verbose && expr_list_count(as->symbols->lists) > 0) {
+        fprintf(g_info, "Lists: %d defined, %ld bytes of elements\n",
+                expr_list_count(as->symbols->lists), expr_list_bytes(as->symbols->lists));
+    }
+
+    if (g_options.verbose && expr_function_count(as->symbols->functions) > 0) {
+        fprintf(g_info, "Functions: %d defined, %ld results remembered\n",
+                expr_function_count(as->symbols->functions),
+                expr_function_memo_count(as->symbols->functions));
+    }
+
+    if (result == 0 && g_options.optimize) {
+        optimize_report(as, g_info);
+    }
+
+    if (result == 0 && profile) {
+        pgo_report(profile, g_info);
+    }
+
+    if (result == 0 && g_options.pgo_train) {
+        uint16_t entry;
+        if (pgo_resolve_address(as, g_options.pgo_entry, &entry) < 0) {
+            fprintf(stderr, "error: unknown profile entry '%s'\n", g_options.pgo_entry);
+            result = 1;
+        } else {
+            result = pgo_train(as, entry, g_options.pgo_frames, g_options.raster_system,
+                               g_options.pgo_train, g_info);
+        }
+    }
+
+    if (result == 0 && g_options.perf_lint) {
+        assembler_perf_lint(as, g_options.perf_disabled);
+    }
+
+    if (result == 0 && g_options.irq_report) {
+        assembler_irq_report(as, g_info);
+    }
+
+    if (result == 0 && g_options.size_report) {
+        assembler_size_report(as, g_info);
+    }
+
+    /* Check raster timing before anything is written */
+    if (result == 0 && g_options.check_raster) {
+        result = assembler_check_raster(as, g_options.raster_system, g_info);
+    }
 
     if (result == 0) {
         /* Write output file */
@@ -277,28 +606,52 @@ int main(int argc, char **argv) {
             output = default_output;
         }
 
-        result = assembler_write_output(as, output);
-        if (result == 0 && g_options.verbose) {
-            uint16_t start_addr;
-            int size;
-            assembler_get_output(as, &start_addr, &size);
-            printf("Output: %s (%d bytes, $%04X-$%04X)\n",
-                   output, size + 2, start_addr, start_addr + size - 1);
+        /* Write the program, symbols, listing and folded stacks concurrently */
+        OutputJob jobs[4];
+        int job_count = 0;
+        memset(jobs, 0, sizeof(jobs));
+        jobs[job_count].kind = OUTPUT_FILE_PROGRAM;
+        jobs[job_count++].filename = output;
+        if (g_options.symbol_file) {
+            jobs[job_count].kind = OUTPUT_FILE_SYMBOLS;
+            jobs[job_count++].filename = g_options.symbol_file;
+        }
+        if (g_options.listing_file) {
+            jobs[job_count].kind = OUTPUT_FILE_LISTING;
+            jobs[job_count++].filename = g_options.listing_file;
+        }
+        if (g_options.folded_file) {
+            jobs[job_count].kind = OUTPUT_FILE_FOLDED;
+            jobs[job_count++].filename = g_options.folded_file;
         }
 
-        /* Write symbol file if requested */
-        if (g_options.symbol_file && result == 0) {
-            result = assembler_write_symbols(as, g_options.symbol_file);
-            if (result == 0 && g_options.verbose) {
-                printf("Symbols: %s\n", g_options.symbol_file);
+        result = assembler_write_outputs(as, jobs, job_count,
+                                         g_options.direct_io ? OUTPUT_DIRECT : 0);
+
+        if (g_options.verbose) {
+            for (int i = 0; i < job_count; i++) {
+                if (jobs[i].result != 0) continue;
+                if (jobs[i].kind == OUTPUT_FILE_PROGRAM) {
+                    uint16_t start_addr;
+                    int size;
+                    assembler_get_output(as, &start_addr, &size);
+                    fprintf(g_info, "Output: %s (%d bytes, $%04X-$%04X)\n",
+                           output, size + 2, start_addr, start_addr + size - 1);
+                } else if (jobs[i].kind == OUTPUT_FILE_SYMBOLS) {
+                    fprintf(g_info, "Symbols: %s\n", jobs[i].filename);
+                } else if (jobs[i].kind == OUTPUT_FILE_LISTING) {
+                    fprintf(g_info, "Listing: %s\n", jobs[i].filename);
+                } else {
+                    fprintf(g_info, "Folded stacks: %s\n", jobs[i].filename);
+                }
             }
         }
 
-        /* Write listing file if requested */
-        if (g_options.listing_file && result == 0) {
-            result = assembler_write_listing(as, g_options.listing_file);
-            if (result == 0 && g_options.verbose) {
-                printf("Listing: %s\n", g_options.listing_file);
+        if (g_options.show_timings) {
+            for (int i = 0; i < job_count; i++) {
+                fprintf(stderr, "timing: %-8s %10zu bytes %9.2f ms%s  %s\n",
+                        output_kind_name(jobs[i].kind), jobs[i].bytes, jobs[i].ms,
+                        jobs[i].direct ? " (direct)" : "", jobs[i].filename);
             }
         }
     }
@@ -311,8 +664,9 @@ int main(int argc, char **argv) {
         fprintf(stderr, "%d warning%s\n", as->warnings, as->warnings == 1 ? "" : "s");
     }
 
-    int exit_code = (as->errors > 0) ? 1 : 0;
+    int exit_code = (as->errors > 0 || result != 0) ? 1 : 0;
     assembler_free(as);
+    pgo_profile_free(profile);
 
     return exit_code;
 }
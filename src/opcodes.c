@@ -1,9 +1,10 @@
 /*
- * opcodes.c - 6502/6510 Opcode Table Implementation
+ * opcodes.c - 6502/6510/65C02 Opcode Table Implementation
  * ASM64 - 6502/6510 Assembler for Commodore 64
  *
  * Complete instruction table for official 6502 opcodes plus
- * common illegal/undocumented 6510 opcodes.
+ * common illegal/undocumented 6510 opcodes, and the 65C02
+ * additions in a table of their own.
  */
 
 #include "opcodes.h"
@@ -24,6 +25,7 @@
 #define M_INX  (1 << ADDR_INDIRECT_X)
 #define M_INY  (1 << ADDR_INDIRECT_Y)
 #define M_REL  (1 << ADDR_RELATIVE)
+#define M_ZPR  (1 << ADDR_ZP_RELATIVE)
 
 /*
  * Complete 6502 opcode table.
@@ -422,6 +424,114 @@ static const OpcodeEntry opcode_table[] = {
 /* Number of entries (calculated at init) */
 static int opcode_count = 0;
 
+/*
+ * 65C02 instructions and addressing modes, plus official opcodes whose
+ * timing differs on the 65C02. Looked up before opcode_table for
+ * CPU_65C02, so an entry here replaces the NMOS one.
+ * The bit instructions (RMB, SMB, BBR, BBS) and WAI/STP are the
+ * Rockwell and WDC additions.
+ */
+static const OpcodeEntry cmos_table[] = {
+
+    /* ===== (zp) - Zero Page Indirect ===== */
+    { "ADC",  ADDR_ZP_INDIRECT, 0x72, 2, 5, 0 },
+    { "AND",  ADDR_ZP_INDIRECT, 0x32, 2, 5, 0 },
+    { "CMP",  ADDR_ZP_INDIRECT, 0xD2, 2, 5, 0 },
+    { "EOR",  ADDR_ZP_INDIRECT, 0x52, 2, 5, 0 },
+    { "LDA",  ADDR_ZP_INDIRECT, 0xB2, 2, 5, 0 },
+    { "ORA",  ADDR_ZP_INDIRECT, 0x12, 2, 5, 0 },
+    { "SBC",  ADDR_ZP_INDIRECT, 0xF2, 2, 5, 0 },
+    { "STA",  ADDR_ZP_INDIRECT, 0x92, 2, 5, 0 },
+
+    /* ===== BIT - New Modes ===== */
+    { "BIT",  ADDR_IMMEDIATE,   0x89, 2, 2, 0 },
+    { "BIT",  ADDR_ZEROPAGE_X,  0x34, 2, 4, 0 },
+    { "BIT",  ADDR_ABSOLUTE_X,  0x3C, 3, 4, 1 },
+
+    /* ===== BRA - Branch Always ===== */
+    { "BRA",  ADDR_RELATIVE,    0x80, 2, 3, 1 },  /* Always taken */
+
+    /* ===== INC/DEC - Accumulator ===== */
+    { "INC",  ADDR_ACCUMULATOR, 0x1A, 1, 2, 0 },
+    { "DEC",  ADDR_ACCUMULATOR, 0x3A, 1, 2, 0 },
+
+    /* ===== JMP - Indexed Indirect, No Page Wrap ===== */
+    { "JMP",  ADDR_INDIRECT,    0x6C, 3, 6, 0 },
+    { "JMP",  ADDR_ABS_INDIRECT_X, 0x7C, 3, 6, 0 },
+
+    /* ===== Shifts abs,X - One Cycle Less Unless Crossing ===== */
+    { "ASL",  ADDR_ABSOLUTE_X,  0x1E, 3, 6, 1 },
+    { "LSR",  ADDR_ABSOLUTE_X,  0x5E, 3, 6, 1 },
+    { "ROL",  ADDR_ABSOLUTE_X,  0x3E, 3, 6, 1 },
+    { "ROR",  ADDR_ABSOLUTE_X,  0x7E, 3, 6, 1 },
+
+    /* ===== Stack - X and Y ===== */
+    { "PHX",  ADDR_IMPLIED,     0xDA, 1, 3, 0 },
+    { "PHY",  ADDR_IMPLIED,     0x5A, 1, 3, 0 },
+    { "PLX",  ADDR_IMPLIED,     0xFA, 1, 4, 0 },
+    { "PLY",  ADDR_IMPLIED,     0x7A, 1, 4, 0 },
+
+    /* ===== STZ - Store Zero ===== */
+    { "STZ",  ADDR_ZEROPAGE,    0x64, 2, 3, 0 },
+    { "STZ",  ADDR_ZEROPAGE_X,  0x74, 2, 4, 0 },
+    { "STZ",  ADDR_ABSOLUTE,    0x9C, 3, 4, 0 },
+    { "STZ",  ADDR_ABSOLUTE_X,  0x9E, 3, 5, 0 },
+
+    /* ===== TRB/TSB - Test and Reset/Set Bits ===== */
+    { "TRB",  ADDR_ZEROPAGE,    0x14, 2, 5, 0 },
+    { "TRB",  ADDR_ABSOLUTE,    0x1C, 3, 6, 0 },
+    { "TSB",  ADDR_ZEROPAGE,    0x04, 2, 5, 0 },
+    { "TSB",  ADDR_ABSOLUTE,    0x0C, 3, 6, 0 },
+
+    /* ===== RMB/SMB - Reset/Set Memory Bit ===== */
+    { "RMB0", ADDR_ZEROPAGE,    0x07, 2, 5, 0 },
+    { "RMB1", ADDR_ZEROPAGE,    0x17, 2, 5, 0 },
+    { "RMB2", ADDR_ZEROPAGE,    0x27, 2, 5, 0 },
+    { "RMB3", ADDR_ZEROPAGE,    0x37, 2, 5, 0 },
+    { "RMB4", ADDR_ZEROPAGE,    0x47, 2, 5, 0 },
+    { "RMB5", ADDR_ZEROPAGE,    0x57, 2, 5, 0 },
+    { "RMB6", ADDR_ZEROPAGE,    0x67, 2, 5, 0 },
+    { "RMB7", ADDR_ZEROPAGE,    0x77, 2, 5, 0 },
+    { "SMB0", ADDR_ZEROPAGE,    0x87, 2, 5, 0 },
+    { "SMB1", ADDR_ZEROPAGE,    0x97, 2, 5, 0 },
+    { "SMB2", ADDR_ZEROPAGE,    0xA7, 2, 5, 0 },
+    { "SMB3", ADDR_ZEROPAGE,    0xB7, 2, 5, 0 },
+    { "SMB4", ADDR_ZEROPAGE,    0xC7, 2, 5, 0 },
+    { "SMB5", ADDR_ZEROPAGE,    0xD7, 2, 5, 0 },
+    { "SMB6", ADDR_ZEROPAGE,    0xE7, 2, 5, 0 },
+    { "SMB7", ADDR_ZEROPAGE,    0xF7, 2, 5, 0 },
+
+    /* ===== BBR/BBS - Branch on Bit Reset/Set ===== */
+    { "BBR0", ADDR_ZP_RELATIVE, 0x0F, 3, 5, 1 },
+    { "BBR1", ADDR_ZP_RELATIVE, 0x1F, 3, 5, 1 },
+    { "BBR2", ADDR_ZP_RELATIVE, 0x2F, 3, 5, 1 },
+    { "BBR3", ADDR_ZP_RELATIVE, 0x3F, 3, 5, 1 },
+    { "BBR4", ADDR_ZP_RELATIVE, 0x4F, 3, 5, 1 },
+    { "BBR5", ADDR_ZP_RELATIVE, 0x5F, 3, 5, 1 },
+    { "BBR6", ADDR_ZP_RELATIVE, 0x6F, 3, 5, 1 },
+    { "BBR7", ADDR_ZP_RELATIVE, 0x7F, 3, 5, 1 },
+    { "BBS0", ADDR_ZP_RELATIVE, 0x8F, 3, 5, 1 },
+    { "BBS1", ADDR_ZP_RELATIVE, 0x9F, 3, 5, 1 },
+    { "BBS2", ADDR_ZP_RELATIVE, 0xAF, 3, 5, 1 },
+    { "BBS3", ADDR_ZP_RELATIVE, 0xBF, 3, 5, 1 },
+    { "BBS4", ADDR_ZP_RELATIVE, 0xCF, 3, 5, 1 },
+    { "BBS5", ADDR_ZP_RELATIVE, 0xDF, 3, 5, 1 },
+    { "BBS6", ADDR_ZP_RELATIVE, 0xEF, 3, 5, 1 },
+    { "BBS7", ADDR_ZP_RELATIVE, 0xFF, 3, 5, 1 },
+
+    /* ===== WAI/STP - Wait for Interrupt, Stop ===== */
+    { "WAI",  ADDR_IMPLIED,     0xCB, 1, 3, 0 },
+    { "STP",  ADDR_IMPLIED,     0xDB, 1, 3, 0 },
+
+    /* Sentinel - end of table */
+    { NULL, ADDR_INVALID, 0, 0, 0, 0 }
+};
+
+static int cmos_count = 0;
+
+/* Entry each opcode byte decodes to, per CPU (built at init) */
+static const OpcodeEntry *opcode_matrix[CPU_TYPE_COUNT][256];
+
 /* Mnemonic information table for quick lookup */
 static const MnemonicInfo mnemonic_info[] = {
     /* Official instructions */
@@ -520,6 +630,50 @@ static const MnemonicInfo mnemonic_info[] = {
     { "KIL", M_IMP, INST_ILLEGAL },
     { "HLT", M_IMP, INST_ILLEGAL },
 
+    /* 65C02 instructions */
+    { "BRA", M_REL, INST_BRANCH|INST_65C02 },
+    { "PHX", M_IMP, INST_STACK|INST_65C02 },
+    { "PHY", M_IMP, INST_STACK|INST_65C02 },
+    { "PLX", M_IMP, INST_STACK|INST_65C02 },
+    { "PLY", M_IMP, INST_STACK|INST_65C02 },
+    { "STZ", M_ZP|M_ZPX|M_ABS|M_ABX, INST_65C02 },
+    { "TRB", M_ZP|M_ABS, INST_65C02 },
+    { "TSB", M_ZP|M_ABS, INST_65C02 },
+    { "RMB0", M_ZP, INST_65C02 },
+    { "RMB1", M_ZP, INST_65C02 },
+    { "RMB2", M_ZP, INST_65C02 },
+    { "RMB3", M_ZP, INST_65C02 },
+    { "RMB4", M_ZP, INST_65C02 },
+    { "RMB5", M_ZP, INST_65C02 },
+    { "RMB6", M_ZP, INST_65C02 },
+    { "RMB7", M_ZP, INST_65C02 },
+    { "SMB0", M_ZP, INST_65C02 },
+    { "SMB1", M_ZP, INST_65C02 },
+    { "SMB2", M_ZP, INST_65C02 },
+    { "SMB3", M_ZP, INST_65C02 },
+    { "SMB4", M_ZP, INST_65C02 },
+    { "SMB5", M_ZP, INST_65C02 },
+    { "SMB6", M_ZP, INST_65C02 },
+    { "SMB7", M_ZP, INST_65C02 },
+    { "BBR0", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBR1", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBR2", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBR3", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBR4", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBR5", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBR6", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBR7", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBS0", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBS1", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBS2", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBS3", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBS4", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBS5", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBS6", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "BBS7", M_ZPR, INST_BRANCH|INST_65C02 },
+    { "WAI", M_IMP, INST_65C02 },
+    { "STP", M_IMP, INST_65C02 },
+
     /* Sentinel */
     { NULL, 0, 0 }
 };
@@ -539,6 +693,9 @@ static const char *mode_names[] = {
     "(indirect,X)",
     "(indirect),Y",
     "relative",
+    "(zero page)",
+    "(absolute,X)",
+    "zero page,relative",
     "invalid"
 };
 
@@ -557,6 +714,9 @@ static const int mode_sizes[] = {
     2,  /* INDIRECT_X */
     2,  /* INDIRECT_Y */
     2,  /* RELATIVE */
+    2,  /* ZP_INDIRECT */
+    3,  /* ABS_INDIRECT_X */
+    3,  /* ZP_RELATIVE */
     0   /* INVALID */
 };
 
@@ -579,6 +739,26 @@ void opcodes_init(void) {
     while (opcode_table[opcode_count].mnemonic != NULL) {
         opcode_count++;
     }
+    cmos_count = 0;
+    while (cmos_table[cmos_count].mnemonic != NULL) {
+        cmos_count++;
+    }
+
+    /* Decode matrix; walk backwards so the first entry for a byte wins */
+    for (int cpu = 0; cpu < CPU_TYPE_COUNT; cpu++) {
+        for (int i = 0; i < 256; i++) {
+            opcode_matrix[cpu][i] = NULL;
+        }
+        for (int i = opcode_count - 1; i >= 0; i--) {
+            const OpcodeEntry *entry = &opcode_table[i];
+            if (cpu != CPU_6510 && opcode_is_illegal(entry->mnemonic)) continue;
+            opcode_matrix[cpu][entry->opcode] = entry;
+        }
+        if (cpu != CPU_65C02) continue;
+        for (int i = cmos_count - 1; i >= 0; i--) {
+            opcode_matrix[cpu][cmos_table[i].opcode] = &cmos_table[i];
+        }
+    }
 }
 
 /* Find opcode entry by mnemonic and addressing mode */
@@ -592,6 +772,30 @@ const OpcodeEntry *opcode_find(const char *mnemonic, AddressingMode mode) {
     return NULL;
 }
 
+/* Find opcode entry by mnemonic and addressing mode on a CPU */
+const OpcodeEntry *opcode_find_cpu(CpuType cpu, const char *mnemonic, AddressingMode mode) {
+    if (cpu == CPU_65C02) {
+        for (int i = 0; i < cmos_count; i++) {
+            if (strcasecmp_local(cmos_table[i].mnemonic, mnemonic) == 0 &&
+                cmos_table[i].mode == mode) {
+                return &cmos_table[i];
+            }
+        }
+    }
+    const OpcodeEntry *entry = opcode_find(mnemonic, mode);
+    if (entry && cpu != CPU_6510 && opcode_is_illegal(entry->mnemonic)) return NULL;
+    return entry;
+}
+
+/* Check if a CPU has an instruction */
+int opcode_cpu_has_mnemonic(CpuType cpu, const char *mnemonic) {
+    uint8_t flags = opcode_get_flags(mnemonic);
+    if (!opcode_is_valid_mnemonic(mnemonic)) return 0;
+    if ((flags & INST_ILLEGAL) && cpu != CPU_6510) return 0;
+    if ((flags & INST_65C02) && cpu != CPU_65C02) return 0;
+    return 1;
+}
+
 /* Get valid addressing modes for a mnemonic */
 uint16_t opcode_get_valid_modes(const char *mnemonic) {
     for (int i = 0; mnemonic_info[i].mnemonic != NULL; i++) {
@@ -650,10 +854,37 @@ const char *opcode_mode_name(AddressingMode mode) {
 
 /* Find opcode entry by opcode byte */
 const OpcodeEntry *opcode_find_by_opcode(uint8_t opcode) {
-    for (int i = 0; i < opcode_count; i++) {
-        if (opcode_table[i].opcode == opcode) {
-            return &opcode_table[i];
-        }
+    return opcode_matrix[CPU_6510][opcode];
+}
+
+/* Find opcode entry by opcode byte on a CPU */
+const OpcodeEntry *opcode_find_by_opcode_cpu(CpuType cpu, uint8_t opcode) {
+    if ((unsigned)cpu >= CPU_TYPE_COUNT) return NULL;
+    return opcode_matrix[cpu][opcode];
+}
+
+/* Decimal mode costs the 65C02 a cycle on ADC and SBC */
+int opcode_decimal_penalty(CpuType cpu, const OpcodeEntry *entry) {
+    if (cpu != CPU_65C02) return 0;
+    return strcmp(entry->mnemonic, "ADC") == 0 || strcmp(entry->mnemonic, "SBC") == 0;
+}
+
+/* Check if an opcode reads, modifies and writes back memory */
+int opcode_is_rmw(const OpcodeEntry *entry) {
+    static const char *const names[] = {
+        "ASL", "LSR", "ROL", "ROR", "INC", "DEC",
+        "SLO", "ASO", "RLA", "SRE", "LSE", "RRA", "DCP", "DCM", "ISC", "ISB", "INS",
+        "TSB", "TRB",
+        NULL
+    };
+    if (entry->mode == ADDR_ACCUMULATOR) return 0;
+    for (int i = 0; names[i]; i++) {
+        if (strcmp(entry->mnemonic, names[i]) == 0) return 1;
     }
-    return NULL;
+    /* RMB0-7 and SMB0-7 */
+    if ((strncmp(entry->mnemonic, "RMB", 3) == 0 || strncmp(entry->mnemonic, "SMB", 3) == 0) &&
+        entry->mnemonic[3] != '\0') {
+        return 1;
+    }
+    return 0;
 }
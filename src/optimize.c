@@ -0,0 +1,643 @@
+/*
+ * optimize.c - Register and Flag Value-Tracking Optimizer
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#include "optimize.h"
+#include "opcodes.h"
+#include "parser.h"
+#include "expr.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* ========== Known Values ========== */
+
+/* Register values and flags, each -1 while unknown */
+typedef struct {
+    int a, x, y;
+    int c, z, n, v, d;
+} Known;
+
+static void forget(Known *k) {
+    k->a = k->x = k->y = -1;
+    k->c = k->z = k->n = k->v = k->d = -1;
+}
+
+static void set_nz(Known *k, int value) {
+    k->n = value < 0 ? -1 : (value >> 7) & 1;
+    k->z = value < 0 ? -1 : value == 0;
+}
+
+/* Branches by the flag they test and its value when taken */
+static const struct {
+    const char *name;
+    char flag;
+    int value;
+    const char *what;
+} branches[] = {
+    { "BCS", 'c', 1, "carry is set" },          { "BCC", 'c', 0, "carry is clear" },
+    { "BEQ", 'z', 1, "zero flag is set" },      { "BNE", 'z', 0, "zero flag is clear" },
+    { "BMI", 'n', 1, "negative flag is set" },  { "BPL", 'n', 0, "negative flag is clear" },
+    { "BVS", 'v', 1, "overflow is set" },       { "BVC", 'v', 0, "overflow is clear" }
+};
+
+#define BRANCH_COUNT ((int)(sizeof(branches) / sizeof(branches[0])))
+
+static int *flag_of(Known *k, char flag) {
+    switch (flag) {
+        case 'c': return &k->c;
+        case 'z': return &k->z;
+        case 'n': return &k->n;
+        default:  return &k->v;
+    }
+}
+
+static int branch_lookup(const char *mnemonic) {
+    for (int i = 0; i < BRANCH_COUNT; i++) {
+        if (strcasecmp(branches[i].name, mnemonic) == 0) return i;
+    }
+    return -1;
+}
+
+/* ========== Helpers ========== */
+
+typedef struct {
+    Assembler *as;
+    uint8_t *targets;        /* Per address: a branch or jump lands there */
+    uint8_t *stored;         /* Per address: an instruction may store there */
+    int plan;                /* Plan changes instead of checking them */
+    int32_t pinned;          /* Lines below this address stay as written */
+} Optimizer;
+
+static int is(const InstructionInfo *info, const char *mnemonic) {
+    return strcasecmp(info->mnemonic, mnemonic) == 0;
+}
+
+static int is_directive(const AssembledLine *line, const char *name) {
+    return line->stmt->type == STMT_DIRECTIVE &&
+           strcmp(line->stmt->data.directive.name, name) == 0;
+}
+
+/* Opcode of an instruction line that generated bytes, or NULL */
+static const OpcodeEntry *line_opcode(const AssembledLine *line) {
+    if (line->stmt->type != STMT_INSTRUCTION || line->byte_count == 0) return NULL;
+    return opcode_find_by_opcode_cpu(line->cpu, line->bytes[0]);
+}
+
+static uint16_t operand_word(const AssembledLine *line) {
+    return (uint16_t)(line->bytes[1] | (line->bytes[2] << 8));
+}
+
+/* Immediate operand of an instruction line, or -1; removed lines have
+ * no bytes, so their operand is evaluated again */
+static int immediate(Optimizer *opt, const AssembledLine *line) {
+    const InstructionInfo *info = &line->stmt->data.instruction;
+    if (info->mode != ADDR_IMMEDIATE) return -1;
+    if (line->byte_count >= 2) return line->bytes[1];
+
+    Assembler *as = opt->as;
+    ExprResult r = expr_eval(info->operand, as->symbols, as->anon_labels, line->address, 2, line->zone);
+    return r.defined ? (int)(r.value & 0xFF) : -1;
+}
+
+/* Instructions that only read their memory operand */
+static int reads_only(const char *mnemonic) {
+    static const char *const names[] = {
+        "LDA", "LDX", "LDY", "LAX", "CMP", "CPX", "CPY", "ADC", "SBC", "AND",
+        "ORA", "EOR", "BIT", "NOP", "JMP", "JSR"
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcasecmp(names[i], mnemonic) == 0) return 1;
+    }
+    return 0;
+}
+
+/* Mark where branches and jumps land and where code may store */
+static void find_targets(Optimizer *opt) {
+    Assembler *as = opt->as;
+
+    for (int i = 0; i < as->line_count; i++) {
+        const AssembledLine *line = &as->lines[i];
+        const OpcodeEntry *entry = line_opcode(line);
+        if (!entry) continue;
+
+        switch (entry->mode) {
+            case ADDR_RELATIVE:
+                opt->targets[(uint16_t)(line->address + 2 + (int8_t)line->bytes[1])] = 1;
+                continue;
+            case ADDR_ZP_RELATIVE:
+                opt->targets[(uint16_t)(line->address + 3 + (int8_t)line->bytes[2])] = 1;
+                continue;
+            case ADDR_ABSOLUTE:
+                if (strcmp(entry->mnemonic, "JMP") == 0 || strcmp(entry->mnemonic, "JSR") == 0) {
+                    opt->targets[operand_word(line)] = 1;
+                }
+                break;
+            default:
+                break;
+        }
+        if (reads_only(entry->mnemonic)) continue;
+
+        /* Indexed stores may reach 255 bytes on; indirect ones are left
+         * to :@ labels */
+        uint16_t base = entry->size == 3 ? operand_word(line) : line->bytes[1];
+        int reach = 0;
+        switch (entry->mode) {
+            case ADDR_ZEROPAGE: case ADDR_ABSOLUTE: reach = 1; break;
+            case ADDR_ZEROPAGE_X: case ADDR_ZEROPAGE_Y:
+            case ADDR_ABSOLUTE_X: case ADDR_ABSOLUTE_Y: reach = 256; break;
+            default: break;
+        }
+        for (int b = 0; b < reach; b++) opt->stored[(uint16_t)(base + b)] = 1;
+    }
+}
+
+/* Whether a directive emits 16-bit words */
+static int is_word_directive(const AssembledLine *line) {
+    return is_directive(line, "word") || is_directive(line, "wo") ||
+           is_directive(line, "dw") || is_directive(line, "16");
+}
+
+/* Raise opt->pinned past a number written in the source that points into
+ * the code, which does not move with it */
+static void pin_literal(Optimizer *opt, const AssembledLine *line, Expr *expr) {
+    Assembler *as = opt->as;
+    if (!expr || expr_has_symbols(expr)) return;
+
+    ExprResult r = expr_eval(expr, as->symbols, as->anon_labels, line->address, 2, line->zone);
+    if (!r.defined || r.value < as->lowest_addr || r.value > as->highest_addr) return;
+    if (r.value + 1 > opt->pinned) opt->pinned = r.value + 1;
+}
+
+/*
+ * Removing bytes moves everything after them, so a literal address into
+ * the code (jmp $1009, lda $1020,x or !word $1009) would land elsewhere;
+ * no line at or below the highest one changes.
+ */
+static void find_pinned(Optimizer *opt) {
+    Assembler *as = opt->as;
+
+    opt->pinned = 0;
+    for (int i = 0; i < as->line_count; i++) {
+        const AssembledLine *line = &as->lines[i];
+        const Statement *stmt = line->stmt;
+
+        if (stmt->type == STMT_INSTRUCTION && line->byte_count > 0) {
+            const InstructionInfo *info = &stmt->data.instruction;
+            if (info->mode == ADDR_IMMEDIATE || info->mode == ADDR_IMPLIED ||
+                info->mode == ADDR_ACCUMULATOR) {
+                continue;
+            }
+            pin_literal(opt, line, info->operand);
+            pin_literal(opt, line, info->target);
+        } else if (stmt->type == STMT_DIRECTIVE && line->emitted > 0 && is_word_directive(line)) {
+            for (int a = 0; a < stmt->data.directive.arg_count; a++) {
+                pin_literal(opt, line, stmt->data.directive.args[a]);
+            }
+        }
+    }
+}
+
+/* Whether code may change the line's bytes while it runs */
+static int self_modified(const Optimizer *opt, const AssembledLine *line) {
+    if (line->smc) return 1;
+    int size = line->byte_count;
+    if (size == 0) size = line->stmt->data.instruction.size;
+    for (int b = 0; b < size; b++) {
+        if (opt->stored[(uint16_t)(line->address + b)]) return 1;
+    }
+    return 0;
+}
+
+/* ========== Instruction Effects ========== */
+
+static int shift(const InstructionInfo *info, int value, int carry, int *carry_out) {
+    if (is(info, "ASL")) {
+        *carry_out = value >> 7;
+        return (value << 1) & 0xFF;
+    }
+    if (is(info, "LSR")) {
+        *carry_out = value & 1;
+        return value >> 1;
+    }
+    if (is(info, "ROL")) {
+        *carry_out = value >> 7;
+        return ((value << 1) | carry) & 0xFF;
+    }
+    *carry_out = value & 1;
+    return (value >> 1) | (carry << 7);
+}
+
+/* Apply what an instruction that falls through does to k */
+static void step(Optimizer *opt, Known *k, const AssembledLine *line) {
+    const InstructionInfo *info = &line->stmt->data.instruction;
+    int imm = immediate(opt, line);
+    int acc = info->mode == ADDR_ACCUMULATOR || info->mode == ADDR_IMPLIED;
+    int *reg = NULL;
+
+    if (is(info, "LDA")) reg = &k->a;
+    else if (is(info, "LDX")) reg = &k->x;
+    else if (is(info, "LDY")) reg = &k->y;
+    if (reg) {
+        *reg = imm;
+        set_nz(k, imm);
+        return;
+    }
+
+    if (is(info, "TAX")) { k->x = k->a; set_nz(k, k->x); return; }
+    if (is(info, "TAY")) { k->y = k->a; set_nz(k, k->y); return; }
+    if (is(info, "TXA")) { k->a = k->x; set_nz(k, k->a); return; }
+    if (is(info, "TYA")) { k->a = k->y; set_nz(k, k->a); return; }
+    if (is(info, "TSX")) { k->x = -1; set_nz(k, -1); return; }
+
+    if (is(info, "INX") || is(info, "DEX")) reg = &k->x;
+    else if (is(info, "INY") || is(info, "DEY")) reg = &k->y;
+    else if ((is(info, "INC") || is(info, "DEC")) && acc) reg = &k->a;
+    if (reg) {
+        int delta = toupper((unsigned char)info->mnemonic[0]) == 'I' ? 1 : -1;
+        if (*reg >= 0) *reg = (*reg + delta) & 0xFF;
+        set_nz(k, *reg);
+        return;
+    }
+
+    if (is(info, "CLC")) { k->c = 0; return; }
+    if (is(info, "SEC")) { k->c = 1; return; }
+    if (is(info, "CLD")) { k->d = 0; return; }
+    if (is(info, "SED")) { k->d = 1; return; }
+    if (is(info, "CLV")) { k->v = 0; return; }
+
+    if (is(info, "CMP")) reg = &k->a;
+    else if (is(info, "CPX")) reg = &k->x;
+    else if (is(info, "CPY")) reg = &k->y;
+    if (reg) {
+        if (imm >= 0 && *reg >= 0) {
+            k->c = *reg >= imm;
+            set_nz(k, (*reg - imm) & 0xFF);
+        } else {
+            k->c = -1;
+            set_nz(k, -1);
+        }
+        return;
+    }
+
+    if (is(info, "ADC") || is(info, "SBC")) {
+        if (imm >= 0 && k->a >= 0 && k->c >= 0 && k->d == 0) {
+            int operand = is(info, "SBC") ? imm ^ 0xFF : imm;
+            int sum = k->a + operand + k->c;
+            int result = sum & 0xFF;
+            k->v = ((k->a ^ result) & (operand ^ result) & 0x80) != 0;
+            k->c = sum > 0xFF;
+            k->a = result;
+        } else {
+            k->a = k->c = k->v = -1;
+        }
+        set_nz(k, k->a);
+        return;
+    }
+
+    if (is(info, "AND") || is(info, "ORA") || is(info, "EOR")) {
+        if (imm >= 0 && k->a >= 0) {
+            k->a = is(info, "AND") ? k->a & imm : is(info, "ORA") ? k->a | imm : k->a ^ imm;
+        } else if (imm == 0 && is(info, "AND")) {
+            k->a = 0;
+        } else if (imm == 0xFF && is(info, "ORA")) {
+            k->a = 0xFF;
+        } else {
+            k->a = -1;
+        }
+        set_nz(k, k->a);
+        return;
+    }
+
+    if (is(info, "ASL") || is(info, "LSR") || is(info, "ROL") || is(info, "ROR")) {
+        int rotate = toupper((unsigned char)info->mnemonic[0]) == 'R';
+        if (acc && k->a >= 0 && (!rotate || k->c >= 0)) {
+            k->a = shift(info, k->a, k->c, &k->c);
+        } else {
+            if (acc) k->a = -1;
+            k->c = -1;
+        }
+        set_nz(k, acc ? k->a : -1);
+        return;
+    }
+
+    if (is(info, "BIT")) {
+        if (imm >= 0) {
+            k->z = k->a >= 0 ? (k->a & imm) == 0 : -1;
+        } else {
+            k->n = k->v = k->z = -1;
+        }
+        return;
+    }
+
+    if (is(info, "INC") || is(info, "DEC")) { set_nz(k, -1); return; }
+    if (is(info, "TRB") || is(info, "TSB")) { k->z = -1; return; }
+    if (is(info, "PLA")) { k->a = -1; set_nz(k, -1); return; }
+    if (is(info, "PLX")) { k->x = -1; set_nz(k, -1); return; }
+    if (is(info, "PLY")) { k->y = -1; set_nz(k, -1); return; }
+    if (is(info, "PLP")) { k->c = k->z = k->n = k->v = k->d = -1; return; }
+
+    if (is(info, "STA") || is(info, "STX") || is(info, "STY") || is(info, "STZ") ||
+        is(info, "PHA") || is(info, "PHP") || is(info, "PHX") || is(info, "PHY") ||
+        is(info, "TXS") || is(info, "SEI") || is(info, "CLI") || is(info, "NOP")) {
+        return;
+    }
+
+    /* Anything else (illegal opcodes among them) may change anything */
+    forget(k);
+}
+
+/* ========== Changes ========== */
+
+/*
+ * Whether an instruction would change nothing in k, with what makes it
+ * so written to reason.
+ */
+static int redundant(Optimizer *opt, const Known *k, const AssembledLine *line,
+                     char *reason, size_t size) {
+    const InstructionInfo *info = &line->stmt->data.instruction;
+    int imm = immediate(opt, line);
+    int value = -1;
+    char name = 0;
+
+    if (is(info, "LDA")) { value = k->a; name = 'A'; }
+    else if (is(info, "LDX")) { value = k->x; name = 'X'; }
+    else if (is(info, "LDY")) { value = k->y; name = 'Y'; }
+    if (name) {
+        if (imm < 0 || value != imm || k->n != imm >> 7 || k->z != (imm == 0)) return 0;
+        snprintf(reason, size, "%c is already $%02X", name, imm);
+        return 1;
+    }
+
+    static const struct { const char *mnemonic; char from; char to; } transfers[] = {
+        { "TAX", 'A', 'X' }, { "TAY", 'A', 'Y' }, { "TXA", 'X', 'A' }, { "TYA", 'Y', 'A' }
+    };
+    for (int i = 0; i < 4; i++) {
+        if (!is(info, transfers[i].mnemonic)) continue;
+        int from = transfers[i].from == 'A' ? k->a : transfers[i].from == 'X' ? k->x : k->y;
+        int to = transfers[i].to == 'A' ? k->a : transfers[i].to == 'X' ? k->x : k->y;
+        if (from < 0 || to != from || k->n != from >> 7 || k->z != (from == 0)) return 0;
+        snprintf(reason, size, "%c already equals %c ($%02X)", transfers[i].to,
+                 transfers[i].from, from);
+        return 1;
+    }
+
+    static const struct { const char *mnemonic; char flag; int value; const char *what; } flags[] = {
+        { "CLC", 'c', 0, "carry is already clear" },
+        { "SEC", 'c', 1, "carry is already set" },
+        { "CLD", 'd', 0, "decimal mode is already off" },
+        { "SED", 'd', 1, "decimal mode is already on" },
+        { "CLV", 'v', 0, "overflow is already clear" }
+    };
+    for (int i = 0; i < 5; i++) {
+        if (!is(info, flags[i].mnemonic)) continue;
+        int flag = flags[i].flag == 'c' ? k->c : flags[i].flag == 'd' ? k->d : k->v;
+        if (flag != flags[i].value) return 0;
+        snprintf(reason, size, "%s", flags[i].what);
+        return 1;
+    }
+
+    if (is(info, "CMP")) { value = k->a; name = 'A'; }
+    else if (is(info, "CPX")) { value = k->x; name = 'X'; }
+    else if (is(info, "CPY")) { value = k->y; name = 'Y'; }
+    if (name) {
+        if (imm < 0 || value < 0) return 0;
+        int result = (value - imm) & 0xFF;
+        if (k->c != (value >= imm) || k->n != result >> 7 || k->z != (result == 0)) return 0;
+        snprintf(reason, size, "flags already match %c = $%02X", name, value);
+        return 1;
+    }
+    return 0;
+}
+
+/* Branch taken for what k knows, preferring BRA; -1 if none */
+static int taken_branch(const Known *k, CpuType cpu, uint8_t *opcode, const char **what) {
+    const OpcodeEntry *op = opcode_find_cpu(cpu, "BRA", ADDR_RELATIVE);
+    if (op) {
+        *opcode = op->opcode;
+        *what = "BRA is always taken";
+        return 0;
+    }
+    Known copy = *k;
+    for (int i = 0; i < BRANCH_COUNT; i++) {
+        if (*flag_of(&copy, branches[i].flag) != branches[i].value) continue;
+        op = opcode_find_cpu(cpu, branches[i].name, ADDR_RELATIVE);
+        if (!op) continue;
+        *opcode = op->opcode;
+        *what = branches[i].what;
+        return 0;
+    }
+    return -1;
+}
+
+/* Whether a branch from address to target reaches without crossing a page */
+static int branch_fits(uint16_t address, uint16_t target) {
+    int32_t offset = (int32_t)target - (address + 2);
+    return offset >= -128 && offset <= 127 && !(((address + 2) ^ target) & 0xFF00);
+}
+
+static OptEdit *add_edit(Assembler *as, int index, uint8_t kind) {
+    if (as->opt_edit_count >= as->opt_edit_capacity) {
+        int capacity = as->opt_edit_capacity ? as->opt_edit_capacity * 2 : 32;
+        OptEdit *edits = realloc(as->opt_edits, (size_t)capacity * sizeof(OptEdit));
+        if (!edits) return NULL;
+        as->opt_edits = edits;
+        as->opt_edit_capacity = capacity;
+    }
+    const Statement *stmt = as->lines[index].stmt;
+    OptEdit *edit = &as->opt_edits[as->opt_edit_count++];
+    memset(edit, 0, sizeof(*edit));
+    edit->line = index;
+    edit->file = stmt->file;
+    edit->source_line = stmt->line;
+    snprintf(edit->mnemonic, sizeof(edit->mnemonic), "%s", stmt->data.instruction.mnemonic);
+    for (char *c = edit->mnemonic; *c; c++) *c = (char)toupper((unsigned char)*c);
+    edit->kind = kind;
+    return edit;
+}
+
+/* Plan a change to an instruction that has none yet */
+static void plan_line(Optimizer *opt, const Known *k, int index) {
+    Assembler *as = opt->as;
+    const AssembledLine *line = &as->lines[index];
+    const InstructionInfo *info = &line->stmt->data.instruction;
+    char reason[sizeof(((OptEdit *)0)->reason)];
+
+    if (redundant(opt, k, line, reason, sizeof(reason))) {
+        OptEdit *edit = add_edit(as, index, OPT_REMOVE);
+        if (!edit) return;
+        edit->bytes = line->byte_count;
+        edit->cycles = info->cycles;
+        snprintf(edit->reason, sizeof(edit->reason), "%s", reason);
+        return;
+    }
+
+    const char *what;
+    uint8_t opcode;
+    if (!is(info, "JMP") || info->mode != ADDR_ABSOLUTE || line->byte_count != 3 ||
+        !branch_fits(line->address, operand_word(line)) ||
+        taken_branch(k, line->cpu, &opcode, &what) < 0) {
+        return;
+    }
+    const OpcodeEntry *branch = opcode_find_by_opcode_cpu(line->cpu, opcode);
+    OptEdit *edit = add_edit(as, index, OPT_BRANCH);
+    if (!edit) return;
+    edit->opcode = opcode;
+    edit->bytes = 1;
+    edit->cycles = info->cycles - (branch->cycles + 1);
+    snprintf(edit->reason, sizeof(edit->reason), "%s", what);
+}
+
+/* Whether the change pass 1 made to a line still holds */
+static int check_line(Optimizer *opt, const Known *k, const AssembledLine *line) {
+    char reason[sizeof(((OptEdit *)0)->reason)];
+
+    if (line->optimized == OPT_REMOVE) {
+        return redundant(opt, k, line, reason, sizeof(reason));
+    }
+    const InstructionInfo *info = &line->stmt->data.instruction;
+    if (line->byte_count != 2 ||
+        !branch_fits(line->address, (uint16_t)(line->address + 2 + (int8_t)line->bytes[1]))) {
+        return 0;
+    }
+    if (is(info, "BRA")) return 1;
+    int b = branch_lookup(info->mnemonic);
+    Known copy = *k;
+    return b >= 0 && *flag_of(&copy, branches[b].flag) == branches[b].value;
+}
+
+/* ========== Analysis ========== */
+
+static void analyze(Optimizer *opt) {
+    Assembler *as = opt->as;
+    Known k;
+    int frozen = 0;
+    int slot = 0;
+    int32_t next = -1;
+
+    forget(&k);
+    for (int i = 0; i < as->line_count; i++) {
+        const AssembledLine *line = &as->lines[i];
+        const Statement *stmt = line->stmt;
+
+        /* Timing-exact regions keep their code as written */
+        if (is_directive(line, "balanced") || is_directive(line, "raster_block")) frozen++;
+        if ((is_directive(line, "balanced_end") || is_directive(line, "raster_end")) && frozen > 0) {
+            frozen--;
+        }
+
+        /* A removed line shares its address with the next one, which takes the barrier */
+        int removed = line->optimized == OPT_REMOVE && line->byte_count == 0;
+        if (stmt->label || (!removed && (opt->targets[line->address] || line->address != next))) {
+            forget(&k);
+        }
+        if (stmt->type != STMT_INSTRUCTION) {
+            if (line->emitted > 0) forget(&k);
+            if (line->emitted > 0 || is_directive(line, "org")) next = -1;
+            continue;
+        }
+        if (line->byte_count == 0 && line->optimized != OPT_REMOVE) continue;
+
+        const InstructionInfo *info = &stmt->data.instruction;
+        int changeable = !frozen && !line->in_pseudopc && !self_modified(opt, line) &&
+                         line->address >= opt->pinned;
+        next = (uint16_t)(line->address + line->byte_count);
+
+        int kept = 0;
+        if (line->optimized) {
+            while (slot < as->opt_edit_count && as->opt_edits[slot].line < i) slot++;
+            OptEdit *edit = slot < as->opt_edit_count && as->opt_edits[slot].line == i ?
+                            &as->opt_edits[slot] : NULL;
+            kept = edit && changeable && check_line(opt, &k, line);
+            if (edit && !kept) edit->applied = 0;
+        } else if (opt->plan && changeable) {
+            plan_line(opt, &k, i);
+        }
+
+        /* What falls through to the next line */
+        if (line->optimized == OPT_REMOVE && kept) continue;
+        int b = branch_lookup(info->mnemonic);
+        if (line->optimized == OPT_BRANCH || is(info, "BRA") || is(info, "JMP") ||
+            is(info, "JSR") || is(info, "RTS") || is(info, "RTI") || is(info, "BRK")) {
+            forget(&k);
+        } else if (b >= 0 && info->mode == ADDR_RELATIVE) {
+            int *flag = flag_of(&k, branches[b].flag);
+            if (*flag == branches[b].value) {
+                forget(&k);
+            } else {
+                *flag = !branches[b].value;
+            }
+        } else if (info->mode != ADDR_ZP_RELATIVE) {
+            step(opt, &k, line);
+        }
+        if (self_modified(opt, line)) forget(&k);
+    }
+}
+
+static int run(Assembler *as, int plan) {
+    Optimizer opt = { as, calloc(ASM_MEMORY_SIZE, 1), calloc(ASM_MEMORY_SIZE, 1), plan, 0 };
+    if (!opt.targets || !opt.stored) {
+        free(opt.targets);
+        free(opt.stored);
+        return -1;
+    }
+    find_targets(&opt);
+    find_pinned(&opt);
+    analyze(&opt);
+    free(opt.targets);
+    free(opt.stored);
+    return 0;
+}
+
+int optimize_plan(Assembler *as) {
+    as->opt_edit_count = 0;
+    if (run(as, 1) < 0) return 0;
+    return as->opt_edit_count;
+}
+
+int optimize_verify(Assembler *as) {
+    if (run(as, 0) < 0) {
+        int dropped = as->opt_edit_count;
+        as->opt_edit_count = 0;
+        return dropped;
+    }
+
+    /* Changes pass 1 did not make are dropped with those that no longer hold */
+    int kept = 0;
+    for (int i = 0; i < as->opt_edit_count; i++) {
+        if (as->opt_edits[i].applied) as->opt_edits[kept++] = as->opt_edits[i];
+    }
+    int dropped = as->opt_edit_count - kept;
+    as->opt_edit_count = kept;
+    return dropped;
+}
+
+/* ========== Report ========== */
+
+void optimize_report(const Assembler *as, FILE *out) {
+    int bytes = 0, cycles = 0;
+
+    for (int i = 0; i < as->opt_edit_count; i++) {
+        const OptEdit *edit = &as->opt_edits[i];
+        const char *file = edit->file ? edit->file : "<input>";
+        if (edit->kind == OPT_REMOVE) {
+            fprintf(out, "%s:%d: %s removed: %s (%d byte%s, %d cycle%s saved)\n",
+                    file, edit->source_line, edit->mnemonic, edit->reason,
+                    edit->bytes, edit->bytes == 1 ? "" : "s",
+                    edit->cycles, edit->cycles == 1 ? "" : "s");
+        } else {
+            const OpcodeEntry *branch = opcode_find_by_opcode_cpu(as->lines[edit->line].cpu, edit->opcode);
+            fprintf(out, "%s:%d: %s replaced by %s: %s (%d byte%s, %d cycle%s saved)\n",
+                    file, edit->source_line, edit->mnemonic, branch ? branch->mnemonic : "branch",
+                    edit->reason, edit->bytes, edit->bytes == 1 ? "" : "s",
+                    edit->cycles, edit->cycles == 1 ? "" : "s");
+        }
+        bytes += edit->bytes;
+        cycles += edit->cycles;
+    }
+    fprintf(out, "Optimizer: %d change%s, %d byte%s and %d cycle%s saved\n",
+            as->opt_edit_count, as->opt_edit_count == 1 ? "" : "s",
+            bytes, bytes == 1 ? "" : "s", cycles, cycles == 1 ? "" : "s");
+}
@@ -0,0 +1,812 @@
+/*
+ * output.c - Concurrent Output File Writers
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#define _GNU_SOURCE              /* O_DIRECT */
+#include "output.h"
+#include "threadpool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Why a job failed, reported once all workers are done */
+typedef enum {
+    WRITE_OK,
+    WRITE_CANNOT_CREATE,
+    WRITE_FAILED
+} WriteStatus;
+
+/* Per-job worker state */
+typedef struct {
+    Assembler *as;
+    OutputJob *job;
+    int flags;
+    mode_t mode;             /* Permissions for newly created files */
+    int skip;                /* Nothing to write (empty program) */
+    int stream;              /* Destination is "-" or "fd:N" */
+    char *data;              /* Rendered bytes for stream destinations */
+    size_t size;
+    WriteStatus status;
+} WriteTask;
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+const char *output_kind_name(OutputFileKind kind) {
+    switch (kind) {
+        case OUTPUT_FILE_PROGRAM: return "program";
+        case OUTPUT_FILE_SYMBOLS: return "symbols";
+        case OUTPUT_FILE_LISTING: return "listing";
+        case OUTPUT_FILE_FOLDED: return "folded";
+    }
+    return "output";
+}
+
+/* Noun used in error messages, matching the single-file writers */
+static const char *output_kind_noun(OutputFileKind kind) {
+    switch (kind) {
+        case OUTPUT_FILE_PROGRAM: return "output";
+        case OUTPUT_FILE_SYMBOLS: return "symbol";
+        case OUTPUT_FILE_LISTING: return "listing";
+        case OUTPUT_FILE_FOLDED: return "folded stack";
+    }
+    return "output";
+}
+
+/* ========== Destinations ========== */
+
+static int is_stream_destination(const char *name) {
+    return strcmp(name, "-") == 0 || strncmp(name, "fd:", 3) == 0;
+}
+
+/*
+ * Open a stream destination: "-" is standard output, "fd:N" an already
+ * open descriptor (duplicated so closing never touches the caller's copy).
+ */
+static FILE *open_stream(const char *name) {
+    if (strcmp(name, "-") == 0) {
+        return stdout;
+    }
+    char *end;
+    long fd = strtol(name + 3, &end, 10);
+    if (end == name + 3 || *end != '\0' || fd < 0 || fd > INT_MAX) {
+        return NULL;
+    }
+    int dup_fd = dup((int)fd);
+    if (dup_fd < 0) return NULL;
+    FILE *fp = fdopen(dup_fd, "wb");
+    if (!fp) close(dup_fd);
+    return fp;
+}
+
+/* Close a stream opened by open_stream. Returns 0 if all data was written. */
+static int close_stream(FILE *fp) {
+    int failed = ferror(fp);
+    if (fp == stdout) {
+        return (fflush(fp) != 0 || failed) ? -1 : 0;
+    }
+    return (fclose(fp) != 0 || failed) ? -1 : 0;
+}
+
+/* Write all of buf to fd, retrying short writes */
+static int write_all(int fd, const char *buf, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * Write rendered data to a freshly created file, bypassing the page cache
+ * when the filesystem supports it. The data is copied into an aligned,
+ * block-padded buffer and the file trimmed back to size afterwards; any
+ * failure falls back to an ordinary write.
+ */
+static int write_direct(int fd, const char *data, size_t size, int *direct) {
+    *direct = 0;
+#ifdef O_DIRECT
+    size_t padded = (size + OUTPUT_DIRECT_ALIGN - 1) & ~(size_t)(OUTPUT_DIRECT_ALIGN - 1);
+    void *aligned = NULL;
+    int fl = fcntl(fd, F_GETFL);
+    if (padded > 0 && fl >= 0 &&
+        posix_memalign(&aligned, OUTPUT_DIRECT_ALIGN, padded) == 0) {
+        memcpy(aligned, data, size);
+        memset((char *)aligned + size, 0, padded - size);
+        if (fcntl(fd, F_SETFL, fl | O_DIRECT) == 0) {
+            if (write_all(fd, aligned, padded) == 0 && ftruncate(fd, (off_t)size) == 0) {
+                *direct = 1;
+            } else {
+                /* Start over with buffered I/O */
+                if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+                    free(aligned);
+                    return -1;
+                }
+            }
+            fcntl(fd, F_SETFL, fl);
+        }
+        free(aligned);
+        if (*direct) return 0;
+    }
+#endif
+    return write_all(fd, data, size);
+}
+
+/* ========== Renderers ========== */
+
+static int render_program(Assembler *as, FILE *fp) {
+    /* Write load address header for PRG format */
+    if (as->format == OUTPUT_PRG) {
+        uint8_t header[2];
+        header[0] = as->lowest_addr & 0xFF;
+        header[1] = (as->lowest_addr >> 8) & 0xFF;
+        fwrite(header, 1, 2, fp);
+    }
+
+    /* Write code */
+    int size = as->highest_addr - as->lowest_addr + 1;
+    fwrite(&as->memory[as->lowest_addr], 1, size, fp);
+    return 0;
+}
+
+/* Append "XXXX  " */
+static char *format_address(char *p, uint16_t addr) {
+    p[0] = hex_digits[(addr >> 12) & 0xF];
+    p[1] = hex_digits[(addr >> 8) & 0xF];
+    p[2] = hex_digits[(addr >> 4) & 0xF];
+    p[3] = hex_digits[addr & 0xF];
+    p[4] = ' ';
+    p[5] = ' ';
+    return p + 6;
+}
+
+/* Append up to 4 "XX " byte columns, padded to 12 characters */
+static char *format_bytes(char *p, const uint8_t *bytes, int count) {
+    char *start = p;
+    for (int j = 0; j < count; j++) {
+        *p++ = hex_digits[bytes[j] >> 4];
+        *p++ = hex_digits[bytes[j] & 0xF];
+        *p++ = ' ';
+    }
+    while (p - start < 12) {
+        *p++ = ' ';
+    }
+    return p;
+}
+
+static char *format_spaces(char *p, int count) {
+    memset(p, ' ', count);
+    return p + count;
+}
+
+/* Symbols in VICE format, then with --export-lists each list element as
+ * name_i in definition order */
+static int render_symbols(Assembler *as, FILE *fp) {
+    if (symbol_write_vice(as->symbols, fp) < 0) return -1;
+    if (!as->export_lists) return 0;
+
+    for (int i = 0; i < expr_list_count(as->symbols->lists); i++) {
+        const ExprList *list = expr_list_at(as->symbols->lists, i);
+        for (int e = 0; e < expr_list_length(list); e++) {
+            fprintf(fp, "al C:%04X .%s_%d\n", (uint16_t)expr_list_get(list, e),
+                    expr_list_name(list), e);
+        }
+    }
+    return ferror(fp) ? -1 : 0;
+}
+
+/*
+ * Render the listing. Each line's fixed-width columns are formatted into
+ * a local buffer and emitted with a single call rather than a printf per
+ * column.
+ */
+static int render_listing(Assembler *as, FILE *fp) {
+    char buf[64];
+
+    /* Write header */
+    fputs("; ASM64 Listing File\n"
+          "; Generated from assembled source\n"
+          ";\n", fp);
+    if (as->show_cycles) {
+        fputs("; Address  Bytes         Cycles  Source\n"
+              "; -------  ----------    ------  ------\n", fp);
+    } else {
+        fputs("; Address  Bytes         Source\n"
+              "; -------  ----------    ------\n", fp);
+    }
+    fputc('\n', fp);
+
+    /* Write each assembled line */
+    for (int i = 0; i < as->line_count; i++) {
+        AssembledLine *line = &as->lines[i];
+        Statement *stmt = line->stmt;
+        char *p = buf;
+
+        /* Skip empty statements without source */
+        if (stmt && stmt->type == STMT_EMPTY && !line->source_text) {
+            continue;
+        }
+
+        /* Check if this is an ORG directive (doesn't generate bytes) */
+        int is_org = 0;
+        if (line->source_text && line->source_text[0] == '*' &&
+            strchr(line->source_text, '=')) {
+            is_org = 1;
+        }
+
+        /* Format address - show new address for ORG, otherwise current address */
+        if ((line->byte_count > 0 && !is_org) ||
+            (stmt && stmt->type == STMT_LABEL)) {
+            p = format_address(p, line->address);
+        } else {
+            p = format_spaces(p, 6);
+        }
+
+        /* Format hex bytes (up to 4 bytes on the line, more if needed) */
+        /* Skip bytes display for ORG directives */
+        int bytes_shown = 0;
+        if (!is_org) {
+            bytes_shown = line->byte_count > 4 ? 4 : line->byte_count;
+        }
+        p = format_bytes(p, line->bytes, bytes_shown);
+
+        /* Format cycle count if enabled */
+        if (as->show_cycles) {
+            if (line->cycles > 0) {
+                p += snprintf(p, sizeof(buf) - (p - buf), "  %2d%c   ",
+                              line->cycles, line->page_penalty ? '+' : ' ');
+            } else {
+                p = format_spaces(p, 8);
+            }
+        }
+
+        /* Source text */
+        const char *text = NULL;
+        if (line->source_text) {
+            text = line->source_text;
+        } else if (stmt && stmt->type == STMT_INSTRUCTION) {
+            /* Generate instruction text if source not available */
+            text = stmt->data.instruction.mnemonic;
+        }
+        if (text) {
+            p = format_spaces(p, 2);
+            fwrite(buf, 1, p - buf, fp);
+            fputs(text, fp);
+            fputc('\n', fp);
+        } else {
+            *p++ = '\n';
+            fwrite(buf, 1, p - buf, fp);
+        }
+
+        /* If more than 4 bytes, continue on next lines (skip for ORG) */
+        if (line->byte_count > 4 && !is_org) {
+            int pos = 4;
+            while (pos < line->byte_count) {
+                int count = (line->byte_count - pos) > 4 ? 4 : (line->byte_count - pos);
+                p = format_address(buf, line->address + pos);
+                p = format_bytes(p, line->bytes + pos, count);
+                if (as->show_cycles) {
+                    p = format_spaces(p, 8);
+                }
+                *p++ = '\n';
+                fwrite(buf, 1, p - buf, fp);
+                pos += count;
+            }
+        }
+    }
+
+    /* Write what inlining cost and saved */
+    if (as->inline_call_count > 0) {
+        int added = 0;
+        fputs("\n; Inlined Calls\n"
+              "; -------------\n", fp);
+        for (int i = 0; i < as->inline_call_count; i++) {
+            const InlineCall *call = &as->inline_calls[i];
+            fprintf(fp, "; $%04X  %-16s %s:%d  %+d bytes, %d cycles saved\n",
+                    call->address, call->routine, call->filename, call->line_number,
+                    call->size - 3, ASM_INLINE_SAVED_CYCLES);
+            added += call->size - 3;
+        }
+        fprintf(fp, "; %d call(s) inlined: %+d bytes, %d cycles saved\n",
+                as->inline_call_count, added, as->inline_call_count * ASM_INLINE_SAVED_CYCLES);
+    }
+
+    /* Write where !soa put its tables and what alignment cost */
+    int soa_header = 0;
+    for (int i = 0; i < as->line_count; i++) {
+        Statement *stmt = as->lines[i].stmt;
+        SoaLayout layout;
+        if (stmt->type != STMT_DIRECTIVE || strcmp(stmt->data.directive.name, "soa") != 0 ||
+            assembler_soa_layout(as, stmt, as->lines[i].address, &layout) < 0) {
+            continue;
+        }
+        if (!soa_header) {
+            fputs("\n; Struct-of-Arrays Tables\n"
+                  "; -----------------------\n", fp);
+            soa_header = 1;
+        }
+        fprintf(fp, "; $%04X-$%04X  %-16s %d table(s) of %d bytes, %d bytes wasted\n",
+                as->lines[i].address, (unsigned)(layout.end - 1) & 0xFFFF,
+                stmt->data.directive.args[0]->data.symbol,
+                layout.tables, layout.count, layout.waste);
+    }
+
+    /* Write how full each !charmap character set is */
+    int charmap_header = 0;
+    for (int i = 0; i < as->line_count; i++) {
+        const BuiltCharmap *built = as->charmaps;
+        while (built && built->stmt != as->lines[i].stmt) built = built->next;
+        if (!built) continue;
+        if (!charmap_header) {
+            fputs("\n; Character Maps\n"
+                  "; --------------\n", fp);
+            charmap_header = 1;
+        }
+        fprintf(fp, "; $%04X  %-16s %dx%d cells, %d distinct, %d of %d characters (%d%%)\n",
+                as->lines[i].address, as->lines[i].stmt->data.directive.string_arg,
+                built->width, built->height, built->unique, built->chars, built->limit,
+                built->chars * 100 / built->limit);
+    }
+
+    /* Write what each !strpool saved */
+    int strpool_header = 0;
+    for (int i = 0; i < as->line_count; i++) {
+        const StringPool *sp = as->strpools;
+        while (sp && sp->end != as->lines[i].stmt) sp = sp->next;
+        if (!sp) continue;
+        if (!strpool_header) {
+            fputs("\n; String Pools\n"
+                  "; ------------\n", fp);
+            strpool_header = 1;
+        }
+        const LabelInfo *label = sp->stmt->label;
+        fprintf(fp, "; $%04X  %-16s %d string(s), %d distinct, %d inside others",
+                sp->address, label ? label->name : "-",
+                sp->pool.count, sp->pool.distinct, sp->pool.shared);
+        if (sp->options.compress) {
+            fprintf(fp, ", %d dictionary words", sp->pool.words);
+        }
+        fprintf(fp, ": %d -> %d bytes, %d saved\n",
+                sp->input_size, sp->pool.size, sp->input_size - sp->pool.size);
+    }
+
+    /* Write what each !rodata packing saved */
+    int rodata_header = 0;
+    for (int i = 0; i < as->line_count; i++) {
+        const RodataRegion *rp = as->rodata;
+        while (rp && rp->end != as->lines[i].stmt) rp = rp->next;
+        if (!rp) continue;
+        if (!rodata_header) {
+            fputs("\n; Read-Only Data\n"
+                  "; --------------\n", fp);
+            rodata_header = 1;
+        }
+        const LabelInfo *label = rp->stmt->label;
+        fprintf(fp, "; $%04X  %-16s %d block(s), %d distinct, %d inside others, %d bytes overlapped: "
+                "%d -> %d bytes, %d padding, %d saved\n",
+                rp->address, label ? label->name : "-",
+                rp->pack.count, rp->pack.distinct, rp->pack.inside, rp->pack.overlapped,
+                rp->input_size, rp->pack.size, rp->pack.padding,
+                rp->input_size - (rp->pack.size - rp->pack.padding));
+    }
+
+    /* Write which operand bytes self-modifying code rewrites */
+    int smc_header = 0;
+    for (int i = 0; i < as->line_count; i++) {
+        const AssembledLine *line = &as->lines[i];
+        if (!line->smc) continue;
+        if (!smc_header) {
+            fputs("\n; Self-Modifying Operands\n"
+                  "; ------------------------\n", fp);
+            smc_header = 1;
+        }
+        int first = (line->smc & 0x02) ? 1 : 2;
+        int last = (line->smc & 0x04) ? 2 : 1;
+        fprintf(fp, "; $%04X-$%04X  %-16s %s:%d\n",
+                (line->address + first) & 0xFFFF, (line->address + last) & 0xFFFF,
+                line->stmt->data.instruction.operand_label->name,
+                line->stmt->file, line->stmt->line);
+    }
+
+    /* Write symbol table summary */
+    fputs("\n; Symbol Table\n"
+          "; ------------\n", fp);
+    return render_symbols(as, fp);
+}
+
+/* ========== Size Report ========== */
+
+/* Bytes and base cycles attributed to one name */
+typedef struct {
+    char *name;              /* Owned */
+    long bytes;
+    long cycles;
+} SizeRow;
+
+typedef struct {
+    const char *title;
+    SizeRow *rows;
+    int count;
+    int capacity;
+} SizeTable;
+
+static int size_add(SizeTable *table, const char *name, long bytes, long cycles) {
+    for (int i = 0; i < table->count; i++) {
+        if (strcmp(table->rows[i].name, name) == 0) {
+            table->rows[i].bytes += bytes;
+            table->rows[i].cycles += cycles;
+            return 0;
+        }
+    }
+    if (table->count >= table->capacity) {
+        int new_capacity = table->capacity ? table->capacity * 2 : 16;
+        SizeRow *rows = realloc(table->rows, new_capacity * sizeof(SizeRow));
+        if (!rows) return -1;
+        table->rows = rows;
+        table->capacity = new_capacity;
+    }
+    SizeRow *row = &table->rows[table->count];
+    row->name = strdup(name);
+    if (!row->name) return -1;
+    row->bytes = bytes;
+    row->cycles = cycles;
+    table->count++;
+    return 0;
+}
+
+static void size_table_free(SizeTable *table) {
+    for (int i = 0; i < table->count; i++) free(table->rows[i].name);
+    free(table->rows);
+}
+
+/* Largest first, then by name */
+static int size_row_compare(const void *a, const void *b) {
+    const SizeRow *ra = a, *rb = b;
+    if (ra->bytes != rb->bytes) return ra->bytes < rb->bytes ? 1 : -1;
+    if (ra->cycles != rb->cycles) return ra->cycles < rb->cycles ? 1 : -1;
+    return strcmp(ra->name, rb->name);
+}
+
+static int size_row_compare_name(const void *a, const void *b) {
+    return strcmp(((const SizeRow *)a)->name, ((const SizeRow *)b)->name);
+}
+
+/* Zone a line counts towards: the caller's inside expansions, else the
+ * global label the line defines or the zone it was assembled in */
+static const char *line_zone(const AssembledLine *line) {
+    const LabelInfo *label = line->stmt->label;
+    if (line->origin_zone) return line->origin_zone[0] ? line->origin_zone : "(global)";
+    if (label && !label->is_local && !label->is_anon_fwd && !label->is_anon_back) {
+        return label->name;
+    }
+    return line->zone ? line->zone : "(global)";
+}
+
+static int is_loop_frame(const char *frame, size_t length) {
+    return (length > 5 && strncmp(frame, "<for ", 5) == 0) ||
+           (length == 7 && strncmp(frame, "<while>", 7) == 0);
+}
+
+/* Outermost and innermost macro frames and innermost loop frame of a
+ * line, copied into the given buffers ("(none)" if there is none) */
+static void line_frames(const AssembledLine *line, char *outer, char *inner,
+                        char *loop, size_t size) {
+    snprintf(outer, size, "(none)");
+    snprintf(inner, size, "(none)");
+    snprintf(loop, size, "(none)");
+
+    for (const char *frame = line->frames; frame && *frame; ) {
+        const char *end = strchr(frame, ';');
+        size_t length = end ? (size_t)(end - frame) : strlen(frame);
+        int n = length < size ? (int)length : (int)size - 1;
+        if (is_loop_frame(frame, length)) {
+            snprintf(loop, size, "%.*s", n, frame);
+        } else {
+            if (strcmp(outer, "(none)") == 0) snprintf(outer, size, "%.*s", n, frame);
+            snprintf(inner, size, "%.*s", n, frame);
+        }
+        frame = end ? end + 1 : NULL;
+    }
+}
+
+/* Base cycles of a line that emitted an instruction */
+static long line_cycles(const AssembledLine *line) {
+    if (line->stmt->type != STMT_INSTRUCTION || line->emitted == 0) return 0;
+    return line->cycles;
+}
+
+void assembler_size_report(Assembler *as, FILE *out) {
+    enum { BY_FILE, BY_ZONE, BY_OUTER, BY_INNER, BY_LOOP, BY_COUNT };
+    SizeTable tables[BY_COUNT] = {
+        { "By include file", NULL, 0, 0 },
+        { "By zone", NULL, 0, 0 },
+        { "By outermost macro", NULL, 0, 0 },
+        { "By innermost macro", NULL, 0, 0 },
+        { "By loop", NULL, 0, 0 }
+    };
+    char outer[256], inner[256], loop[256];
+    long total_bytes = 0, total_cycles = 0;
+    int failed = 0;
+
+    for (int i = 0; i < as->line_count && !failed; i++) {
+        const AssembledLine *line = &as->lines[i];
+        long cycles = line_cycles(line);
+        if (line->emitted == 0 && cycles == 0) continue;
+
+        line_frames(line, outer, inner, loop, sizeof(outer));
+        const char *names[BY_COUNT] = {
+            line->origin_file ? line->origin_file : "(none)",
+            line_zone(line), outer, inner, loop
+        };
+        for (int t = 0; t < BY_COUNT; t++) {
+            if (size_add(&tables[t], names[t], line->emitted, cycles) < 0) failed = 1;
+        }
+        total_bytes += line->emitted;
+        total_cycles += cycles;
+    }
+
+    if (failed) {
+        assembler_error(as, "out of memory for size report");
+    } else {
+        fprintf(out, "Size report: %ld bytes, %ld base cycles\n", total_bytes, total_cycles);
+        for (int t = 0; t < BY_COUNT; t++) {
+            SizeTable *table = &tables[t];
+            qsort(table->rows, table->count, sizeof(SizeRow), size_row_compare);
+            fprintf(out, "\n%s:\n", table->title);
+            fprintf(out, "  %8s %7s %8s  %s\n", "bytes", "%", "cycles", "name");
+            for (int i = 0; i < table->count; i++) {
+                const SizeRow *row = &table->rows[i];
+                double percent = total_bytes ? 100.0 * row->bytes / total_bytes : 0.0;
+                fprintf(out, "  %8ld %6.1f%% %8ld  %s\n",
+                        row->bytes, percent, row->cycles, row->name);
+            }
+        }
+    }
+
+    for (int t = 0; t < BY_COUNT; t++) size_table_free(&tables[t]);
+}
+
+/* One "file;zone;frame;... bytes" line per distinct stack, sorted */
+static int render_folded(Assembler *as, FILE *fp) {
+    SizeTable stacks = { "folded", NULL, 0, 0 };
+    char stack[2048];
+    int result = 0;
+
+    for (int i = 0; i < as->line_count && result == 0; i++) {
+        const AssembledLine *line = &as->lines[i];
+        if (line->emitted == 0) continue;
+        snprintf(stack, sizeof(stack), "%s;%s%s%s",
+                 line->origin_file ? line->origin_file : "(none)", line_zone(line),
+                 line->frames ? ";" : "", line->frames ? line->frames : "");
+        result = size_add(&stacks, stack, line->emitted, line_cycles(line));
+    }
+
+    if (result == 0) {
+        qsort(stacks.rows, stacks.count, sizeof(SizeRow), size_row_compare_name);
+        for (int i = 0; i < stacks.count; i++) {
+            fprintf(fp, "%s %ld\n", stacks.rows[i].name, stacks.rows[i].bytes);
+        }
+        if (ferror(fp)) result = -1;
+    }
+
+    size_table_free(&stacks);
+    return result;
+}
+
+static int render(WriteTask *task, FILE *fp) {
+    switch (task->job->kind) {
+        case OUTPUT_FILE_PROGRAM: return render_program(task->as, fp);
+        case OUTPUT_FILE_SYMBOLS: return render_symbols(task->as, fp);
+        case OUTPUT_FILE_LISTING: return render_listing(task->as, fp);
+        case OUTPUT_FILE_FOLDED: return render_folded(task->as, fp);
+    }
+    return -1;
+}
+
+/* Render into task->data/size */
+static int render_to_memory(WriteTask *task) {
+    FILE *fp = open_memstream(&task->data, &task->size);
+    if (!fp) return -1;
+    int result = render(task, fp);
+    if (fclose(fp) != 0) result = -1;
+    return result;
+}
+
+/* ========== File Commit ========== */
+
+/*
+ * Write a regular file through a temporary sibling that is renamed over
+ * the target once complete. Targets that exist but are not regular files
+ * (devices, FIFOs) are written in place.
+ */
+static WriteStatus write_file(WriteTask *task) {
+    const char *name = task->job->filename;
+    struct stat st;
+    mode_t mode = task->mode;
+
+    if (stat(name, &st) == 0) {
+        if (!S_ISREG(st.st_mode)) {
+            FILE *fp = fopen(name, "wb");
+            if (!fp) return WRITE_CANNOT_CREATE;
+            int result = render(task, fp);
+            long end = ftell(fp);
+            task->job->bytes = end > 0 ? (size_t)end : 0;
+            int failed = ferror(fp);
+            if (fclose(fp) != 0 || failed || result != 0) return WRITE_FAILED;
+            return WRITE_OK;
+        }
+        mode = st.st_mode & 07777;
+    }
+
+    size_t len = strlen(name);
+    char *tmp = malloc(len + 8);
+    if (!tmp) return WRITE_CANNOT_CREATE;
+    memcpy(tmp, name, len);
+    memcpy(tmp + len, ".XXXXXX", 8);
+
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        free(tmp);
+        return WRITE_CANNOT_CREATE;
+    }
+    fchmod(fd, mode);
+
+    int ok;
+    if (task->flags & OUTPUT_DIRECT) {
+        ok = render_to_memory(task) == 0 &&
+             write_direct(fd, task->data, task->size, &task->job->direct) == 0;
+        task->job->bytes = task->size;
+        ok = (close(fd) == 0) && ok;
+        free(task->data);
+        task->data = NULL;
+    } else {
+        FILE *fp = fdopen(fd, "wb");
+        if (!fp) {
+            close(fd);
+            ok = 0;
+        } else {
+            setvbuf(fp, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+            ok = render(task, fp) == 0;
+            long end = ftell(fp);
+            task->job->bytes = end > 0 ? (size_t)end : 0;
+            ok = !ferror(fp) && ok;
+            ok = (fclose(fp) == 0) && ok;
+        }
+    }
+
+    if (ok && rename(tmp, name) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok ? WRITE_OK : WRITE_FAILED;
+}
+
+static void write_task(void *arg, int index) {
+    WriteTask *task = &((WriteTask *)arg)[index];
+    if (task->skip) return;
+
+    double start = now_ms();
+    if (task->stream) {
+        task->status = render_to_memory(task) == 0 ? WRITE_OK : WRITE_FAILED;
+    } else {
+        task->status = write_file(task);
+    }
+    task->job->ms = now_ms() - start;
+}
+
+/* ========== Public Interface ========== */
+
+int assembler_write_outputs(Assembler *as, OutputJob *jobs, int count, int flags) {
+    if (count <= 0) return 0;
+
+    WriteTask *tasks = calloc(count, sizeof(WriteTask));
+    if (!tasks) {
+        assembler_error(as, "out of memory");
+        return -1;
+    }
+
+    /* umask is process-wide, so read it once before any thread starts */
+    mode_t mask = umask(0);
+    umask(mask);
+
+    for (int i = 0; i < count; i++) {
+        jobs[i].result = 0;
+        jobs[i].bytes = 0;
+        jobs[i].ms = 0;
+        jobs[i].direct = 0;
+        tasks[i].as = as;
+        tasks[i].job = &jobs[i];
+        tasks[i].flags = flags;
+        tasks[i].mode = 0666 & ~mask;
+        tasks[i].stream = is_stream_destination(jobs[i].filename);
+        if (jobs[i].kind == OUTPUT_FILE_PROGRAM && as->lowest_addr > as->highest_addr) {
+            assembler_warning(as, "no output generated");
+            tasks[i].skip = 1;
+        }
+    }
+
+    /* Writers are mostly I/O bound, so use one thread per job */
+    ThreadPool *pool = threadpool_create(count);
+    threadpool_run(pool, write_task, tasks, count);
+    threadpool_free(pool);
+
+    /* Stream destinations go out in job order, then errors are reported */
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+        WriteTask *task = &tasks[i];
+        if (task->skip) continue;
+
+        if (task->stream && task->status == WRITE_OK) {
+            double start = now_ms();
+            FILE *fp = open_stream(jobs[i].filename);
+            if (!fp) {
+                task->status = WRITE_CANNOT_CREATE;
+            } else {
+                fwrite(task->data, 1, task->size, fp);
+                if (close_stream(fp) != 0) {
+                    task->status = WRITE_FAILED;
+                }
+                jobs[i].bytes = task->size;
+            }
+            jobs[i].ms += now_ms() - start;
+        }
+        free(task->data);
+
+        if (task->status == WRITE_CANNOT_CREATE) {
+            assembler_error(as, "cannot create %s file: %s",
+                            output_kind_noun(jobs[i].kind), jobs[i].filename);
+        } else if (task->status == WRITE_FAILED) {
+            assembler_error(as, "error writing %s file: %s",
+                            output_kind_noun(jobs[i].kind), jobs[i].filename);
+        }
+        if (task->status != WRITE_OK) {
+            jobs[i].result = -1;
+            result = -1;
+        }
+    }
+
+    free(tasks);
+    return result;
+}
+
+/* ========== Single-file Writers ========== */
+
+static int write_one(Assembler *as, OutputFileKind kind, const char *filename) {
+    OutputJob job;
+    memset(&job, 0, sizeof(job));
+    job.kind = kind;
+    job.filename = filename;
+    return assembler_write_outputs(as, &job, 1, 0);
+}
+
+int assembler_write_output(Assembler *as, const char *filename) {
+    return write_one(as, OUTPUT_FILE_PROGRAM, filename);
+}
+
+int assembler_write_symbols(Assembler *as, const char *filename) {
+    return write_one(as, OUTPUT_FILE_SYMBOLS, filename);
+}
+
+int assembler_write_listing(Assembler *as, const char *filename) {
+    return write_one(as, OUTPUT_FILE_LISTING, filename);
+}
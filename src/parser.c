@@ -66,6 +66,7 @@ void parser_init(Parser *parser, Lexer *lexer, SymbolTable *symbols) {
     parser->symbols = symbols;
     parser->pc = 0x0801;  /* Default C64 BASIC start */
     parser->pass = 1;
+    parser->cpu = CPU_6510;
     parser->error = NULL;
     advance(parser);  /* Load first token */
 }
@@ -78,6 +79,16 @@ void parser_set_pass(Parser *parser, int pass) {
     parser->pass = pass;
 }
 
+void parser_set_cpu(Parser *parser, CpuType cpu) {
+    parser->cpu = cpu;
+}
+
+/* Mnemonics of the CPU being assembled for */
+static int is_mnemonic(Parser *parser, const Token *tok) {
+    if (token_is_mnemonic(tok)) return 1;
+    return parser->cpu == CPU_65C02 && token_is_65c02_mnemonic(tok);
+}
+
 const char *parser_error(Parser *parser) {
     return parser->error;
 }
@@ -103,6 +114,18 @@ static void label_free(LabelInfo *label) {
     free(label);
 }
 
+static void transform_steps_free(DirectiveInfo *dir) {
+    for (int i = 0; i < dir->transform_count; i++) {
+        free(dir->transforms[i].name);
+        for (int a = 0; a < dir->transforms[i].arg_count; a++) {
+            expr_free(dir->transforms[i].args[a]);
+        }
+    }
+    free(dir->transforms);
+    dir->transforms = NULL;
+    dir->transform_count = 0;
+}
+
 void statement_free(Statement *stmt) {
     if (!stmt) return;
 
@@ -112,6 +135,8 @@ void statement_free(Statement *stmt) {
         case STMT_INSTRUCTION:
             free(stmt->data.instruction.mnemonic);
             expr_free(stmt->data.instruction.operand);
+            expr_free(stmt->data.instruction.target);
+            label_free(stmt->data.instruction.operand_label);
             break;
 
         case STMT_DIRECTIVE:
@@ -121,6 +146,8 @@ void statement_free(Statement *stmt) {
             }
             free(stmt->data.directive.args);
             free(stmt->data.directive.string_arg);
+            transform_steps_free(&stmt->data.directive);
+            expr_free(stmt->data.directive.range_end);
             break;
 
         case STMT_ASSIGNMENT:
@@ -206,7 +233,7 @@ static OperandInfo parse_operand(Parser *parser) {
                 free(reg);
             }
         }
-    } else if (!at_line_end(parser)) {
+    } else if (!at_line_end(parser) && !check(parser, TOK_OPERAND_LABEL)) {
         /* Parse non-indirect operand expression */
         expr_parser_init_with_token(&expr_parser, parser->lexer, parser->current);
         info.expr = expr_parse(&expr_parser);
@@ -237,7 +264,7 @@ static OperandInfo parse_operand(Parser *parser) {
 
 int is_branch_instruction(const char *mnemonic) {
     static const char *branches[] = {
-        "BCC", "BCS", "BEQ", "BMI", "BNE", "BPL", "BVC", "BVS", NULL
+        "BCC", "BCS", "BEQ", "BMI", "BNE", "BPL", "BVC", "BVS", "BRA", NULL
     };
     for (int i = 0; branches[i]; i++) {
         if (strcasecmp(mnemonic, branches[i]) == 0) return 1;
@@ -256,6 +283,7 @@ int is_accumulator_optional(const char *mnemonic) {
 }
 
 AddressingMode detect_addressing_mode(
+    CpuType cpu,
     const char *mnemonic,
     Expr *expr,
     int has_hash,
@@ -275,13 +303,11 @@ AddressingMode detect_addressing_mode(
         return ADDR_IMMEDIATE;
     }
 
-    /* No operand: implied or accumulator */
+    /* No operand: implied or accumulator (ASL, and INC/DEC on the 65C02) */
     if (!expr) {
-        if (is_accumulator_optional(mnemonic)) {
-            /* Could be either - check if accumulator mode exists */
-            if (opcode_find(mnemonic, ADDR_ACCUMULATOR)) {
-                return ADDR_ACCUMULATOR;
-            }
+        if (opcode_find_cpu(cpu, mnemonic, ADDR_ACCUMULATOR) &&
+            !opcode_find_cpu(cpu, mnemonic, ADDR_IMPLIED)) {
+            return ADDR_ACCUMULATOR;
         }
         return ADDR_IMPLIED;
     }
@@ -289,7 +315,7 @@ AddressingMode detect_addressing_mode(
     /* Check for explicit accumulator operand (A) */
     if (expr->type == EXPR_SYMBOL && expr->data.symbol) {
         if (strcasecmp(expr->data.symbol, "A") == 0 &&
-            is_accumulator_optional(mnemonic)) {
+            opcode_find_cpu(cpu, mnemonic, ADDR_ACCUMULATOR)) {
             return ADDR_ACCUMULATOR;
         }
     }
@@ -297,11 +323,17 @@ AddressingMode detect_addressing_mode(
     /* Indirect modes */
     if (is_indirect) {
         if (has_x_index) {
-            /* (expr,X) - indexed indirect */
+            /* (expr,X) - indexed indirect, or JMP (abs,X) on the 65C02 */
+            if (opcode_find_cpu(cpu, mnemonic, ADDR_ABS_INDIRECT_X)) {
+                return ADDR_ABS_INDIRECT_X;
+            }
             return ADDR_INDIRECT_X;
         } else if (has_y_index) {
             /* (expr),Y - indirect indexed */
             return ADDR_INDIRECT_Y;
+        } else if (opcode_find_cpu(cpu, mnemonic, ADDR_ZP_INDIRECT)) {
+            /* (expr) - zero page indirect on the 65C02 */
+            return ADDR_ZP_INDIRECT;
         } else {
             /* (expr) - indirect (only for JMP) */
             return ADDR_INDIRECT;
@@ -313,7 +345,7 @@ AddressingMode detect_addressing_mode(
         /* Decide between zero-page,X and absolute,X */
         if (value_known && value >= 0 && value <= 0xFF) {
             /* Check if ZP,X mode exists for this instruction */
-            if (opcode_find(mnemonic, ADDR_ZEROPAGE_X)) {
+            if (opcode_find_cpu(cpu, mnemonic, ADDR_ZEROPAGE_X)) {
                 return ADDR_ZEROPAGE_X;
             }
         }
@@ -323,7 +355,7 @@ AddressingMode detect_addressing_mode(
     if (has_y_index) {
         /* Decide between zero-page,Y and absolute,Y */
         if (value_known && value >= 0 && value <= 0xFF) {
-            if (opcode_find(mnemonic, ADDR_ZEROPAGE_Y)) {
+            if (opcode_find_cpu(cpu, mnemonic, ADDR_ZEROPAGE_Y)) {
                 return ADDR_ZEROPAGE_Y;
             }
         }
@@ -332,7 +364,7 @@ AddressingMode detect_addressing_mode(
 
     /* Plain address - decide between zero-page and absolute */
     if (value_known && value >= 0 && value <= 0xFF) {
-        if (opcode_find(mnemonic, ADDR_ZEROPAGE)) {
+        if (opcode_find_cpu(cpu, mnemonic, ADDR_ZEROPAGE)) {
             return ADDR_ZEROPAGE;
         }
     }
@@ -351,12 +383,117 @@ int get_instruction_size(Statement *stmt) {
 
 /* ========== Instruction Parsing ========== */
 
+/*
+ * Parse ":@name", ":@lo name" or ":@hi name" after an operand. Returns
+ * an error message, or NULL (also when there is no operand label).
+ */
+static const char *parse_operand_label(Parser *parser, InstructionInfo *info) {
+    if (!match(parser, TOK_OPERAND_LABEL)) return NULL;
+
+    OperandLabelPart part = OPERAND_LABEL_ALL;
+    if (check(parser, TOK_IDENTIFIER)) {
+        Token next = lexer_peek(parser->lexer);
+        if (next.type == TOK_IDENTIFIER || next.type == TOK_LOCAL_LABEL) {
+            char *word = token_to_upper(&parser->current);
+            if (word && strcmp(word, "LO") == 0) part = OPERAND_LABEL_LO;
+            if (word && strcmp(word, "HI") == 0) part = OPERAND_LABEL_HI;
+            free(word);
+            if (part == OPERAND_LABEL_ALL) return "expected one label after ':@'";
+            advance(parser);
+        }
+    }
+    if (!check(parser, TOK_IDENTIFIER) && !check(parser, TOK_LOCAL_LABEL)) {
+        return "expected label after ':@'";
+    }
+
+    if (info->size < 2 || (part == OPERAND_LABEL_HI && info->size < 3)) {
+        return "operand label on an instruction without that operand byte";
+    }
+
+    LabelInfo *label = label_new();
+    if (!label) return "out of memory";
+    label->name = token_to_string(&parser->current);
+    label->is_local = check(parser, TOK_LOCAL_LABEL);
+    advance(parser);
+
+    info->operand_label = label;
+    info->operand_part = part;
+    return NULL;
+}
+
+/* Parse "zp, target" for a 65C02 bit branch (BBR0-7, BBS0-7) */
+static Statement *parse_bit_branch(Parser *parser, Statement *stmt) {
+    InstructionInfo *info = &stmt->data.instruction;
+    const OpcodeEntry *op = opcode_find_cpu(parser->cpu, info->mnemonic, ADDR_ZP_RELATIVE);
+    ExprParser expr_parser;
+
+    expr_parser_init_with_token(&expr_parser, parser->lexer, parser->current);
+    info->operand = expr_parse(&expr_parser);
+    parser->current = expr_parser.current;
+    if (info->operand && match(parser, TOK_COMMA)) {
+        expr_parser_init_with_token(&expr_parser, parser->lexer, parser->current);
+        info->target = expr_parse(&expr_parser);
+        parser->current = expr_parser.current;
+    }
+    if (!info->operand || !info->target) {
+        stmt->type = STMT_ERROR;
+        stmt->error_msg = str_dup("expected zero page address and branch target");
+        return stmt;
+    }
+
+    info->mode = ADDR_ZP_RELATIVE;
+    info->opcode = op->opcode;
+    info->size = op->size;
+    info->cycles = op->cycles;
+    info->page_penalty = op->page_penalty;
+
+    const char *error = parse_operand_label(parser, info);
+    if (error) {
+        stmt->type = STMT_ERROR;
+        stmt->error_msg = str_dup(error);
+    }
+    return stmt;
+}
+
 static Statement *parse_instruction(Parser *parser, const char *mnemonic, int line) {
     Statement *stmt = statement_new(STMT_INSTRUCTION, line, parser->lexer->filename);
     if (!stmt) return NULL;
 
     stmt->data.instruction.mnemonic = str_dup(mnemonic);
 
+    /*
+     * jsr+ (the + directly after the mnemonic) asks for the call to be
+     * inlined when a target follows; a bare jsr+ calls the next + label.
+     */
+    if (strcasecmp(mnemonic, "JSR") == 0 &&
+        (check(parser, TOK_ANON_FWD) || check(parser, TOK_PLUS)) &&
+        parser->current.length == 1 &&
+        parser->current.start == parser->previous.start + parser->previous.length) {
+        Token next = lexer_peek(parser->lexer);
+        if (next.type != TOK_EOL && next.type != TOK_EOF) {
+            stmt->data.instruction.inline_call = 1;
+            advance(parser);
+        }
+    }
+
+    if (!opcode_cpu_has_mnemonic(parser->cpu, mnemonic)) {
+        stmt->type = STMT_ERROR;
+        stmt->error_msg = malloc(64 + strlen(mnemonic));
+        if (stmt->error_msg) {
+            int n = sprintf(stmt->error_msg, "instruction not available on this CPU: ");
+            for (const char *c = mnemonic; *c; c++) {
+                stmt->error_msg[n++] = (char)toupper((unsigned char)*c);
+            }
+            stmt->error_msg[n] = '\0';
+        }
+        return stmt;
+    }
+
+    /* BBR/BBS: zero-page operand, then the branch target */
+    if (opcode_find_cpu(parser->cpu, mnemonic, ADDR_ZP_RELATIVE)) {
+        return parse_bit_branch(parser, stmt);
+    }
+
     /* Parse operand */
     OperandInfo operand = parse_operand(parser);
     stmt->data.instruction.operand = operand.expr;
@@ -374,6 +511,7 @@ static Statement *parse_instruction(Parser *parser, const char *mnemonic, int li
 
     /* Determine addressing mode */
     AddressingMode mode = detect_addressing_mode(
+        parser->cpu,
         mnemonic,
         operand.expr,
         operand.has_hash,
@@ -387,7 +525,7 @@ static Statement *parse_instruction(Parser *parser, const char *mnemonic, int li
     stmt->data.instruction.mode = mode;
 
     /* Look up opcode */
-    const OpcodeEntry *op = opcode_find(mnemonic, mode);
+    const OpcodeEntry *op = opcode_find_cpu(parser->cpu, mnemonic, mode);
     if (op) {
         stmt->data.instruction.opcode = op->opcode;
         stmt->data.instruction.size = op->size;
@@ -398,7 +536,7 @@ static Statement *parse_instruction(Parser *parser, const char *mnemonic, int li
         /* In pass 1, might be due to unknown forward reference - assume absolute */
         if (!value_known && parser->pass == 1) {
             /* Try absolute mode as fallback */
-            op = opcode_find(mnemonic, ADDR_ABSOLUTE);
+            op = opcode_find_cpu(parser->cpu, mnemonic, ADDR_ABSOLUTE);
             if (op) {
                 stmt->data.instruction.mode = ADDR_ABSOLUTE;
                 stmt->data.instruction.opcode = op->opcode;
@@ -415,11 +553,172 @@ static Statement *parse_instruction(Parser *parser, const char *mnemonic, int li
         }
     }
 
+    if (stmt->type == STMT_INSTRUCTION) {
+        const char *error = parse_operand_label(parser, &stmt->data.instruction);
+        if (error) {
+            stmt->type = STMT_ERROR;
+            stmt->error_msg = str_dup(error);
+        }
+    }
+
     return stmt;
 }
 
 /* ========== Directive Parsing ========== */
 
+/* Append an argument, growing the array as needed */
+static int add_directive_arg(Expr ***args, int *arg_count, int *arg_capacity, Expr *arg) {
+    if (*arg_count >= *arg_capacity) {
+        int new_capacity = *arg_capacity ? *arg_capacity * 2 : 4;
+        Expr **new_args = realloc(*args, new_capacity * sizeof(Expr *));
+        if (!new_args) return -1;
+        *args = new_args;
+        *arg_capacity = new_capacity;
+    }
+    (*args)[(*arg_count)++] = arg;
+    return 0;
+}
+
+/*
+ * Parse a "{ name[:size], ... }" field list into further arguments. A
+ * name:size field is stored as a "name = size" pair like a named argument.
+ * Returns the index of the first field, or 0 if the list is malformed.
+ */
+static int parse_field_block(Parser *parser, Expr ***args, int *arg_count, int *arg_capacity) {
+    int first = *arg_count;
+    advance(parser);  /* Skip { */
+
+    while (!at_line_end(parser) && !check(parser, TOK_RBRACE)) {
+        if (!check(parser, TOK_IDENTIFIER)) return 0;
+        char *name = token_to_string(&parser->current);
+        Expr *field = expr_symbol(name);
+        free(name);
+        advance(parser);
+
+        if (field && match(parser, TOK_COLON)) {
+            ExprParser expr_parser;
+            expr_parser_init_with_token(&expr_parser, parser->lexer, parser->current);
+            Expr *size = expr_parse(&expr_parser);
+            parser->current = expr_parser.current;
+            field = size ? expr_binary(BINARY_EQ, field, size) : NULL;
+        }
+        if (!field || add_directive_arg(args, arg_count, arg_capacity, field) < 0) {
+            expr_free(field);
+            return 0;
+        }
+        if (!match(parser, TOK_COMMA)) break;
+    }
+
+    if (!match(parser, TOK_RBRACE) || first == 0) return 0;
+    return first;
+}
+
+/*
+ * Parse "transform = step | step ..." where a step is name or
+ * name(arg, ...). Returns the number of steps, or -1 if the chain is
+ * malformed.
+ */
+static int parse_transform_chain(Parser *parser, DirectiveInfo *dir) {
+    advance(parser);  /* Skip transform */
+    if (!match(parser, TOK_EQ)) return -1;
+
+    do {
+        if (!check(parser, TOK_IDENTIFIER)) return -1;
+        TransformStep *steps = realloc(dir->transforms,
+                                       (dir->transform_count + 1) * sizeof(TransformStep));
+        if (!steps) return -1;
+        dir->transforms = steps;
+        TransformStep *step = &steps[dir->transform_count++];
+        memset(step, 0, sizeof(*step));
+        step->name = token_to_string(&parser->current);
+        advance(parser);
+
+        if (match(parser, TOK_LPAREN)) {
+            do {
+                if (step->arg_count == PARSER_MAX_TRANSFORM_ARGS) return -1;
+                ExprParser expr_parser;
+                expr_parser_init_with_token(&expr_parser, parser->lexer, parser->current);
+                Expr *arg = expr_parse(&expr_parser);
+                parser->current = expr_parser.current;
+                if (!arg) return -1;
+                step->args[step->arg_count++] = arg;
+            } while (match(parser, TOK_COMMA));
+            if (!match(parser, TOK_RPAREN)) return -1;
+        }
+    } while (match(parser, TOK_PIPE));
+
+    return dir->transform_count;
+}
+
+/* Append the identifier at the current token as a symbol argument */
+static int add_name_arg(Parser *parser, Expr ***args, int *arg_count, int *arg_capacity) {
+    if (!check(parser, TOK_IDENTIFIER)) return 0;
+    char *name = token_to_string(&parser->current);
+    Expr *symbol = expr_symbol(name);
+    free(name);
+    if (!symbol || add_directive_arg(args, arg_count, arg_capacity, symbol) < 0) {
+        expr_free(symbol);
+        return 0;
+    }
+    advance(parser);
+    return 1;
+}
+
+/*
+ * Parse "name(param, ...) = expression" into a symbol for the name, one
+ * per parameter and the body as the last argument. Returns 0, or -1 if
+ * the definition is malformed.
+ */
+static int parse_func_definition(Parser *parser, Expr ***args, int *arg_count, int *arg_capacity) {
+    if (!add_name_arg(parser, args, arg_count, arg_capacity)) return -1;
+    if (!match(parser, TOK_LPAREN)) return -1;
+    if (!check(parser, TOK_RPAREN)) {
+        do {
+            if (!add_name_arg(parser, args, arg_count, arg_capacity)) return -1;
+        } while (match(parser, TOK_COMMA));
+    }
+    if (!match(parser, TOK_RPAREN) || !match(parser, TOK_EQ)) return -1;
+
+    ExprParser expr_parser;
+    expr_parser_init_with_token(&expr_parser, parser->lexer, parser->current);
+    Expr *body = expr_parse(&expr_parser);
+    parser->current = expr_parser.current;
+    if (!body || !at_line_end(parser) ||
+        add_directive_arg(args, arg_count, arg_capacity, body) < 0) {
+        expr_free(body);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Parse "name = list" into a symbol for the name and the list expression.
+ * Returns 0, or -1 if the definition is malformed.
+ */
+static int parse_let_definition(Parser *parser, Expr ***args, int *arg_count, int *arg_capacity) {
+    if (!add_name_arg(parser, args, arg_count, arg_capacity)) return -1;
+    if (!match(parser, TOK_EQ)) return -1;
+
+    ExprParser expr_parser;
+    expr_parser_init_with_token(&expr_parser, parser->lexer, parser->current);
+    Expr *list = expr_parse_list(&expr_parser);
+    parser->current = expr_parser.current;
+    if (!list || !at_line_end(parser) ||
+        add_directive_arg(args, arg_count, arg_capacity, list) < 0) {
+        expr_free(list);
+        return -1;
+    }
+    return 0;
+}
+
+static int is_transform_arg(Parser *parser) {
+    if (!check(parser, TOK_IDENTIFIER)) return 0;
+    char *name = token_to_string(&parser->current);
+    int result = name && strcasecmp(name, "transform") == 0;
+    free(name);
+    return result;
+}
+
 static Statement *parse_directive(Parser *parser, int line) {
     Statement *stmt = statement_new(STMT_DIRECTIVE, line, parser->lexer->filename);
     if (!stmt) return NULL;
@@ -443,6 +742,30 @@ static Statement *parse_directive(Parser *parser, int line) {
     /* Special handling for !macro directive: parse space-separated identifiers */
     int is_macro_directive = (strcasecmp(stmt->data.directive.name, "macro") == 0);
 
+    /* !soa ends with a { field, ... } list */
+    int has_field_block = (strcasecmp(stmt->data.directive.name, "soa") == 0);
+
+    /* !binary takes a transform= chain */
+    int has_transforms = (strcasecmp(stmt->data.directive.name, "binary") == 0);
+
+    /* !run takes a capture=start..end range */
+    int has_range = (strcasecmp(stmt->data.directive.name, "run") == 0);
+
+    /* !func name(params) = body and !let name = list */
+    int is_func = (strcasecmp(stmt->data.directive.name, "func") == 0);
+    if (is_func || strcasecmp(stmt->data.directive.name, "let") == 0) {
+        int parsed = is_func ? parse_func_definition(parser, &args, &arg_count, &arg_capacity)
+                             : parse_let_definition(parser, &args, &arg_count, &arg_capacity);
+        if (parsed < 0) {
+            for (int i = 0; i < arg_count; i++) expr_free(args[i]);
+            arg_count = 0;
+            while (!at_line_end(parser)) advance(parser);
+        }
+        stmt->data.directive.args = args;
+        stmt->data.directive.arg_count = arg_count;
+        return stmt;
+    }
+
     while (!at_line_end(parser)) {
         /* Check for string argument */
         if (check(parser, TOK_STRING)) {
@@ -454,6 +777,13 @@ static Statement *parse_directive(Parser *parser, int line) {
                 stmt->data.directive.string_arg[parser->current.value.string.len] = '\0';
             }
             advance(parser);
+        } else if (has_transforms && is_transform_arg(parser)) {
+            if (stmt->data.directive.transforms ||
+                parse_transform_chain(parser, &stmt->data.directive) < 0) {
+                transform_steps_free(&stmt->data.directive);
+                stmt->data.directive.transform_count = -1;
+                break;
+            }
         } else if (is_macro_directive && check(parser, TOK_IDENTIFIER)) {
             /* For !macro, collect identifiers as symbol expressions (name and params) */
             char *ident = token_to_string(&parser->current);
@@ -494,6 +824,26 @@ static Statement *parse_directive(Parser *parser, int line) {
                 }
                 args[arg_count++] = arg;
             }
+
+            if (has_range && match(parser, TOK_DOTDOT)) {
+                DirectiveInfo *dir = &stmt->data.directive;
+                expr_parser_init_with_token(&expr_parser, parser->lexer, parser->current);
+                Expr *end = expr_parse(&expr_parser);
+                parser->current = expr_parser.current;
+                if (!arg || !end || dir->range_end || check(parser, TOK_DOTDOT)) {
+                    expr_free(end);
+                    dir->range_arg = -1;
+                    break;
+                }
+                dir->range_end = end;
+                dir->range_arg = arg_count - 1;
+            }
+        }
+
+        if (has_field_block && check(parser, TOK_LBRACE)) {
+            stmt->data.directive.block_start =
+                parse_field_block(parser, &args, &arg_count, &arg_capacity);
+            break;
         }
 
         /* Skip comma between arguments */
@@ -619,7 +969,7 @@ Statement *parser_parse_line(Parser *parser) {
             stmt = parse_assignment(parser, name, line);
             free(name);
             goto done;
-        } else if (token_is_mnemonic(&saved)) {
+        } else if (is_mnemonic(parser, &saved)) {
             /* Instruction */
             stmt = parse_instruction(parser, name, line);
             free(name);
@@ -658,7 +1008,7 @@ Statement *parser_parse_line(Parser *parser) {
         } else if (check(parser, TOK_IDENTIFIER)) {
             /* Should be an instruction */
             char *name = token_to_upper(&parser->current);
-            if (token_is_mnemonic(&parser->current)) {
+            if (is_mnemonic(parser, &parser->current)) {
                 advance(parser);
                 stmt = parse_instruction(parser, name, line);
             } else {
@@ -0,0 +1,281 @@
+/*
+ * perf.c - Performance Lint for Assembled Code
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#include "perf.h"
+#include "opcodes.h"
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const check_names[PERF_CHECK_COUNT] = {
+    "forced_abs", "jsr_rts", "branch_page", "index_page", "pha_temp", "rmw_io"
+};
+
+const char *perf_check_name(PerfCheck check) {
+    return (unsigned)check < PERF_CHECK_COUNT ? check_names[check] : "unknown";
+}
+
+int perf_check_lookup(const char *name) {
+    for (int i = 0; i < PERF_CHECK_COUNT; i++) {
+        if (strcmp(check_names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+/* ========== Helpers ========== */
+
+typedef struct {
+    Assembler *as;
+    int issued;
+    int *loop_end;           /* Per line: a backward branch enclosing it, or -1 */
+    int free_zp;             /* Unused zero-page byte, or -1 */
+} PerfLint;
+
+static int is_directive(const AssembledLine *line, const char *name) {
+    return line->stmt->type == STMT_DIRECTIVE &&
+           strcmp(line->stmt->data.directive.name, name) == 0;
+}
+
+/* Opcode of an instruction line that generated bytes, or NULL */
+static const OpcodeEntry *line_opcode(const AssembledLine *line) {
+    if (line->stmt->type != STMT_INSTRUCTION || line->byte_count == 0) return NULL;
+    return opcode_find_by_opcode_cpu(line->cpu, line->bytes[0]);
+}
+
+static uint16_t operand_word(const AssembledLine *line) {
+    return (uint16_t)(line->bytes[1] | (line->bytes[2] << 8));
+}
+
+static uint16_t branch_target(const AssembledLine *line) {
+    return (uint16_t)(line->address + 2 + (int8_t)line->bytes[1]);
+}
+
+static void warn(PerfLint *lint, const AssembledLine *line, PerfCheck check,
+                 int cycles, const char *what) {
+    Assembler *as = lint->as;
+    const char *file = as->current_file;
+    int current_line = as->current_line;
+
+    as->current_file = line->stmt->file;
+    as->current_line = line->stmt->line;
+    assembler_warning(as, "%s (~%d cycle%s) [-Wperf=%s]", what, cycles,
+                      cycles == 1 ? "" : "s", check_names[check]);
+    as->current_file = file;
+    as->current_line = current_line;
+    lint->issued++;
+}
+
+/* Mark each line inside a loop: from a backward branch's target up to the branch */
+static int find_loops(PerfLint *lint) {
+    Assembler *as = lint->as;
+    lint->loop_end = malloc(as->line_count * sizeof(int));
+    if (!lint->loop_end) return -1;
+    for (int i = 0; i < as->line_count; i++) lint->loop_end[i] = -1;
+
+    for (int i = 0; i < as->line_count; i++) {
+        const OpcodeEntry *entry = line_opcode(&as->lines[i]);
+        if (!entry || entry->mode != ADDR_RELATIVE) continue;
+        uint16_t target = branch_target(&as->lines[i]);
+        if (target > as->lines[i].address) continue;
+        for (int j = i; j >= 0 && as->lines[j].address >= target; j--) {
+            if (as->lines[j].address > as->lines[i].address) break;
+            lint->loop_end[j] = i;
+        }
+    }
+    return 0;
+}
+
+static int mark_symbol(Symbol *sym, void *userdata) {
+    uint8_t *used = userdata;
+    if ((sym->flags & SYM_DEFINED) && sym->value >= 0 && sym->value < 0x100) {
+        used[sym->value] = 1;
+    }
+    return 0;
+}
+
+/* First of PERF_FREE_ZP that no operand, symbol or output byte touches */
+static int find_free_zp(Assembler *as) {
+    static const uint8_t candidates[] = PERF_FREE_ZP;
+    uint8_t used[0x100];
+
+    memset(used, 0, sizeof(used));
+    symbol_iterate(as->symbols, mark_symbol, used);
+    for (int i = 0; i < 0x100; i++) {
+        if (as->written[i]) used[i] = 1;
+    }
+    for (int i = 0; i < as->line_count; i++) {
+        const AssembledLine *line = &as->lines[i];
+        const OpcodeEntry *entry = line_opcode(line);
+        if (!entry || entry->size < 2 || entry->mode == ADDR_IMMEDIATE ||
+            entry->mode == ADDR_RELATIVE) {
+            continue;
+        }
+        if (entry->size == 2 || entry->mode == ADDR_ZP_RELATIVE) {
+            used[line->bytes[1]] = 1;
+            if (entry->mode == ADDR_INDIRECT_Y || entry->mode == ADDR_ZP_INDIRECT) {
+                used[(uint8_t)(line->bytes[1] + 1)] = 1;
+            }
+        } else if (line->bytes[2] == 0) {
+            used[line->bytes[1]] = 1;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(candidates); i++) {
+        if (!used[candidates[i]]) return candidates[i];
+    }
+    return -1;
+}
+
+/* ========== Checks ========== */
+
+static void check_forced_abs(PerfLint *lint, const AssembledLine *line, const OpcodeEntry *entry) {
+    static const AddressingMode zp_modes[][2] = {
+        { ADDR_ABSOLUTE, ADDR_ZEROPAGE },
+        { ADDR_ABSOLUTE_X, ADDR_ZEROPAGE_X },
+        { ADDR_ABSOLUTE_Y, ADDR_ZEROPAGE_Y }
+    };
+    if (line->bytes[2] != 0) return;
+
+    for (int i = 0; i < 3; i++) {
+        if (entry->mode != zp_modes[i][0]) continue;
+        const OpcodeEntry *zp = opcode_find_cpu(line->cpu, entry->mnemonic, zp_modes[i][1]);
+        if (!zp) return;
+
+        char what[128];
+        snprintf(what, sizeof(what),
+                 "%s $%04X is absolute because the operand is defined later; zero page saves 1 byte",
+                 entry->mnemonic, operand_word(line));
+        warn(lint, line, PERF_FORCED_ABS, entry->cycles - zp->cycles, what);
+        return;
+    }
+}
+
+static void check_jsr_rts(PerfLint *lint, int index, const OpcodeEntry *entry) {
+    Assembler *as = lint->as;
+    const AssembledLine *line = &as->lines[index];
+    if (strcmp(entry->mnemonic, "JSR") != 0) return;
+
+    for (int i = index + 1; i < as->line_count; i++) {
+        const AssembledLine *next = &as->lines[i];
+        if (next->byte_count == 0) continue;
+        const OpcodeEntry *ret = line_opcode(next);
+        if (!ret || strcmp(ret->mnemonic, "RTS") != 0 ||
+            next->address != (uint16_t)(line->address + entry->size)) {
+            return;
+        }
+
+        const OpcodeEntry *jmp = opcode_find("JMP", ADDR_ABSOLUTE);
+        char what[128];
+        snprintf(what, sizeof(what), "JSR $%04X followed by RTS; use JMP $%04X",
+                 operand_word(line), operand_word(line));
+        warn(lint, line, PERF_JSR_RTS, entry->cycles + ret->cycles - jmp->cycles, what);
+        return;
+    }
+}
+
+static void check_branch_page(PerfLint *lint, const AssembledLine *line, const OpcodeEntry *entry) {
+    uint16_t next = (uint16_t)(line->address + 2);
+    uint16_t target = branch_target(line);
+    if (target > line->address || !((next ^ target) & 0xFF00)) return;
+
+    char what[128];
+    snprintf(what, sizeof(what), "loop %s to $%04X crosses a page on every taken iteration",
+             entry->mnemonic, target);
+    warn(lint, line, PERF_BRANCH_PAGE, 1, what);
+}
+
+static void check_index_page(PerfLint *lint, int index, const OpcodeEntry *entry) {
+    const AssembledLine *line = &lint->as->lines[index];
+    if (!entry->page_penalty || lint->loop_end[index] < 0) return;
+    if (entry->mode != ADDR_ABSOLUTE_X && entry->mode != ADDR_ABSOLUTE_Y) return;
+    if (line->bytes[1] == 0) return;
+
+    char what[128];
+    snprintf(what, sizeof(what), "%s $%04X,%c in a loop can cross a page; align the table",
+             entry->mnemonic, operand_word(line), entry->mode == ADDR_ABSOLUTE_X ? 'X' : 'Y');
+    warn(lint, line, PERF_INDEX_PAGE, 1, what);
+}
+
+/* PHA ... PLA in straight-line code: STA/LDA of a free byte is cheaper */
+static void check_pha_temp(PerfLint *lint, int index, const OpcodeEntry *entry) {
+    static const char *const barriers[] = {
+        "PHA", "PHP", "PLP", "TSX", "TXS", "JSR", "JMP", "RTS", "RTI", "BRK", NULL
+    };
+    Assembler *as = lint->as;
+    if (strcmp(entry->mnemonic, "PHA") != 0 || lint->free_zp < 0) return;
+
+    for (int i = index + 1; i < as->line_count; i++) {
+        const AssembledLine *next = &as->lines[i];
+        if (next->stmt->label) return;
+        if (next->byte_count == 0) continue;
+        const OpcodeEntry *op = line_opcode(next);
+        if (!op || op->mode == ADDR_RELATIVE) return;
+        if (strcmp(op->mnemonic, "PLA") == 0) {
+            const OpcodeEntry *sta = opcode_find("STA", ADDR_ZEROPAGE);
+            const OpcodeEntry *lda = opcode_find("LDA", ADDR_ZEROPAGE);
+            int cycles = entry->cycles + op->cycles - sta->cycles - lda->cycles;
+            if (cycles <= 0) return;
+
+            char what[128];
+            snprintf(what, sizeof(what), "PHA/PLA keeps A on the stack; STA/LDA $%02X is free",
+                     lint->free_zp);
+            warn(lint, &as->lines[index], PERF_PHA_TEMP, cycles, what);
+            return;
+        }
+        for (int b = 0; barriers[b]; b++) {
+            if (strcmp(op->mnemonic, barriers[b]) == 0) return;
+        }
+    }
+}
+
+static void check_rmw_io(PerfLint *lint, const AssembledLine *line, const OpcodeEntry *entry) {
+    if (!opcode_is_rmw(entry) || entry->size != 3) return;
+    uint16_t address = operand_word(line);
+    if (address < 0xD000 || address > 0xDFFF) return;
+
+    const OpcodeEntry *sta = opcode_find_cpu(line->cpu, "STA", entry->mode);
+    char what[128];
+    snprintf(what, sizeof(what), "%s $%04X in a raster block writes the register twice; store the value instead",
+             entry->mnemonic, address);
+    warn(lint, line, PERF_RMW_IO, entry->cycles - (sta ? sta->cycles : 4), what);
+}
+
+/* ========== Lint Pass ========== */
+
+int assembler_perf_lint(Assembler *as, unsigned disabled) {
+    PerfLint lint = { as, 0, NULL, -1 };
+    int in_raster = 0;
+
+    if (find_loops(&lint) < 0) {
+        assembler_error(as, "out of memory for performance lint");
+        return 0;
+    }
+    lint.free_zp = find_free_zp(as);
+
+    for (int i = 0; i < as->line_count; i++) {
+        const AssembledLine *line = &as->lines[i];
+        if (is_directive(line, "raster_block")) in_raster = 1;
+        if (is_directive(line, "raster_end")) in_raster = 0;
+
+        const OpcodeEntry *entry = line_opcode(line);
+        if (!entry) continue;
+
+        if (!(disabled & (1u << PERF_PHA_TEMP))) check_pha_temp(&lint, i, entry);
+
+        /* A self-modifying operand only holds its initial value here */
+        if (line->smc) continue;
+        if (!(disabled & (1u << PERF_FORCED_ABS))) check_forced_abs(&lint, line, entry);
+        if (!(disabled & (1u << PERF_JSR_RTS))) check_jsr_rts(&lint, i, entry);
+        if (entry->mode == ADDR_RELATIVE && !(disabled & (1u << PERF_BRANCH_PAGE))) {
+            check_branch_page(&lint, line, entry);
+        }
+        if (!(disabled & (1u << PERF_INDEX_PAGE))) check_index_page(&lint, i, entry);
+        if (in_raster && !(disabled & (1u << PERF_RMW_IO))) check_rmw_io(&lint, line, entry);
+    }
+
+    free(lint.loop_end);
+    return lint.issued;
+}
@@ -0,0 +1,681 @@
+/*
+ * pgo.c - Profile-Guided Code Layout
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#include "pgo.h"
+#include "sim6510.h"
+#include "opcodes.h"
+#include "parser.h"
+#include "expr.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#define PGO_HEADER      "asm64-profile 1"
+
+/* ========== Source Keys ========== */
+
+static const char *line_file(const AssembledLine *line) {
+    return line->stmt->file ? line->stmt->file : "";
+}
+
+static int compare_location(const char *file_a, int line_a, const char *file_b, int line_b) {
+    int c = strcmp(file_a, file_b);
+    if (c != 0) return c;
+    return (line_a > line_b) - (line_a < line_b);
+}
+
+typedef struct {
+    const AssembledLine *line;
+    int index;
+} LineKey;
+
+static int compare_line_keys(const void *a, const void *b) {
+    const LineKey *ka = a;
+    const LineKey *kb = b;
+    int c = compare_location(line_file(ka->line), ka->line->stmt->line,
+                             line_file(kb->line), kb->line->stmt->line);
+    if (c != 0) return c;
+    return (ka->index > kb->index) - (ka->index < kb->index);
+}
+
+/*
+ * Occurrence of each instruction line among the instructions assembled
+ * from the same source line, or -1 for other lines.
+ */
+static int *line_occurrences(Assembler *as) {
+    int *occurrence = malloc((as->line_count + 1) * sizeof(int));
+    LineKey *keys = malloc((as->line_count + 1) * sizeof(LineKey));
+    if (!occurrence || !keys) {
+        free(occurrence);
+        free(keys);
+        return NULL;
+    }
+
+    int n = 0;
+    for (int i = 0; i < as->line_count; i++) {
+        occurrence[i] = -1;
+        if (as->lines[i].stmt->type == STMT_INSTRUCTION) {
+            keys[n].line = &as->lines[i];
+            keys[n].index = i;
+            n++;
+        }
+    }
+    qsort(keys, n, sizeof(LineKey), compare_line_keys);
+
+    int run = 0;
+    for (int k = 0; k < n; k++) {
+        if (k > 0 && compare_location(line_file(keys[k].line), keys[k].line->stmt->line,
+                                      line_file(keys[k - 1].line), keys[k - 1].line->stmt->line) == 0) {
+            run++;
+        } else {
+            run = 0;
+        }
+        occurrence[keys[k].index] = run;
+    }
+
+    free(keys);
+    return occurrence;
+}
+
+/* First instruction line outside !pseudopc at each address, or -1 */
+static int *index_instructions(Assembler *as) {
+    int *line_at = malloc(ASM_MEMORY_SIZE * sizeof(int));
+    if (!line_at) return NULL;
+    for (int i = 0; i < ASM_MEMORY_SIZE; i++) line_at[i] = -1;
+    for (int i = as->line_count - 1; i >= 0; i--) {
+        AssembledLine *line = &as->lines[i];
+        if (line->stmt->type == STMT_INSTRUCTION && !line->in_pseudopc) {
+            line_at[line->address] = i;
+        }
+    }
+    return line_at;
+}
+
+/* ========== Profile File ========== */
+
+static int compare_records(const void *a, const void *b) {
+    const PgoRecord *ra = a;
+    const PgoRecord *rb = b;
+    int c = compare_location(ra->file, ra->line, rb->file, rb->line);
+    if (c != 0) return c;
+    return (ra->occurrence > rb->occurrence) - (ra->occurrence < rb->occurrence);
+}
+
+PgoProfile *pgo_profile_load(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) return NULL;
+
+    PgoProfile *profile = calloc(1, sizeof(PgoProfile));
+    char text[1024];
+    int capacity = 0;
+    int ok = profile && fgets(text, sizeof(text), f) &&
+             strncmp(text, PGO_HEADER, strlen(PGO_HEADER)) == 0;
+
+    while (ok && fgets(text, sizeof(text), f)) {
+        text[strcspn(text, "\r\n")] = '\0';
+        int line, occurrence, value, consumed = 0;
+        unsigned long count, taken;
+
+        if (sscanf(text, "frames %d", &value) == 1) {
+            profile->frames = value;
+        } else if (sscanf(text, "insn %d %d %lu %lu %n", &line, &occurrence, &count, &taken,
+                          &consumed) == 4 && consumed > 0) {
+            if (profile->record_count >= capacity) {
+                int new_capacity = capacity ? capacity * 2 : 64;
+                PgoRecord *records = realloc(profile->records, new_capacity * sizeof(PgoRecord));
+                if (!records) {
+                    ok = 0;
+                    break;
+                }
+                profile->records = records;
+                capacity = new_capacity;
+            }
+            PgoRecord *record = &profile->records[profile->record_count];
+            record->file = str_dup(text + consumed);
+            record->line = line;
+            record->occurrence = occurrence;
+            record->count = (uint32_t)count;
+            record->taken = (uint32_t)taken;
+            record->index = NULL;
+            profile->record_count++;
+        } else if (sscanf(text, "index %d %lu", &value, &count) == 2 &&
+                   profile->record_count > 0 && value >= 0 && value < 256) {
+            PgoRecord *record = &profile->records[profile->record_count - 1];
+            if (!record->index) {
+                record->index = calloc(256, sizeof(uint32_t));
+                if (!record->index) {
+                    ok = 0;
+                    break;
+                }
+            }
+            record->index[value] = (uint32_t)count;
+        } else if (text[0] != '\0') {
+            ok = 0;
+        }
+    }
+    fclose(f);
+
+    if (!ok || profile->frames <= 0) {
+        pgo_profile_free(profile);
+        return NULL;
+    }
+    qsort(profile->records, profile->record_count, sizeof(PgoRecord), compare_records);
+    return profile;
+}
+
+void pgo_profile_free(PgoProfile *profile) {
+    if (!profile) return;
+    for (int i = 0; i < profile->record_count; i++) {
+        free(profile->records[i].file);
+        free(profile->records[i].index);
+    }
+    free(profile->records);
+    for (int i = 0; i < profile->slot_count; i++) {
+        free(profile->slots[i].file);
+    }
+    free(profile->slots);
+    free(profile);
+}
+
+static const PgoRecord *find_record(const PgoProfile *profile, const AssembledLine *line,
+                                    int occurrence) {
+    PgoRecord key;
+    key.file = (char *)line_file(line);
+    key.line = line->stmt->line;
+    key.occurrence = occurrence;
+    return bsearch(&key, profile->records, profile->record_count, sizeof(PgoRecord),
+                   compare_records);
+}
+
+int pgo_resolve_address(Assembler *as, const char *text, uint16_t *address) {
+    const char *digits = text;
+    int base = 0;
+    if (text[0] == '$') {
+        digits = text + 1;
+        base = 16;
+    } else if (!isdigit((unsigned char)text[0])) {
+        Symbol *sym = symbol_lookup(as->symbols, text);
+        if (!sym || !(sym->flags & SYM_DEFINED)) return -1;
+        *address = (uint16_t)sym->value;
+        return 0;
+    }
+
+    char *end;
+    long value = strtol(digits, &end, base);
+    if (end == digits || *end != '\0' || value < 0 || value > 0xFFFF) return -1;
+    *address = (uint16_t)value;
+    return 0;
+}
+
+/* ========== Training Run ========== */
+
+/* Frame position shared with the I/O read callback */
+typedef struct {
+    int cycles_per_line;
+    long frame_cycles;
+    long cycle;              /* Cycles since the run started */
+} TrainRun;
+
+static uint8_t train_read_io(void *ctx, uint16_t address, int cycle) {
+    TrainRun *run = ctx;
+    if (address > 0xD3FF) return 0;
+
+    int line = (int)(((run->cycle + cycle) % run->frame_cycles) / run->cycles_per_line);
+    switch (address & 0x3F) {
+        case 0x11:
+            return (uint8_t)(0x1B | ((line & 0x100) ? 0x80 : 0));
+        case 0x12:
+            return (uint8_t)line;
+        default:
+            return 0;
+    }
+}
+
+static void locate_line(Assembler *as, const int *line_at, uint16_t address) {
+    int index = line_at[address];
+    if (index >= 0) {
+        as->current_file = as->lines[index].stmt->file;
+        as->current_line = as->lines[index].stmt->line;
+    }
+}
+
+static int write_profile(Assembler *as, const int *line_at, const int *occurrence, int frames,
+                         const uint32_t *count, const uint32_t *taken, uint32_t **index,
+                         const char *filename) {
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        assembler_error(as, "cannot write profile '%s'", filename);
+        return -1;
+    }
+
+    fprintf(f, "%s\n", PGO_HEADER);
+    fprintf(f, "frames %d\n", frames);
+    for (int addr = 0; addr < ASM_MEMORY_SIZE; addr++) {
+        if (!count[addr] || line_at[addr] < 0) continue;
+        const AssembledLine *line = &as->lines[line_at[addr]];
+        fprintf(f, "insn %d %d %lu %lu %s\n", line->stmt->line, occurrence[line_at[addr]],
+                (unsigned long)count[addr], (unsigned long)taken[addr], line_file(line));
+        if (!index[addr]) continue;
+        for (int i = 0; i < 256; i++) {
+            if (index[addr][i]) {
+                fprintf(f, "index %d %lu\n", i, (unsigned long)index[addr][i]);
+            }
+        }
+    }
+
+    if (fclose(f) != 0) {
+        assembler_error(as, "cannot write profile '%s'", filename);
+        return -1;
+    }
+    return 0;
+}
+
+int pgo_train(Assembler *as, uint16_t entry, int frames, RasterSystem system,
+              const char *filename, FILE *report) {
+    RasterModel vic;
+    raster_model_init(&vic, system);
+
+    uint8_t *memory = malloc(ASM_MEMORY_SIZE);
+    uint32_t *count = calloc(ASM_MEMORY_SIZE, sizeof(uint32_t));
+    uint32_t *taken = calloc(ASM_MEMORY_SIZE, sizeof(uint32_t));
+    uint32_t **index = calloc(ASM_MEMORY_SIZE, sizeof(uint32_t *));
+    int *line_at = index_instructions(as);
+    int *occurrence = line_occurrences(as);
+    int result = 0;
+
+    if (!memory || !count || !taken || !index || !line_at || !occurrence) {
+        assembler_error(as, "out of memory for profile run");
+        result = -1;
+        goto done;
+    }
+    if (!as->written[entry]) {
+        assembler_error(as, "profile entry $%04X is not in the assembled program", entry);
+        result = -1;
+        goto done;
+    }
+    memcpy(memory, as->memory, ASM_MEMORY_SIZE);
+
+    TrainRun run;
+    run.cycles_per_line = vic.cycles_per_line;
+    run.frame_cycles = (long)vic.cycles_per_line * vic.lines_per_frame;
+    run.cycle = 0;
+
+    Sim6510 cpu;
+    sim6510_init(&cpu, memory, entry);
+    cpu.read_io = train_read_io;
+    cpu.ctx = &run;
+
+    long total = (long)frames * run.frame_cycles;
+    long frame_end = run.frame_cycles;
+    long executed = 0;
+    int calls = 1;
+    int depth = 0;
+
+    while (run.cycle < total) {
+        /* Leaving the image (e.g. JMP $EA31) ends the call like RTS */
+        int returned = !as->written[cpu.pc];
+
+        if (!returned) {
+            uint16_t pc = cpu.pc;
+            uint8_t x = cpu.x;
+            uint8_t y = cpu.y;
+            SimStep step;
+            if (sim6510_step(&cpu, &step) < 0) {
+                locate_line(as, line_at, step.pc);
+                assembler_error(as, "profile run reached unsupported opcode $%02X at $%04X",
+                                step.opcode, step.pc);
+                result = -1;
+                break;
+            }
+            run.cycle += step.cycles;
+            executed++;
+            count[pc]++;
+
+            const OpcodeEntry *op = opcode_find_by_opcode(step.opcode);
+            if (op && op->mode == ADDR_RELATIVE && cpu.pc != (uint16_t)(pc + 2)) {
+                taken[pc]++;
+            } else if (op && op->page_penalty &&
+                       (op->mode == ADDR_ABSOLUTE_X || op->mode == ADDR_ABSOLUTE_Y)) {
+                if (!index[pc] && !(index[pc] = calloc(256, sizeof(uint32_t)))) {
+                    assembler_error(as, "out of memory for profile run");
+                    result = -1;
+                    break;
+                }
+                index[pc][op->mode == ADDR_ABSOLUTE_X ? x : y]++;
+            }
+
+            if (step.opcode == 0x20) {
+                depth++;
+            } else if (step.opcode == 0x60 || step.opcode == 0x40) {
+                if (depth == 0) {
+                    returned = 1;
+                } else {
+                    depth--;
+                }
+            }
+        }
+
+        while (run.cycle >= frame_end) {
+            frame_end += run.frame_cycles;
+        }
+        if (returned) {
+            /* Idle until the next frame calls the entry again */
+            run.cycle = frame_end;
+            frame_end += run.frame_cycles;
+            cpu.pc = entry;
+            cpu.sp = 0xFF;
+            depth = 0;
+            if (run.cycle < total) calls++;
+        }
+    }
+
+    if (result == 0) {
+        result = write_profile(as, line_at, occurrence, frames, count, taken, index, filename);
+    }
+    if (result == 0 && report) {
+        fprintf(report, "pgo: profiled %d frame(s) from $%04X: %ld instruction(s) in %d call(s), written to %s\n",
+                frames, entry, executed, calls, filename);
+    }
+
+done:
+    if (index) {
+        for (int i = 0; i < ASM_MEMORY_SIZE; i++) free(index[i]);
+    }
+    free(index);
+    free(taken);
+    free(count);
+    free(memory);
+    free(line_at);
+    free(occurrence);
+    return result;
+}
+
+/* ========== Layout ========== */
+
+typedef enum {
+    SITE_BRANCH,             /* Extra cycle when a taken branch crosses a page */
+    SITE_INDEXED,            /* Extra cycle when base + index crosses a page */
+    SITE_INDIRECT            /* JMP ($xxFF) reads its vector from the wrong page */
+} SiteKind;
+
+/* An instruction whose timing or correctness depends on the layout */
+typedef struct {
+    SiteKind kind;
+    long address;            /* Instruction address */
+    long target;             /* Branch target, indexed base or JMP () vector */
+    uint64_t taken;          /* Taken branches over the profile */
+    uint64_t crossing[257];  /* Indexed: executions with index >= k */
+} Site;
+
+/* A !pgo_pad and the addresses its padding moves: [start, end) */
+typedef struct {
+    int line;
+    long start;
+    long end;
+    long room;               /* Free bytes after end, shared by slots with the same end */
+    int max;
+    int pad;
+} Slot;
+
+static long shift_at(const Slot *slots, int slot_count, long address) {
+    long shift = 0;
+    for (int i = 0; i < slot_count; i++) {
+        if (address >= slots[i].start && address < slots[i].end) shift += slots[i].pad;
+    }
+    return shift;
+}
+
+/*
+ * Page-crossing cycles over the profile with the slots' current padding,
+ * or -1 if a branch would go out of range or a JMP () vector would end
+ * up at $xxFF.
+ */
+static int64_t layout_cost(const Site *sites, int site_count, const Slot *slots, int slot_count) {
+    int64_t cost = 0;
+    for (int i = 0; i < site_count; i++) {
+        const Site *site = &sites[i];
+        long target = site->target + shift_at(slots, slot_count, site->target);
+
+        if (site->kind == SITE_BRANCH) {
+            long next = site->address + shift_at(slots, slot_count, site->address) + 2;
+            if (target - next < -128 || target - next > 127) return -1;
+            if ((next ^ target) & 0xFF00) cost += (int64_t)site->taken;
+        } else if (site->kind == SITE_INDEXED) {
+            cost += (int64_t)site->crossing[256 - (target & 0xFF)];
+        } else if ((target & 0xFF) == 0xFF) {
+            return -1;
+        }
+    }
+    return cost;
+}
+
+static int is_directive(const AssembledLine *line, const char *name) {
+    return line->stmt->type == STMT_DIRECTIVE &&
+           strcmp(line->stmt->data.directive.name, name) == 0;
+}
+
+/* True if execution cannot fall through from this line */
+static int ends_flow(const AssembledLine *line) {
+    if (line->stmt->type != STMT_INSTRUCTION) return 1;
+    const char *mnemonic = line->stmt->data.instruction.mnemonic;
+    return strcasecmp(mnemonic, "JMP") == 0 || strcasecmp(mnemonic, "RTS") == 0 ||
+           strcasecmp(mnemonic, "RTI") == 0 || strcasecmp(mnemonic, "BRA") == 0;
+}
+
+static int collect_slots(Assembler *as, Slot **out) {
+    int count = 0;
+    for (int i = 0; i < as->line_count; i++) {
+        if (is_directive(&as->lines[i], "pgo_pad")) count++;
+    }
+    *out = calloc(count + 1, sizeof(Slot));
+    if (!*out) return -1;
+
+    int n = 0;
+    for (int i = 0; i < as->line_count; i++) {
+        AssembledLine *line = &as->lines[i];
+        if (!is_directive(line, "pgo_pad")) continue;
+        Slot *slot = &(*out)[n++];
+        slot->line = i;
+        slot->max = 0;
+
+        as->current_file = line->stmt->file;
+        as->current_line = line->stmt->line;
+        if (line->in_pseudopc) {
+            assembler_warning(as, "!pgo_pad inside !pseudopc is left unpadded");
+            continue;
+        }
+
+        /* Padding must not be executed, nor move the start of a segment */
+        int prev = i - 1;
+        while (prev >= 0 && as->lines[prev].byte_count == 0 &&
+               !is_directive(&as->lines[prev], "org")) {
+            prev--;
+        }
+        if (prev < 0 || as->lines[prev].byte_count == 0) {
+            assembler_warning(as, "!pgo_pad at the start of a segment is left unpadded");
+            continue;
+        }
+        if (!ends_flow(&as->lines[prev])) {
+            assembler_warning(as, "!pgo_pad follows code that falls through; left unpadded");
+            continue;
+        }
+
+        Expr *max = assembler_directive_arg(line->stmt, "max");
+        slot->max = PGO_PAD_MAX;
+        if (max) {
+            slot->max = expr_eval(max, as->symbols, as->anon_labels, line->address, 2, line->zone).value;
+        }
+
+        /* The segment ends where the next origin starts */
+        int last = i;
+        while (last + 1 < as->line_count && !is_directive(&as->lines[last + 1], "org")) {
+            last++;
+        }
+        slot->start = line->real_address;
+        slot->end = as->lines[last].real_address;
+        while (slot->end < ASM_MEMORY_SIZE && as->written[slot->end]) slot->end++;
+        slot->room = 0;
+        while (slot->end + slot->room < ASM_MEMORY_SIZE && !as->written[slot->end + slot->room]) {
+            slot->room++;
+        }
+    }
+    return count;
+}
+
+static int collect_sites(Assembler *as, PgoProfile *profile, const int *occurrence, Site **out) {
+    int capacity = 64;
+    int count = 0;
+    Site *sites = malloc(capacity * sizeof(Site));
+    if (!sites) return -1;
+
+    profile->matched = 0;
+    for (int i = 0; i < as->line_count; i++) {
+        AssembledLine *line = &as->lines[i];
+        if (line->stmt->type != STMT_INSTRUCTION) continue;
+        const PgoRecord *record = find_record(profile, line, occurrence[i]);
+        if (record) profile->matched++;
+
+        const OpcodeEntry *op = opcode_find_by_opcode_cpu(line->cpu, line->bytes[0]);
+        if (!op || line->in_pseudopc || line->byte_count < 2) continue;
+
+        /* A self-modifying operand's target is not the assembled one */
+        if (line->smc) continue;
+
+        Site site;
+        memset(&site, 0, sizeof(site));
+        site.address = line->real_address;
+        if (op->mode == ADDR_RELATIVE) {
+            site.kind = SITE_BRANCH;
+            site.target = (line->real_address + 2 + (int8_t)line->bytes[1]) & 0xFFFF;
+            site.taken = record ? record->taken : 0;
+        } else if (op->mode == ADDR_INDIRECT && line->byte_count >= 3) {
+            site.kind = SITE_INDIRECT;
+            site.target = line->bytes[1] | (line->bytes[2] << 8);
+            if ((site.target & 0xFF) == 0xFF) continue;
+        } else if (record && record->index && line->byte_count >= 3) {
+            site.kind = SITE_INDEXED;
+            site.target = line->bytes[1] | (line->bytes[2] << 8);
+            for (int k = 255; k >= 0; k--) {
+                site.crossing[k] = site.crossing[k + 1] + record->index[k];
+            }
+        } else {
+            continue;
+        }
+
+        if (count >= capacity) {
+            capacity *= 2;
+            Site *grown = realloc(sites, capacity * sizeof(Site));
+            if (!grown) {
+                free(sites);
+                return -1;
+            }
+            sites = grown;
+        }
+        sites[count++] = site;
+    }
+
+    *out = sites;
+    return count;
+}
+
+/* Padding already given to other slots sharing this slot's free space */
+static long room_used(const Slot *slots, int slot_count, int skip) {
+    long used = 0;
+    for (int i = 0; i < slot_count; i++) {
+        if (i != skip && slots[i].end == slots[skip].end) used += slots[i].pad;
+    }
+    return used;
+}
+
+int pgo_plan_layout(Assembler *as) {
+    PgoProfile *profile = as->profile;
+    const char *file = as->current_file;
+    int line_number = as->current_line;
+    Slot *slots = NULL;
+    Site *sites = NULL;
+    int *occurrence = line_occurrences(as);
+    int slot_count = collect_slots(as, &slots);
+    int site_count = occurrence ? collect_sites(as, profile, occurrence, &sites) : -1;
+    int changed = 0;
+
+    if (slot_count < 0 || site_count < 0) {
+        assembler_error(as, "out of memory for profile-guided layout");
+        goto done;
+    }
+
+    /* Coordinate descent: best padding per slot with the others held */
+    int64_t before = layout_cost(sites, site_count, slots, slot_count);
+    int64_t best = before;
+    for (int round = 0; round < PGO_LAYOUT_ROUNDS; round++) {
+        int improved = 0;
+        for (int s = 0; s < slot_count; s++) {
+            Slot *slot = &slots[s];
+            long limit = slot->room - room_used(slots, slot_count, s);
+            if (limit > slot->max) limit = slot->max;
+
+            int best_pad = slot->pad;
+            for (int pad = 0; pad <= limit; pad++) {
+                slot->pad = pad;
+                int64_t cost = layout_cost(sites, site_count, slots, slot_count);
+                if (cost >= 0 && (cost < best || (cost == best && pad < best_pad))) {
+                    if (cost < best) improved = 1;
+                    best = cost;
+                    best_pad = pad;
+                }
+            }
+            slot->pad = best_pad;
+        }
+        if (!improved) break;
+    }
+
+    free(as->layout_pads);
+    as->layout_pads = malloc((slot_count + 1) * sizeof(int));
+    as->layout_pad_count = 0;
+    for (int i = 0; i < profile->slot_count; i++) {
+        free(profile->slots[i].file);
+    }
+    free(profile->slots);
+    profile->slots = calloc(slot_count + 1, sizeof(PgoSlot));
+    profile->slot_count = 0;
+    if (!as->layout_pads || !profile->slots) {
+        assembler_error(as, "out of memory for profile-guided layout");
+        goto done;
+    }
+
+    for (int s = 0; s < slot_count; s++) {
+        const AssembledLine *line = &as->lines[slots[s].line];
+        as->layout_pads[as->layout_pad_count++] = slots[s].pad;
+        profile->slots[s].file = str_dup(line_file(line));
+        profile->slots[s].line = line->stmt->line;
+        profile->slots[s].pad = slots[s].pad;
+        profile->slot_count++;
+        if (slots[s].pad > 0) changed = 1;
+    }
+    profile->before = (uint64_t)before;
+    profile->after = (uint64_t)best;
+
+done:
+    as->current_file = file;
+    as->current_line = line_number;
+    free(slots);
+    free(sites);
+    free(occurrence);
+    return changed;
+}
+
+void pgo_report(const PgoProfile *profile, FILE *out) {
+    fprintf(out, "pgo: %d of %d profiled instruction(s) matched, %d frame(s)\n",
+            profile->matched, profile->record_count, profile->frames);
+    for (int i = 0; i < profile->slot_count; i++) {
+        const PgoSlot *slot = &profile->slots[i];
+        fprintf(out, "%s:%d: !pgo_pad inserts %d byte(s)\n", slot->file, slot->line, slot->pad);
+    }
+    double before = (double)profile->before / profile->frames;
+    double after = (double)profile->after / profile->frames;
+    fprintf(out, "pgo: page-crossing cycles per frame %.1f -> %.1f, estimated %.1f saved per frame\n",
+            before, after, before - after);
+}
@@ -0,0 +1,351 @@
+/*
+ * raster.c - VIC-II Raster Timing Model and Raster Block Verification
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#include "raster.h"
+#include "sim6510.h"
+#include "parser.h"
+#include "expr.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* ========== Timing Model ========== */
+
+void raster_model_init(RasterModel *vic, RasterSystem system) {
+    vic->system = system;
+    vic->cycles_per_line = (system == RASTER_NTSC) ? 65 : 63;
+    vic->lines_per_frame = (system == RASTER_NTSC) ? 263 : 312;
+    vic->d011 = 0x1B;
+    vic->d015 = 0x00;
+}
+
+int raster_is_badline(const RasterModel *vic, int line) {
+    return (vic->d011 & 0x10) &&
+           line >= RASTER_FIRST_DMA_LINE && line <= RASTER_LAST_DMA_LINE &&
+           (line & 7) == (vic->d011 & 7);
+}
+
+/* BA is pulled low three cycles before a sprite's first s-access and
+ * stays low through its last one. Sprite 0 is fetched five cycles
+ * before the end of the line, each further sprite two cycles later. */
+static int sprite_ba(const RasterModel *vic, int cycle) {
+    int cpl = vic->cycles_per_line;
+    for (int n = 0; n < 8; n++) {
+        if (!(vic->d015 & (1 << n))) continue;
+        int first = cpl - 5 + 2 * n;
+        for (int c = first - 3; c <= first + 1; c++) {
+            if ((c - 1) % cpl + 1 == cycle) return 1;
+        }
+    }
+    return 0;
+}
+
+static int ba_is_low(const RasterModel *vic, RasterPos pos) {
+    if (raster_is_badline(vic, pos.line) &&
+        pos.cycle >= RASTER_BADLINE_BA && pos.cycle <= RASTER_BADLINE_END) {
+        return 1;
+    }
+    return sprite_ba(vic, pos.cycle);
+}
+
+int raster_ba_low(const RasterModel *vic, RasterPos pos) {
+    int count = 0;
+    int limit = 2 * vic->cycles_per_line;
+
+    while (count < limit && ba_is_low(vic, pos)) {
+        count++;
+        if (--pos.cycle < 1) {
+            pos.cycle = vic->cycles_per_line;
+            if (--pos.line < 0) pos.line = vic->lines_per_frame - 1;
+        }
+    }
+    return count;
+}
+
+int raster_cpu_stalled(const RasterModel *vic, RasterPos pos, int is_write) {
+    int low = raster_ba_low(vic, pos);
+    return is_write ? low > 3 : low > 0;
+}
+
+void raster_advance(const RasterModel *vic, RasterPos *pos, int cycles) {
+    pos->cycle += cycles;
+    while (pos->cycle > vic->cycles_per_line) {
+        pos->cycle -= vic->cycles_per_line;
+        if (++pos->line >= vic->lines_per_frame) pos->line = 0;
+    }
+}
+
+/* ========== Raster Blocks ========== */
+
+/* A !raster_block or !raster_end in the program */
+typedef struct {
+    AssembledLine *line;
+    int is_end;
+    RasterPos pos;
+    int sprites;             /* -1 if not given */
+    int yscroll;             /* -1 if not given */
+    int visited;
+} RasterMark;
+
+/* State of one run, shared with the I/O read callback */
+typedef struct {
+    RasterModel vic;
+    RasterPos start;         /* Where the current instruction began */
+} RasterRun;
+
+/* Position of a cycle within an instruction whose earlier cycles are all reads */
+static RasterPos read_cycle_pos(RasterRun *run, int cycle) {
+    RasterPos pos = run->start;
+    for (int i = 0; ; i++) {
+        while (raster_cpu_stalled(&run->vic, pos, 0)) {
+            raster_advance(&run->vic, &pos, 1);
+        }
+        if (i == cycle) return pos;
+        raster_advance(&run->vic, &pos, 1);
+    }
+}
+
+static uint8_t raster_read_io(void *ctx, uint16_t address, int cycle) {
+    RasterRun *run = ctx;
+    if (address > 0xD3FF) return 0;
+
+    switch (address & 0x3F) {
+        case 0x11: {
+            RasterPos pos = read_cycle_pos(run, cycle);
+            return (uint8_t)((run->vic.d011 & 0x7F) | ((pos.line & 0x100) ? 0x80 : 0));
+        }
+        case 0x12:
+            return (uint8_t)read_cycle_pos(run, cycle).line;
+        case 0x15:
+            return run->vic.d015;
+        default:
+            return 0;
+    }
+}
+
+static int mark_arg(Assembler *as, RasterMark *mark, const char *name, int *value) {
+    Expr *expr = assembler_directive_arg(mark->line->stmt, name);
+    if (!expr) return 0;
+    ExprResult r = expr_eval(expr, as->symbols, as->anon_labels, mark->line->address,
+                             2, mark->line->zone);
+    *value = r.value;
+    return 1;
+}
+
+static int collect_marks(Assembler *as, RasterMark **out) {
+    RasterMark *marks = NULL;
+    int count = 0;
+
+    for (int i = 0; i < as->line_count; i++) {
+        AssembledLine *line = &as->lines[i];
+        Statement *stmt = line->stmt;
+        if (stmt->type != STMT_DIRECTIVE) continue;
+
+        int is_end = strcmp(stmt->data.directive.name, "raster_end") == 0;
+        if (!is_end && strcmp(stmt->data.directive.name, "raster_block") != 0) continue;
+
+        RasterMark *grown = realloc(marks, (count + 1) * sizeof(RasterMark));
+        if (!grown) break;
+        marks = grown;
+
+        RasterMark *mark = &marks[count++];
+        memset(mark, 0, sizeof(*mark));
+        mark->line = line;
+        mark->is_end = is_end;
+        mark->sprites = -1;
+        mark->yscroll = -1;
+        if (!is_end) {
+            mark_arg(as, mark, "line", &mark->pos.line);
+            mark_arg(as, mark, "cycle", &mark->pos.cycle);
+            mark_arg(as, mark, "sprites", &mark->sprites);
+            mark_arg(as, mark, "yscroll", &mark->yscroll);
+        }
+    }
+
+    *out = marks;
+    return count;
+}
+
+static RasterMark *mark_at(RasterMark *marks, int count, uint16_t address) {
+    for (int i = 0; i < count; i++) {
+        if (marks[i].line->address == address) return &marks[i];
+    }
+    return NULL;
+}
+
+static void apply_mark(RasterModel *vic, const RasterMark *mark) {
+    if (mark->sprites >= 0) vic->d015 = (uint8_t)mark->sprites;
+    if (mark->yscroll >= 0) vic->d011 = (uint8_t)((vic->d011 & ~7) | mark->yscroll);
+}
+
+/* Report the next diagnostic at the mark's source line */
+static void locate_mark(Assembler *as, const RasterMark *mark) {
+    as->current_file = mark->line->stmt->file;
+    as->current_line = mark->line->stmt->line;
+}
+
+/* Run one block from its start mark; returns 0 or -1 on drift or failure */
+static int run_block(Assembler *as, RasterMark *marks, int count, RasterMark *start,
+                     RasterSystem system, const int *line_at, FILE *report) {
+    uint8_t *memory = malloc(ASM_MEMORY_SIZE);
+    if (!memory) {
+        assembler_error(as, "out of memory for raster analysis");
+        return -1;
+    }
+    memcpy(memory, as->memory, ASM_MEMORY_SIZE);
+
+    RasterRun run;
+    raster_model_init(&run.vic, system);
+    apply_mark(&run.vic, start);
+
+    Sim6510 cpu;
+    sim6510_init(&cpu, memory, start->line->address);
+    cpu.read_io = raster_read_io;
+    cpu.ctx = &run;
+
+    RasterPos pos = start->pos;
+    long budget = 2L * run.vic.cycles_per_line * run.vic.lines_per_frame;
+    long elapsed = 0;
+    int depth = 0;
+    int result = 0;
+
+    start->visited = 1;
+    if (report) {
+        fprintf(report, "%s:%d: raster block at $%04X, line $%03X cycle %d\n",
+                start->line->stmt->file, start->line->stmt->line,
+                start->line->address, pos.line, pos.cycle);
+    }
+
+    for (int first = 1; ; first = 0) {
+        RasterMark *mark = first ? NULL : mark_at(marks, count, cpu.pc);
+        if (mark) {
+            if (mark->is_end) break;
+            if (!mark->visited) {
+                mark->visited = 1;
+                if (mark->pos.line != pos.line || mark->pos.cycle != pos.cycle) {
+                    locate_mark(as, mark);
+                    assembler_error(as, "raster drift: reached line $%03X cycle %d, "
+                                    "expected line $%03X cycle %d",
+                                    pos.line, pos.cycle, mark->pos.line, mark->pos.cycle);
+                    result = -1;
+                    pos = mark->pos;
+                }
+                apply_mark(&run.vic, mark);
+            }
+        }
+
+        if (!as->written[cpu.pc]) break;
+
+        SimStep step;
+        run.start = pos;
+        if (sim6510_step(&cpu, &step) < 0) {
+            locate_mark(as, start);
+            assembler_error(as, "raster block runs unsupported opcode $%02X at $%04X",
+                            step.opcode, step.pc);
+            result = -1;
+            break;
+        }
+
+        /* Place each bus cycle, waiting while the VIC-II holds the bus */
+        RasterPos cycle_pos[8];
+        for (int i = 0; i < step.cycles; i++) {
+            int is_write = (step.write_mask >> i) & 1;
+            while (raster_cpu_stalled(&run.vic, pos, is_write)) {
+                raster_advance(&run.vic, &pos, 1);
+                elapsed++;
+            }
+            if (i < 8) cycle_pos[i] = pos;
+            raster_advance(&run.vic, &pos, 1);
+            elapsed++;
+        }
+
+        for (int w = 0; w < step.io_write_count; w++) {
+            SimWrite *write = &step.io_writes[w];
+            RasterPos at = cycle_pos[write->cycle];
+            if (write->address <= 0xD3FF) {
+                if ((write->address & 0x3F) == 0x11) run.vic.d011 = write->value;
+                if ((write->address & 0x3F) == 0x15) run.vic.d015 = write->value;
+            }
+            if (report && write->address <= 0xD0FF) {
+                int index = line_at[step.pc];
+                AssembledLine *src = index >= 0 ? &as->lines[index] : start->line;
+                fprintf(report, "%s:%d: $%04X <- $%02X  line $%03X cycle %d\n",
+                        src->stmt->file, src->stmt->line, write->address, write->value,
+                        at.line, at.cycle);
+            }
+        }
+
+        if (step.opcode == 0x20) {
+            depth++;
+        } else if (step.opcode == 0x60 || step.opcode == 0x40) {
+            if (depth == 0) break;
+            depth--;
+        }
+
+        if (elapsed > budget) {
+            locate_mark(as, start);
+            assembler_error(as, "raster block did not finish within two frames");
+            result = -1;
+            break;
+        }
+    }
+
+    if (report) {
+        fprintf(report, "%s:%d: raster block ends at line $%03X cycle %d\n",
+                start->line->stmt->file, start->line->stmt->line, pos.line, pos.cycle);
+    }
+
+    free(memory);
+    return result;
+}
+
+int assembler_check_raster(Assembler *as, RasterSystem system, FILE *report) {
+    RasterMark *marks = NULL;
+    int count = collect_marks(as, &marks);
+    if (count == 0) {
+        free(marks);
+        return 0;
+    }
+
+    /* First instruction line at each address, for store locations */
+    int *line_at = malloc(ASM_MEMORY_SIZE * sizeof(int));
+    if (!line_at) {
+        free(marks);
+        assembler_error(as, "out of memory for raster analysis");
+        return -1;
+    }
+    for (int i = 0; i < ASM_MEMORY_SIZE; i++) line_at[i] = -1;
+    for (int i = as->line_count - 1; i >= 0; i--) {
+        AssembledLine *line = &as->lines[i];
+        if (line->stmt->type == STMT_INSTRUCTION && !line->in_pseudopc) {
+            line_at[line->address] = i;
+        }
+    }
+
+    RasterModel vic;
+    raster_model_init(&vic, system);
+
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+        RasterMark *mark = &marks[i];
+        if (mark->is_end || mark->visited) continue;
+        if (mark->pos.line >= vic.lines_per_frame ||
+            mark->pos.cycle > vic.cycles_per_line) {
+            locate_mark(as, mark);
+            assembler_error(as, "!raster_block position line $%03X cycle %d is outside the %s frame",
+                            mark->pos.line, mark->pos.cycle,
+                            system == RASTER_NTSC ? "NTSC" : "PAL");
+            result = -1;
+            continue;
+        }
+        if (run_block(as, marks, count, mark, system, line_at, report) < 0) {
+            result = -1;
+        }
+    }
+
+    free(line_at);
+    free(marks);
+    return result;
+}
@@ -0,0 +1,407 @@
+/*
+ * rodata.c - Read-Only Data Packing
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#include "rodata.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Per distinct block state while packing */
+typedef struct {
+    const RodataBlock *blocks;
+    int count;
+    int distinct;
+    int *of_block;           /* Distinct index of each block, -1 if empty */
+    int *first;              /* First block of each distinct one */
+    int *align;              /* Strictest alignment among its equal blocks */
+    int *parent;             /* Block it was found inside, or -1 */
+    int *at;                 /* Offset inside the parent */
+    int *prev;               /* Neighbours in its chain, or -1 */
+    int *next;
+    int *overlap;            /* Bytes shared with prev */
+    int *head;               /* First block of its chain */
+    int *start;              /* Offset in the packed data */
+} Packer;
+
+typedef struct {
+    int overlap;
+    int left;
+    int right;
+} Overlap;
+
+static const uint8_t *block_bytes(const Packer *pk, int d) {
+    return pk->blocks[pk->first[d]].bytes;
+}
+
+static int block_length(const Packer *pk, int d) {
+    return pk->blocks[pk->first[d]].length;
+}
+
+static void packer_free(Packer *pk) {
+    free(pk->of_block);
+    free(pk->first);
+    free(pk->align);
+    free(pk->parent);
+    free(pk->at);
+    free(pk->prev);
+    free(pk->next);
+    free(pk->overlap);
+    free(pk->head);
+    free(pk->start);
+}
+
+static int packer_init(Packer *pk, const RodataBlock *blocks, int count) {
+    size_t n = (size_t)(count > 0 ? count : 1);
+    memset(pk, 0, sizeof(*pk));
+    pk->blocks = blocks;
+    pk->count = count;
+    pk->of_block = malloc(n * sizeof(int));
+    pk->first = malloc(n * sizeof(int));
+    pk->align = malloc(n * sizeof(int));
+    pk->parent = malloc(n * sizeof(int));
+    pk->at = malloc(n * sizeof(int));
+    pk->prev = malloc(n * sizeof(int));
+    pk->next = malloc(n * sizeof(int));
+    pk->overlap = malloc(n * sizeof(int));
+    pk->head = malloc(n * sizeof(int));
+    pk->start = malloc(n * sizeof(int));
+    return pk->of_block && pk->first && pk->align && pk->parent && pk->at &&
+           pk->prev && pk->next && pk->overlap && pk->head && pk->start ? 0 : -1;
+}
+
+/* ========== Distinct Blocks ========== */
+
+static uint32_t hash_bytes(const uint8_t *bytes, int length) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        h = (h ^ bytes[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* Fill of_block, first and align; equal blocks take the strictest alignment */
+static int find_distinct(Packer *pk) {
+    int bits = 1;
+    while ((1 << bits) < pk->count * 2) bits++;
+    size_t mask = ((size_t)1 << bits) - 1;
+    int *table = calloc(mask + 1, sizeof(int));     /* Distinct index + 1, 0 = empty */
+    if (!table) return -1;
+
+    for (int i = 0; i < pk->count; i++) {
+        const RodataBlock *b = &pk->blocks[i];
+        if (b->length == 0) {
+            pk->of_block[i] = -1;
+            continue;
+        }
+        size_t slot = hash_bytes(b->bytes, b->length) & mask;
+        while (table[slot]) {
+            const RodataBlock *t = &pk->blocks[pk->first[table[slot] - 1]];
+            if (t->length == b->length && memcmp(t->bytes, b->bytes, (size_t)b->length) == 0) break;
+            slot = (slot + 1) & mask;
+        }
+        if (!table[slot]) {
+            pk->first[pk->distinct] = i;
+            pk->align[pk->distinct] = 1;
+            table[slot] = ++pk->distinct;
+        }
+        int d = table[slot] - 1;
+        pk->of_block[i] = d;
+        if (b->align > pk->align[d]) pk->align[d] = b->align;
+    }
+    free(table);
+    return 0;
+}
+
+/* ========== Matching ========== */
+
+/* Knuth-Morris-Pratt failure function of pattern */
+static void build_failure(const uint8_t *pattern, int length, int *fail) {
+    fail[0] = 0;
+    for (int i = 1, k = 0; i < length; i++) {
+        while (k > 0 && pattern[i] != pattern[k]) k = fail[k - 1];
+        if (pattern[i] == pattern[k]) k++;
+        fail[i] = k;
+    }
+}
+
+/* Offset of the first occurrence of pattern in text, or -1 with *overlap
+ * set to the length of the longest end of text that pattern starts with */
+static int scan(const uint8_t *text, int size, const uint8_t *pattern, int length,
+                const int *fail, int *overlap) {
+    int k = 0;
+    for (int i = 0; i < size; i++) {
+        while (k > 0 && text[i] != pattern[k]) k = fail[k - 1];
+        if (text[i] == pattern[k]) k++;
+        if (k == length) return i - length + 1;
+    }
+    *overlap = k;
+    return -1;
+}
+
+/* Longest first, then first seen */
+static const Packer *sort_packer;
+
+static int compare_length(const void *a, const void *b) {
+    int da = *(const int *)a, db = *(const int *)b;
+    int la = block_length(sort_packer, da), lb = block_length(sort_packer, db);
+    if (la != lb) return lb - la;
+    return da - db;
+}
+
+/* Most shared bytes first, then in block order so packing is repeatable */
+static int compare_overlap(const void *a, const void *b) {
+    const Overlap *x = a, *y = b;
+    if (x->overlap != y->overlap) return y->overlap - x->overlap;
+    if (x->left != y->left) return x->left - y->left;
+    return x->right - y->right;
+}
+
+/* Point each unaligned block found inside a longer one at it; a block
+ * inside one that is itself inside another is also inside that one */
+static int find_inside(Packer *pk, const int *order, int *fail) {
+    for (int n = 0; n < pk->distinct; n++) {
+        int d = order[n];
+        pk->parent[d] = -1;
+        if (pk->align[d] > 1) continue;
+
+        const uint8_t *bytes = block_bytes(pk, d);
+        int length = block_length(pk, d);
+        build_failure(bytes, length, fail);
+        for (int m = 0; m < n; m++) {
+            int e = order[m];
+            int overlap;
+            if (pk->parent[e] >= 0 || block_length(pk, e) == length) continue;
+            int at = scan(block_bytes(pk, e), block_length(pk, e), bytes, length, fail, &overlap);
+            if (at >= 0) {
+                pk->parent[d] = e;
+                pk->at[d] = at;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Chain blocks greedily by the longest overlap; a chain's alignment is
+ * its first block's, so only unaligned blocks are appended */
+static int chain_blocks(Packer *pk, int *fail) {
+    size_t capacity = 0, count = 0;
+    Overlap *pairs = NULL;
+
+    for (int d = 0; d < pk->distinct; d++) {
+        pk->prev[d] = pk->next[d] = -1;
+        pk->overlap[d] = 0;
+        pk->head[d] = d;
+    }
+    for (int right = 0; right < pk->distinct; right++) {
+        if (pk->parent[right] >= 0 || pk->align[right] > 1) continue;
+        const uint8_t *bytes = block_bytes(pk, right);
+        int length = block_length(pk, right);
+        build_failure(bytes, length, fail);
+        for (int left = 0; left < pk->distinct; left++) {
+            int overlap;
+            if (left == right || pk->parent[left] >= 0) continue;
+            if (scan(block_bytes(pk, left), block_length(pk, left), bytes, length, fail,
+                     &overlap) >= 0 || overlap == 0) {
+                continue;
+            }
+            if (count >= capacity) {
+                size_t new_capacity = capacity ? capacity * 2 : 64;
+                Overlap *grown = realloc(pairs, new_capacity * sizeof(Overlap));
+                if (!grown) {
+                    free(pairs);
+                    return -1;
+                }
+                pairs = grown;
+                capacity = new_capacity;
+            }
+            pairs[count].overlap = overlap;
+            pairs[count].left = left;
+            pairs[count].right = right;
+            count++;
+        }
+    }
+
+    if (count > 1) qsort(pairs, count, sizeof(Overlap), compare_overlap);
+    for (size_t i = 0; i < count; i++) {
+        int left = pairs[i].left, right = pairs[i].right;
+        if (pk->next[left] >= 0 || pk->prev[right] >= 0 || pk->head[left] == right) continue;
+        pk->next[left] = right;
+        pk->prev[right] = left;
+        pk->overlap[right] = pairs[i].overlap;
+        for (int d = right; d >= 0; d = pk->next[d]) pk->head[d] = pk->head[left];
+    }
+    free(pairs);
+    return 0;
+}
+
+/* ========== Layout ========== */
+
+static int chain_length(const Packer *pk, int head) {
+    int length = 0;
+    for (int d = head; d >= 0; d = pk->next[d]) {
+        length += block_length(pk, d) - pk->overlap[d];
+    }
+    return length;
+}
+
+static void place_chain(Packer *pk, int head, int offset) {
+    for (int d = head; d >= 0; d = pk->next[d]) {
+        offset -= pk->overlap[d];
+        pk->start[d] = offset;
+        offset += block_length(pk, d);
+    }
+}
+
+/* Place every chain and return the packed size; aligned chains go where
+ * they need the least padding, and unaligned ones fill the gap first */
+static int lay_out(Packer *pk, uint16_t address, int *padding) {
+    int *plain = malloc((size_t)(pk->distinct > 0 ? pk->distinct : 1) * sizeof(int));
+    int *aligned = malloc((size_t)(pk->distinct > 0 ? pk->distinct : 1) * sizeof(int));
+    if (!plain || !aligned) {
+        free(plain);
+        free(aligned);
+        return -1;
+    }
+
+    int plain_count = 0, aligned_count = 0;
+    for (int d = 0; d < pk->distinct; d++) {
+        if (pk->parent[d] >= 0 || pk->prev[d] >= 0) continue;
+        if (pk->align[d] > 1) {
+            aligned[aligned_count++] = d;
+        } else {
+            plain[plain_count++] = d;
+        }
+    }
+
+    /* Longest unaligned chains first, to fill gaps with as few as possible */
+    int *length = malloc((size_t)(pk->distinct > 0 ? pk->distinct : 1) * sizeof(int));
+    if (!length) {
+        free(plain);
+        free(aligned);
+        return -1;
+    }
+    for (int n = 0; n < plain_count; n++) length[n] = chain_length(pk, plain[n]);
+    for (int n = 1; n < plain_count; n++) {
+        int d = plain[n], l = length[n], m = n;
+        for (; m > 0 && length[m - 1] < l; m--) {
+            plain[m] = plain[m - 1];
+            length[m] = length[m - 1];
+        }
+        plain[m] = d;
+        length[m] = l;
+    }
+
+    int offset = 0;
+    *padding = 0;
+    while (aligned_count > 0) {
+        int best = 0, best_gap = 0;
+        for (int n = 0; n < aligned_count; n++) {
+            int align = pk->align[aligned[n]];
+            int gap = (int)((unsigned)(-(long)(address + offset)) & (unsigned)(align - 1));
+            if (n == 0 || gap < best_gap ||
+                (gap == best_gap && align > pk->align[aligned[best]])) {
+                best = n;
+                best_gap = gap;
+            }
+        }
+        for (int n = 0; n < plain_count && best_gap > 0; n++) {
+            if (plain[n] < 0 || length[n] > best_gap) continue;
+            place_chain(pk, plain[n], offset);
+            offset += length[n];
+            best_gap -= length[n];
+            plain[n] = -1;
+        }
+        *padding += best_gap;
+        offset += best_gap;
+        place_chain(pk, aligned[best], offset);
+        offset += chain_length(pk, aligned[best]);
+        aligned[best] = aligned[--aligned_count];
+    }
+    for (int n = 0; n < plain_count; n++) {
+        if (plain[n] < 0) continue;
+        place_chain(pk, plain[n], offset);
+        offset += length[n];
+    }
+
+    free(plain);
+    free(aligned);
+    free(length);
+    return offset;
+}
+
+/* ========== Packing ========== */
+
+int rodata_pack(const RodataBlock *blocks, int count, uint16_t address,
+                RodataPack *pack, const char **error) {
+    Packer pk;
+    int *order = NULL, *fail = NULL;
+    int longest = 1;
+
+    memset(pack, 0, sizeof(*pack));
+    pack->count = count;
+    pack->offsets = malloc((size_t)(count > 0 ? count : 1) * sizeof(int));
+    int result = packer_init(&pk, blocks, count) == 0 && pack->offsets ? find_distinct(&pk) : -1;
+    if (result == 0) {
+        for (int i = 0; i < count; i++) {
+            if (blocks[i].length > longest) longest = blocks[i].length;
+        }
+        order = malloc((size_t)(pk.distinct > 0 ? pk.distinct : 1) * sizeof(int));
+        fail = malloc((size_t)longest * sizeof(int));
+        result = order && fail ? 0 : -1;
+    }
+    if (result == 0) {
+        for (int d = 0; d < pk.distinct; d++) order[d] = d;
+        sort_packer = &pk;
+        qsort(order, (size_t)pk.distinct, sizeof(int), compare_length);
+        result = find_inside(&pk, order, fail);
+    }
+    if (result == 0) result = chain_blocks(&pk, fail);
+
+    int size = result == 0 ? lay_out(&pk, address, &pack->padding) : -1;
+    if (size >= 0) {
+        pack->data = calloc((size_t)(size > 0 ? size : 1), 1);
+        if (!pack->data) size = -1;
+    }
+    free(order);
+    free(fail);
+    if (size < 0) {
+        packer_free(&pk);
+        rodata_free(pack);
+        *error = "out of memory";
+        return -1;
+    }
+    if ((long)address + size > 0x10000) {
+        packer_free(&pk);
+        rodata_free(pack);
+        *error = "packed data runs past $FFFF";
+        return -1;
+    }
+
+    pack->size = size;
+    pack->distinct = pk.distinct;
+    for (int d = 0; d < pk.distinct; d++) {
+        if (pk.parent[d] >= 0) {
+            pack->inside++;
+            continue;
+        }
+        pack->overlapped += pk.overlap[d];
+        memcpy(pack->data + pk.start[d], block_bytes(&pk, d), (size_t)block_length(&pk, d));
+    }
+    for (int d = 0; d < pk.distinct; d++) {
+        if (pk.parent[d] >= 0) pk.start[d] = pk.start[pk.parent[d]] + pk.at[d];
+    }
+    for (int i = 0; i < count; i++) {
+        pack->offsets[i] = pk.of_block[i] >= 0 ? pk.start[pk.of_block[i]] : size;
+    }
+    packer_free(&pk);
+    return 0;
+}
+
+void rodata_free(RodataPack *pack) {
+    free(pack->data);
+    free(pack->offsets);
+    pack->data = NULL;
+    pack->offsets = NULL;
+}
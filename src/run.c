@@ -0,0 +1,79 @@
+/*
+ * run.c - Assembly-Time Execution of 6502 Code
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#include "run.h"
+#include "sim6510.h"
+#include <stdlib.h>
+#include <string.h>
+
+int run_execute(const uint8_t *memory, const RunOptions *options, uint8_t *out,
+                RunResult *result, const char **error) {
+    uint8_t *copy = malloc(65536);
+    if (!copy) {
+        *error = "out of memory";
+        return -1;
+    }
+    memcpy(copy, memory, 65536);
+
+    Sim6510 cpu;
+    sim6510_init(&cpu, copy, options->entry);
+    if (options->until >= 0) {
+        uint16_t ret = (uint16_t)(options->until - 1);
+        copy[0x100 + cpu.sp--] = (uint8_t)(ret >> 8);
+        copy[0x100 + cpu.sp--] = (uint8_t)(ret & 0xFF);
+    }
+
+    long limit = options->cycles > 0 ? options->cycles : RUN_MAX_CYCLES;
+    long cycles = 0;
+    int status = 0;
+    while (options->until < 0 || cpu.pc != options->until) {
+        if (cycles >= limit) {
+            if (options->cycles <= 0) {
+                *error = "did not reach until= within the cycle limit";
+                status = -1;
+            }
+            break;
+        }
+        SimStep step;
+        if (sim6510_step(&cpu, &step) < 0) {
+            *error = "opcode the 6510 model does not implement";
+            status = -1;
+            break;
+        }
+        cycles += step.cycles;
+    }
+
+    result->cycles = cycles;
+    result->pc = cpu.pc;
+    if (status == 0) memcpy(out, copy + options->capture, (size_t)options->length);
+    free(copy);
+    return status;
+}
+
+static uint64_t fnv1a(uint64_t hash, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+uint64_t run_cache_key(const uint8_t *memory, const RunOptions *options) {
+    uint8_t params[16];
+    uint32_t until = (uint32_t)options->until;
+    uint32_t cycles = (uint32_t)options->cycles;
+    uint32_t length = (uint32_t)options->length;
+    params[0] = (uint8_t)options->entry;
+    params[1] = (uint8_t)(options->entry >> 8);
+    params[2] = (uint8_t)options->capture;
+    params[3] = (uint8_t)(options->capture >> 8);
+    for (int i = 0; i < 4; i++) {
+        params[4 + i] = (uint8_t)(until >> (8 * i));
+        params[8 + i] = (uint8_t)(cycles >> (8 * i));
+        params[12 + i] = (uint8_t)(length >> (8 * i));
+    }
+    uint64_t hash = fnv1a(0xCBF29CE484222325ULL, memory, 65536);
+    return fnv1a(hash, params, sizeof(params));
+}
@@ -0,0 +1,452 @@
+/*
+ * sim6510.c - 6510 Instruction and Bus Cycle Model Implementation
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "sim6510.h"
+#include "opcodes.h"
+#include <pthread.h>
+#include <string.h>
+
+/* Operations the model implements */
+typedef enum {
+    OP_NONE,
+    /* Reads */
+    OP_LDA, OP_LDX, OP_LDY, OP_LAX, OP_ADC, OP_SBC, OP_AND, OP_ORA, OP_EOR,
+    OP_CMP, OP_CPX, OP_CPY, OP_BIT, OP_NOP, OP_ANC, OP_ALR, OP_ARR,
+    /* Writes */
+    OP_STA, OP_STX, OP_STY, OP_SAX,
+    /* Read-modify-write */
+    OP_ASL, OP_LSR, OP_ROL, OP_ROR, OP_INC, OP_DEC,
+    OP_SLO, OP_RLA, OP_SRE, OP_RRA, OP_DCP, OP_ISC,
+    /* Register and flag operations */
+    OP_CLC, OP_SEC, OP_CLI, OP_SEI, OP_CLV, OP_CLD, OP_SED,
+    OP_TAX, OP_TAY, OP_TXA, OP_TYA, OP_TSX, OP_TXS,
+    OP_INX, OP_INY, OP_DEX, OP_DEY,
+    /* Stack and control flow */
+    OP_PHA, OP_PHP, OP_PLA, OP_PLP, OP_JMP, OP_JSR, OP_RTS, OP_RTI, OP_BRK,
+    OP_BCC, OP_BCS, OP_BEQ, OP_BNE, OP_BMI, OP_BPL, OP_BVC, OP_BVS
+} SimOp;
+
+static const struct {
+    const char *mnemonic;
+    SimOp op;
+} op_names[] = {
+    { "LDA", OP_LDA }, { "LDX", OP_LDX }, { "LDY", OP_LDY }, { "LAX", OP_LAX },
+    { "ADC", OP_ADC }, { "SBC", OP_SBC }, { "USB", OP_SBC }, { "AND", OP_AND },
+    { "ORA", OP_ORA }, { "EOR", OP_EOR }, { "CMP", OP_CMP }, { "CPX", OP_CPX },
+    { "CPY", OP_CPY }, { "BIT", OP_BIT }, { "NOP", OP_NOP }, { "DOP", OP_NOP },
+    { "TOP", OP_NOP }, { "ANC", OP_ANC }, { "ANC2", OP_ANC }, { "ALR", OP_ALR },
+    { "ASR", OP_ALR }, { "ARR", OP_ARR },
+    { "STA", OP_STA }, { "STX", OP_STX }, { "STY", OP_STY }, { "SAX", OP_SAX },
+    { "ASL", OP_ASL }, { "LSR", OP_LSR }, { "ROL", OP_ROL }, { "ROR", OP_ROR },
+    { "INC", OP_INC }, { "DEC", OP_DEC }, { "SLO", OP_SLO }, { "ASO", OP_SLO },
+    { "RLA", OP_RLA }, { "SRE", OP_SRE }, { "LSE", OP_SRE }, { "RRA", OP_RRA },
+    { "DCP", OP_DCP }, { "DCM", OP_DCP }, { "ISC", OP_ISC }, { "ISB", OP_ISC },
+    { "INS", OP_ISC },
+    { "CLC", OP_CLC }, { "SEC", OP_SEC }, { "CLI", OP_CLI }, { "SEI", OP_SEI },
+    { "CLV", OP_CLV }, { "CLD", OP_CLD }, { "SED", OP_SED },
+    { "TAX", OP_TAX }, { "TAY", OP_TAY }, { "TXA", OP_TXA }, { "TYA", OP_TYA },
+    { "TSX", OP_TSX }, { "TXS", OP_TXS },
+    { "INX", OP_INX }, { "INY", OP_INY }, { "DEX", OP_DEX }, { "DEY", OP_DEY },
+    { "PHA", OP_PHA }, { "PHP", OP_PHP }, { "PLA", OP_PLA }, { "PLP", OP_PLP },
+    { "JMP", OP_JMP }, { "JSR", OP_JSR }, { "RTS", OP_RTS }, { "RTI", OP_RTI },
+    { "BRK", OP_BRK },
+    { "BCC", OP_BCC }, { "BCS", OP_BCS }, { "BEQ", OP_BEQ }, { "BNE", OP_BNE },
+    { "BMI", OP_BMI }, { "BPL", OP_BPL }, { "BVC", OP_BVC }, { "BVS", OP_BVS },
+    { NULL, OP_NONE }
+};
+
+/* Decoded opcode */
+typedef struct {
+    SimOp op;
+    AddressingMode mode;
+    uint8_t size;
+    uint8_t cycles;
+    uint8_t page_penalty;
+} SimDecode;
+
+static SimDecode decode_table[256];
+static pthread_once_t decode_once = PTHREAD_ONCE_INIT;
+
+static void build_decode_table(void) {
+    for (int i = 0; i < 256; i++) {
+        const OpcodeEntry *entry = opcode_find_by_opcode((uint8_t)i);
+        decode_table[i].op = OP_NONE;
+        if (!entry) continue;
+        for (int n = 0; op_names[n].mnemonic; n++) {
+            if (strcmp(op_names[n].mnemonic, entry->mnemonic) == 0) {
+                decode_table[i].op = op_names[n].op;
+                break;
+            }
+        }
+        decode_table[i].mode = entry->mode;
+        decode_table[i].size = entry->size;
+        decode_table[i].cycles = entry->cycles;
+        decode_table[i].page_penalty = entry->page_penalty;
+    }
+}
+
+void sim6510_init(Sim6510 *cpu, uint8_t *memory, uint16_t pc) {
+    /* Pass 2 workers (!delay) may get here together */
+    pthread_once(&decode_once, build_decode_table);
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->sp = 0xFF;
+    cpu->p = SIM6510_FLAG_U | SIM6510_FLAG_I;
+    cpu->pc = pc;
+    cpu->memory = memory;
+}
+
+/* ========== Bus Access ========== */
+
+static int is_io(uint16_t address) {
+    return address >= SIM6510_IO_START && address <= SIM6510_IO_END;
+}
+
+static uint8_t read_byte(Sim6510 *cpu, uint16_t address, int cycle) {
+    if (is_io(address)) {
+        return cpu->read_io ? cpu->read_io(cpu->ctx, address, cycle) : 0;
+    }
+    return cpu->memory[address];
+}
+
+static void write_byte(Sim6510 *cpu, SimStep *step, uint16_t address,
+                       uint8_t value, int cycle) {
+    step->write_mask |= (uint8_t)(1u << cycle);
+    if (is_io(address)) {
+        if (step->io_write_count < 2) {
+            SimWrite *w = &step->io_writes[step->io_write_count++];
+            w->address = address;
+            w->value = value;
+            w->cycle = (uint8_t)cycle;
+        }
+        return;
+    }
+    cpu->memory[address] = value;
+}
+
+static void push(Sim6510 *cpu, SimStep *step, uint8_t value, int cycle) {
+    write_byte(cpu, step, (uint16_t)(0x0100 | cpu->sp), value, cycle);
+    cpu->sp--;
+}
+
+static uint8_t pull(Sim6510 *cpu) {
+    cpu->sp++;
+    return cpu->memory[0x0100 | cpu->sp];
+}
+
+/* ========== Flags and Arithmetic ========== */
+
+static void set_flag(Sim6510 *cpu, uint8_t flag, int on) {
+    if (on) {
+        cpu->p |= flag;
+    } else {
+        cpu->p &= (uint8_t)~flag;
+    }
+}
+
+static uint8_t set_nz(Sim6510 *cpu, uint8_t value) {
+    set_flag(cpu, SIM6510_FLAG_Z, value == 0);
+    set_flag(cpu, SIM6510_FLAG_N, value & 0x80);
+    return value;
+}
+
+static void compare(Sim6510 *cpu, uint8_t reg, uint8_t value) {
+    set_flag(cpu, SIM6510_FLAG_C, reg >= value);
+    set_nz(cpu, (uint8_t)(reg - value));
+}
+
+static void adc(Sim6510 *cpu, uint8_t value) {
+    unsigned a = cpu->a;
+    unsigned carry = cpu->p & SIM6510_FLAG_C;
+    unsigned sum = a + value + carry;
+
+    if (cpu->p & SIM6510_FLAG_D) {
+        unsigned lo = (a & 0x0F) + (value & 0x0F) + carry;
+        if (lo > 9) lo += 6;
+        unsigned hi = (a >> 4) + (value >> 4) + (lo > 0x0F);
+        set_flag(cpu, SIM6510_FLAG_Z, (sum & 0xFF) == 0);
+        set_flag(cpu, SIM6510_FLAG_N, hi & 0x08);
+        set_flag(cpu, SIM6510_FLAG_V, ~(a ^ value) & (a ^ (hi << 4)) & 0x80);
+        if (hi > 9) hi += 6;
+        set_flag(cpu, SIM6510_FLAG_C, hi > 0x0F);
+        cpu->a = (uint8_t)((hi << 4) | (lo & 0x0F));
+        return;
+    }
+
+    set_flag(cpu, SIM6510_FLAG_C, sum > 0xFF);
+    set_flag(cpu, SIM6510_FLAG_V, ~(a ^ value) & (a ^ sum) & 0x80);
+    cpu->a = set_nz(cpu, (uint8_t)sum);
+}
+
+static void sbc(Sim6510 *cpu, uint8_t value) {
+    unsigned a = cpu->a;
+    unsigned borrow = (cpu->p & SIM6510_FLAG_C) ? 0 : 1;
+    unsigned diff = a - value - borrow;
+
+    set_flag(cpu, SIM6510_FLAG_C, diff < 0x100);
+    set_flag(cpu, SIM6510_FLAG_V, (a ^ value) & (a ^ diff) & 0x80);
+    set_nz(cpu, (uint8_t)diff);
+
+    if (cpu->p & SIM6510_FLAG_D) {
+        unsigned lo = (a & 0x0F) - (value & 0x0F) - borrow;
+        unsigned hi = (a >> 4) - (value >> 4);
+        if (lo & 0x10) {
+            lo -= 6;
+            hi--;
+        }
+        if (hi & 0x10) hi -= 6;
+        cpu->a = (uint8_t)((hi << 4) | (lo & 0x0F));
+        return;
+    }
+    cpu->a = (uint8_t)diff;
+}
+
+/* Shifts and rotates shared by the accumulator and memory forms */
+static uint8_t shift(Sim6510 *cpu, SimOp op, uint8_t value) {
+    unsigned carry_in = cpu->p & SIM6510_FLAG_C;
+    uint8_t result;
+
+    switch (op) {
+        case OP_ASL:
+        case OP_SLO:
+            set_flag(cpu, SIM6510_FLAG_C, value & 0x80);
+            result = (uint8_t)(value << 1);
+            break;
+        case OP_LSR:
+        case OP_SRE:
+            set_flag(cpu, SIM6510_FLAG_C, value & 0x01);
+            result = (uint8_t)(value >> 1);
+            break;
+        case OP_ROL:
+        case OP_RLA:
+            set_flag(cpu, SIM6510_FLAG_C, value & 0x80);
+            result = (uint8_t)((value << 1) | carry_in);
+            break;
+        default:    /* ROR, RRA */
+            set_flag(cpu, SIM6510_FLAG_C, value & 0x01);
+            result = (uint8_t)((value >> 1) | (carry_in << 7));
+            break;
+    }
+    return set_nz(cpu, result);
+}
+
+/* ========== Addressing ========== */
+
+static uint16_t read_word_zp(Sim6510 *cpu, uint8_t zp) {
+    return (uint16_t)(cpu->memory[zp] | (cpu->memory[(uint8_t)(zp + 1)] << 8));
+}
+
+/* Effective address of the operand; sets *crossed on a page crossing */
+static uint16_t operand_address(Sim6510 *cpu, AddressingMode mode, int *crossed) {
+    uint8_t lo = cpu->memory[(uint16_t)(cpu->pc + 1)];
+    uint8_t hi = cpu->memory[(uint16_t)(cpu->pc + 2)];
+    uint16_t abs = (uint16_t)(lo | (hi << 8));
+    uint16_t base;
+
+    *crossed = 0;
+    switch (mode) {
+        case ADDR_ZEROPAGE:
+            return lo;
+        case ADDR_ZEROPAGE_X:
+            return (uint8_t)(lo + cpu->x);
+        case ADDR_ZEROPAGE_Y:
+            return (uint8_t)(lo + cpu->y);
+        case ADDR_ABSOLUTE:
+            return abs;
+        case ADDR_ABSOLUTE_X:
+            *crossed = ((abs & 0xFF) + cpu->x) > 0xFF;
+            return (uint16_t)(abs + cpu->x);
+        case ADDR_ABSOLUTE_Y:
+            *crossed = ((abs & 0xFF) + cpu->y) > 0xFF;
+            return (uint16_t)(abs + cpu->y);
+        case ADDR_INDIRECT:
+            /* JMP ($xxFF) wraps within the page */
+            return (uint16_t)(cpu->memory[abs] |
+                   (cpu->memory[(abs & 0xFF00) | ((abs + 1) & 0xFF)] << 8));
+        case ADDR_INDIRECT_X:
+            return read_word_zp(cpu, (uint8_t)(lo + cpu->x));
+        case ADDR_INDIRECT_Y:
+            base = read_word_zp(cpu, lo);
+            *crossed = ((base & 0xFF) + cpu->y) > 0xFF;
+            return (uint16_t)(base + cpu->y);
+        case ADDR_RELATIVE:
+            return (uint16_t)(cpu->pc + 2 + (int8_t)lo);
+        default:
+            return 0;
+    }
+}
+
+static int branch_taken(Sim6510 *cpu, SimOp op) {
+    switch (op) {
+        case OP_BCC: return !(cpu->p & SIM6510_FLAG_C);
+        case OP_BCS: return (cpu->p & SIM6510_FLAG_C) != 0;
+        case OP_BNE: return !(cpu->p & SIM6510_FLAG_Z);
+        case OP_BEQ: return (cpu->p & SIM6510_FLAG_Z) != 0;
+        case OP_BPL: return !(cpu->p & SIM6510_FLAG_N);
+        case OP_BMI: return (cpu->p & SIM6510_FLAG_N) != 0;
+        case OP_BVC: return !(cpu->p & SIM6510_FLAG_V);
+        default:     return (cpu->p & SIM6510_FLAG_V) != 0;
+    }
+}
+
+/* ========== Execution ========== */
+
+int sim6510_step(Sim6510 *cpu, SimStep *step) {
+    uint8_t opcode = cpu->memory[cpu->pc];
+    const SimDecode *d = &decode_table[opcode];
+
+    memset(step, 0, sizeof(*step));
+    step->pc = cpu->pc;
+    step->opcode = opcode;
+    if (d->op == OP_NONE) return -1;
+
+    int crossed = 0;
+    uint16_t addr = operand_address(cpu, d->mode, &crossed);
+    uint16_t next = (uint16_t)(cpu->pc + d->size);
+    int cycles = d->cycles + (d->page_penalty ? crossed : 0);
+    uint8_t imm = cpu->memory[(uint16_t)(cpu->pc + 1)];
+    uint8_t value;
+
+    /* Operand of a read instruction, fetched on its last cycle */
+    #define OPERAND() (d->mode == ADDR_IMMEDIATE ? imm : read_byte(cpu, addr, cycles - 1))
+
+    switch (d->op) {
+        case OP_LDA: cpu->a = set_nz(cpu, OPERAND()); break;
+        case OP_LDX: cpu->x = set_nz(cpu, OPERAND()); break;
+        case OP_LDY: cpu->y = set_nz(cpu, OPERAND()); break;
+        case OP_LAX: cpu->a = cpu->x = set_nz(cpu, OPERAND()); break;
+        case OP_ADC: adc(cpu, OPERAND()); break;
+        case OP_SBC: sbc(cpu, OPERAND()); break;
+        case OP_AND: cpu->a = set_nz(cpu, cpu->a & OPERAND()); break;
+        case OP_ORA: cpu->a = set_nz(cpu, cpu->a | OPERAND()); break;
+        case OP_EOR: cpu->a = set_nz(cpu, cpu->a ^ OPERAND()); break;
+        case OP_CMP: compare(cpu, cpu->a, OPERAND()); break;
+        case OP_CPX: compare(cpu, cpu->x, OPERAND()); break;
+        case OP_CPY: compare(cpu, cpu->y, OPERAND()); break;
+        case OP_BIT:
+            value = OPERAND();
+            set_flag(cpu, SIM6510_FLAG_Z, (cpu->a & value) == 0);
+            set_flag(cpu, SIM6510_FLAG_N, value & 0x80);
+            set_flag(cpu, SIM6510_FLAG_V, value & 0x40);
+            break;
+        case OP_NOP:
+            if (d->mode != ADDR_IMPLIED && d->mode != ADDR_IMMEDIATE) {
+                (void)OPERAND();
+            }
+            break;
+        case OP_ANC:
+            cpu->a = set_nz(cpu, cpu->a & imm);
+            set_flag(cpu, SIM6510_FLAG_C, cpu->a & 0x80);
+            break;
+        case OP_ALR:
+            cpu->a = shift(cpu, OP_LSR, cpu->a & imm);
+            break;
+        case OP_ARR:
+            cpu->a = shift(cpu, OP_ROR, cpu->a & imm);
+            set_flag(cpu, SIM6510_FLAG_C, cpu->a & 0x40);
+            set_flag(cpu, SIM6510_FLAG_V, ((cpu->a >> 6) ^ (cpu->a >> 5)) & 1);
+            break;
+
+        case OP_STA: write_byte(cpu, step, addr, cpu->a, cycles - 1); break;
+        case OP_STX: write_byte(cpu, step, addr, cpu->x, cycles - 1); break;
+        case OP_STY: write_byte(cpu, step, addr, cpu->y, cycles - 1); break;
+        case OP_SAX: write_byte(cpu, step, addr, cpu->a & cpu->x, cycles - 1); break;
+
+        case OP_ASL: case OP_LSR: case OP_ROL: case OP_ROR:
+        case OP_INC: case OP_DEC:
+        case OP_SLO: case OP_RLA: case OP_SRE: case OP_RRA:
+        case OP_DCP: case OP_ISC: {
+            if (d->mode == ADDR_ACCUMULATOR) {
+                cpu->a = shift(cpu, d->op, cpu->a);
+                break;
+            }
+            /* Read, write the old value back, then write the result */
+            uint8_t old = read_byte(cpu, addr, cycles - 3);
+            uint8_t result;
+            step->write_mask |= (uint8_t)(1u << (cycles - 2));
+            if (d->op == OP_INC || d->op == OP_ISC) {
+                result = set_nz(cpu, (uint8_t)(old + 1));
+            } else if (d->op == OP_DEC || d->op == OP_DCP) {
+                result = set_nz(cpu, (uint8_t)(old - 1));
+            } else {
+                result = shift(cpu, d->op, old);
+            }
+            write_byte(cpu, step, addr, result, cycles - 1);
+
+            if (d->op == OP_SLO) cpu->a = set_nz(cpu, cpu->a | result);
+            if (d->op == OP_RLA) cpu->a = set_nz(cpu, cpu->a & result);
+            if (d->op == OP_SRE) cpu->a = set_nz(cpu, cpu->a ^ result);
+            if (d->op == OP_RRA) adc(cpu, result);
+            if (d->op == OP_DCP) compare(cpu, cpu->a, result);
+            if (d->op == OP_ISC) sbc(cpu, result);
+            break;
+        }
+
+        case OP_CLC: set_flag(cpu, SIM6510_FLAG_C, 0); break;
+        case OP_SEC: set_flag(cpu, SIM6510_FLAG_C, 1); break;
+        case OP_CLI: set_flag(cpu, SIM6510_FLAG_I, 0); break;
+        case OP_SEI: set_flag(cpu, SIM6510_FLAG_I, 1); break;
+        case OP_CLV: set_flag(cpu, SIM6510_FLAG_V, 0); break;
+        case OP_CLD: set_flag(cpu, SIM6510_FLAG_D, 0); break;
+        case OP_SED: set_flag(cpu, SIM6510_FLAG_D, 1); break;
+        case OP_TAX: cpu->x = set_nz(cpu, cpu->a); break;
+        case OP_TAY: cpu->y = set_nz(cpu, cpu->a); break;
+        case OP_TXA: cpu->a = set_nz(cpu, cpu->x); break;
+        case OP_TYA: cpu->a = set_nz(cpu, cpu->y); break;
+        case OP_TSX: cpu->x = set_nz(cpu, cpu->sp); break;
+        case OP_TXS: cpu->sp = cpu->x; break;
+        case OP_INX: cpu->x = set_nz(cpu, (uint8_t)(cpu->x + 1)); break;
+        case OP_INY: cpu->y = set_nz(cpu, (uint8_t)(cpu->y + 1)); break;
+        case OP_DEX: cpu->x = set_nz(cpu, (uint8_t)(cpu->x - 1)); break;
+        case OP_DEY: cpu->y = set_nz(cpu, (uint8_t)(cpu->y - 1)); break;
+
+        case OP_PHA: push(cpu, step, cpu->a, 2); break;
+        case OP_PHP: push(cpu, step, cpu->p | SIM6510_FLAG_B | SIM6510_FLAG_U, 2); break;
+        case OP_PLA: cpu->a = set_nz(cpu, pull(cpu)); break;
+        case OP_PLP: cpu->p = (uint8_t)((pull(cpu) & ~SIM6510_FLAG_B) | SIM6510_FLAG_U); break;
+
+        case OP_JMP:
+            next = addr;
+            break;
+        case OP_JSR:
+            push(cpu, step, (uint8_t)((next - 1) >> 8), 3);
+            push(cpu, step, (uint8_t)(next - 1), 4);
+            next = addr;
+            break;
+        case OP_RTS:
+            next = pull(cpu);
+            next = (uint16_t)((next | (pull(cpu) << 8)) + 1);
+            break;
+        case OP_RTI:
+            cpu->p = (uint8_t)((pull(cpu) & ~SIM6510_FLAG_B) | SIM6510_FLAG_U);
+            next = pull(cpu);
+            next = (uint16_t)(next | (pull(cpu) << 8));
+            break;
+        case OP_BRK:
+            push(cpu, step, (uint8_t)((cpu->pc + 2) >> 8), 2);
+            push(cpu, step, (uint8_t)(cpu->pc + 2), 3);
+            push(cpu, step, cpu->p | SIM6510_FLAG_B | SIM6510_FLAG_U, 4);
+            set_flag(cpu, SIM6510_FLAG_I, 1);
+            next = (uint16_t)(cpu->memory[0xFFFE] | (cpu->memory[0xFFFF] << 8));
+            break;
+
+        case OP_BCC: case OP_BCS: case OP_BEQ: case OP_BNE:
+        case OP_BMI: case OP_BPL: case OP_BVC: case OP_BVS:
+            if (branch_taken(cpu, d->op)) {
+                cycles += ((next ^ addr) & 0xFF00) ? 2 : 1;
+                next = addr;
+            }
+            break;
+
+        case OP_NONE:
+            return -1;
+    }
+
+    #undef OPERAND
+
+    step->cycles = cycles;
+    cpu->pc = next;
+    return 0;
+}
@@ -0,0 +1,431 @@
+/*
+ * strpool.c - String Pooling and Dictionary Compression
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#include "strpool.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* ========== Distinct Strings ========== */
+
+static uint32_t hash_bytes(const uint8_t *bytes, int length) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        h = (h ^ bytes[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* Index of each string's first equal string; returns the distinct count */
+static int find_distinct(const PoolString *strings, int count, int *first, int *of_string) {
+    int bits = 1;
+    while ((1 << bits) < count * 2) bits++;
+    size_t mask = ((size_t)1 << bits) - 1;
+    int *table = calloc(mask + 1, sizeof(int));     /* Distinct index + 1, 0 = empty */
+    if (!table) return -1;
+
+    int distinct = 0;
+    for (int i = 0; i < count; i++) {
+        const PoolString *s = &strings[i];
+        size_t slot = hash_bytes(s->bytes, s->length) & mask;
+        while (table[slot]) {
+            const PoolString *t = &strings[first[table[slot] - 1]];
+            if (t->length == s->length && memcmp(t->bytes, s->bytes, (size_t)s->length) == 0) break;
+            slot = (slot + 1) & mask;
+        }
+        if (!table[slot]) {
+            first[distinct] = i;
+            table[slot] = ++distinct;
+        }
+        of_string[i] = table[slot] - 1;
+    }
+    free(table);
+    return distinct;
+}
+
+/* ========== Dictionary ========== */
+
+/* A substring counted while looking for the next dictionary entry */
+typedef struct {
+    uint32_t hash;
+    int round;               /* Search the slot was filled in, 0 = never */
+    int string;              /* First occurrence */
+    int start;
+    int length;
+    int count;               /* Occurrences that do not overlap */
+    int last_string;         /* End of the last counted occurrence */
+    int last_end;
+} Candidate;
+
+typedef struct {
+    uint8_t **text;          /* Encoded distinct strings, without the terminator (owned) */
+    int *length;
+    int count;
+    int base;                /* First code */
+    Candidate *table;
+    size_t mask;
+    size_t used;             /* Slots filled this round */
+    int round;
+} Encoder;
+
+/* Count every run of 2 to STRPOOL_MAX_WORD literals; occurrences of one
+ * run are met in string order, so a left-to-right replace finds as many */
+static const Candidate *best_candidate(Encoder *enc) {
+    const Candidate *best = NULL;
+    int best_saving = 0;
+
+    enc->round++;
+    enc->used = 0;
+    for (int s = 0; s < enc->count; s++) {
+        const uint8_t *text = enc->text[s];
+        for (int start = 0; start + 1 < enc->length[s]; start++) {
+            uint32_t h = 2166136261u;
+            for (int len = 1; len <= STRPOOL_MAX_WORD && start + len <= enc->length[s]; len++) {
+                uint8_t b = text[start + len - 1];
+                if (b >= enc->base) break;
+                h = (h ^ b) * 16777619u;
+                if (len < 2) continue;
+
+                size_t slot = (h ^ (uint32_t)len) & enc->mask;
+                Candidate *c;
+                for (;; slot = (slot + 1) & enc->mask) {
+                    c = &enc->table[slot];
+                    if (c->round != enc->round) {
+                        /* A full table counts only the runs it holds */
+                        if (enc->used >= enc->mask / 2) {
+                            c = NULL;
+                            break;
+                        }
+                        enc->used++;
+                        c->round = enc->round;
+                        c->hash = h;
+                        c->string = s;
+                        c->start = start;
+                        c->length = len;
+                        c->count = 0;
+                        c->last_string = -1;
+                        break;
+                    }
+                    if (c->hash == h && c->length == len &&
+                        memcmp(enc->text[c->string] + c->start, text + start, (size_t)len) == 0) {
+                        break;
+                    }
+                }
+                if (!c || (c->last_string == s && start < c->last_end)) continue;
+                c->count++;
+                c->last_string = s;
+                c->last_end = start + len;
+
+                /* Each use saves len - 1 bytes; the entry costs its bytes,
+                 * a terminator and two address bytes */
+                int saving = c->count * (len - 1) - (len + 3);
+                if (saving > best_saving ||
+                    (saving == best_saving && best && len > best->length)) {
+                    best = c;
+                    best_saving = saving;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+/* Replace the occurrences of word with code, left to right */
+static void replace_word(Encoder *enc, const uint8_t *word, int length, uint8_t code) {
+    for (int s = 0; s < enc->count; s++) {
+        uint8_t *text = enc->text[s];
+        int in = 0, out = 0;
+        while (in < enc->length[s]) {
+            if (in + length <= enc->length[s] && memcmp(text + in, word, (size_t)length) == 0) {
+                text[out++] = code;
+                in += length;
+            } else {
+                text[out++] = text[in++];
+            }
+        }
+        enc->length[s] = out;
+    }
+}
+
+/* ========== Layout ========== */
+
+/* Decoder with zero page operands relative to zp; put_decoder fills in the rest */
+static const uint8_t decoder[STRPOOL_DECODER_SIZE] = {
+    0x85, 0,                /*          sta zp          */
+    0x86, 1,                /*          stx zp+1        */
+    0xA0, 0x00,             /* next     ldy #0          */
+    0xB1, 0,                /*          lda (zp),y      */
+    0xF0, 44,               /*          beq done        */
+    0xE6, 0,                /*          inc zp          */
+    0xD0, 2,                /*          bne +           */
+    0xE6, 1,                /*          inc zp+1        */
+    0xC9, 0x00,             /* +        cmp #base       */
+    0xB0, 6,                /*          bcs word        */
+    0x20, 0x00, 0x00,       /*          jsr output      */
+    0x4C, 0x00, 0x00,       /*          jmp next        */
+    0xAA,                   /* word     tax             */
+    0xBD, 0x00, 0x00,       /*          lda lo-base,x   */
+    0x85, 2,                /*          sta zp+2        */
+    0xBD, 0x00, 0x00,       /*          lda hi-base,x   */
+    0x85, 3,                /*          sta zp+3        */
+    0xA0, 0x00,             /* copy     ldy #0          */
+    0xB1, 2,                /*          lda (zp+2),y    */
+    0xF0, (uint8_t)-39,     /*          beq next        */
+    0x20, 0x00, 0x00,       /*          jsr output      */
+    0xE6, 2,                /*          inc zp+2        */
+    0xD0, (uint8_t)-13,     /*          bne copy        */
+    0xE6, 3,                /*          inc zp+3        */
+    0xD0, (uint8_t)-17,     /*          bne copy        */
+    0x60                    /* done     rts             */
+};
+
+static const int decoder_zp[] = { 1, 3, 7, 11, 15, 31, 36, 40, 47, 51 };
+
+static void put_word(uint8_t *out, uint16_t value) {
+    out[0] = (uint8_t)(value & 0xFF);
+    out[1] = (uint8_t)(value >> 8);
+}
+
+static void put_decoder(uint8_t *out, const StrPoolOptions *options, uint16_t address,
+                        int base, int words) {
+    uint16_t lo = (uint16_t)(address + STRPOOL_DECODER_SIZE);
+    uint16_t hi = (uint16_t)(lo + words);
+
+    memcpy(out, decoder, STRPOOL_DECODER_SIZE);
+    for (size_t i = 0; i < sizeof(decoder_zp) / sizeof(decoder_zp[0]); i++) {
+        out[decoder_zp[i]] = (uint8_t)(options->zp + decoder[decoder_zp[i]]);
+    }
+    out[17] = (uint8_t)base;
+    put_word(out + 24, (uint16_t)(address + 4));
+    put_word(out + 28, (uint16_t)(lo - base));
+    put_word(out + 33, (uint16_t)(hi - base));
+    strpool_set_output(out, options->output);
+}
+
+void strpool_set_output(uint8_t *decoder, uint16_t output) {
+    put_word(decoder + 21, output);
+    put_word(decoder + 44, output);
+}
+
+/* Offset of needle in haystack, or -1 */
+static int find_bytes(const uint8_t *haystack, int size, const uint8_t *needle, int length) {
+    if (length == 0) return 0;
+    const uint8_t *p = haystack;
+    const uint8_t *end = haystack + size - length;
+    while (p <= end) {
+        p = memchr(p, needle[0], (size_t)(end - p) + 1);
+        if (!p) return -1;
+        if (memcmp(p, needle, (size_t)length) == 0) return (int)(p - haystack);
+        p++;
+    }
+    return -1;
+}
+
+static const int *sort_length;
+
+/* Longest first, then first seen */
+static int compare_length(const void *a, const void *b) {
+    int ia = *(const int *)a, ib = *(const int *)b;
+    if (sort_length[ia] != sort_length[ib]) return sort_length[ib] - sort_length[ia];
+    return ia - ib;
+}
+
+/* Place texts after header bytes, sharing where one is inside another */
+static int place_strings(const uint8_t *const *text, const int *length, int count,
+                         int header, StrPool *pool, int *offset) {
+    int *order = malloc((size_t)count * sizeof(int));
+    int capacity = header;
+    for (int i = 0; i < count; i++) capacity += length[i];
+    uint8_t *data = malloc(capacity > 0 ? (size_t)capacity : 1);
+    if (!order || !data) {
+        free(order);
+        free(data);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) order[i] = i;
+    sort_length = length;
+    qsort(order, (size_t)count, sizeof(int), compare_length);
+
+    int size = header;
+    for (int n = 0; n < count; n++) {
+        int d = order[n];
+        int at = find_bytes(data + header, size - header, text[d], length[d]);
+        if (at >= 0) {
+            offset[d] = header + at;
+            pool->shared++;
+        } else {
+            offset[d] = size;
+            memcpy(data + size, text[d], (size_t)length[d]);
+            size += length[d];
+        }
+    }
+    free(order);
+    pool->data = data;
+    pool->size = size;
+    return 0;
+}
+
+/* ========== Building ========== */
+
+static void encoder_free(Encoder *enc) {
+    for (int i = 0; enc->text && i < enc->count; i++) free(enc->text[i]);
+    free(enc->text);
+    free(enc->length);
+    free(enc->table);
+}
+
+/* Copy the distinct strings and encode them with up to 256 - base entries */
+static int encode(const PoolString *strings, const int *first, int distinct,
+                  Encoder *enc, uint8_t words[][STRPOOL_MAX_WORD], int *word_length) {
+    size_t positions = 0;
+    enc->text = calloc((size_t)(distinct > 0 ? distinct : 1), sizeof(uint8_t *));
+    enc->length = malloc((size_t)(distinct > 0 ? distinct : 1) * sizeof(int));
+    enc->count = distinct;
+    if (!enc->text || !enc->length) return -1;
+    for (int d = 0; d < distinct; d++) {
+        const PoolString *s = &strings[first[d]];
+        enc->length[d] = s->length - 1;
+        enc->text[d] = malloc((size_t)s->length);
+        if (!enc->text[d]) return -1;
+        memcpy(enc->text[d], s->bytes, (size_t)enc->length[d]);
+        positions += (size_t)enc->length[d];
+    }
+
+    int bits = 4;
+    while (((size_t)1 << bits) < positions * (STRPOOL_MAX_WORD - 1) * 2 && bits < 20) bits++;
+    enc->mask = ((size_t)1 << bits) - 1;
+    enc->table = calloc(enc->mask + 1, sizeof(Candidate));
+    if (!enc->table) return -1;
+
+    int count = 0;
+    while (enc->base + count < 256) {
+        const Candidate *best = best_candidate(enc);
+        if (!best) break;
+        word_length[count] = best->length;
+        memcpy(words[count], enc->text[best->string] + best->start, (size_t)best->length);
+        replace_word(enc, words[count], best->length, (uint8_t)(enc->base + count));
+        count++;
+    }
+    return count;
+}
+
+static int build_compressed(const PoolString *strings, const int *first, int distinct,
+                            const StrPoolOptions *options, uint16_t address,
+                            StrPool *pool, int *offset, const char **error) {
+    int base = 1;
+    for (int d = 0; d < distinct; d++) {
+        const PoolString *s = &strings[first[d]];
+        if (s->length < 1 || s->bytes[s->length - 1] != 0 ||
+            memchr(s->bytes, 0, (size_t)s->length - 1)) {
+            *error = "compressed strings must end in their only zero byte";
+            return -1;
+        }
+        for (int i = 0; i < s->length; i++) {
+            if (s->bytes[i] >= base) base = s->bytes[i] + 1;
+        }
+    }
+    if (base > 255) {
+        *error = "compressed strings cannot use byte $FF";
+        return -1;
+    }
+
+    uint8_t words[256][STRPOOL_MAX_WORD];
+    int word_length[256];
+    Encoder enc;
+    memset(&enc, 0, sizeof(enc));
+    enc.base = base;
+    int count = encode(strings, first, distinct, &enc, words, word_length);
+    if (count < 0) {
+        encoder_free(&enc);
+        *error = "out of memory";
+        return -1;
+    }
+
+    /* Put the terminators back */
+    for (int d = 0; d < distinct; d++) enc.text[d][enc.length[d]++] = 0;
+
+    int header = STRPOOL_DECODER_SIZE + count * 2;
+    for (int w = 0; w < count; w++) header += word_length[w] + 1;
+    int result = place_strings((const uint8_t *const *)enc.text, enc.length, distinct,
+                               header, pool, offset);
+    encoder_free(&enc);
+    if (result < 0) {
+        *error = "out of memory";
+        return -1;
+    }
+
+    put_decoder(pool->data, options, address, base, count);
+    uint8_t *lo = pool->data + STRPOOL_DECODER_SIZE;
+    uint8_t *hi = lo + count;
+    uint8_t *out = hi + count;
+    for (int w = 0; w < count; w++) {
+        uint16_t at = (uint16_t)(address + (out - pool->data));
+        lo[w] = (uint8_t)(at & 0xFF);
+        hi[w] = (uint8_t)(at >> 8);
+        memcpy(out, words[w], (size_t)word_length[w]);
+        out += word_length[w];
+        *out++ = 0;
+    }
+    pool->words = count;
+    return 0;
+}
+
+int strpool_build(const PoolString *strings, int count, const StrPoolOptions *options,
+                  uint16_t address, StrPool *pool, const char **error) {
+    memset(pool, 0, sizeof(*pool));
+    pool->count = count;
+
+    int *first = malloc((size_t)(count > 0 ? count : 1) * sizeof(int));
+    int *of_string = malloc((size_t)(count > 0 ? count : 1) * sizeof(int));
+    int *offset = malloc((size_t)(count > 0 ? count : 1) * sizeof(int));
+    pool->offsets = malloc((size_t)(count > 0 ? count : 1) * sizeof(int));
+    int distinct = (first && of_string && offset && pool->offsets) ?
+                   find_distinct(strings, count, first, of_string) : -1;
+    if (distinct < 0) {
+        free(first);
+        free(of_string);
+        free(offset);
+        strpool_free(pool);
+        *error = "out of memory";
+        return -1;
+    }
+    pool->distinct = distinct;
+
+    int result;
+    if (options->compress) {
+        result = build_compressed(strings, first, distinct, options, address, pool, offset, error);
+    } else {
+        const uint8_t **text = malloc((size_t)(distinct > 0 ? distinct : 1) * sizeof(uint8_t *));
+        int *length = malloc((size_t)(distinct > 0 ? distinct : 1) * sizeof(int));
+        result = -1;
+        if (text && length) {
+            for (int d = 0; d < distinct; d++) {
+                text[d] = strings[first[d]].bytes;
+                length[d] = strings[first[d]].length;
+            }
+            result = place_strings(text, length, distinct, 0, pool, offset);
+        }
+        if (result < 0) *error = "out of memory";
+        free(text);
+        free(length);
+    }
+
+    if (result == 0) {
+        for (int i = 0; i < count; i++) pool->offsets[i] = offset[of_string[i]];
+    } else {
+        strpool_free(pool);
+    }
+    free(first);
+    free(of_string);
+    free(offset);
+    return result;
+}
+
+void strpool_free(StrPool *pool) {
+    free(pool->data);
+    free(pool->offsets);
+    pool->data = NULL;
+    pool->offsets = NULL;
+}
@@ -58,6 +58,8 @@ SymbolTable *symbol_table_create(int size) {
 
     table->size = size;
     table->count = 0;
+    table->functions = NULL;
+    table->lists = NULL;
     return table;
 }
 
@@ -70,6 +72,7 @@ void symbol_table_free(SymbolTable *table) {
             Symbol *next = sym->next;
             free(sym->name);
             free(sym->display_name);
+            free(sym->def_lines);
             free(sym);
             sym = next;
         }
@@ -109,7 +112,7 @@ Symbol *symbol_define(SymbolTable *table, const char *name, int32_t value,
     }
 
     /* Create new symbol */
-    sym = malloc(sizeof(Symbol));
+    sym = calloc(1, sizeof(Symbol));
     if (!sym) return NULL;
 
     sym->name = str_dup(name);
@@ -166,7 +169,7 @@ Symbol *symbol_reference(SymbolTable *table, const char *name,
     /* Create undefined symbol entry */
     unsigned int bucket = hash_symbol(name) % table->size;
 
-    sym = malloc(sizeof(Symbol));
+    sym = calloc(1, sizeof(Symbol));
     if (!sym) return NULL;
 
     sym->name = str_dup(name);
@@ -188,6 +191,24 @@ Symbol *symbol_reference(SymbolTable *table, const char *name,
     return sym;
 }
 
+int symbol_add_definer(Symbol *sym, int line_index) {
+    if (!sym) return -1;
+
+    /* Lines are added in order, so a repeat can only be the last entry */
+    if (sym->def_count > 0 && sym->def_lines[sym->def_count - 1] == line_index) {
+        return 0;
+    }
+    if (sym->def_count >= sym->def_capacity) {
+        int new_capacity = sym->def_capacity ? sym->def_capacity * 2 : 2;
+        int *lines = realloc(sym->def_lines, new_capacity * sizeof(int));
+        if (!lines) return -1;
+        sym->def_lines = lines;
+        sym->def_capacity = new_capacity;
+    }
+    sym->def_lines[sym->def_count++] = line_index;
+    return 0;
+}
+
 int symbol_check_undefined(SymbolTable *table,
                            void (*error_fn)(const char *file, int line,
                                            const char *name)) {
@@ -390,6 +411,27 @@ void anon_reset_pass(AnonLabels *anon) {
     anon->backward_count = 0;  /* Reset backward labels for pass 2 re-definition */
 }
 
+AnonLabels *anon_clone(const AnonLabels *anon) {
+    if (!anon) return NULL;
+
+    AnonLabels *copy = malloc(sizeof(AnonLabels));
+    if (!copy) return NULL;
+
+    *copy = *anon;
+    copy->forward = malloc(anon->forward_capacity * sizeof(AnonLabel));
+    copy->backward = malloc(anon->backward_capacity * sizeof(AnonLabel));
+    if (!copy->forward || !copy->backward) {
+        free(copy->forward);
+        free(copy->backward);
+        free(copy);
+        return NULL;
+    }
+
+    memcpy(copy->forward, anon->forward, anon->forward_count * sizeof(AnonLabel));
+    memcpy(copy->backward, anon->backward, anon->backward_count * sizeof(AnonLabel));
+    return copy;
+}
+
 void anon_clear(AnonLabels *anon) {
     if (!anon) return;
     anon->forward_count = 0;
@@ -0,0 +1,161 @@
+/*
+ * threadpool.c - Fixed-size Worker Thread Pool Implementation
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "threadpool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct ThreadPool {
+    pthread_t *workers;
+    int worker_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;   /* Signalled when a new batch starts */
+    pthread_cond_t work_done;    /* Signalled when a batch completes */
+
+    /* Current batch */
+    ThreadTask task;
+    void *arg;
+    int count;
+    int next;                    /* Next index to hand out */
+    int pending;                 /* Indices not yet finished */
+    unsigned long generation;    /* Incremented per batch */
+    int shutdown;
+};
+
+/* Take indices from the current batch until none are left */
+static void run_batch(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->next < pool->count) {
+        int index = pool->next++;
+        ThreadTask task = pool->task;
+        void *arg = pool->arg;
+        pthread_mutex_unlock(&pool->lock);
+
+        task(arg, index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_broadcast(&pool->work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void *worker_main(void *data) {
+    ThreadPool *pool = data;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->shutdown) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_batch(pool);
+
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* ========== Pool Lifecycle ========== */
+
+ThreadPool *threadpool_create(int threads) {
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (!pool) return NULL;
+
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        free(pool);
+        return NULL;
+    }
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    int wanted = threads > 1 ? threads - 1 : 0;
+    if (wanted > 0) {
+        pool->workers = malloc(wanted * sizeof(pthread_t));
+        if (!pool->workers) {
+            threadpool_free(pool);
+            return NULL;
+        }
+    }
+
+    /* A partial pool is still usable; the caller just gets fewer threads */
+    for (int i = 0; i < wanted; i++) {
+        if (pthread_create(&pool->workers[i], NULL, worker_main, pool) != 0) {
+            break;
+        }
+        pool->worker_count++;
+    }
+
+    return pool;
+}
+
+void threadpool_free(ThreadPool *pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+/* ========== Task Execution ========== */
+
+void threadpool_run(ThreadPool *pool, ThreadTask task, void *arg, int count) {
+    if (count <= 0) return;
+
+    if (!pool || pool->worker_count == 0) {
+        for (int i = 0; i < count; i++) {
+            task(arg, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->count = count;
+    pool->next = 0;
+    pool->pending = count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    /* The caller works on the batch too */
+    run_batch(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int threadpool_size(const ThreadPool *pool) {
+    return pool ? pool->worker_count + 1 : 1;
+}
+
+int threadpool_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
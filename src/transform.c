@@ -0,0 +1,186 @@
+/*
+ * transform.c - Data Transforms for !binary
+ * ASM64 - 6502/6510 Assembler for Commodore 64
+ */
+
+#include "transform.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+    const char *name;
+    int min_args;
+    int max_args;
+} transforms[TRANSFORM_KIND_COUNT] = {
+    { "reverse", 0, 0 },
+    { "bitreverse", 0, 0 },
+    { "mirror", 1, 2 },
+    { "transpose", 2, 2 },
+    { "interleave", 1, 1 },
+    { "deinterleave", 1, 1 },
+    { "delta", 0, 0 },
+    { "nibblepack", 0, 0 },
+    { "xor", 1, 1 },
+    { "add", 1, 1 }
+};
+
+const char *transform_name(TransformKind kind) {
+    return (unsigned)kind < TRANSFORM_KIND_COUNT ? transforms[kind].name : "unknown";
+}
+
+int transform_lookup(const char *name) {
+    for (int i = 0; i < TRANSFORM_KIND_COUNT; i++) {
+        if (strcmp(transforms[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+void transform_arg_range(TransformKind kind, int *min, int *max) {
+    *min = transforms[kind].min_args;
+    *max = transforms[kind].max_args;
+}
+
+/* ========== Byte Tables ========== */
+
+/* Each byte with its bits in reverse order */
+#define R2(n)   n, n + 2 * 64, n + 1 * 64, n + 3 * 64
+#define R4(n)   R2(n), R2(n + 2 * 16), R2(n + 1 * 16), R2(n + 3 * 16)
+#define R6(n)   R4(n), R4(n + 2 * 4), R4(n + 1 * 4), R4(n + 3 * 4)
+static const uint8_t reversed_bits[256] = { R6(0), R6(2), R6(1), R6(3) };
+
+/* Each byte with its 2-bit pixels in reverse order */
+#define P1(n)   n, n + 64, n + 128, n + 192
+#define P2(n)   P1(n), P1(n + 16), P1(n + 32), P1(n + 48)
+#define P3(n)   P2(n), P2(n + 4), P2(n + 8), P2(n + 12)
+static const uint8_t reversed_pairs[256] = { P3(0), P3(1), P3(2), P3(3) };
+
+/* ========== Steps ========== */
+
+static void map_bytes(uint8_t *data, int length, const uint8_t *table) {
+    for (int i = 0; i < length; i++) data[i] = table[data[i]];
+}
+
+static void reverse_bytes(uint8_t *data, int length) {
+    for (int i = 0, j = length - 1; i < j; i++, j--) {
+        uint8_t t = data[i];
+        data[i] = data[j];
+        data[j] = t;
+    }
+}
+
+/* Blocks of h rows of w bytes become w columns of h bytes */
+static int transpose(uint8_t **data, int length, int w, int h, const char **error) {
+    if ((long)w * h > length) {
+        *error = "block is larger than the data";
+        return -1;
+    }
+    int block = w * h;
+    if (length % block != 0) {
+        *error = "length is not a multiple of the block size";
+        return -1;
+    }
+    uint8_t *out = malloc((size_t)length);
+    if (!out) {
+        *error = "out of memory";
+        return -1;
+    }
+    for (int base = 0; base < length; base += block) {
+        const uint8_t *in = *data + base;
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                out[base + x * h + y] = in[y * w + x];
+            }
+        }
+    }
+    free(*data);
+    *data = out;
+    return 0;
+}
+
+int transform_apply(const BinaryTransform *step, uint8_t **data, int *length,
+                    const char **error) {
+    uint8_t *bytes = *data;
+    int n = *length;
+
+    switch (step->kind) {
+        case TRANSFORM_REVERSE:
+            reverse_bytes(bytes, n);
+            return 0;
+
+        case TRANSFORM_BITREVERSE:
+            map_bytes(bytes, n, reversed_bits);
+            return 0;
+
+        case TRANSFORM_MIRROR: {
+            int w = step->args[0];
+            int bits = step->arg_count > 1 ? step->args[1] : 1;
+            if (w < 1 || bits < 1 || bits > 2) {
+                *error = "mirror takes a row width of at least 1 and 1 or 2 bits per pixel";
+                return -1;
+            }
+            if (n % w != 0) {
+                *error = "length is not a multiple of the row width";
+                return -1;
+            }
+            for (int row = 0; row < n; row += w) reverse_bytes(bytes + row, w);
+            map_bytes(bytes, n, bits == 1 ? reversed_bits : reversed_pairs);
+            return 0;
+        }
+
+        case TRANSFORM_TRANSPOSE:
+            if (step->args[0] < 1 || step->args[1] < 1 || step->args[0] > n || step->args[1] > n) {
+                *error = "transpose width and height must be from 1 to the length";
+                return -1;
+            }
+            return transpose(data, n, step->args[0], step->args[1], error);
+
+        case TRANSFORM_INTERLEAVE:
+        case TRANSFORM_DEINTERLEAVE: {
+            int tables = step->args[0];
+            if (tables < 1 || tables > n || n % tables != 0) {
+                *error = "length is not a multiple of the table count";
+                return -1;
+            }
+            /* n tables of n/tables bytes are rows to turn into columns */
+            if (step->kind == TRANSFORM_INTERLEAVE) {
+                return transpose(data, n, n / tables, tables, error);
+            }
+            return transpose(data, n, tables, n / tables, error);
+        }
+
+        case TRANSFORM_DELTA:
+            for (int i = n - 1; i > 0; i--) bytes[i] = (uint8_t)(bytes[i] - bytes[i - 1]);
+            return 0;
+
+        case TRANSFORM_NIBBLEPACK: {
+            /* An odd last byte gets a zero low nibble */
+            int packed = (n + 1) / 2;
+            for (int i = 0; i < packed; i++) {
+                uint8_t low = 2 * i + 1 < n ? (uint8_t)(bytes[2 * i + 1] & 0x0F) : 0;
+                bytes[i] = (uint8_t)((bytes[2 * i] << 4) | low);
+            }
+            *length = packed;
+            return 0;
+        }
+
+        case TRANSFORM_XOR:
+        case TRANSFORM_ADD: {
+            int v = step->args[0];
+            if (v < -255 || v > 255) {
+                *error = "value must be from -255 to 255";
+                return -1;
+            }
+            uint8_t value = (uint8_t)v;
+            if (step->kind == TRANSFORM_XOR) {
+                for (int i = 0; i < n; i++) bytes[i] ^= value;
+            } else {
+                for (int i = 0; i < n; i++) bytes[i] = (uint8_t)(bytes[i] + value);
+            }
+            return 0;
+        }
+
+        default:
+            *error = "unknown transform";
+            return -1;
+    }
+}
@@ -0,0 +1,71 @@
+/* Pass 2 thread scaling benchmark */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/assembler.h"
+#include "../include/opcodes.h"
+
+#define BENCH_BLOCKS 8000
+#define BENCH_RUNS 3
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* Generate a program of 7-byte blocks filling most of memory */
+static char *make_program(int blocks) {
+    size_t cap = (size_t)blocks * 48 + 64;
+    size_t len = 0;
+    char *src = malloc(cap);
+    len += snprintf(src + len, cap - len, "*=$0400\n");
+    for (int i = 0; i < blocks; i++) {
+        len += snprintf(src + len, cap - len,
+                        "-   lda $%04x,x\n    bne -\n    beq +\n+\n", i);
+    }
+    return src;
+}
+
+int main(void) {
+    int counts[] = { 1, 2, 4, 8, 16, 32 };
+    char *src = make_program(BENCH_BLOCKS);
+    Assembler *reference = NULL;
+    double base = 0;
+
+    opcodes_init();
+
+    printf("Pass 2 scaling (%d source blocks, best of %d)\n", BENCH_BLOCKS, BENCH_RUNS);
+    printf("  threads  chunks     ms  speedup\n");
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        double best = 0;
+        Assembler *as = NULL;
+        for (int run = 0; run < BENCH_RUNS; run++) {
+            if (as) assembler_free(as);
+            as = assembler_create();
+            assembler_set_threads(as, counts[c]);
+            double start = now_ms();
+            assembler_assemble_string(as, src, "bench.asm");
+            double elapsed = now_ms() - start;
+            if (run == 0 || elapsed < best) best = elapsed;
+        }
+
+        if (!reference) {
+            reference = as;
+            base = best;
+        } else if (memcmp(reference->memory, as->memory, ASM_MEMORY_SIZE) != 0) {
+            printf("  output differs with %d threads\n", counts[c]);
+            return 1;
+        }
+        printf("  %7d  %6d  %5.1f  %6.2fx\n", counts[c], as->pass2_chunks,
+               best, best > 0 ? base / best : 0.0);
+        if (as != reference) assembler_free(as);
+    }
+
+    assembler_free(reference);
+    free(src);
+    return 0;
+}
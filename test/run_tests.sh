@@ -129,6 +129,50 @@ else
     ((PASSED++))
 fi
 
+# Test streaming: source from stdin, PRG to stdout
+printf "  %-30s " "stdin to stdout pipe"
+pipe_bytes=$(printf '*=$c000\n    lda #$01\n    rts\n' | "$ASM64" - | od -An -tx1 | tr -d ' \n')
+if [ "$pipe_bytes" = "00c0a90160" ]; then
+    echo -e "${GREEN}PASS${NC}"
+    ((PASSED++))
+else
+    echo -e "${RED}FAIL${NC} (got '$pipe_bytes')"
+    ((FAILED++))
+fi
+
+# Test listing to a numbered file descriptor
+printf "  %-30s " "listing to fd"
+if printf '*=$c000\n    nop\n' | "$ASM64" -o /dev/null -l fd:3 - 3>&1 | grep -q "C000  EA"; then
+    echo -e "${GREEN}PASS${NC}"
+    ((PASSED++))
+else
+    echo -e "${RED}FAIL${NC}"
+    ((FAILED++))
+fi
+
+printf "  %-30s " "writer timings"
+if printf '*=$c000\n    nop\n' | "$ASM64" -o /dev/null -l /dev/null --timings - 2>&1 | grep -q "timing: listing"; then
+    echo -e "${GREEN}PASS${NC}"
+    ((PASSED++))
+else
+    echo -e "${RED}FAIL${NC}"
+    ((FAILED++))
+fi
+
+printf "  %-30s " "raster drift fails build"
+if ! printf '*=$c000\n!raster_block line=$40, cycle=1\n    nop\n!raster_block line=$40, cycle=4\n    rts\n' | \
+        "$ASM64" --raster pal -o /dev/null - 2>&1 | grep -q "raster drift"; then
+    echo -e "${RED}FAIL${NC}"
+    ((FAILED++))
+elif printf '*=$c000\n!raster_block line=$40, cycle=1\n    nop\n!raster_block line=$40, cycle=3\n    rts\n' | \
+        "$ASM64" --raster pal -o /dev/null - > /dev/null 2>&1; then
+    echo -e "${GREEN}PASS${NC}"
+    ((PASSED++))
+else
+    echo -e "${RED}FAIL${NC}"
+    ((FAILED++))
+fi
+
 echo ""
 
 # Run assembly tests
@@ -257,6 +257,49 @@ TEST(label_expression) {
     return check_output("*=$1000\ndata: NOP\nLDA data+1", expected, 4, 0x1000);
 }
 
+TEST(anon_forward_call) {
+    /* A bare jsr+ is a JSR to the next + label, not an inline call */
+    uint8_t bare[] = { 0x20, 0x03, 0x10, 0x60 };
+    uint8_t commented[] = { 0x20, 0x04, 0x10, 0x60, 0x60 };
+    return check_output("*=$1000\njsr+\n+ rts", bare, 4, 0x1000) &&
+           check_output("*=$1000\nJSR+ ; next\nRTS\n+ rts", commented, 5, 0x1000);
+}
+
+/* ========== Self-Modifying Operand Tests ========== */
+
+TEST(smc_operand_label) {
+    uint8_t expected[] = { 0xA9, 0x00, 0xEE, 0x01, 0x10, 0x8D, 0x02, 0x10 };
+    return check_output("*=$1000\nLDA #0 :@value\nINC value\nSTA value+1", expected, 8, 0x1000);
+}
+
+TEST(smc_operand_parts) {
+    Assembler *as = assembler_create();
+    int errors = assembler_assemble_string(as,
+        "*=$1000\n"
+        "start: STA $D020 :@lo low\n"
+        "  LDX table :@hi .page\n"
+        "  JMP $1000 :@target\n"
+        "table: RTS", "test");
+    Symbol *low = symbol_lookup(as->symbols, "low");
+    Symbol *page = symbol_lookup(as->symbols, "start.page");
+    Symbol *target = symbol_lookup(as->symbols, "target");
+    int ok = errors == 0 &&
+             low && low->value == 0x1001 && (low->flags & SYM_SMC) &&
+             page && page->value == 0x1005 && (page->flags & SYM_SMC) &&
+             target && target->value == 0x1007 &&
+             as->lines[1].smc == 0x02 && as->lines[2].smc == 0x04 &&
+             as->lines[3].smc == 0x06 && as->lines[4].smc == 0;
+    assembler_free(as);
+    return ok;
+}
+
+TEST(smc_operand_errors) {
+    return check_error("*=$1000\nNOP :@value") &&
+           check_error("*=$1000\nLDA #0 :@hi value") &&
+           check_error("*=$1000\nLDA #0 :@") &&
+           check_error("*=$1000\nLDA #0 :@one two");
+}
+
 /* ========== Directive Tests ========== */
 
 TEST(byte_single) {
@@ -484,6 +527,12 @@ int main(void) {
     RUN_TEST(backward_reference);
     RUN_TEST(multiple_labels);
     RUN_TEST(label_expression);
+    RUN_TEST(anon_forward_call);
+
+    printf("\nSelf-Modifying Operands:\n");
+    RUN_TEST(smc_operand_label);
+    RUN_TEST(smc_operand_parts);
+    RUN_TEST(smc_operand_errors);
 
     printf("\nDirectives:\n");
     RUN_TEST(byte_single);
@@ -3,11 +3,14 @@
  * Tests command-line options and features
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include "../include/assembler.h"
 #include "../include/opcodes.h"
 
@@ -593,6 +596,117 @@ void test_listing_file_output(void) {
     unlink(lstfile);
 }
 
+/* ========== Streaming I/O Tests ========== */
+
+void test_stream_input(void) {
+    TEST("stream_input");
+
+    /* Source arriving through a pipe, longer than one read chunk */
+    int fds[2];
+    if (pipe(fds) != 0) {
+        FAIL("pipe failed");
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        FILE *w = fdopen(fds[1], "w");
+        fputs("*=$C000\n", w);
+        for (int i = 0; i < 8000; i++) {
+            fputs("    nop          ; padding comment to grow the stream\n", w);
+        }
+        fputs("done:\n    lda #<done\n", w);
+        fclose(w);
+        _exit(0);
+    }
+    close(fds[1]);
+
+    FILE *r = fdopen(fds[0], "r");
+    Assembler *as = assembler_create();
+    int result = assembler_assemble_stream(as, r, "<stdin>");
+    fclose(r);
+    waitpid(pid, NULL, 0);
+
+    if (result != 0) {
+        FAIL("assembly failed");
+    } else {
+        /* Last line's listing text comes from the incrementally built index */
+        const char *last_text = NULL;
+        for (int i = as->line_count - 1; i >= 0 && !last_text; i--) {
+            last_text = as->lines[i].source_text;
+        }
+        int ok = as->memory[0xC000] == 0xEA &&
+                 last_text && strcmp(last_text, "lda #<done") == 0;
+        if (ok) {
+            PASS();
+        } else {
+            FAIL("wrong output or source text");
+        }
+    }
+
+    assembler_free(as);
+}
+
+void test_fd_outputs(void) {
+    TEST("fd_outputs");
+
+    const char *source =
+        "*=$C000\n"
+        "START:\n"
+        "    lda #$00\n"
+        "    rts\n";
+
+    char symfile[256], lstfile[256];
+    snprintf(symfile, sizeof(symfile), "/tmp/test_fdsym_%d.sym", getpid());
+    snprintf(lstfile, sizeof(lstfile), "/tmp/test_fdlst_%d.lst", getpid());
+
+    int sym_fd = open(symfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int lst_fd = open(lstfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    char sym_dest[32], lst_dest[32];
+    snprintf(sym_dest, sizeof(sym_dest), "fd:%d", sym_fd);
+    snprintf(lst_dest, sizeof(lst_dest), "fd:%d", lst_fd);
+
+    Assembler *as = assembler_create();
+    int result = assembler_assemble_string(as, source, "test.asm");
+    if (result == 0) result = assembler_write_symbols(as, sym_dest);
+    if (result == 0) result = assembler_write_listing(as, lst_dest);
+
+    /* The caller's descriptors must still be open and usable */
+    int still_open = fcntl(sym_fd, F_GETFD) != -1 && fcntl(lst_fd, F_GETFD) != -1;
+    close(sym_fd);
+    close(lst_fd);
+
+    int sym_size = 0, lst_size = 0;
+    uint8_t *sym = read_file_bytes(symfile, &sym_size);
+    uint8_t *lst = read_file_bytes(lstfile, &lst_size);
+
+    if (result != 0) {
+        FAIL("writing to descriptors failed");
+    } else if (!still_open) {
+        FAIL("caller descriptor was closed");
+    } else if (!sym || !lst || sym_size == 0 || lst_size == 0) {
+        FAIL("descriptor outputs empty");
+    } else {
+        PASS();
+    }
+
+    /* Invalid descriptor specs must fail cleanly */
+    TEST("fd_output_invalid");
+    if (assembler_write_symbols(as, "fd:abc") != 0 &&
+        assembler_write_symbols(as, "fd:9999") != 0) {
+        PASS();
+    } else {
+        FAIL("invalid descriptor accepted");
+    }
+
+    free(sym);
+    free(lst);
+    assembler_free(as);
+    unlink(symfile);
+    unlink(lstfile);
+}
+
 /* ========== Main ========== */
 
 int main(void) {
@@ -619,6 +733,10 @@ int main(void) {
     test_symbol_file_output();
     test_listing_file_output();
 
+    printf("\nStreaming I/O:\n");
+    test_stream_input();
+    test_fd_outputs();
+
     printf("\n=====================\n");
     printf("Total: %d passed, %d failed\n", tests_passed, tests_failed);
 
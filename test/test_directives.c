@@ -4,6 +4,7 @@
  */
 
 #include "assembler.h"
+#include "sim6510.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -488,6 +489,110 @@ TEST(binary_with_offset) {
     assembler_free(as);
 }
 
+/* Write 01 02 03 04 05 06 80 81 to /tmp/test_xf.bin; 0 if it cannot be created */
+static int write_transform_file(void) {
+    static const uint8_t data[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x80, 0x81 };
+    FILE *f = fopen("/tmp/test_xf.bin", "wb");
+    if (!f) return 0;
+    fwrite(data, 1, sizeof(data), f);
+    fclose(f);
+    return 1;
+}
+
+TEST(binary_transforms) {
+    static const struct {
+        const char *transform;
+        int size;
+        uint8_t expected[8];
+    } cases[] = {
+        { "reverse", 8, { 0x81, 0x80, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01 } },
+        { "bitreverse", 8, { 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0x01, 0x81 } },
+        { "mirror(2)", 8, { 0x40, 0x80, 0x20, 0xC0, 0x60, 0xA0, 0x81, 0x01 } },
+        { "mirror(4, 2)", 8, { 0x10, 0xC0, 0x80, 0x40, 0x42, 0x02, 0x90, 0x50 } },
+        { "transpose(4, 2)", 8, { 0x01, 0x05, 0x02, 0x06, 0x03, 0x80, 0x04, 0x81 } },
+        { "interleave(2)", 8, { 0x01, 0x05, 0x02, 0x06, 0x03, 0x80, 0x04, 0x81 } },
+        { "deinterleave(2)", 8, { 0x01, 0x03, 0x05, 0x80, 0x02, 0x04, 0x06, 0x81 } },
+        { "delta", 8, { 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x7A, 0x01 } },
+        { "nibblepack", 4, { 0x12, 0x34, 0x56, 0x01 } },
+        { "xor($ff)", 8, { 0xFE, 0xFD, 0xFC, 0xFB, 0xFA, 0xF9, 0x7F, 0x7E } },
+        { "add(-1)", 8, { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x7F, 0x80 } },
+    };
+    if (!write_transform_file()) {
+        printf("[SKIP - cannot create test file]\n");
+        tests_passed++;
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        char source[128];
+        snprintf(source, sizeof(source), "* = $1000\n!binary \"test_xf.bin\", transform=%s",
+                 cases[i].transform);
+        Assembler *as = assembler_create();
+        assembler_add_include_path(as, "/tmp");
+        int errors = assembler_assemble_string(as, source, "test.asm");
+        ASSERT_EQ(errors, 0);
+
+        uint16_t start;
+        int size;
+        const uint8_t *output = assembler_get_output(as, &start, &size);
+        ASSERT_EQ(size, cases[i].size);
+        ASSERT(memcmp(output, cases[i].expected, size) == 0);
+        assembler_free(as);
+    }
+}
+
+TEST(binary_transform_chain) {
+    if (!write_transform_file()) {
+        printf("[SKIP - cannot create test file]\n");
+        tests_passed++;
+        return;
+    }
+    Assembler *as = assembler_create();
+    assembler_add_include_path(as, "/tmp");
+
+    /* Bytes 2-5, then lo/hi split and inverted; the label after sees the length */
+    const char *source =
+        "* = $1000\n"
+        "width = 2\n"
+        "!binary \"test_xf.bin\", 4, 2, transform=deinterleave(width) | xor($ff)\n"
+        "end !byte <end\n";
+    int errors = assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(errors, 0);
+
+    uint16_t start;
+    int size;
+    const uint8_t *output = assembler_get_output(as, &start, &size);
+    ASSERT_EQ(size, 5);
+    ASSERT_EQ(output[0], 0xFC);
+    ASSERT_EQ(output[1], 0xFA);
+    ASSERT_EQ(output[2], 0xFB);
+    ASSERT_EQ(output[3], 0xF9);
+    ASSERT_EQ(output[4], 0x04);
+
+    assembler_free(as);
+}
+
+TEST(binary_transform_errors) {
+    if (!write_transform_file()) {
+        printf("[SKIP - cannot create test file]\n");
+        tests_passed++;
+        return;
+    }
+    Assembler *as = assembler_create();
+    assembler_add_include_path(as, "/tmp");
+    const char *source =
+        "* = $1000\n"
+        "!binary \"test_xf.bin\", transform=scramble\n"
+        "!binary \"test_xf.bin\", transform=reverse(1)\n"
+        "!binary \"test_xf.bin\", transform=transpose(3, 2)\n"
+        "!binary \"test_xf.bin\", transform=mirror(2, 3)\n"
+        "!binary \"test_xf.bin\", transform=xor(undefined_value)\n"
+        "!binary \"test_xf.bin\", transform=delta |\n";
+    assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(as->errors, 6);
+    assembler_free(as);
+}
+
 /* ========== BASIC Stub Directive Tests ========== */
 
 TEST(basic_default) {
@@ -608,6 +713,559 @@ TEST(basic_sys_address_digits) {
     assembler_free(as);
 }
 
+/* ========== Struct-of-Arrays Tests ========== */
+
+static int symbol_value(Assembler *as, const char *name) {
+    Symbol *sym = symbol_lookup(as->symbols, name);
+    return sym ? sym->value : -1;
+}
+
+TEST(soa_defines_tables) {
+    Assembler *as = assembler_create();
+    const char *source =
+        "* = $1000\n"
+        "!soa actors, count=32 { x, y:1, ptr:2 }\n"
+        "after nop\n";
+    int errors = assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(errors, 0);
+    ASSERT_EQ(symbol_value(as, "actors_x"), 0x1000);
+    ASSERT_EQ(symbol_value(as, "actors_y"), 0x1020);
+    ASSERT_EQ(symbol_value(as, "actors_ptr_lo"), 0x1040);
+    ASSERT_EQ(symbol_value(as, "actors_ptr_hi"), 0x1060);
+    ASSERT_EQ(symbol_value(as, "after"), 0x1080);
+    assembler_free(as);
+}
+
+TEST(soa_tables_avoid_page_crossing) {
+    Assembler *as = assembler_create();
+    const char *source =
+        "* = $10f0\n"
+        "    lda objs_b_2,x\n"
+        "!soa objs, count=100 { a, b:3 }\n";
+    int errors = assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(errors, 0);
+    ASSERT_EQ(symbol_value(as, "objs_a"), 0x1100);
+    ASSERT_EQ(symbol_value(as, "objs_b_0"), 0x1164);
+    ASSERT_EQ(symbol_value(as, "objs_b_1"), 0x1200);
+    ASSERT_EQ(symbol_value(as, "objs_b_2"), 0x1264);
+    ASSERT_EQ(as->memory[0x10F1], 0x64);
+
+    SoaLayout layout;
+    ASSERT_EQ(assembler_soa_layout(as, as->lines[2].stmt, 0x10F3, &layout), 0);
+    ASSERT_EQ(layout.tables, 4);
+    ASSERT_EQ(layout.waste, 13 + 56);
+    ASSERT_EQ(layout.end, 0x12C8);
+    assembler_free(as);
+}
+
+TEST(soa_errors) {
+    Assembler *as = assembler_create();
+    const char *source =
+        "* = $1000\n"
+        "!soa a, count=32\n"
+        "!soa b { x }\n"
+        "!soa c, count=300 { x }\n"
+        "!soa d, count=8, align=2 { x }\n"
+        "!soa e, count=8 { x:5 }\n";
+    assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(as->errors, 5);
+    assembler_free(as);
+}
+
+/* ========== String Pool Tests ========== */
+
+TEST(strpool_shares_strings) {
+    Assembler *as = assembler_create();
+    const char *source =
+        "* = $1000\n"
+        "pool !strpool\n"
+        "a    !null \"PRESS FIRE\"\n"
+        "b    !null \"FIRE\"\n"
+        "c    !text \"ESS\"\n"
+        "d    !null \"PRESS FIRE\"\n"
+        "e    !scr \"ab\"\n"
+        "     !strpool_end\n"
+        "     !word a, b, c, d, e\n";
+    int errors = assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(errors, 0);
+
+    /* "PRESS FIRE",0 once; the rest point into it, then screen codes 1, 2 */
+    uint8_t expected[] = { 'P', 'R', 'E', 'S', 'S', ' ', 'F', 'I', 'R', 'E', 0, 1, 2,
+                           0x00, 0x10, 0x06, 0x10, 0x02, 0x10, 0x00, 0x10, 0x0B, 0x10 };
+    uint16_t start;
+    int size;
+    const uint8_t *output = assembler_get_output(as, &start, &size);
+    ASSERT_EQ(start, 0x1000);
+    ASSERT_EQ(size, (int)sizeof(expected));
+    ASSERT(memcmp(output, expected, sizeof(expected)) == 0);
+
+    ASSERT_EQ(as->strpools->input_size, 11 + 5 + 3 + 11 + 2);
+    ASSERT_EQ(as->strpools->pool.size, 13);
+    ASSERT_EQ(as->strpools->pool.distinct, 4);
+    ASSERT_EQ(as->strpools->pool.shared, 2);
+    assembler_free(as);
+}
+
+/* Run a compressed pool's decoder on the string at address; the output
+ * routine of the test program appends to buffer */
+static int run_decoder(Assembler *as, uint16_t address, char *decoded, int capacity) {
+    uint8_t *memory = calloc(65536, 1);
+    if (!memory) return -1;
+    memcpy(memory, as->memory, 65536);
+
+    Sim6510 cpu;
+    sim6510_init(&cpu, memory, (uint16_t)symbol_value(as, "text_decode"));
+    cpu.a = (uint8_t)(address & 0xFF);
+    cpu.x = (uint8_t)(address >> 8);
+    /* RTS from the decoder lands on $FFF0 */
+    memory[0x1FF] = 0xFF;
+    memory[0x1FE] = 0xEF;
+    cpu.sp = 0xFD;
+
+    int steps = 0;
+    while (cpu.pc != 0xFFF0) {
+        SimStep step;
+        if (++steps > 100000 || sim6510_step(&cpu, &step) < 0) {
+            free(memory);
+            return -1;
+        }
+    }
+    int length = memory[symbol_value(as, "count")];
+    if (length >= capacity) length = capacity - 1;
+    memcpy(decoded, memory + symbol_value(as, "buffer"), (size_t)length);
+    decoded[length] = '\0';
+    free(memory);
+    return 0;
+}
+
+TEST(strpool_compressed_decodes) {
+    static const char *const names[] = { "m1", "m2", "m3", "m4", "m5" };
+    static const char *const texts[] = {
+        "THE QUICK BROWN FOX", "THE LAZY DOG", "THE QUICK DOG",
+        "THE THE THE", "DOG"
+    };
+    Assembler *as = assembler_create();
+    const char *source =
+        "* = $1000\n"
+        "text !strpool compress=1, output=store, zp=$f0\n"
+        "m1   !null \"THE QUICK BROWN FOX\"\n"
+        "m2   !null \"THE LAZY DOG\"\n"
+        "m3   !null \"THE QUICK DOG\"\n"
+        "m4   !text \"THE THE THE\"\n"
+        "m5   !null \"DOG\"\n"
+        "     !strpool_end\n"
+        "store ldx count\n"
+        "     sta buffer,x\n"
+        "     inc count\n"
+        "     rts\n"
+        "count !byte 0\n"
+        "buffer !fill 64\n";
+    int errors = assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(errors, 0);
+    ASSERT_EQ(symbol_value(as, "text_decode"), 0x1000);
+    ASSERT(as->strpools->pool.words > 0);
+    ASSERT(as->strpools->pool.size - STRPOOL_DECODER_SIZE < as->strpools->input_size);
+
+    for (int i = 0; i < 5; i++) {
+        char decoded[64];
+        ASSERT(run_decoder(as, (uint16_t)symbol_value(as, names[i]), decoded, sizeof(decoded)) == 0);
+        ASSERT(strcmp(decoded, texts[i]) == 0);
+    }
+    assembler_free(as);
+}
+
+TEST(strpool_incremental_matches) {
+    const char *source =
+        "* = $1000\n"
+        "     lda #<b\n"
+        "     ldx #>b\n"
+        "pool !strpool\n"
+        "a    !pet \"game over\"\n"
+        "b    !pet \"over\"\n"
+        "     !strpool_end\n"
+        "     !word a, b\n";
+    Assembler *plain = assembler_create();
+    Assembler *incremental = assembler_create();
+    incremental->incremental = 1;
+    ASSERT_EQ(assembler_assemble_string(plain, source, "test.asm"), 0);
+    ASSERT_EQ(assembler_assemble_string(incremental, source, "test.asm"), 0);
+
+    uint16_t start1, start2;
+    int size1, size2;
+    const uint8_t *out1 = assembler_get_output(plain, &start1, &size1);
+    const uint8_t *out2 = assembler_get_output(incremental, &start2, &size2);
+    ASSERT_EQ(size1, 4 + 9 + 4);
+    ASSERT_EQ(size2, size1);
+    ASSERT(memcmp(out1, out2, (size_t)size1) == 0);
+    ASSERT_EQ(symbol_value(plain, "b"), 0x1004 + 5);
+    assembler_free(plain);
+    assembler_free(incremental);
+}
+
+TEST(strpool_errors) {
+    Assembler *as = assembler_create();
+    const char *source =
+        "* = $1000\n"
+        "!strpool_end\n"
+        "!strpool level=2\n"
+        "!strpool zp=$f0\n"
+        "!strpool compress=1\n"
+        "  !strpool\n"
+        "  nop\n"
+        "x !scr \"a@b\"\n"
+        "+ !null \"ANON\"\n"
+        "!strpool_end\n"
+        "!strpool\n";
+    assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(as->errors, 8);
+    assembler_free(as);
+}
+
+/* ========== Read-Only Data Tests ========== */
+
+TEST(rodata_packs_blocks) {
+    Assembler *as = assembler_create();
+    const char *source =
+        "* = $1000\n"
+        "       lda sine2,x\n"
+        "tables !rodata\n"
+        "sine1  !byte 1,2,3,4,5,6\n"
+        "sine2  !byte 4,5,6,7,8\n"
+        "copy   !byte 1,2,3,4,5,6\n"
+        "inner  !byte 3,4\n"
+        "masks\n"
+        "       !byte 1,2,4,8\n"
+        ".high  !byte 16,32\n"
+        "end    !rodata_end\n";
+    int errors = assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(errors, 0);
+
+    /* sine2 overlaps the end of sine1; copy and inner point into it */
+    uint8_t expected[] = { 0xBD, 0x06, 0x10,
+                           1, 2, 3, 4, 5, 6, 7, 8, 1, 2, 4, 8, 16, 32 };
+    uint16_t start;
+    int size;
+    const uint8_t *output = assembler_get_output(as, &start, &size);
+    ASSERT_EQ(start, 0x1000);
+    ASSERT_EQ(size, (int)sizeof(expected));
+    ASSERT(memcmp(output, expected, sizeof(expected)) == 0);
+
+    ASSERT_EQ(symbol_value(as, "sine1"), 0x1003);
+    ASSERT_EQ(symbol_value(as, "copy"), 0x1003);
+    ASSERT_EQ(symbol_value(as, "inner"), 0x1005);
+    ASSERT_EQ(symbol_value(as, "masks"), 0x100B);
+    ASSERT_EQ(symbol_value(as, "masks.high"), 0x100F);
+    ASSERT_EQ(symbol_value(as, "end"), 0x1011);
+    ASSERT_EQ(as->rodata->input_size, 6 + 5 + 6 + 2 + 6);
+    ASSERT_EQ(as->rodata->pack.distinct, 4);
+    ASSERT_EQ(as->rodata->pack.inside, 1);
+    ASSERT_EQ(as->rodata->pack.overlapped, 3);
+    assembler_free(as);
+}
+
+TEST(rodata_alignment_gap_is_filled) {
+    Assembler *as = assembler_create();
+    const char *source =
+        "* = $1001\n"
+        "!rodata\n"
+        "a  !byte 9,9,9\n"
+        "   !align 8\n"
+        "b  !byte 1,2,3,4\n"
+        "c  !byte 7\n"
+        "!rodata_end\n";
+    int errors = assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(errors, 0);
+
+    /* a and c go before b, which needs $1008; the rest is padding */
+    uint8_t expected[] = { 9, 9, 9, 7, 0, 0, 0, 1, 2, 3, 4 };
+    uint16_t start;
+    int size;
+    const uint8_t *output = assembler_get_output(as, &start, &size);
+    ASSERT_EQ(size, (int)sizeof(expected));
+    ASSERT(memcmp(output, expected, sizeof(expected)) == 0);
+    ASSERT_EQ(symbol_value(as, "b"), 0x1008);
+    ASSERT_EQ(symbol_value(as, "c"), 0x1004);
+    ASSERT_EQ(as->rodata->pack.padding, 3);
+    assembler_free(as);
+}
+
+TEST(rodata_incremental_matches) {
+    const char *source =
+        "* = $1000\n"
+        "     lda rows+1,x\n"
+        "     !rodata\n"
+        "rows !word $0400, $0428, $0450\n"
+        "lo   !byte >$0428, <$0450\n"
+        "     !rodata_end\n";
+    Assembler *plain = assembler_create();
+    Assembler *incremental = assembler_create();
+    incremental->incremental = 1;
+    ASSERT_EQ(assembler_assemble_string(plain, source, "test.asm"), 0);
+    ASSERT_EQ(assembler_assemble_string(incremental, source, "test.asm"), 0);
+
+    uint16_t start1, start2;
+    int size1, size2;
+    const uint8_t *out1 = assembler_get_output(plain, &start1, &size1);
+    const uint8_t *out2 = assembler_get_output(incremental, &start2, &size2);
+    ASSERT_EQ(size1, 3 + 6);
+    ASSERT_EQ(size2, size1);
+    ASSERT(memcmp(out1, out2, (size_t)size1) == 0);
+    ASSERT_EQ(symbol_value(plain, "lo"), 0x1006);
+    assembler_free(plain);
+    assembler_free(incremental);
+}
+
+TEST(rodata_errors) {
+    Assembler *as = assembler_create();
+    const char *source =
+        "* = $1000\n"
+        "!rodata_end\n"
+        "!rodata 5\n"
+        "!rodata\n"
+        "  nop\n"
+        "+ !byte 1\n"
+        "x !byte 1\n"
+        "y !word x\n"
+        "  !byte later\n"
+        "  !align 3\n"
+        "!rodata_end\n"
+        "later = 1\n"
+        "!rodata\n";
+    assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(as->errors, 8);
+    assembler_free(as);
+}
+
+/* ========== Function Tests ========== */
+
+TEST(func_directive) {
+    const char *source =
+        "* = $1000\n"
+        "!func scr(col, row) = $0400 + row * 40 + col\n"
+        "!func fib(n) = if(n < 2, n, fib(n - 1) + fib(n - 2))\n"
+        "     lda scr(10, 3)\n"
+        "     !byte fib(10), later(4)\n"
+        "!func later(a) = a * 2\n";
+    uint8_t expected[] = { 0xAD, 0x82, 0x04, 55, 8 };
+    ASSERT(assemble_and_check(source, expected, sizeof(expected)));
+
+    Assembler *plain = assembler_create();
+    Assembler *incremental = assembler_create();
+    incremental->incremental = 1;
+    ASSERT_EQ(assembler_assemble_string(plain, source, "test.asm"), 0);
+    ASSERT_EQ(assembler_assemble_string(incremental, source, "test.asm"), 0);
+    uint16_t start1, start2;
+    int size1, size2;
+    const uint8_t *out1 = assembler_get_output(plain, &start1, &size1);
+    const uint8_t *out2 = assembler_get_output(incremental, &start2, &size2);
+    ASSERT_EQ(size2, size1);
+    ASSERT(memcmp(out1, out2, (size_t)size1) == 0);
+    assembler_free(plain);
+    assembler_free(incremental);
+}
+
+TEST(func_errors) {
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as,
+        "!func twice(a, a) = a\n"
+        "!func broken(x = 3\n"
+        "!func f(x) = x\n"
+        "!func f(y) = y\n", "test.asm");
+    ASSERT_EQ(as->errors, 3);
+    assembler_free(as);
+
+    as = assembler_create();
+    assembler_assemble_string(as,
+        "* = $1000\n"
+        "!func deep(n) = if(n = 0, 0, deep(n - 1) + 1)\n"
+        "  lda deep(1000)\n"
+        "  lda deep(1, 2)\n"
+        "  !byte missing(1)\n", "test.asm");
+    ASSERT_EQ(as->errors, 3);
+    assembler_free(as);
+}
+
+/* ========== List Tests ========== */
+
+TEST(let_lists) {
+    const char *source =
+        "* = $1000\n"
+        "!let rows = [$0400 + r * 40 for r, 0, 2]\n"
+        "!let small = [1, 2]\n"
+        "     lda rows[1]\n"
+        "     ldx #len(rows)\n"
+        "     !byte <rows, >rows\n"
+        "     !word small\n";
+    uint8_t expected[] = { 0xAD, 0x28, 0x04, 0xA2, 0x03,
+                           0x00, 0x28, 0x50, 0x04, 0x04, 0x04,
+                           0x01, 0x00, 0x02, 0x00 };
+    ASSERT(assemble_and_check(source, expected, sizeof(expected)));
+
+    Assembler *plain = assembler_create();
+    Assembler *incremental = assembler_create();
+    incremental->incremental = 1;
+    ASSERT_EQ(assembler_assemble_string(plain, source, "test.asm"), 0);
+    ASSERT_EQ(assembler_assemble_string(incremental, source, "test.asm"), 0);
+    uint16_t start1, start2;
+    int size1, size2;
+    const uint8_t *out1 = assembler_get_output(plain, &start1, &size1);
+    const uint8_t *out2 = assembler_get_output(incremental, &start2, &size2);
+    ASSERT_EQ(size2, size1);
+    ASSERT(memcmp(out1, out2, (size_t)size1) == 0);
+    /* Lists are not symbols */
+    ASSERT_EQ(symbol_count(plain->symbols), 0);
+    assembler_free(plain);
+    assembler_free(incremental);
+}
+
+TEST(let_errors) {
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as,
+        "x = 1\n"
+        "!let x = [1]\n"
+        "!let a = [1, 2\n"
+        "!let c = [fwd]\n"
+        "!let d = [1]\n"
+        "!let d = [2]\n"
+        "fwd = 2\n", "test.asm");
+    ASSERT_EQ(as->errors, 4);
+    assembler_free(as);
+
+    as = assembler_create();
+    assembler_assemble_string(as,
+        "* = $1000\n"
+        "!let a = [1, 2]\n"
+        "  lda a[2]\n"
+        "  lda nolist[0]\n"
+        "  !byte later\n"
+        "!let later = [1]\n", "test.asm");
+    ASSERT_EQ(as->errors, 3);
+    assembler_free(as);
+}
+
+/* ========== Assembly-Time Run Tests ========== */
+
+/* Fills $C000-$C0FF with the low bytes of the squares 0..255 */
+static const char *run_source =
+    "* = $1000\n"
+    "        jmp done\n"
+    "gen     ldx #0\n"
+    "        stx $fb\n"
+    "        stx $fc\n"
+    "-       lda $fb\n"
+    "        sta $c000,x\n"
+    "        txa\n"
+    "        asl\n"
+    "        sec\n"
+    "        adc $fb\n"
+    "        sta $fb\n"
+    "        inx\n"
+    "        bne -\n"
+    "        rts\n"
+    "squares\n"
+    "!run gen, until=done, capture=$c000..$c0ff\n"
+    "done    rts\n";
+
+TEST(run_captures_memory) {
+    Assembler *as = assembler_create();
+    ASSERT_EQ(assembler_assemble_string(as, run_source, "test.asm"), 0);
+    ASSERT_EQ(as->runs, 1);
+    uint16_t start;
+    int size;
+    const uint8_t *out = assembler_get_output(as, &start, &size);
+    int squares = symbol_value(as, "squares") - start;
+    ASSERT_EQ(symbol_value(as, "done") - start, squares + 256);
+    for (int i = 0; i < 256; i++) {
+        ASSERT_EQ(out[squares + i], (uint8_t)(i * i));
+    }
+    /* The listing shows the captured bytes */
+    int run_line = 0;
+    while (run_line < as->line_count && !as->lines[run_line].run) run_line++;
+    ASSERT(run_line < as->line_count);
+    ASSERT_EQ(as->lines[run_line].bytes[3], 9);
+
+    /* Assembling again reuses the capture */
+    ASSERT_EQ(assembler_assemble_string(as, run_source, "test.asm"), 0);
+    ASSERT_EQ(as->runs, 1);
+    ASSERT_EQ(as->run_cache_hits, 1);
+    assembler_free(as);
+
+    /* A cycle budget stops a run that never returns; the INC that
+     * crosses it still completes */
+    as = assembler_create();
+    ASSERT_EQ(assembler_assemble_string(as,
+        "* = $1000\n"
+        "loop inc $c000\n"
+        "     jmp loop\n"
+        "!run loop, cycles=1000, capture=$c000..$c000\n", "test.asm"), 0);
+    out = assembler_get_output(as, &start, &size);
+    ASSERT_EQ(out[size - 1], 1000 / 9 + 1);
+    assembler_free(as);
+}
+
+TEST(run_parallel_and_cache) {
+    Assembler *serial = assembler_create();
+    Assembler *parallel = assembler_create();
+    assembler_set_threads(parallel, 4);
+    parallel->incremental = 1;
+    ASSERT_EQ(assembler_assemble_string(serial, run_source, "test.asm"), 0);
+    ASSERT_EQ(assembler_assemble_string(parallel, run_source, "test.asm"), 0);
+    uint16_t start1, start2;
+    int size1, size2;
+    const uint8_t *out1 = assembler_get_output(serial, &start1, &size1);
+    const uint8_t *out2 = assembler_get_output(parallel, &start2, &size2);
+    ASSERT_EQ(size2, size1);
+    ASSERT(memcmp(out1, out2, (size_t)size1) == 0);
+    assembler_free(serial);
+    assembler_free(parallel);
+
+    /* A second build reads the capture from the cache directory */
+    for (int build = 0; build < 2; build++) {
+        Assembler *as = assembler_create();
+        assembler_set_run_cache(as, "/tmp/test_run_cache");
+        ASSERT_EQ(assembler_assemble_string(as, run_source, "test.asm"), 0);
+        if (build == 1) {
+            ASSERT_EQ(as->runs, 0);
+            ASSERT_EQ(as->run_cache_hits, 1);
+        }
+        assembler_free(as);
+    }
+}
+
+TEST(run_errors) {
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as,
+        "* = $1000\n"
+        "!run $1000, until=1\n"
+        "!run $1000, until=1, capture=$c001..$c000\n"
+        "!run $1000, until=1, capture=later..$c000\n"
+        "!run $1000, until=1, capture=1..2..3\n"
+        "!run until=1, capture=1..2\n"
+        "!run $1000, to=1, capture=1..2\n"
+        "later\n", "test.asm");
+    ASSERT_EQ(as->errors, 6);
+    assembler_free(as);
+
+    as = assembler_create();
+    assembler_assemble_string(as,
+        "* = $1000\n"
+        "!run $1000, capture=$c000..$c001\n"
+        "!run $1000, until=1, cycles=2, capture=$c000..$c001\n"
+        "!run $1000, cycles=0, capture=$c000..$c001\n"
+        "!run nowhere, cycles=5, capture=$c000..$c001\n", "test.asm");
+    ASSERT_EQ(as->errors, 4);
+    assembler_free(as);
+
+    /* Runs that never reach until= or hit a JAM opcode */
+    as = assembler_create();
+    assembler_assemble_string(as,
+        "* = $1000\n"
+        "     !byte $02\n"
+        "!run $1000, cycles=5, capture=$c000..$c001\n", "test.asm");
+    ASSERT_EQ(as->errors, 1);
+    assembler_free(as);
+}
+
 /* ========== Error Cases ========== */
 
 TEST(pet_missing_string) {
@@ -692,6 +1350,9 @@ int main(void) {
     printf("\nBinary Include Tests:\n");
     RUN_TEST(binary_basic);
     RUN_TEST(binary_with_offset);
+    RUN_TEST(binary_transforms);
+    RUN_TEST(binary_transform_chain);
+    RUN_TEST(binary_transform_errors);
 
     printf("\nBASIC Stub Directive Tests:\n");
     RUN_TEST(basic_default);
@@ -699,6 +1360,36 @@ int main(void) {
     RUN_TEST(basic_custom_address);
     RUN_TEST(basic_sys_address_digits);
 
+    printf("\nStruct-of-Arrays Tests:\n");
+    RUN_TEST(soa_defines_tables);
+    RUN_TEST(soa_tables_avoid_page_crossing);
+    RUN_TEST(soa_errors);
+
+    printf("\nString Pool Tests:\n");
+    RUN_TEST(strpool_shares_strings);
+    RUN_TEST(strpool_compressed_decodes);
+    RUN_TEST(strpool_incremental_matches);
+    RUN_TEST(strpool_errors);
+
+    printf("\nRead-Only Data Tests:\n");
+    RUN_TEST(rodata_packs_blocks);
+    RUN_TEST(rodata_alignment_gap_is_filled);
+    RUN_TEST(rodata_incremental_matches);
+    RUN_TEST(rodata_errors);
+
+    printf("\nFunction Tests:\n");
+    RUN_TEST(func_directive);
+    RUN_TEST(func_errors);
+
+    printf("\nList Tests:\n");
+    RUN_TEST(let_lists);
+    RUN_TEST(let_errors);
+
+    printf("\nAssembly-Time Run Tests:\n");
+    RUN_TEST(run_captures_memory);
+    RUN_TEST(run_parallel_and_cache);
+    RUN_TEST(run_errors);
+
     printf("\nError Case Tests:\n");
     RUN_TEST(pet_missing_string);
     RUN_TEST(skip_negative);
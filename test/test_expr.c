@@ -32,7 +32,7 @@ static ExprResult parse_eval(const char *text, SymbolTable *symbols, uint16_t pc
     lexer_init(&lexer, text, "test");
     expr_parser_init(&parser, &lexer);
     Expr *expr = expr_parse(&parser);
-    ExprResult result = { 0, 0, 0 };
+    ExprResult result = { 0, 0, 0, NULL, NULL };
     if (expr) {
         result = expr_eval(expr, symbols, NULL, pc, 2, NULL);
         expr_free(expr);
@@ -422,6 +422,169 @@ TEST(hex_arithmetic) {
     return eval("$D020 + 1") == 0xD021;
 }
 
+/* ========== User Function Tests ========== */
+
+/* Parse body and define name(params) = body in table's functions */
+static int define_func(SymbolTable *table, const char *name,
+                       const char *const *params, int count, const char *body) {
+    Lexer lexer;
+    ExprParser parser;
+    lexer_init(&lexer, body, "test");
+    expr_parser_init(&parser, &lexer);
+    Expr *expr = expr_parse(&parser);
+    const char *error = NULL;
+    int result = expr ? expr_function_define(table->functions, name, params, count,
+                                             expr, &error) : -1;
+    expr_free(expr);
+    return result;
+}
+
+static SymbolTable *function_table(void) {
+    SymbolTable *table = symbol_table_create(127);
+    table->functions = expr_functions_create();
+    return table;
+}
+
+static void free_function_table(SymbolTable *table) {
+    expr_functions_free(table->functions);
+    symbol_table_free(table);
+}
+
+TEST(func_call) {
+    SymbolTable *table = function_table();
+    const char *params[] = { "col", "row" };
+    int ok = define_func(table, "scr", params, 2, "$0400 + row * 40 + col") == 0 &&
+             eval_sym("scr(10, 3) + 1", table) == 0x0400 + 3 * 40 + 10 + 1;
+    free_function_table(table);
+    return ok;
+}
+
+TEST(func_reads_symbols_at_call) {
+    SymbolTable *table = function_table();
+    const char *params[] = { "x" };
+    int ok = define_func(table, "off", params, 1, "x + base") == 0 &&
+             !expr_function_is_pure(table->functions, "off");
+    symbol_define(table, "base", 0x20, SYM_NONE, "test", 1);
+    ok = ok && eval_sym("off(5)", table) == 0x25;
+    free_function_table(table);
+    return ok;
+}
+
+TEST(func_if_builtin) {
+    return eval("if(1, 2, 3)") == 2 && eval("if(0, 2, 3)") == 3;
+}
+
+TEST(func_recursion_memo) {
+    SymbolTable *table = function_table();
+    const char *params[] = { "n" };
+    int ok = define_func(table, "fib", params, 1,
+                         "if(n < 2, n, fib(n - 1) + fib(n - 2))") == 0 &&
+             expr_function_is_pure(table->functions, "fib");
+    /* Pass 1 remembers the results the pass 2 call below reuses */
+    Lexer lexer;
+    ExprParser parser;
+    lexer_init(&lexer, "fib(24)", "test");
+    expr_parser_init(&parser, &lexer);
+    Expr *expr = expr_parse(&parser);
+    ExprResult r = expr_eval(expr, table, NULL, 0, 1, NULL);
+    expr_free(expr);
+    ok = ok && r.defined && r.value == 46368 &&
+         expr_function_memo_count(table->functions) == 25 &&
+         eval_sym("fib(20)", table) == 6765;
+    free_function_table(table);
+    return ok;
+}
+
+TEST(func_errors) {
+    SymbolTable *table = function_table();
+    const char *params[] = { "n", "n" };
+    int ok = define_func(table, "deep", params, 1, "if(n = 0, 0, deep(n - 1) + 1)") == 0 &&
+             define_func(table, "deep", params, 1, "n") < 0 &&
+             define_func(table, "twice", params, 2, "n") < 0 &&
+             define_func(table, "if", params, 1, "n") < 0;
+    ExprResult r = parse_eval("deep(1000)", table, 0);
+    ok = ok && !r.defined && r.error && strcmp(r.function, "deep") == 0;
+    r = parse_eval("deep(1, 2)", table, 0);
+    ok = ok && !r.defined && r.error;
+    r = parse_eval("missing(1)", table, 0);
+    ok = ok && !r.defined && r.error;
+    free_function_table(table);
+    return ok;
+}
+
+/* ========== List Tests ========== */
+
+/* Parse and evaluate list text into a new list name in table */
+static int define_list(SymbolTable *table, const char *name, const char *text) {
+    Lexer lexer;
+    ExprParser parser;
+    lexer_init(&lexer, text, "test");
+    expr_parser_init(&parser, &lexer);
+    Expr *list = expr_parse_list(&parser);
+    int32_t *values = NULL;
+    int count = 0;
+    ExprResult failed;
+    const char *error = NULL;
+    int result = -1;
+    if (list && expr_list_eval(list, table, NULL, 0, 1, NULL, &values, &count, &failed) == 0) {
+        result = expr_list_define(table->lists, name, values, count, 0, &error);
+    }
+    free(values);
+    expr_free(list);
+    return result;
+}
+
+static SymbolTable *list_table(void) {
+    SymbolTable *table = function_table();
+    table->lists = expr_lists_create();
+    return table;
+}
+
+static void free_list_table(SymbolTable *table) {
+    expr_lists_free(table->lists);
+    free_function_table(table);
+}
+
+TEST(list_literal_index) {
+    SymbolTable *table = list_table();
+    symbol_define(table, "BASE", 0x1000, SYM_NONE, "test", 1);
+    int ok = define_list(table, "t", "[1, BASE, -5]") == 0 &&
+             eval_sym("t[0] + t[1]", table) == 0x1001 &&
+             eval_sym("t[-1]", table) == -5 &&
+             eval_sym("len(t)", table) == 3;
+    ExprResult r = parse_eval("t[3]", table, 0);
+    ok = ok && !r.defined && r.error;
+    free_list_table(table);
+    return ok;
+}
+
+TEST(list_comprehension) {
+    SymbolTable *table = list_table();
+    const char *params[] = { "n" };
+    int ok = define_func(table, "sq", params, 1, "n * n") == 0 &&
+             define_list(table, "rows", "[$0400 + r * 40 for r, 0, 24]") == 0 &&
+             define_list(table, "down", "[sq(i) for i, 3, 1]") == 0 &&
+             eval_sym("rows[24]", table) == 0x07C0 &&
+             eval_sym("len(rows)", table) == 25 &&
+             eval_sym("down[0] * 100 + down[2]", table) == 901;
+    free_list_table(table);
+    return ok;
+}
+
+TEST(list_packed) {
+    SymbolTable *table = list_table();
+    /* 1, 2 and 4 bytes per element */
+    int ok = define_list(table, "b", "[i for i, 0, 255]") == 0 &&
+             define_list(table, "w", "[i * 256 for i, 0, 255]") == 0 &&
+             define_list(table, "l", "[-1, 2]") == 0 &&
+             expr_list_bytes(table->lists) == 256 + 512 + 8 &&
+             eval_sym("w[255]", table) == 0xFF00 && eval_sym("l[0]", table) == -1 &&
+             define_list(table, "b", "[1]") < 0 &&
+             define_list(table, "copy", "w") == 0 && eval_sym("copy[1]", table) == 256;
+    free_list_table(table);
+    return ok;
+}
+
 /* ========== Main ========== */
 
 int main(void) {
@@ -522,6 +685,18 @@ int main(void) {
     RUN_TEST(negative_result);
     RUN_TEST(hex_arithmetic);
 
+    printf("\nUser Functions:\n");
+    RUN_TEST(func_call);
+    RUN_TEST(func_reads_symbols_at_call);
+    RUN_TEST(func_if_builtin);
+    RUN_TEST(func_recursion_memo);
+    RUN_TEST(func_errors);
+
+    printf("\nLists:\n");
+    RUN_TEST(list_literal_index);
+    RUN_TEST(list_comprehension);
+    RUN_TEST(list_packed);
+
     printf("\n==========================\n");
     printf("Results: %d/%d passed\n\n", tests_passed, tests_run);
 
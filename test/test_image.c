@@ -0,0 +1,773 @@
+/* Test suite for !image PNG import, C64 conversion and !charmap */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include "../include/assembler.h"
+#include "../include/opcodes.h"
+#include "../include/image.h"
+#include "../include/charmap.h"
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name) static int test_##name(void)
+#define RUN_TEST(name) do { \
+    tests_run++; \
+    printf("  %-40s ", #name); \
+    if (test_##name()) { \
+        printf("\033[0;32mPASS\033[0m\n"); \
+        tests_passed++; \
+    } else { \
+        printf("\033[0;31mFAIL\033[0m\n"); \
+    } \
+} while(0)
+
+/* 8x8 gray ramp (y*32 + x*4), rows using filters none, sub, up, average
+ * and paeth in turn; zlib level 9 chose a fixed-Huffman block */
+static const uint8_t fixed_idat[] = {
+    0x78, 0xDA, 0x63, 0x60, 0x60, 0xE1, 0xE0, 0x11, 0x10, 0x91, 0x90, 0x61,
+    0x54, 0x60, 0x81, 0x00, 0x26, 0x05, 0x28, 0x60, 0x76, 0x10, 0x82, 0x00,
+    0x16, 0x98, 0x14, 0xC3, 0x82, 0x25, 0x2B, 0xD6, 0x6C, 0xD8, 0xB2, 0x63,
+    0x0F, 0xE3, 0x01, 0x74, 0xC5, 0x00, 0x11, 0x85, 0x0A, 0x00,
+};
+
+/* 8x8 8-bit palette image of dynamic_pixels in a dynamic-Huffman block */
+static const uint8_t dynamic_idat[] = {
+    0x78, 0xDA, 0x25, 0x8B, 0x41, 0x12, 0x00, 0x40, 0x0C, 0xC1, 0x12, 0xFF,
+    0x7F, 0xF4, 0xB2, 0x75, 0x40, 0xD3, 0x01, 0x0A, 0xA1, 0xB6, 0x20, 0xAD,
+    0x23, 0xC6, 0xB2, 0xF9, 0xA8, 0xF9, 0x67, 0x75, 0xBF, 0x95, 0x85, 0x37,
+    0xAA, 0x1E, 0x06, 0xF0, 0x00, 0x2D,
+};
+
+static const uint8_t dynamic_pixels[] = {
+    0x00, 0x01, 0x01, 0x00, 0x00, 0x02, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02,
+    0x00, 0x00, 0x02, 0x02, 0x01, 0x01, 0x01, 0x00, 0x00, 0x01, 0x02, 0x01,
+    0x01, 0x00, 0x01, 0x02, 0x01, 0x00, 0x00, 0x02, 0x00, 0x01, 0x02, 0x02,
+    0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x02,
+    0x00, 0x00, 0x01, 0x00, 0x01, 0x02, 0x00, 0x01, 0x00, 0x00, 0x02, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+};
+
+/* Black, white, red and cyan as in the C64 palette */
+static const uint8_t test_palette[][3] = {
+    { 0x00, 0x00, 0x00 }, { 0xFF, 0xFF, 0xFF }, { 0x68, 0x37, 0x2B }, { 0x70, 0xA4, 0xB2 }
+};
+
+/* ========== Helpers ========== */
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+} Buffer;
+
+static void put(Buffer *buf, const void *data, size_t size) {
+    buf->data = realloc(buf->data, buf->size + size);
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
+static void put_u32(Buffer *buf, uint32_t value) {
+    uint8_t be[4] = { (uint8_t)(value >> 24), (uint8_t)(value >> 16),
+                      (uint8_t)(value >> 8), (uint8_t)value };
+    put(buf, be, 4);
+}
+
+/* Chunk with a zero CRC; the decoder does not check it */
+static void put_chunk(Buffer *buf, const char *type, const void *data, size_t size) {
+    put_u32(buf, (uint32_t)size);
+    put(buf, type, 4);
+    if (size) put(buf, data, size);
+    put_u32(buf, 0);
+}
+
+/* A PNG around a zlib stream; palette entries are used for color type 3 */
+static Buffer make_png(int width, int height, int depth, int color_type,
+                       const uint8_t *idat, size_t idat_size) {
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+    Buffer png = { NULL, 0 };
+    Buffer ihdr = { NULL, 0 };
+
+    put(&png, signature, sizeof(signature));
+    put_u32(&ihdr, (uint32_t)width);
+    put_u32(&ihdr, (uint32_t)height);
+    uint8_t rest[5] = { (uint8_t)depth, (uint8_t)color_type, 0, 0, 0 };
+    put(&ihdr, rest, sizeof(rest));
+    put_chunk(&png, "IHDR", ihdr.data, ihdr.size);
+    free(ihdr.data);
+    if (color_type == 3) put_chunk(&png, "PLTE", test_palette, sizeof(test_palette));
+    put_chunk(&png, "IDAT", idat, idat_size);
+    put_chunk(&png, "IEND", NULL, 0);
+    return png;
+}
+
+/* Wrap raw scanlines in a zlib stream of stored blocks */
+static Buffer stored_zlib(const uint8_t *raw, size_t size) {
+    Buffer z = { NULL, 0 };
+    uint8_t header[2] = { 0x78, 0x01 };
+    put(&z, header, 2);
+    size_t done = 0;
+    do {
+        size_t n = size - done > 65535 ? 65535 : size - done;
+        uint8_t block[5] = { done + n == size ? 1 : 0, (uint8_t)n, (uint8_t)(n >> 8),
+                             (uint8_t)~n, (uint8_t)(~n >> 8) };
+        put(&z, block, sizeof(block));
+        put(&z, raw + done, n);
+        done += n;
+    } while (done < size);
+    put_u32(&z, 0);
+    return z;
+}
+
+/* PNG of unfiltered rows given as one byte per pixel (palette index, or
+ * a color for RGB images looked up in test_palette) */
+static Buffer png_from_pixels(int width, int height, int color_type, const uint8_t *pixels) {
+    int bpp = color_type == 2 ? 3 : 1;
+    size_t stride = 1 + (size_t)width * bpp;
+    uint8_t *raw = calloc(stride * height, 1);
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = raw + y * stride + 1;
+        for (int x = 0; x < width; x++) {
+            uint8_t p = pixels[y * width + x];
+            if (bpp == 3) {
+                memcpy(row + x * 3, test_palette[p], 3);
+            } else {
+                row[x] = p;
+            }
+        }
+    }
+    Buffer z = stored_zlib(raw, stride * height);
+    Buffer png = make_png(width, height, 8, color_type, z.data, z.size);
+    free(raw);
+    free(z.data);
+    return png;
+}
+
+/* Two sprites: a white frame on black, and solid red */
+static Buffer sprites_png(void) {
+    uint8_t pixels[48 * 21];
+    for (int y = 0; y < 21; y++) {
+        for (int x = 0; x < 48; x++) {
+            int frame = x == 0 || x == 23 || y == 0 || y == 20;
+            pixels[y * 48 + x] = x >= 24 ? 2 : frame ? 1 : 0;
+        }
+    }
+    return png_from_pixels(48, 21, 3, pixels);
+}
+
+static int convert(const Buffer *png, ImageMode mode, int background,
+                   uint8_t **out, int *length) {
+    C64Image image;
+    ImageOptions options = { mode, background };
+    const char *error;
+    int result = image_load(png->data, png->size, &image, &error);
+    if (result == 0) result = image_convert(&image, &options, NULL, out, length, &error);
+    image_free(&image);
+    return result;
+}
+
+static int write_file(const char *path, const Buffer *buf) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    fwrite(buf->data, 1, buf->size, f);
+    fclose(f);
+    return 0;
+}
+
+/* Assemble src with stderr discarded; 0 on success */
+static int assemble_quiet(Assembler *as, const char *src) {
+    fflush(stderr);
+    int saved = dup(2);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, 2);
+    close(null);
+
+    int result = assembler_assemble_string(as, src, "test.asm");
+
+    fflush(stderr);
+    dup2(saved, 2);
+    close(saved);
+    return result;
+}
+
+static void remove_dir(const char *path) {
+    DIR *dir = opendir(path);
+    if (dir) {
+        struct dirent *entry;
+        char file[512];
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+            snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+            unlink(file);
+        }
+        closedir(dir);
+    }
+    rmdir(path);
+}
+
+/* ========== Decoding Tests ========== */
+
+TEST(decode_stored_rgba) {
+    uint8_t raw[] = {
+        0, 0xFF, 0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0x80,
+        0, 0x00, 0x00, 0xFF, 0x10, 0x01, 0x02, 0x03, 0x04
+    };
+    Buffer z = stored_zlib(raw, sizeof(raw));
+    Buffer png = make_png(2, 2, 8, 6, z.data, z.size);
+    int w, h;
+    uint8_t *rgba;
+    const char *error;
+    int ok = image_png_decode(png.data, png.size, &w, &h, &rgba, &error) == 0;
+    if (ok) {
+        ok = w == 2 && h == 2 && memcmp(rgba, raw + 1, 8) == 0 && memcmp(rgba + 8, raw + 10, 8) == 0;
+        free(rgba);
+    }
+    free(z.data);
+    free(png.data);
+    return ok;
+}
+
+TEST(decode_fixed_huffman_and_filters) {
+    Buffer png = make_png(8, 8, 8, 0, fixed_idat, sizeof(fixed_idat));
+    int w, h;
+    uint8_t *rgba = NULL;
+    const char *error;
+    int ok = image_png_decode(png.data, png.size, &w, &h, &rgba, &error) == 0;
+    for (int i = 0; ok && i < 64; i++) {
+        uint8_t gray = (uint8_t)((i / 8) * 32 + (i % 8) * 4);
+        ok = rgba[i * 4] == gray && rgba[i * 4 + 1] == gray && rgba[i * 4 + 2] == gray &&
+             rgba[i * 4 + 3] == 0xFF;
+    }
+    free(rgba);
+    free(png.data);
+    return ok;
+}
+
+TEST(decode_dynamic_huffman_palette) {
+    Buffer png = make_png(8, 8, 8, 3, dynamic_idat, sizeof(dynamic_idat));
+    C64Image image;
+    const char *error;
+    int ok = image_load(png.data, png.size, &image, &error) == 0 &&
+             image.width == 8 && image.height == 8 &&
+             memcmp(image.pixels, dynamic_pixels, 64) == 0;
+    image_free(&image);
+    free(png.data);
+    return ok;
+}
+
+TEST(decode_packed_palette) {
+    /* 4-bit indices: a byte holds two pixels, high nibble first */
+    uint8_t raw[] = { 0, 0x12, 0x30, 0, 0x01, 0x23 };
+    Buffer z = stored_zlib(raw, sizeof(raw));
+    Buffer png = make_png(4, 2, 4, 3, z.data, z.size);
+    static const uint8_t expected[] = { 1, 2, 3, 0, 0, 1, 2, 3 };
+    C64Image image;
+    const char *error;
+    int ok = image_load(png.data, png.size, &image, &error) == 0 &&
+             memcmp(image.pixels, expected, 8) == 0;
+    image_free(&image);
+    free(z.data);
+    free(png.data);
+    return ok;
+}
+
+TEST(decode_rejects_bad_input) {
+    uint8_t raw[] = { 0, 0 };
+    Buffer z = stored_zlib(raw, sizeof(raw));
+    Buffer png = make_png(1, 1, 8, 0, z.data, z.size);
+    int w, h;
+    uint8_t *rgba;
+    const char *error = NULL;
+    int ok = 1;
+
+    /* Not a PNG */
+    ok = ok && image_png_decode((const uint8_t *)"GIF89a..", 8, &w, &h, &rgba, &error) < 0 && error;
+    /* Truncated */
+    ok = ok && image_png_decode(png.data, png.size / 2, &w, &h, &rgba, &error) < 0;
+    /* Interlaced: byte 28 is the IHDR interlace method */
+    png.data[28] = 1;
+    ok = ok && image_png_decode(png.data, png.size, &w, &h, &rgba, &error) < 0;
+    free(z.data);
+    free(png.data);
+    return ok;
+}
+
+TEST(nearest_color) {
+    return image_nearest_color(0, 0, 0) == 0 &&
+           image_nearest_color(0xFF, 0xFF, 0xFF) == 1 &&
+           image_nearest_color(0xF0, 0xF8, 0xFA) == 1 &&
+           image_nearest_color(0x6A, 0x38, 0x2C) == 2 &&
+           image_nearest_color(0x6C, 0x6C, 0x6C) == 12 &&
+           image_nearest_color(0x30, 0x28, 0x80) == 6;
+}
+
+/* ========== Conversion Tests ========== */
+
+TEST(sprites) {
+    Buffer png = sprites_png();
+    uint8_t *out;
+    int length;
+    int ok = convert(&png, IMAGE_SPRITES, 0, &out, &length) == 0 && length == 128;
+    if (ok) {
+        static const uint8_t top[3] = { 0xFF, 0xFF, 0xFF }, side[3] = { 0x80, 0x00, 0x01 };
+        ok = memcmp(out, top, 3) == 0 && memcmp(out + 3, side, 3) == 0 &&
+             memcmp(out + 60, top, 3) == 0 && out[63] == 0;
+        for (int i = 64; ok && i < 127; i++) ok = out[i] == 0xFF;
+        ok = ok && out[127] == 0;
+        free(out);
+    }
+    free(png.data);
+    return ok;
+}
+
+TEST(sprites_default_background) {
+    /* Red covers most pixels, so it becomes the background */
+    Buffer png = sprites_png();
+    uint8_t *out;
+    int length;
+    int ok = convert(&png, IMAGE_SPRITES, -1, &out, &length) == 0;
+    if (ok) {
+        for (int i = 0; ok && i < 63; i++) ok = out[i] == 0xFF;
+        for (int i = 64; ok && i < 128; i++) ok = out[i] == 0;
+        free(out);
+    }
+    free(png.data);
+    return ok;
+}
+
+TEST(charset_transparency) {
+    /* Two characters: a diagonal, and only transparent pixels */
+    uint8_t raw[8 * (1 + 16 * 4)];
+    memset(raw, 0, sizeof(raw));
+    for (int y = 0; y < 8; y++) {
+        uint8_t *px = raw + y * (1 + 16 * 4) + 1 + y * 4;
+        px[0] = px[1] = px[2] = px[3] = 0xFF;
+    }
+    Buffer z = stored_zlib(raw, sizeof(raw));
+    Buffer png = make_png(16, 8, 8, 6, z.data, z.size);
+    uint8_t *out = NULL;
+    int length = 0;
+    int ok = convert(&png, IMAGE_CHARSET, 0, &out, &length) == 0 && length == 16;
+    for (int i = 0; ok && i < 8; i++) ok = out[i] == (0x80 >> i) && out[8 + i] == 0;
+    free(out);
+    free(z.data);
+    free(png.data);
+    return ok;
+}
+
+TEST(hires_cell_colors) {
+    /* Cyan everywhere; the first cell has a white left column */
+    uint8_t *pixels = malloc(320 * 200);
+    memset(pixels, 3, 320 * 200);
+    for (int y = 0; y < 8; y++) pixels[y * 320] = 1;
+    Buffer png = png_from_pixels(320, 200, 2, pixels);
+    uint8_t *out;
+    int length;
+    int ok = convert(&png, IMAGE_HIRES, -1, &out, &length) == 0 && length == IMAGE_HIRES_SIZE;
+    if (ok) {
+        for (int y = 0; ok && y < 8; y++) ok = out[y] == 0x80 && out[8 + y] == 0x00;
+        ok = ok && out[IMAGE_BITMAP_SIZE] == 0x13 && out[IMAGE_BITMAP_SIZE + 1] == 0x03;
+        free(out);
+    }
+    free(pixels);
+    free(png.data);
+    return ok;
+}
+
+TEST(koala_cell_colors) {
+    /* Each row of the first cell is white, red, cyan, black */
+    static const uint8_t row[4] = { 1, 2, 3, 0 };
+    uint8_t *narrow = calloc(160 * 200, 1);
+    uint8_t *wide = calloc(320 * 200, 1);
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 4; x++) {
+            narrow[y * 160 + x] = row[x];
+            wide[y * 320 + x * 2] = wide[y * 320 + x * 2 + 1] = row[x];
+        }
+    }
+    Buffer png_narrow = png_from_pixels(160, 200, 3, narrow);
+    Buffer png_wide = png_from_pixels(320, 200, 2, wide);
+    uint8_t *out, *out_wide;
+    int length, length_wide;
+    int ok = convert(&png_narrow, IMAGE_KOALA, -1, &out, &length) == 0 &&
+             length == IMAGE_KOALA_SIZE;
+    if (ok) {
+        for (int y = 0; ok && y < 8; y++) ok = out[y] == 0x6C;
+        ok = ok && out[IMAGE_BITMAP_SIZE] == 0x12 &&
+             out[IMAGE_BITMAP_SIZE + IMAGE_SCREEN_SIZE] == 0x03 &&
+             out[IMAGE_KOALA_SIZE - 1] == 0x00;
+        if (convert(&png_wide, IMAGE_KOALA, -1, &out_wide, &length_wide) == 0) {
+            ok = ok && length_wide == length && memcmp(out, out_wide, length) == 0;
+            free(out_wide);
+        } else {
+            ok = 0;
+        }
+        free(out);
+    }
+    free(narrow);
+    free(wide);
+    free(png_narrow.data);
+    free(png_wide.data);
+    return ok;
+}
+
+TEST(parallel_conversion_matches) {
+    uint8_t *pixels = malloc(320 * 200);
+    for (int i = 0; i < 320 * 200; i++) pixels[i] = (uint8_t)((i * 7 + i / 320) % 4);
+    Buffer png = png_from_pixels(320, 200, 2, pixels);
+    C64Image image;
+    ImageOptions options = { IMAGE_HIRES, -1 };
+    const char *error;
+    uint8_t *serial, *parallel;
+    int length, length_parallel;
+    ThreadPool *pool = threadpool_create(4);
+    int ok = image_load(png.data, png.size, &image, &error) == 0 &&
+             image_convert(&image, &options, NULL, &serial, &length, &error) == 0;
+    if (ok) {
+        ok = image_convert(&image, &options, pool, &parallel, &length_parallel, &error) == 0 &&
+             length == length_parallel && memcmp(serial, parallel, length) == 0;
+        if (ok) free(parallel);
+        free(serial);
+    }
+    threadpool_free(pool);
+    image_free(&image);
+    free(pixels);
+    free(png.data);
+    return ok;
+}
+
+TEST(output_sizes) {
+    const char *error = NULL;
+    return image_output_size(IMAGE_KOALA, 160, 200, &error) == IMAGE_KOALA_SIZE &&
+           image_output_size(IMAGE_HIRES, 320, 200, &error) == IMAGE_HIRES_SIZE &&
+           image_output_size(IMAGE_SPRITES, 48, 42, &error) == 4 * IMAGE_SPRITE_SIZE &&
+           image_output_size(IMAGE_CHARSET, 64, 16, &error) == 16 * 8 &&
+           image_output_size(IMAGE_HIRES, 160, 200, &error) < 0 && error &&
+           image_output_size(IMAGE_SPRITES, 25, 21, &error) < 0 &&
+           image_output_size(IMAGE_CHARSET, 8, 9, &error) < 0;
+}
+
+TEST(mode_names_round_trip) {
+    for (int i = 0; i < IMAGE_MODE_COUNT; i++) {
+        if (image_mode_lookup(image_mode_name((ImageMode)i)) != i) return 0;
+    }
+    return image_mode_lookup("sprites") == IMAGE_SPRITES && image_mode_lookup("ham") == -1;
+}
+
+/* ========== Directive Tests ========== */
+
+TEST(directive_emits_data) {
+    char path[128], src[512];
+    snprintf(path, sizeof(path), "/tmp/test_image_%d.png", getpid());
+    Buffer png = sprites_png();
+    write_file(path, &png);
+    free(png.data);
+
+    snprintf(src, sizeof(src),
+             "*=$2000\n"
+             "sprites !image \"%s\", mode=sprites, background=0\n"
+             "end\n"
+             "    !byte <end, >end\n", path);
+    Assembler *as = assembler_create();
+    int ok = assembler_assemble_string(as, src, "test.asm") == 0;
+    if (ok) {
+        uint16_t start;
+        int size;
+        const uint8_t *out = assembler_get_output(as, &start, &size);
+        ok = start == 0x2000 && size == 130 && out[0] == 0xFF && out[3] == 0x80 &&
+             out[64] == 0xFF && out[128] == 0x80 && out[129] == 0x20;
+    }
+    assembler_free(as);
+    unlink(path);
+    return ok;
+}
+
+TEST(directive_errors) {
+    char path[128], src[512];
+    snprintf(path, sizeof(path), "/tmp/test_image_err_%d.png", getpid());
+    Buffer png = sprites_png();
+    write_file(path, &png);
+    free(png.data);
+
+    static const char *const bad[] = {
+        "!image \"%s\", mode=ham\n",
+        "!image \"%s\"\n",
+        "!image \"%s\", mode=sprites, size=2\n",
+        "!image \"%s\", mode=sprites, background=16\n",
+        "!image \"%s\", mode=hires\n",
+        "!image \"%s.missing\", mode=sprites\n",
+    };
+    int ok = 1;
+    for (size_t i = 0; ok && i < sizeof(bad) / sizeof(bad[0]); i++) {
+        snprintf(src, sizeof(src), bad[i], path);
+        Assembler *as = assembler_create();
+        ok = assemble_quiet(as, src) != 0 && as->errors > 0;
+        assembler_free(as);
+    }
+    unlink(path);
+    return ok;
+}
+
+TEST(cache_round_trip) {
+    char path[128], dir[128], src[512];
+    snprintf(path, sizeof(path), "/tmp/test_image_cache_%d.png", getpid());
+    snprintf(dir, sizeof(dir), "/tmp/test_image_cache_%d", getpid());
+    Buffer png = sprites_png();
+    write_file(path, &png);
+    free(png.data);
+    snprintf(src, sizeof(src), "*=$2000\n!image \"%s\", mode=sprites, background=0\n", path);
+
+    uint8_t first[128];
+    int ok = 1;
+    for (int run = 0; ok && run < 2; run++) {
+        Assembler *as = assembler_create();
+        assembler_set_image_cache(as, dir);
+        ok = assembler_assemble_string(as, src, "test.asm") == 0 &&
+             as->image_cache_hits == run;
+        if (ok) {
+            uint16_t start;
+            int size;
+            const uint8_t *out = assembler_get_output(as, &start, &size);
+            ok = size == 128;
+            if (run == 0) memcpy(first, out, 128);
+            else ok = ok && memcmp(first, out, 128) == 0;
+        }
+        assembler_free(as);
+    }
+
+    /* Another background is another conversion */
+    uint8_t *data;
+    int length;
+    ImageOptions other = { IMAGE_SPRITES, 2 };
+    uint64_t key = image_cache_key((const uint8_t *)"x", 1, &other);
+    ok = ok && image_cache_load(dir, key, &data, &length) < 0;
+
+    unlink(path);
+    remove_dir(dir);
+    return ok;
+}
+
+/* ========== Charmap Tests ========== */
+
+#define CELL_A  0x8040201008040201ULL
+#define CELL_B  0xFF000000000000FFULL
+#define CELL_C  0x0000001818000000ULL
+
+TEST(charmap_exact_dedup) {
+    static const uint64_t cells[6] = { CELL_A, CELL_B, CELL_A, CELL_C, CELL_B, CELL_A };
+    static const uint8_t screen[6] = { 0, 1, 0, 2, 1, 0 };
+    CharmapOptions options = { 0, 0 };
+    Charmap map;
+    const char *error;
+    int ok = charmap_build(cells, NULL, 3, 2, &options, &map, &error) == 0 &&
+             map.chars == 3 && map.unique == 3 && map.charset_size == 24 &&
+             memcmp(map.screen, screen, 6) == 0 &&
+             map.charset[0] == 0x80 && map.charset[7] == 0x01 && map.charset[8] == 0xFF;
+    charmap_free(&map);
+    return ok;
+}
+
+TEST(charmap_tolerance) {
+    /* A one-pixel variant of the more frequent cell shares its character */
+    uint64_t cells[4] = { CELL_B, CELL_A ^ 1, CELL_A, CELL_A };
+    CharmapOptions options = { 1, 0 };
+    Charmap map;
+    const char *error;
+    int ok = charmap_build(cells, NULL, 4, 1, &options, &map, &error) == 0 &&
+             map.chars == 2 && map.unique == 3 &&
+             map.screen[0] == 1 && map.screen[1] == 0 && map.screen[2] == 0 &&
+             map.charset[7] == 0x01;
+    charmap_free(&map);
+
+    options.tolerance = 0;
+    ok = ok && charmap_build(cells, NULL, 4, 1, &options, &map, &error) == 0 && map.chars == 3;
+    charmap_free(&map);
+    return ok;
+}
+
+TEST(charmap_invert) {
+    uint64_t cells[3] = { CELL_A, ~CELL_A, CELL_A };
+    CharmapOptions options = { 0, 1 };
+    Charmap map;
+    const char *error;
+    int ok = charmap_build(cells, NULL, 3, 1, &options, &map, &error) == 0 &&
+             map.chars == 1 && map.limit == 128 && map.charset_size == 2048 &&
+             map.screen[0] == 0 && map.screen[1] == 128 &&
+             map.charset[128 * 8] == 0x7F && map.charset[128 * 8 + 7] == 0xFE;
+    charmap_free(&map);
+    return ok;
+}
+
+TEST(charmap_too_many_characters) {
+    uint64_t cells[257];
+    for (int i = 0; i < 257; i++) cells[i] = (uint64_t)i * 0x0101;
+    CharmapOptions options = { 0, 0 };
+    Charmap map;
+    const char *error = NULL;
+    int ok = charmap_build(cells, NULL, 257, 1, &options, &map, &error) < 0 && error &&
+             map.unique == 257 && map.chars > map.limit;
+    charmap_free(&map);
+    ok = ok && charmap_build(cells, NULL, 256, 1, &options, &map, &error) == 0 && map.chars == 256;
+    charmap_free(&map);
+    return ok;
+}
+
+TEST(charmap_bitmap_cells) {
+    /* Two cells side by side: rows alternate between them */
+    uint8_t raw[16];
+    for (int y = 0; y < 8; y++) {
+        raw[y * 2] = (uint8_t)(0x80 >> y);
+        raw[y * 2 + 1] = 0xFF;
+    }
+    uint64_t *cells;
+    const char *error;
+    int ok = charmap_cells_from_bitmap(raw, sizeof(raw), 2, 1, &cells, &error) == 0;
+    if (ok) {
+        ok = cells[0] == CELL_A && cells[1] == 0xFFFFFFFFFFFFFFFFULL;
+        free(cells);
+    }
+    return ok && charmap_cells_from_bitmap(raw, sizeof(raw), 1, 1, &cells, &error) < 0;
+}
+
+TEST(charmap_directive_raw) {
+    char path[128], src[512];
+    snprintf(path, sizeof(path), "/tmp/test_charmap_%d.bin", getpid());
+    /* Three cells across: blank, full, blank */
+    uint8_t raw[24];
+    for (int y = 0; y < 8; y++) {
+        raw[y * 3] = 0x00;
+        raw[y * 3 + 1] = 0xFF;
+        raw[y * 3 + 2] = 0x00;
+    }
+    Buffer buf = { raw, sizeof(raw) };
+    write_file(path, &buf);
+
+    snprintf(src, sizeof(src),
+             "*=$3000\n"
+             "level !charmap \"%s\", width=3, height=1\n"
+             "    !byte level_count, <level_screen, >level_screen, <level_chars\n", path);
+    Assembler *as = assembler_create();
+    int ok = assembler_assemble_string(as, src, "test.asm") == 0;
+    if (ok) {
+        static const uint8_t expected[] = {
+            0, 0, 0, 0, 0, 0, 0, 0,
+            0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+            0, 1, 0,
+            2, 0x10, 0x30, 0x00
+        };
+        uint16_t start;
+        int size;
+        const uint8_t *out = assembler_get_output(as, &start, &size);
+        ok = start == 0x3000 && size == (int)sizeof(expected) &&
+             memcmp(out, expected, sizeof(expected)) == 0 && as->charmaps &&
+             as->charmaps->chars == 2;
+    }
+    assembler_free(as);
+    unlink(path);
+    return ok;
+}
+
+TEST(charmap_directive_png_colors) {
+    char path[128], src[512];
+    snprintf(path, sizeof(path), "/tmp/test_charmap_%d.png", getpid());
+    /* 16x8 on black: a red full cell and a white one */
+    uint8_t pixels[16 * 8];
+    for (int i = 0; i < 16 * 8; i++) pixels[i] = (i % 16) < 8 ? 2 : 1;
+    Buffer png = png_from_pixels(16, 8, 3, pixels);
+    write_file(path, &png);
+    free(png.data);
+
+    snprintf(src, sizeof(src),
+             "*=$3000\n"
+             "tiles !charmap \"%s\", background=0\n"
+             "    !byte <tiles_colors\n", path);
+    Assembler *as = assembler_create();
+    int ok = assembler_assemble_string(as, src, "test.asm") == 0;
+    if (ok) {
+        uint16_t start;
+        int size;
+        const uint8_t *out = assembler_get_output(as, &start, &size);
+        ok = size == 8 + 2 + 2 + 1 && out[0] == 0xFF && out[8] == 0 && out[9] == 0 &&
+             out[10] == 2 && out[11] == 1 && out[12] == 0x0A;
+    }
+    assembler_free(as);
+    unlink(path);
+    return ok;
+}
+
+TEST(charmap_directive_errors) {
+    char path[128], src[512];
+    snprintf(path, sizeof(path), "/tmp/test_charmap_err_%d.bin", getpid());
+    uint8_t raw[16] = { 0 };
+    raw[8] = 1;
+    Buffer buf = { raw, sizeof(raw) };
+    write_file(path, &buf);
+
+    static const char *const bad[] = {
+        "!charmap \"%s\"\n",
+        "!charmap \"%s\", width=3, height=1\n",
+        "!charmap \"%s\", width=2, height=1, flip=1\n",
+        "!charmap \"%s\", width=2, height=1, tolerance=64\n",
+        "!charmap \"%s\", width=2, height=1, invert=2\n",
+        "!charmap \"%s.missing\", width=2, height=1\n",
+    };
+    int ok = 1;
+    for (size_t i = 0; ok && i < sizeof(bad) / sizeof(bad[0]); i++) {
+        snprintf(src, sizeof(src), bad[i], path);
+        Assembler *as = assembler_create();
+        ok = assemble_quiet(as, src) != 0 && as->errors > 0;
+        assembler_free(as);
+    }
+    unlink(path);
+    return ok;
+}
+
+/* ========== Main ========== */
+
+int main(void) {
+    printf("Image Import Tests\n");
+    printf("==================================\n\n");
+
+    opcodes_init();
+
+    printf("Decoding Tests:\n");
+    RUN_TEST(decode_stored_rgba);
+    RUN_TEST(decode_fixed_huffman_and_filters);
+    RUN_TEST(decode_dynamic_huffman_palette);
+    RUN_TEST(decode_packed_palette);
+    RUN_TEST(decode_rejects_bad_input);
+    RUN_TEST(nearest_color);
+
+    printf("\nConversion Tests:\n");
+    RUN_TEST(sprites);
+    RUN_TEST(sprites_default_background);
+    RUN_TEST(charset_transparency);
+    RUN_TEST(hires_cell_colors);
+    RUN_TEST(koala_cell_colors);
+    RUN_TEST(parallel_conversion_matches);
+    RUN_TEST(output_sizes);
+    RUN_TEST(mode_names_round_trip);
+
+    printf("\nDirective Tests:\n");
+    RUN_TEST(directive_emits_data);
+    RUN_TEST(directive_errors);
+    RUN_TEST(cache_round_trip);
+
+    printf("\nCharmap Tests:\n");
+    RUN_TEST(charmap_exact_dedup);
+    RUN_TEST(charmap_tolerance);
+    RUN_TEST(charmap_invert);
+    RUN_TEST(charmap_too_many_characters);
+    RUN_TEST(charmap_bitmap_cells);
+    RUN_TEST(charmap_directive_raw);
+    RUN_TEST(charmap_directive_png_colors);
+    RUN_TEST(charmap_directive_errors);
+
+    printf("\n==================================\n");
+    printf("Total: %d passed, %d failed\n", tests_passed, tests_run - tests_passed);
+
+    return tests_run == tests_passed ? 0 : 1;
+}
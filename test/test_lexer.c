@@ -277,6 +277,24 @@ TEST(delimiters) {
     return 1;
 }
 
+/* Test the range token between addresses and names */
+TEST(range) {
+    const char *src = "$c000..$c0ff start..end";
+    TokenType expected[] = {
+        TOK_NUMBER, TOK_DOTDOT, TOK_NUMBER,
+        TOK_IDENTIFIER, TOK_DOTDOT, TOK_IDENTIFIER, TOK_EOF
+    };
+
+    Lexer lex;
+    lexer_init(&lex, src, "test");
+
+    for (int i = 0; expected[i] != TOK_EOF; i++) {
+        Token tok = lexer_next(&lex);
+        ASSERT_EQ(tok.type, expected[i]);
+    }
+    return 1;
+}
+
 /* Test comments */
 TEST(comment_skip) {
     const char *src = "label ; this is a comment\n";
@@ -446,6 +464,7 @@ int main(void) {
     RUN_TEST(operators);
     RUN_TEST(two_char_operators);
     RUN_TEST(delimiters);
+    RUN_TEST(range);
 
     printf("\nComments and lines:\n");
     RUN_TEST(comment_skip);
@@ -164,6 +164,81 @@ static void test_for_generates_table(void) {
     PASS();
 }
 
+/* ========== Data Loop Tests ========== */
+
+/* Assemble with the given thread count; returns the output size, or -1 */
+static int assemble_data(const char *source, int threads, uint8_t *out, int capacity,
+                         int *warnings, int *generated) {
+    Assembler *as = assembler_create();
+    if (!as) return -1;
+    assembler_set_threads(as, threads);
+
+    int errors = assembler_assemble_string(as, source, "test.asm");
+    uint16_t start;
+    int size;
+    const uint8_t *output = assembler_get_output(as, &start, &size);
+    if (errors != 0 || size > capacity) size = -1;
+    if (size > 0) memcpy(out, output, size);
+    if (warnings) *warnings = as->warnings;
+    if (generated) *generated = as->data_loops;
+
+    assembler_free(as);
+    return size;
+}
+
+static void test_for_data_loop(void) {
+    printf("  for_data_loop                                  ");
+    /* A long !byte/!word body is generated in one go, serially or not */
+    const char *source =
+        "* = $1000\n"
+        "base = 7\n"
+        "!func sq(n) = (n * n) & $ff\n"
+        "!for i, 0, 299\n"
+        "    !byte sq(i), <(I + base)\n"
+        "    !word i * 3 + *\n"
+        "!end\n"
+        "!byte i & $ff\n";
+    static uint8_t expected[1201], serial[1300], parallel[1300];
+    for (int i = 0; i < 300; i++) {
+        uint16_t word = (uint16_t)(i * 3 + 0x1000 + i * 4 + 2);
+        expected[i * 4] = (uint8_t)(i * i);
+        expected[i * 4 + 1] = (uint8_t)(i + 7);
+        expected[i * 4 + 2] = (uint8_t)(word & 0xFF);
+        expected[i * 4 + 3] = (uint8_t)(word >> 8);
+    }
+    expected[1200] = 299 & 0xFF;
+
+    int generated = 0;
+    ASSERT(assemble_data(source, 1, serial, sizeof(serial), NULL, &generated) == 1201);
+    ASSERT(generated == 1);
+    ASSERT(memcmp(serial, expected, 1201) == 0);
+    ASSERT(assemble_data(source, 4, parallel, sizeof(parallel), NULL, &generated) == 1201);
+    ASSERT(generated == 1);
+    ASSERT(memcmp(parallel, expected, 1201) == 0);
+    PASS();
+}
+
+static void test_for_data_loop_fallback(void) {
+    printf("  for_data_loop_fallback                         ");
+    /* A forward label and a value that does not fit in a byte send the
+     * loop through line by line expansion, which reports the warning */
+    const char *source =
+        "* = $1000\n"
+        "!for i, 299, 0\n"
+        "    !byte <(table + i), i\n"
+        "!end\n"
+        "table\n";
+    static uint8_t out[700];
+    int warnings = 0, generated = 0;
+    ASSERT(assemble_data(source, 4, out, sizeof(out), &warnings, &generated) == 600);
+    ASSERT(generated == 0);
+    ASSERT(out[0] == (uint8_t)((0x1000 + 600 + 299) & 0xFF));
+    ASSERT(out[1] == (uint8_t)299);
+    ASSERT(out[598] == 0x58 && out[599] == 0);
+    ASSERT(warnings > 0);
+    PASS();
+}
+
 /* ========== Nested Loop Tests ========== */
 
 static void test_for_nested(void) {
@@ -307,6 +382,8 @@ int main(void) {
     test_for_expression_bounds();
     test_for_var_in_expression();
     test_for_generates_table();
+    test_for_data_loop();
+    test_for_data_loop_fallback();
 
     printf("\nNested Loops:\n");
     test_for_nested();
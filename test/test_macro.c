@@ -277,6 +277,146 @@ TEST(unterminated_macro) {
     assembler_free(as);
 }
 
+/* ========== Inline Subroutines ========== */
+
+TEST(inline_jsr_plus_copies_body) {
+    /* jsr+ before and after the routine; the routine itself stays callable */
+    const char *source =
+        "* = $1000\n"
+        "    jsr+ border\n"
+        "    jsr border\n"
+        "    rts\n"
+        "border !inline\n"
+        "    lda #0\n"
+        "    sta $d020\n"
+        "    rts\n"
+        "    jsr+ border\n";
+    uint8_t expected[] = {
+        0xA9, 0x00, 0x8D, 0x20, 0xD0,   /* Inlined body */
+        0x20, 0x09, 0x10,               /* JSR border */
+        0x60,
+        0xA9, 0x00, 0x8D, 0x20, 0xD0,   /* border */
+        0x60,
+        0xA9, 0x00, 0x8D, 0x20, 0xD0    /* Inlined body */
+    };
+    ASSERT(assemble_and_check(source, expected, sizeof(expected)));
+}
+
+TEST(inline_local_labels_per_copy) {
+    const char *source =
+        "* = $1000\n"
+        "delay !inline\n"
+        "    ldx #2\n"
+        ".loop dex\n"
+        "    bne .loop\n"
+        "    rts\n"
+        "    jsr+ delay\n"
+        "    jsr+ delay\n";
+    uint8_t expected[] = {
+        0xA2, 0x02, 0xCA, 0xD0, 0xFD, 0x60,
+        0xA2, 0x02, 0xCA, 0xD0, 0xFD,
+        0xA2, 0x02, 0xCA, 0xD0, 0xFD
+    };
+    ASSERT(assemble_and_check(source, expected, sizeof(expected)));
+}
+
+TEST(inline_threshold_plain_jsr) {
+    Assembler *as = assembler_create();
+    as->inline_threshold = 2;
+    const char *source =
+        "* = $1000\n"
+        "    jsr short\n"
+        "    jsr long\n"
+        "    rts\n"
+        "short !inline\n"
+        "    inx\n"
+        "    rts\n"
+        "long !inline\n"
+        "    inx\n"
+        "    iny\n"
+        "    inx\n"
+        "    rts\n";
+    int errors = assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(errors, 0);
+    ASSERT_EQ(as->memory[0x1000], 0xE8);    /* short inlined */
+    ASSERT_EQ(as->memory[0x1001], 0x20);    /* long is a JSR */
+    ASSERT_EQ(as->inline_call_count, 1);
+    ASSERT_EQ(as->inline_calls[0].line_number, 2);
+    ASSERT_EQ(as->inline_calls[0].size, 1);
+    assembler_free(as);
+}
+
+TEST(inline_jsr_plus_to_plain_routine_warns) {
+    Assembler *as = assembler_create();
+    const char *source =
+        "* = $1000\n"
+        "    jsr+ plain\n"
+        "    jsr +\n"
+        "+   rts\n"
+        "plain rts\n";
+    int errors = assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(errors, 0);
+    ASSERT_EQ(as->warnings, 1);
+    ASSERT_EQ(as->memory[0x1000], 0x20);
+    ASSERT_EQ(as->memory[0x1004], 0x06);    /* jsr + is an anonymous label */
+    ASSERT_EQ(as->inline_call_count, 0);
+    assembler_free(as);
+}
+
+TEST(inline_routine_errors) {
+    Assembler *as = assembler_create();
+    const char *source =
+        "* = $1000\n"
+        "    !inline\n"
+        "a !inline\n"
+        "    nop\n"
+        "b   nop\n"
+        "    rts\n"
+        "c !inline\n"
+        "-   dex\n"
+        "    bne -\n"
+        "    rts\n"
+        "d !inline\n"
+        "    nop\n";
+    assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(as->errors, 4);
+    assembler_free(as);
+}
+
+TEST(inline_rejects_branch_past_first_rts) {
+    Assembler *as = assembler_create();
+    const char *source =
+        "* = $1000\n"
+        "    jsr+ pick\n"
+        "    rts\n"
+        "pick !inline\n"
+        "    lda $02\n"
+        "    beq .skip\n"
+        "    lda #1\n"
+        "    rts\n"
+        ".skip lda #2\n"
+        "    rts\n";
+    assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(as->errors, 1);
+    ASSERT_EQ(as->inline_call_count, 0);
+    assembler_free(as);
+}
+
+TEST(inline_rejects_self_modifying_code) {
+    Assembler *as = assembler_create();
+    const char *source =
+        "* = $1000\n"
+        "count !inline\n"
+        "    lda #0 :@.value\n"
+        "    inc .value\n"
+        "    rts\n"
+        "    jsr+ count\n";
+    assembler_assemble_string(as, source, "test.asm");
+    ASSERT_EQ(as->errors, 1);
+    ASSERT_EQ(as->inline_call_count, 0);
+    assembler_free(as);
+}
+
 /* ========== Main ========== */
 
 int main(void) {
@@ -311,6 +451,15 @@ int main(void) {
     RUN_TEST(wrong_arg_count);
     RUN_TEST(unterminated_macro);
 
+    printf("\nInline Subroutines:\n");
+    RUN_TEST(inline_jsr_plus_copies_body);
+    RUN_TEST(inline_local_labels_per_copy);
+    RUN_TEST(inline_threshold_plain_jsr);
+    RUN_TEST(inline_jsr_plus_to_plain_routine_warns);
+    RUN_TEST(inline_routine_errors);
+    RUN_TEST(inline_rejects_branch_past_first_rts);
+    RUN_TEST(inline_rejects_self_modifying_code);
+
     printf("\n===========\n");
     printf("Total: %d passed, %d failed\n", tests_passed, tests_failed);
 
@@ -0,0 +1,363 @@
+/* Test suite for the --optimize value-tracking optimizer */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "../include/assembler.h"
+#include "../include/opcodes.h"
+#include "../include/optimize.h"
+#include "../include/sim6510.h"
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name) static int test_##name(void)
+#define RUN_TEST(name) do { \
+    tests_run++; \
+    printf("  %-40s ", #name); \
+    if (test_##name()) { \
+        printf("\033[0;32mPASS\033[0m\n"); \
+        tests_passed++; \
+    } else { \
+        printf("\033[0;31mFAIL\033[0m\n"); \
+    } \
+} while(0)
+
+static uint8_t memory[65536];
+
+/* ========== Helpers ========== */
+
+/* Assemble src with stderr discarded; NULL if assembly fails */
+static Assembler *assemble(const char *src, int optimize) {
+    fflush(stderr);
+    int saved = dup(2);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, 2);
+    close(null);
+
+    Assembler *as = assembler_create();
+    as->optimize = optimize;
+    int result = assembler_assemble_string(as, src, "test.asm");
+
+    fflush(stderr);
+    dup2(saved, 2);
+    close(saved);
+    if (result != 0) {
+        assembler_free(as);
+        return NULL;
+    }
+    return as;
+}
+
+/* Whether the assembled bytes from $1000 are expected */
+static int has_bytes(const Assembler *as, const uint8_t *expected, int length) {
+    return as->lowest_addr == 0x1000 &&
+           as->highest_addr - as->lowest_addr + 1 == length &&
+           memcmp(&as->memory[0x1000], expected, (size_t)length) == 0;
+}
+
+/* Run from start to done in the 6510 model; A, X, Y and P in *state */
+static int run(const Assembler *as, uint8_t p, uint32_t *state) {
+    Symbol *start = symbol_lookup(as->symbols, "start");
+    Symbol *done = symbol_lookup(as->symbols, "done");
+    if (!start || !done) return -1;
+
+    memcpy(memory, as->memory, sizeof(memory));
+    Sim6510 cpu;
+    sim6510_init(&cpu, memory, start->value);
+    cpu.p = p;
+    for (int steps = 0; cpu.pc != done->value; steps++) {
+        SimStep step;
+        if (steps > 1000 || sim6510_step(&cpu, &step) < 0) return -1;
+    }
+    *state = (uint32_t)cpu.a << 24 | (uint32_t)cpu.x << 16 | (uint32_t)cpu.y << 8 | cpu.p;
+    return 0;
+}
+
+/* ========== Change Tests ========== */
+
+TEST(removes_redundant_instructions) {
+    Assembler *as = assemble(
+        "*=$1000\n"
+        "    cld\n"
+        "    lda #0\n"
+        "    sta $d020\n"
+        "    lda #0\n"          /* A is already 0 */
+        "    clc\n"
+        "    adc #3\n"
+        "    clc\n"             /* carry is already clear */
+        "    cmp #3\n"
+        "    cmp #3\n"          /* flags already match */
+        "    tax\n"
+        "    rts\n", 1);
+    if (!as) return 0;
+    static const uint8_t expected[] = {
+        0xD8, 0xA9, 0x00, 0x8D, 0x20, 0xD0, 0x18, 0x69, 0x03, 0xC9, 0x03, 0xAA, 0x60
+    };
+    int passed = has_bytes(as, expected, sizeof(expected)) &&
+                 as->opt_edit_count == 3 &&
+                 as->opt_edits[0].kind == OPT_REMOVE && as->opt_edits[0].source_line == 5 &&
+                 as->opt_edits[1].source_line == 8 && as->opt_edits[1].cycles == 2 &&
+                 as->opt_edits[2].source_line == 10 && as->opt_edits[2].bytes == 2;
+    assembler_free(as);
+    return passed;
+}
+
+TEST(jmp_becomes_taken_branch) {
+    Assembler *as = assemble(
+        "*=$1000\n"
+        "    sec\n"
+        "    jmp done\n"
+        "    nop\n"
+        "done rts\n", 1);
+    if (!as) return 0;
+    static const uint8_t expected[] = { 0x38, 0xB0, 0x01, 0xEA, 0x60 };
+    int passed = has_bytes(as, expected, sizeof(expected)) &&
+                 as->opt_edit_count == 1 && as->opt_edits[0].kind == OPT_BRANCH &&
+                 as->opt_edits[0].bytes == 1 && as->opt_edits[0].cycles == 0;
+    assembler_free(as);
+    return passed;
+}
+
+TEST(jmp_stays_across_pages) {
+    Assembler *as = assemble(
+        "*=$10f8\n"
+        "    sec\n"
+        "    jmp done\n"
+        "    !fill 8, $ea\n"
+        "done rts\n", 1);
+    int passed = as && as->opt_edit_count == 0;
+    assembler_free(as);
+    return passed;
+}
+
+TEST(barriers_forget_known_values) {
+    static const char *const sources[] = {
+        /* A label may be reached with anything in A */
+        "*=$1000\n"
+        "    lda #0\n"
+        "again lda #0\n"
+        "    rts\n",
+        /* An operand the code patches through :@ */
+        "*=$1000\n"
+        "    lda #0\n"
+        "    lda #0 :@value\n"
+        "    rts\n",
+        /* An operand the code stores to */
+        "*=$1000\n"
+        "    lda #0\n"
+        "    sta $1006\n"
+        "    lda #0\n"
+        "    rts\n",
+        /* A subroutine may change anything */
+        "*=$1000\n"
+        "    clc\n"
+        "    jsr sub\n"
+        "    clc\n"
+        "sub rts\n",
+        /* Data between instructions */
+        "*=$1000\n"
+        "    sec\n"
+        "    !byte 0\n"
+        "    sec\n"
+        "    rts\n",
+        /* Timing-exact code is kept as written */
+        "*=$1000\n"
+        "    !raster_block line=$32, cycle=1\n"
+        "    lda #1\n"
+        "    lda #1\n"
+        "    !raster_end\n"
+        "    rts\n"
+    };
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        Assembler *as = assemble(sources[i], 1);
+        int kept = as && as->opt_edit_count == 0;
+        assembler_free(as);
+        if (!kept) return 0;
+    }
+    return 1;
+}
+
+TEST(drops_changes_that_no_longer_hold) {
+    /* Removing the second LDA moves done, so #<done no longer equals A */
+    Assembler *as = assemble(
+        "*=$1000\n"
+        "    lda #$07\n"
+        "    lda #$07\n"
+        "    lda #<done\n"
+        "    rts\n"
+        "done rts\n", 1);
+    if (!as) return 0;
+    static const uint8_t expected[] = { 0xA9, 0x07, 0xA9, 0x05, 0x60, 0x60 };
+    int passed = has_bytes(as, expected, sizeof(expected)) &&
+                 as->opt_edit_count == 1 && as->opt_edits[0].source_line == 3;
+    assembler_free(as);
+    return passed;
+}
+
+TEST(removal_before_branch_target) {
+    /* The removed TAX shares its address with join, which alone is the barrier */
+    Assembler *as = assemble(
+        "*=$1000\n"
+        "    lda #0\n"
+        "    ldx #0\n"
+        "    tax\n"             /* X is already 0 */
+        "join dex\n"
+        "    bne join\n"
+        "    rts\n", 1);
+    if (!as) return 0;
+    static const uint8_t expected[] = { 0xA9, 0x00, 0xA2, 0x00, 0xCA, 0xD0, 0xFD, 0x60 };
+    int passed = has_bytes(as, expected, sizeof(expected)) &&
+                 as->opt_edit_count == 1 && as->opt_edits[0].source_line == 4;
+    assembler_free(as);
+    return passed;
+}
+
+TEST(literal_addresses_pin_the_code) {
+    /* Numbers pointing into the code do not move with it */
+    static const char *const sources[] = {
+        "*=$1000\n"
+        "    sec\n"
+        "    jmp $1009\n"
+        "    lda #0\n"
+        "    lda #0\n"
+        "    nop\n"
+        "    rts\n",
+        "*=$1000\n"
+        "    ldx #0\n"
+        "    ldx #0\n"
+        "    lda $1006,x\n"
+        "    rts\n"
+        "    !byte 1, 2, 3\n",
+        "*=$1000\n"
+        "    clc\n"
+        "    clc\n"
+        "    rts\n"
+        "    !word $1002\n"
+    };
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        Assembler *plain = assemble(sources[i], 0);
+        Assembler *optimized = assemble(sources[i], 1);
+        int same = plain && optimized && optimized->opt_edit_count == 0 &&
+                   plain->highest_addr == optimized->highest_addr &&
+                   memcmp(plain->memory, optimized->memory, ASM_MEMORY_SIZE) == 0;
+        assembler_free(plain);
+        assembler_free(optimized);
+        if (!same) return 0;
+    }
+
+    /* Changes past the highest such address are still made */
+    Assembler *as = assemble(
+        "*=$1000\n"
+        "    jsr $1003\n"
+        "    lda #0\n"
+        "    lda #0\n"
+        "    rts\n", 1);
+    int passed = as && as->opt_edit_count == 1 && as->opt_edits[0].source_line == 4;
+    assembler_free(as);
+    return passed;
+}
+
+TEST(optimized_code_behaves_the_same) {
+    const char *src =
+        "*=$1000\n"
+        "start cld\n"
+        "    lda #$40\n"
+        "    clc\n"
+        "    adc #$40\n"
+        "    clv\n"
+        "    ldx #$80\n"
+        "    txa\n"
+        "    cpx #$80\n"
+        "    bne skip\n"
+        "    ldy #0\n"
+        "    cpx #$80\n"
+        "    sec\n"
+        "    rol\n"
+        "    sec\n"
+        "    bcc skip\n"
+        "    jmp tail\n"
+        "skip ldy #1\n"
+        "tail lda #1\n"
+        "    lsr\n"
+        "    bcs done\n"
+        "    nop\n"
+        "done rts\n";
+    Assembler *plain = assemble(src, 0);
+    Assembler *optimized = assemble(src, 1);
+    int passed = plain && optimized && optimized->opt_edit_count >= 4 &&
+                 optimized->highest_addr < plain->highest_addr;
+    for (int p = 0; passed && p < 256; p += 0x41) {
+        uint32_t before, after;
+        passed = run(plain, (uint8_t)p, &before) == 0 &&
+                 run(optimized, (uint8_t)p, &after) == 0 && before == after;
+    }
+    assembler_free(plain);
+    assembler_free(optimized);
+    return passed;
+}
+
+TEST(off_by_default) {
+    Assembler *as = assemble(
+        "*=$1000\n"
+        "    lda #0\n"
+        "    lda #0\n"
+        "    rts\n", 0);
+    static const uint8_t expected[] = { 0xA9, 0x00, 0xA9, 0x00, 0x60 };
+    int passed = as && as->opt_edit_count == 0 && has_bytes(as, expected, sizeof(expected));
+    assembler_free(as);
+    return passed;
+}
+
+/* ========== Report Tests ========== */
+
+TEST(report_lists_each_change) {
+    Assembler *as = assemble(
+        "*=$1000\n"
+        "    ldy #0\n"
+        "    ldy #0\n"
+        "    sec\n"
+        "    jmp done\n"
+        "done rts\n", 1);
+    if (!as) return 0;
+
+    char buf[1024];
+    FILE *out = fmemopen(buf, sizeof(buf), "w");
+    optimize_report(as, out);
+    fclose(out);
+    assembler_free(as);
+
+    return strstr(buf, "test.asm:3: LDY removed: Y is already $00 (2 bytes, 2 cycles saved)") &&
+           strstr(buf, "test.asm:5: JMP replaced by BCS: carry is set (1 byte, 0 cycles saved)") &&
+           strstr(buf, "Optimizer: 2 changes, 3 bytes and 2 cycles saved");
+}
+
+/* ========== Main ========== */
+
+int main(void) {
+    printf("Value-Tracking Optimizer Tests\n");
+    printf("==================================\n\n");
+
+    opcodes_init();
+
+    printf("Change Tests:\n");
+    RUN_TEST(removes_redundant_instructions);
+    RUN_TEST(jmp_becomes_taken_branch);
+    RUN_TEST(jmp_stays_across_pages);
+    RUN_TEST(barriers_forget_known_values);
+    RUN_TEST(drops_changes_that_no_longer_hold);
+    RUN_TEST(removal_before_branch_target);
+    RUN_TEST(literal_addresses_pin_the_code);
+    RUN_TEST(optimized_code_behaves_the_same);
+    RUN_TEST(off_by_default);
+
+    printf("\nReport Tests:\n");
+    RUN_TEST(report_lists_each_change);
+
+    printf("\n==================================\n");
+    printf("Total: %d passed, %d failed\n", tests_passed, tests_run - tests_passed);
+
+    return tests_run == tests_passed ? 0 : 1;
+}
@@ -7,7 +7,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "assembler.h"
+#include "output.h"
 
 /* Test counters */
 static int tests_passed = 0;
@@ -344,6 +347,256 @@ static void test_empty_output(void) {
     PASS();
 }
 
+/* Helper to compare two files byte for byte */
+static int files_equal(const char *a, const char *b) {
+    char *ca = read_file(a);
+    char *cb = read_file(b);
+    int equal = ca && cb && strcmp(ca, cb) == 0;
+    free(ca);
+    free(cb);
+    return equal;
+}
+
+/* Helper to count directory entries other than . and .. */
+static int count_entries(const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) return -1;
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            count++;
+        }
+    }
+    closedir(dir);
+    return count;
+}
+
+static const char *concurrent_source =
+    "*=$C000\n"
+    "start:\n"
+    "    ldx #0\n"
+    "loop:\n"
+    "    lda text,x\n"
+    "    sta $0400,x\n"
+    "    inx\n"
+    "    bne loop\n"
+    "    rts\n"
+    "text: !text \"HELLO WORLD\"\n";
+
+/* Test concurrent writers produce the same files as the single writers */
+static void test_concurrent_outputs(void) {
+    printf("  %-40s ", "concurrent_outputs");
+
+    Assembler *as = assembler_create();
+    as->show_cycles = 1;
+    assembler_assemble_string(as, concurrent_source, "test.asm");
+
+    assembler_write_output(as, "/tmp/test_single.prg");
+    assembler_write_symbols(as, "/tmp/test_single.sym");
+    assembler_write_listing(as, "/tmp/test_single.lst");
+
+    OutputJob jobs[3];
+    memset(jobs, 0, sizeof(jobs));
+    jobs[0].kind = OUTPUT_FILE_PROGRAM;
+    jobs[0].filename = "/tmp/test_concurrent.prg";
+    jobs[1].kind = OUTPUT_FILE_SYMBOLS;
+    jobs[1].filename = "/tmp/test_concurrent.sym";
+    jobs[2].kind = OUTPUT_FILE_LISTING;
+    jobs[2].filename = "/tmp/test_concurrent.lst";
+
+    int result = assembler_write_outputs(as, jobs, 3, 0);
+
+    if (result != 0 || jobs[0].bytes != 2 + 23 || jobs[2].bytes == 0) {
+        FAIL("write failed");
+    } else if (!files_equal("/tmp/test_single.prg", "/tmp/test_concurrent.prg") ||
+               !files_equal("/tmp/test_single.sym", "/tmp/test_concurrent.sym") ||
+               !files_equal("/tmp/test_single.lst", "/tmp/test_concurrent.lst")) {
+        FAIL("concurrent output differs");
+    } else {
+        PASS();
+    }
+
+    unlink("/tmp/test_single.prg");
+    unlink("/tmp/test_single.sym");
+    unlink("/tmp/test_single.lst");
+    unlink("/tmp/test_concurrent.prg");
+    unlink("/tmp/test_concurrent.sym");
+    unlink("/tmp/test_concurrent.lst");
+    assembler_free(as);
+}
+
+/* Test direct writes produce the same bytes as buffered writes */
+static void test_direct_output(void) {
+    printf("  %-40s ", "direct_output");
+
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as, concurrent_source, "test.asm");
+    assembler_write_listing(as, "/tmp/test_buffered.lst");
+
+    OutputJob job;
+    memset(&job, 0, sizeof(job));
+    job.kind = OUTPUT_FILE_LISTING;
+    job.filename = "/tmp/test_direct.lst";
+
+    /* O_DIRECT may be refused (e.g. tmpfs); the fallback must still match */
+    if (assembler_write_outputs(as, &job, 1, OUTPUT_DIRECT) != 0) {
+        FAIL("write failed");
+    } else if (!files_equal("/tmp/test_buffered.lst", "/tmp/test_direct.lst")) {
+        FAIL("direct output differs");
+    } else {
+        PASS();
+    }
+
+    unlink("/tmp/test_buffered.lst");
+    unlink("/tmp/test_direct.lst");
+    assembler_free(as);
+}
+
+/* Test replacing a file keeps its mode and leaves no temporary behind */
+static void test_output_replace(void) {
+    printf("  %-40s ", "output_replace");
+
+    char dir[64], path[96];
+    snprintf(dir, sizeof(dir), "/tmp/test_output_%d", (int)getpid());
+    snprintf(path, sizeof(path), "%s/game.prg", dir);
+    mkdir(dir, 0755);
+
+    FILE *f = fopen(path, "w");
+    fputs("old", f);
+    fclose(f);
+    chmod(path, 0640);
+
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as, concurrent_source, "test.asm");
+    int result = assembler_write_output(as, path);
+
+    struct stat st;
+    if (result != 0 || stat(path, &st) != 0) {
+        FAIL("write failed");
+    } else if (st.st_size != 2 + 23) {
+        FAIL("file not replaced");
+    } else if ((st.st_mode & 0777) != 0640) {
+        FAIL("mode not preserved");
+    } else if (count_entries(dir) != 1) {
+        FAIL("temporary file left behind");
+    } else {
+        PASS();
+    }
+
+    unlink(path);
+    rmdir(dir);
+    assembler_free(as);
+}
+
+/* Test a failed write reports an error and creates nothing */
+static void test_output_failure(void) {
+    printf("  %-40s ", "output_failure");
+
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as, concurrent_source, "test.asm");
+
+    OutputJob jobs[2];
+    memset(jobs, 0, sizeof(jobs));
+    jobs[0].kind = OUTPUT_FILE_PROGRAM;
+    jobs[0].filename = "/nonexistent_dir/test.prg";
+    jobs[1].kind = OUTPUT_FILE_SYMBOLS;
+    jobs[1].filename = "/tmp/test_failure.sym";
+
+    int errors = as->errors;
+    int result = assembler_write_outputs(as, jobs, 2, 0);
+
+    if (result == 0 || jobs[0].result == 0) {
+        FAIL("expected failure");
+    } else if (jobs[1].result != 0 || !file_exists_test("/tmp/test_failure.sym")) {
+        FAIL("other outputs should still be written");
+    } else if (as->errors != errors + 1) {
+        FAIL("expected one error");
+    } else {
+        PASS();
+    }
+
+    unlink("/tmp/test_failure.sym");
+    assembler_free(as);
+}
+
+/* Macro inside a loop, inside a zone, plus plain code and data */
+static const char *size_source =
+    "!macro border v\n"
+    "    lda #v\n"
+    "    sta $d020\n"
+    "!endmacro\n"
+    "*=$1000\n"
+    "start\n"
+    "    !for i, 0, 3\n"
+    "        +border i\n"
+    "    !end\n"
+    "    rts\n"
+    "table !byte 1, 2, 3\n";
+
+/* Test the size report attributes bytes and cycles */
+static void test_size_report(void) {
+    printf("  %-40s ", "size_report");
+
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as, size_source, "test.asm");
+
+    FILE *f = fopen("/tmp/test_size.txt", "w");
+    if (f) {
+        assembler_size_report(as, f);
+        fclose(f);
+    }
+    char *content = read_file("/tmp/test_size.txt");
+
+    if (!content) {
+        FAIL("no report written");
+    } else if (!strstr(content, "Size report: 24 bytes, 30 base cycles")) {
+        FAIL("wrong totals");
+    } else if (!strstr(content, "21   87.5%       30  start") ||
+               !strstr(content, " 3   12.5%        0  table")) {
+        FAIL("wrong zone attribution");
+    } else if (!strstr(content, "20   83.3%       24  <border>") ||
+               !strstr(content, "20   83.3%       24  <for i>")) {
+        FAIL("wrong macro or loop attribution");
+    } else {
+        PASS();
+    }
+
+    free(content);
+    unlink("/tmp/test_size.txt");
+    assembler_free(as);
+}
+
+/* Test folded stacks are aggregated per expansion path */
+static void test_size_folded(void) {
+    printf("  %-40s ", "size_folded");
+
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as, size_source, "test.asm");
+
+    OutputJob job;
+    memset(&job, 0, sizeof(job));
+    job.kind = OUTPUT_FILE_FOLDED;
+    job.filename = "/tmp/test_size.folded";
+    int result = assembler_write_outputs(as, &job, 1, 0);
+    char *content = read_file("/tmp/test_size.folded");
+
+    if (result != 0 || !content) {
+        FAIL("write failed");
+    } else if (strcmp(content,
+                      "test.asm;start 1\n"
+                      "test.asm;start;<for i>;<border> 20\n"
+                      "test.asm;table 3\n") != 0) {
+        FAIL("wrong stacks");
+    } else {
+        PASS();
+    }
+
+    free(content);
+    unlink("/tmp/test_size.folded");
+    assembler_free(as);
+}
+
 int main(void) {
     printf("Output Generation Tests\n");
     printf("=======================\n\n");
@@ -363,6 +616,16 @@ int main(void) {
     test_get_output();
     test_empty_output();
 
+    printf("\nConcurrent Writers:\n");
+    test_concurrent_outputs();
+    test_direct_output();
+    test_output_replace();
+    test_output_failure();
+
+    printf("\nSize Report:\n");
+    test_size_report();
+    test_size_folded();
+
     printf("\n=======================\n");
     printf("Total: %d passed, %d failed\n", tests_passed, tests_failed);
 
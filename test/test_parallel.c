@@ -0,0 +1,490 @@
+/* Test suite for parallel and incremental pass 2 code generation */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "../include/assembler.h"
+#include "../include/opcodes.h"
+#include "../include/threadpool.h"
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name) static int test_##name(void)
+#define RUN_TEST(name) do { \
+    tests_run++; \
+    printf("  %-40s ", #name); \
+    if (test_##name()) { \
+        printf("\033[0;32mPASS\033[0m\n"); \
+        tests_passed++; \
+    } else { \
+        printf("\033[0;31mFAIL\033[0m\n"); \
+    } \
+} while(0)
+
+/* ========== Helpers ========== */
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} Buf;
+
+static void buf_printf(Buf *b, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    char tmp[256];
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, args);
+    va_end(args);
+    if (b->len + n + 1 > b->cap) {
+        b->cap = (b->cap + n + 1) * 2;
+        b->data = realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, tmp, n + 1);
+    b->len += n;
+}
+
+/* A program exercising zones, local and anonymous labels, forward
+ * references, macros, loops, pseudopc and stable assignments */
+static char *make_program(int blocks) {
+    Buf b = { NULL, 0, 0 };
+    buf_printf(&b, "*=$0810\n");
+    buf_printf(&b, "SCREEN = $0400\n");
+    buf_printf(&b, "!macro poke addr, val\n    lda #val\n    sta addr\n!endmacro\n");
+    buf_printf(&b, "    jmp main\n");
+    for (int i = 0; i < blocks; i++) {
+        buf_printf(&b, "block%d:\n", i);
+        buf_printf(&b, "    ldx #%d\n", i & 0xFF);
+        buf_printf(&b, ".loop:\n");
+        buf_printf(&b, "    lda table%d,x\n", i);
+        buf_printf(&b, "    beq +\n");
+        buf_printf(&b, "    sta SCREEN+%d,x\n", i % 200);
+        buf_printf(&b, "+   dex\n");
+        buf_printf(&b, "    bne .loop\n");
+        buf_printf(&b, "-   inc $d020\n");
+        buf_printf(&b, "    bit -\n");
+        buf_printf(&b, "    +poke $d021, %d\n", i & 15);
+        buf_printf(&b, "    !word block%d, +, main\n", (i + 1) % blocks);
+        buf_printf(&b, "+   rts\n");
+        buf_printf(&b, "table%d:\n", i);
+        buf_printf(&b, "    !byte %d, <block%d, >block%d, 0\n", i & 0xFF, i, i);
+        if (i % 16 == 0) {
+            buf_printf(&b, "!pseudopc $c000\n");
+            buf_printf(&b, "reloc%d:\n    jsr reloc%d\n    lda #<*\n", i, i);
+            buf_printf(&b, "!realpc\n");
+        }
+        if (i % 32 == 0) {
+            buf_printf(&b, "!for j, 0, 3\n    !byte j * %d\n!end\n", i & 7);
+        }
+    }
+    buf_printf(&b, "main:\n    rts\n");
+    return b.data;
+}
+
+static Assembler *assemble_with(const char *src, int threads) {
+    Assembler *as = assembler_create();
+    assembler_set_threads(as, threads);
+    assembler_assemble_string(as, src, "test.asm");
+    return as;
+}
+
+/* Compare everything pass 2 produces */
+static int same_output(Assembler *a, Assembler *b) {
+    if (a->errors != b->errors || a->warnings != b->warnings) return 0;
+    if (a->lowest_addr != b->lowest_addr || a->highest_addr != b->highest_addr) return 0;
+    if (memcmp(a->memory, b->memory, ASM_MEMORY_SIZE) != 0) return 0;
+    if (memcmp(a->written, b->written, ASM_MEMORY_SIZE) != 0) return 0;
+    if (a->line_count != b->line_count) return 0;
+    for (int i = 0; i < a->line_count; i++) {
+        if (a->lines[i].byte_count != b->lines[i].byte_count) return 0;
+        if (memcmp(a->lines[i].bytes, b->lines[i].bytes, a->lines[i].byte_count) != 0) return 0;
+        if (a->lines[i].cycles != b->lines[i].cycles) return 0;
+    }
+    return 1;
+}
+
+static Assembler *assemble_incremental(const char *src, int threads) {
+    Assembler *as = assembler_create();
+    assembler_set_threads(as, threads);
+    as->incremental = 1;
+    assembler_assemble_string(as, src, "test.asm");
+    return as;
+}
+
+/* Assemble src normally and incrementally and compare the results */
+static int incremental_agrees(const char *src, int threads, int *revisited, int *skipped) {
+    Assembler *full = assemble_with(src, 1);
+    Assembler *inc = assemble_incremental(src, threads);
+    int same = same_output(full, inc);
+    if (revisited) *revisited = inc->pass2_revisited;
+    if (skipped) *skipped = inc->pass2_skipped;
+    assembler_free(full);
+    assembler_free(inc);
+    return same;
+}
+
+/* Run assembly with stderr captured into buf */
+static int assemble_capturing(const char *src, int threads, char *buf, size_t size) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_parallel_%d.err", getpid());
+
+    fflush(stderr);
+    int saved = dup(2);
+    FILE *f = fopen(path, "w");
+    dup2(fileno(f), 2);
+
+    Assembler *as = assemble_with(src, threads);
+    int chunks = as->pass2_chunks;
+    assembler_free(as);
+
+    fflush(stderr);
+    dup2(saved, 2);
+    close(saved);
+    fclose(f);
+
+    f = fopen(path, "r");
+    size_t n = fread(buf, 1, size - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    unlink(path);
+    return chunks;
+}
+
+/* ========== Thread Pool Tests ========== */
+
+static void mark_index(void *arg, int index) {
+    ((int *)arg)[index] += index + 1;
+}
+
+TEST(threadpool_runs_each_index_once) {
+    ThreadPool *pool = threadpool_create(4);
+    int marks[1000] = { 0 };
+    int passed = (pool != NULL);
+
+    for (int round = 0; round < 3 && passed; round++) {
+        threadpool_run(pool, mark_index, marks, 1000);
+    }
+    for (int i = 0; i < 1000 && passed; i++) {
+        if (marks[i] != 3 * (i + 1)) passed = 0;
+    }
+
+    threadpool_free(pool);
+    return passed;
+}
+
+TEST(threadpool_single_thread_inline) {
+    ThreadPool *pool = threadpool_create(1);
+    int marks[10] = { 0 };
+    threadpool_run(pool, mark_index, marks, 10);
+    int passed = threadpool_size(pool) == 1 && marks[9] == 10;
+    threadpool_free(pool);
+    return passed;
+}
+
+/* ========== Parallel Pass 2 Tests ========== */
+
+TEST(parallel_matches_serial) {
+    char *src = make_program(400);
+    Assembler *serial = assemble_with(src, 1);
+    Assembler *parallel = assemble_with(src, 8);
+
+    int passed = serial->errors == 0 &&
+                 serial->pass2_chunks == 0 &&
+                 parallel->pass2_chunks > 1 &&
+                 same_output(serial, parallel);
+
+    assembler_free(serial);
+    assembler_free(parallel);
+    free(src);
+    return passed;
+}
+
+TEST(parallel_thread_counts_agree) {
+    char *src = make_program(300);
+    Assembler *serial = assemble_with(src, 1);
+    int passed = serial->errors == 0;
+
+    int counts[] = { 2, 3, 5, 16, 32 };
+    for (int i = 0; i < 5 && passed; i++) {
+        Assembler *parallel = assemble_with(src, counts[i]);
+        passed = same_output(serial, parallel);
+        assembler_free(parallel);
+    }
+
+    assembler_free(serial);
+    free(src);
+    return passed;
+}
+
+TEST(parallel_reassembly_reuses_context) {
+    /* No macros here: macro definitions persist across assemblies */
+    Buf b = { NULL, 0, 0 };
+    buf_printf(&b, "*=$1000\n");
+    for (int i = 0; i < 2000; i++) {
+        buf_printf(&b, "-   lda $%04x,x\n    bne -\n    beq +\n+\n", i);
+    }
+
+    Assembler *as = assemble_with(b.data, 4);
+    Assembler *serial = assemble_with(b.data, 1);
+
+    /* Second run on the same context must reset and match again */
+    assembler_assemble_string(as, b.data, "test.asm");
+    int passed = as->pass2_chunks > 1 && same_output(serial, as);
+
+    assembler_free(as);
+    assembler_free(serial);
+    free(b.data);
+    return passed;
+}
+
+TEST(parallel_falls_back_on_changing_symbol) {
+    /* value is undefined when first assigned in pass 1, so pass 2
+     * changes it mid-pass and lines must see it in order */
+    char *prog = make_program(300);
+    size_t len = strlen(prog);
+    char *src = malloc(len + 64);
+    strcpy(src, "value = later\n");
+    strcat(src, prog);
+    strcat(src, "later: !word value\n");
+
+    Assembler *serial = assemble_with(src, 1);
+    Assembler *parallel = assemble_with(src, 8);
+
+    int passed = parallel->pass2_chunks == 0 && same_output(serial, parallel);
+
+    assembler_free(serial);
+    assembler_free(parallel);
+    free(prog);
+    free(src);
+    return passed;
+}
+
+TEST(parallel_falls_back_on_overlap) {
+    char *prog = make_program(300);
+    size_t len = strlen(prog);
+    char *src = malloc(len + 64);
+    strcpy(src, prog);
+    /* Overwrite the start of the program from the last chunk */
+    strcat(src, "*=$0810\n    !byte $ea, $ea\n");
+
+    Assembler *serial = assemble_with(src, 1);
+    Assembler *parallel = assemble_with(src, 8);
+
+    int passed = parallel->pass2_chunks == 0 &&
+                 serial->memory[0x0810] == 0xEA &&
+                 same_output(serial, parallel);
+
+    assembler_free(serial);
+    assembler_free(parallel);
+    free(prog);
+    free(src);
+    return passed;
+}
+
+TEST(parallel_diagnostics_in_source_order) {
+    Buf b = { NULL, 0, 0 };
+    buf_printf(&b, "*=$1000\n");
+    for (int i = 0; i < 3000; i++) {
+        if (i % 500 == 7) {
+            buf_printf(&b, "    lda missing%d\n", i);
+        } else {
+            buf_printf(&b, "    nop\n");
+        }
+    }
+
+    char serial_err[4096], parallel_err[4096];
+    assemble_capturing(b.data, 1, serial_err, sizeof(serial_err));
+    int chunks = assemble_capturing(b.data, 8, parallel_err, sizeof(parallel_err));
+
+    int passed = chunks > 1 &&
+                 strstr(serial_err, "test.asm:9: error") != NULL &&
+                 strcmp(serial_err, parallel_err) == 0;
+
+    free(b.data);
+    return passed;
+}
+
+TEST(parallel_chunks_start_with_their_cpu) {
+    /* !delay code depends on the CPU in effect, which changes mid-program */
+    Buf b = { NULL, 0, 0 };
+    buf_printf(&b, "*=$1000\n");
+    for (int i = 0; i < 3000; i++) {
+        if (i % 500 == 250) {
+            buf_printf(&b, "    !cpu \"%s\"\n", (i / 500) % 2 ? "6510" : "6502");
+        } else if (i % 100 == 50) {
+            buf_printf(&b, "    !delay 10\n");
+        } else {
+            buf_printf(&b, "    nop\n");
+        }
+    }
+
+    Assembler *serial = assemble_with(b.data, 1);
+    Assembler *parallel = assemble_with(b.data, 8);
+
+    int passed = serial->errors == 0 &&
+                 parallel->pass2_chunks > 1 &&
+                 same_output(serial, parallel);
+
+    assembler_free(serial);
+    assembler_free(parallel);
+    free(b.data);
+    return passed;
+}
+
+TEST(parallel_anon_refs_in_call_arguments) {
+    /* Chunk boundaries must count the + references inside !func calls */
+    Buf b = { NULL, 0, 0 };
+    buf_printf(&b, "!func lo(a) = a & $ff\n*=$1000\n");
+    for (int i = 0; i < 3000; i++) {
+        if (i % 50 == 10) {
+            buf_printf(&b, "    lda #lo(+)\n");
+        } else if (i % 50 == 20) {
+            buf_printf(&b, "+   nop\n");
+        } else {
+            buf_printf(&b, "    nop\n");
+        }
+    }
+
+    Assembler *serial = assemble_with(b.data, 1);
+    Assembler *parallel = assemble_with(b.data, 8);
+
+    int passed = serial->errors == 0 &&
+                 parallel->pass2_chunks > 1 &&
+                 same_output(serial, parallel);
+
+    assembler_free(serial);
+    assembler_free(parallel);
+    free(b.data);
+    return passed;
+}
+
+TEST(small_program_stays_serial) {
+    Assembler *as = assemble_with("*=$1000\n    lda #1\n    rts\n", 8);
+    int passed = as->errors == 0 && as->pass2_chunks == 0 &&
+                 as->memory[0x1000] == 0xA9 && as->memory[0x1002] == 0x60;
+    assembler_free(as);
+    return passed;
+}
+
+/* ========== Incremental Pass 2 Tests ========== */
+
+TEST(incremental_matches_full) {
+    char *src = make_program(300);
+    int revisited, skipped;
+    int passed = incremental_agrees(src, 1, &revisited, &skipped) &&
+                 skipped > revisited && revisited > 0;
+    free(src);
+    return passed;
+}
+
+TEST(incremental_revisits_forward_refs) {
+    const char *src =
+        "*=$1000\n"
+        "    jmp end\n"
+        "    lda #1\n"
+        "-   dex\n"
+        "    bne -\n"
+        "    beq +\n"
+        "    nop\n"
+        "+   lda data\n"
+        "end rts\n"
+        "data !byte 1\n";
+    int revisited, skipped;
+    /* jmp end, beq + and lda data must be revisited; the rest is reused */
+    int passed = incremental_agrees(src, 1, &revisited, &skipped) &&
+                 revisited >= 3 && skipped >= 4;
+    return passed;
+}
+
+TEST(incremental_reassigned_symbol) {
+    const char *src =
+        "*=$1000\n"
+        "n = 2\n"
+        "    lda #n\n"
+        "n = n + 1\n"
+        "    lda #n\n"
+        "    ldx #late\n"
+        "late = 7\n";
+    return incremental_agrees(src, 1, NULL, NULL);
+}
+
+TEST(incremental_restarts_on_resize) {
+    /* Pass 1 keeps the first value of n, so the second !fill grows */
+    const char *src =
+        "*=$1000\n"
+        "n = 2\n"
+        "    !fill n, $ea\n"
+        "n = 3\n"
+        "    !fill n, 1\n"
+        "after lda #<after\n";
+    int revisited, skipped;
+    int passed = incremental_agrees(src, 1, &revisited, &skipped) && skipped == 0;
+    return passed;
+}
+
+TEST(incremental_overlap_disables_reuse) {
+    const char *src =
+        "*=$1000\n"
+        "    lda #1\n"
+        "    rts\n"
+        "*=$1001\n"
+        "    !byte $ff\n";
+    int revisited, skipped;
+    int passed = incremental_agrees(src, 1, &revisited, &skipped) && skipped == 0;
+    return passed;
+}
+
+TEST(incremental_parallel_agrees) {
+    char *prog = make_program(300);
+    size_t len = strlen(prog);
+    char *src = malloc(len + 64);
+    strcpy(src, "value = later\n");
+    strcat(src, prog);
+    strcat(src, "later: !word value\n");
+
+    int passed = incremental_agrees(prog, 8, NULL, NULL) &&
+                 incremental_agrees(src, 8, NULL, NULL);
+
+    free(prog);
+    free(src);
+    return passed;
+}
+
+/* ========== Main ========== */
+
+int main(void) {
+    printf("Parallel Pass 2 Tests\n");
+    printf("==================================\n\n");
+
+    opcodes_init();
+
+    printf("Thread Pool Tests:\n");
+    RUN_TEST(threadpool_runs_each_index_once);
+    RUN_TEST(threadpool_single_thread_inline);
+
+    printf("\nParallel Pass 2 Tests:\n");
+    RUN_TEST(parallel_matches_serial);
+    RUN_TEST(parallel_thread_counts_agree);
+    RUN_TEST(parallel_reassembly_reuses_context);
+    RUN_TEST(parallel_falls_back_on_changing_symbol);
+    RUN_TEST(parallel_falls_back_on_overlap);
+    RUN_TEST(parallel_diagnostics_in_source_order);
+    RUN_TEST(parallel_chunks_start_with_their_cpu);
+    RUN_TEST(parallel_anon_refs_in_call_arguments);
+    RUN_TEST(small_program_stays_serial);
+
+    printf("\nIncremental Pass 2 Tests:\n");
+    RUN_TEST(incremental_matches_full);
+    RUN_TEST(incremental_revisits_forward_refs);
+    RUN_TEST(incremental_reassigned_symbol);
+    RUN_TEST(incremental_restarts_on_resize);
+    RUN_TEST(incremental_overlap_disables_reuse);
+    RUN_TEST(incremental_parallel_agrees);
+
+    printf("\n==================================\n");
+    printf("Total: %d passed, %d failed\n", tests_passed, tests_run - tests_passed);
+
+    return tests_run == tests_passed ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+/* Test suite for the -Wperf performance lint */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "../include/assembler.h"
+#include "../include/opcodes.h"
+#include "../include/perf.h"
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name) static int test_##name(void)
+#define RUN_TEST(name) do { \
+    tests_run++; \
+    printf("  %-40s ", #name); \
+    if (test_##name()) { \
+        printf("\033[0;32mPASS\033[0m\n"); \
+        tests_passed++; \
+    } else { \
+        printf("\033[0;31mFAIL\033[0m\n"); \
+    } \
+} while(0)
+
+/* One instance of every pattern, in check order */
+static const char *slow_code =
+    "*=$1000\n"
+    "start\n"
+    "    sta later\n"
+    "    jsr sub\n"
+    "    rts\n"
+    "sub\n"
+    "    pha\n"
+    "    lda #1\n"
+    "    sta $d020\n"
+    "    pla\n"
+    "    ldx #0\n"
+    "-   lda table,x\n"
+    "    sta $0400,x\n"
+    "    inx\n"
+    "    bne -\n"
+    "    !raster_block line=$32, cycle=1\n"
+    "    inc $d019\n"
+    "    !raster_end\n"
+    "    rts\n"
+    "*=$10f0\n"
+    "loop\n"
+    "    dex\n"
+    "    !fill 20, $ea\n"
+    "    bne loop\n"
+    "    rts\n"
+    "later = $20\n"
+    "table !fill 10, 0\n";
+
+/* ========== Helpers ========== */
+
+/* Assemble src and lint it with stderr discarded; -1 if assembly fails */
+static int lint(const char *src, unsigned disabled) {
+    fflush(stderr);
+    int saved = dup(2);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, 2);
+    close(null);
+
+    Assembler *as = assembler_create();
+    int result = assembler_assemble_string(as, src, "test.asm");
+    int warnings = as->warnings;
+    int issued = -1;
+    if (result == 0) {
+        issued = assembler_perf_lint(as, disabled);
+        if (as->warnings != warnings + issued) issued = -1;
+    }
+    assembler_free(as);
+
+    fflush(stderr);
+    dup2(saved, 2);
+    close(saved);
+    return issued;
+}
+
+/* ========== Check Tests ========== */
+
+TEST(reports_each_check) {
+    if (lint(slow_code, 0) != PERF_CHECK_COUNT) return 0;
+    for (int i = 0; i < PERF_CHECK_COUNT; i++) {
+        unsigned only = ~(1u << i);
+        if (lint(slow_code, only) != 1) return 0;
+    }
+    return 1;
+}
+
+TEST(checks_can_be_disabled) {
+    unsigned disabled = (1u << PERF_FORCED_ABS) | (1u << PERF_JSR_RTS);
+    return lint(slow_code, disabled) == PERF_CHECK_COUNT - 2 &&
+           lint(slow_code, ~0u) == 0;
+}
+
+TEST(clean_code_is_quiet) {
+    const char *src =
+        "later = $20\n"
+        "*=$1000\n"
+        "    sta later\n"
+        "    jsr sub\n"
+        "    jmp start\n"
+        "sub\n"
+        "    pha\n"
+        "    jsr start\n"
+        "    pla\n"
+        "    ldx #0\n"
+        "-   lda table,x\n"
+        "    inx\n"
+        "    bne -\n"
+        "    inc $d019\n"
+        "start\n"
+        "    rts\n"
+        "*=$1100\n"
+        "table !fill 256, 0\n";
+    return lint(src, 0) == 0;
+}
+
+TEST(pha_temp_needs_free_zero_page) {
+    const char *src =
+        "*=$1000\n"
+        "    lda $02\n"
+        "    lda ($fb),y\n"
+        "    lda $fd\n"
+        "    lda $fe\n"
+        "    pha\n"
+        "    pla\n"
+        "    rts\n";
+    return lint(src, 0) == 0;
+}
+
+TEST(check_names_round_trip) {
+    for (int i = 0; i < PERF_CHECK_COUNT; i++) {
+        if (perf_check_lookup(perf_check_name((PerfCheck)i)) != i) return 0;
+    }
+    return perf_check_lookup("forced_abs") == PERF_FORCED_ABS &&
+           perf_check_lookup("nope") == -1;
+}
+
+/* ========== Main ========== */
+
+int main(void) {
+    printf("Performance Lint Tests\n");
+    printf("==================================\n\n");
+
+    opcodes_init();
+
+    printf("Check Tests:\n");
+    RUN_TEST(reports_each_check);
+    RUN_TEST(checks_can_be_disabled);
+    RUN_TEST(clean_code_is_quiet);
+    RUN_TEST(pha_temp_needs_free_zero_page);
+    RUN_TEST(check_names_round_trip);
+
+    printf("\n==================================\n");
+    printf("Total: %d passed, %d failed\n", tests_passed, tests_run - tests_passed);
+
+    return tests_run == tests_passed ? 0 : 1;
+}
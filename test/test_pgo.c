@@ -0,0 +1,241 @@
+/* Test suite for profile collection and profile-guided layout */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/assembler.h"
+#include "../include/opcodes.h"
+#include "../include/pgo.h"
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name) static int test_##name(void)
+#define RUN_TEST(name) do { \
+    tests_run++; \
+    printf("  %-40s ", #name); \
+    if (test_##name()) { \
+        printf("\033[0;32mPASS\033[0m\n"); \
+        tests_passed++; \
+    } else { \
+        printf("\033[0;31mFAIL\033[0m\n"); \
+    } \
+} while(0)
+
+#define PROFILE_FILE "/tmp/asm64_test_pgo.prof"
+
+/* Copy loop whose table access crosses a page until the table moves */
+static const char *copy_loop =
+    "*=$10f8\n"
+    "play\n"
+    "    ldx #0\n"
+    "-   lda table,x\n"
+    "    sta $0400,x\n"
+    "    inx\n"
+    "    cpx #64\n"
+    "    bne -\n"
+    "    jsr helper\n"
+    "    rts\n"
+    "    !pgo_pad\n"
+    "helper\n"
+    "    ldy #32\n"
+    "-   dey\n"
+    "    bne -\n"
+    "    rts\n"
+    "junk !fill 200, 0\n"
+    "    !pgo_pad max=128\n"
+    "table\n"
+    "    !fill 64, 1\n";
+
+/* ========== Helpers ========== */
+
+static int symbol_value(Assembler *as, const char *name) {
+    Symbol *sym = symbol_lookup(as->symbols, name);
+    return sym ? sym->value : -1;
+}
+
+/* Assemble src and write a profile of `frames` calls to entry */
+static int train(const char *src, const char *entry, int frames) {
+    Assembler *as = assembler_create();
+    int result = assembler_assemble_string(as, src, "test.asm");
+    uint16_t address;
+    if (result == 0 && pgo_resolve_address(as, entry, &address) == 0) {
+        result = pgo_train(as, address, frames, RASTER_PAL, PROFILE_FILE, NULL);
+    } else {
+        result = -1;
+    }
+    assembler_free(as);
+    return result;
+}
+
+static const PgoRecord *record_at(const PgoProfile *profile, int line) {
+    for (int i = 0; i < profile->record_count; i++) {
+        if (profile->records[i].line == line) return &profile->records[i];
+    }
+    return NULL;
+}
+
+/* ========== Directive Tests ========== */
+
+TEST(pad_directive_defaults_to_nothing) {
+    Assembler *as = assembler_create();
+    int result = assembler_assemble_string(as,
+        "*=$1000\n"
+        "    rts\n"
+        "    !pgo_pad\n"
+        "next nop\n", "test.asm");
+    int passed = result == 0 && symbol_value(as, "next") == 0x1001;
+    assembler_free(as);
+    return passed;
+}
+
+TEST(pad_directive_applies_layout) {
+    Assembler *as = assembler_create();
+    as->layout_pads = malloc(2 * sizeof(int));
+    as->layout_pads[0] = 3;
+    as->layout_pads[1] = 2;
+    as->layout_pad_count = 2;
+    int result = assembler_assemble_string(as,
+        "*=$1000\n"
+        "    rts\n"
+        "    !pgo_pad\n"
+        "a   rts\n"
+        "    !pgo_pad\n"
+        "b   nop\n", "test.asm");
+    int passed = result == 0 && symbol_value(as, "a") == 0x1004 &&
+                 symbol_value(as, "b") == 0x1007 &&
+                 as->memory[0x1001] == 0x00 && as->memory[0x1004] == 0x60;
+    assembler_free(as);
+    return passed;
+}
+
+TEST(pad_directive_errors) {
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as,
+        "*=$1000\n"
+        "    !pgo_pad 4\n"
+        "    !pgo_pad max=300\n"
+        "    !pgo_pad align=2\n"
+        "    rts\n", "test.asm");
+    int passed = as->errors == 3;
+    assembler_free(as);
+    return passed;
+}
+
+/* ========== Profile Tests ========== */
+
+TEST(train_counts_instructions) {
+    if (train(copy_loop, "play", 10) != 0) return 0;
+    PgoProfile *profile = pgo_profile_load(PROFILE_FILE);
+    if (!profile) return 0;
+
+    const PgoRecord *load = record_at(profile, 4);
+    const PgoRecord *loop = record_at(profile, 8);
+    int passed = profile->frames == 10 &&
+                 load && load->count == 640 && load->index && load->index[63] == 10 &&
+                 loop && loop->count == 640 && loop->taken == 630;
+    pgo_profile_free(profile);
+    unlink(PROFILE_FILE);
+    return passed;
+}
+
+TEST(train_rejects_bad_entry) {
+    uint16_t address = 0;
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as, "*=$1000\nstart rts\n", "test.asm");
+    int passed = pgo_resolve_address(as, "$1000", &address) == 0 && address == 0x1000 &&
+                 pgo_resolve_address(as, "4096", &address) == 0 && address == 0x1000 &&
+                 pgo_resolve_address(as, "start", &address) == 0 &&
+                 pgo_resolve_address(as, "missing", &address) < 0 &&
+                 pgo_train(as, 0x2000, 1, RASTER_PAL, PROFILE_FILE, NULL) < 0;
+    assembler_free(as);
+    return passed;
+}
+
+TEST(profile_rejects_other_files) {
+    FILE *f = fopen(PROFILE_FILE, "w");
+    if (!f) return 0;
+    fprintf(f, "not a profile\n");
+    fclose(f);
+    PgoProfile *profile = pgo_profile_load(PROFILE_FILE);
+    unlink(PROFILE_FILE);
+    return profile == NULL && pgo_profile_load("/nonexistent/asm64.prof") == NULL;
+}
+
+/* ========== Layout Tests ========== */
+
+TEST(layout_moves_table_off_page_boundary) {
+    if (train(copy_loop, "play", 10) != 0) return 0;
+    PgoProfile *profile = pgo_profile_load(PROFILE_FILE);
+    unlink(PROFILE_FILE);
+    if (!profile) return 0;
+
+    Assembler *as = assembler_create();
+    as->profile = profile;
+    int result = assembler_assemble_string(as, copy_loop, "test.asm");
+    int table = symbol_value(as, "table");
+
+    /* Only the loop's own branch still crosses: 63 taken per frame */
+    int passed = result == 0 && (table & 0xFF) + 63 <= 0xFF &&
+                 profile->matched == 12 &&
+                 profile->before == 860 && profile->after == 630 &&
+                 as->memory[0x10FB] == (table & 0xFF) && as->memory[0x10FC] == (table >> 8);
+    assembler_free(as);
+    pgo_profile_free(profile);
+    return passed;
+}
+
+TEST(layout_skips_fall_through_pad) {
+    const char *src =
+        "*=$10f0\n"
+        "play\n"
+        "    ldx #0\n"
+        "-   lda table,x\n"
+        "    inx\n"
+        "    bne -\n"
+        "    !pgo_pad\n"
+        "    rts\n"
+        "table !fill 256, 0\n";
+    if (train(src, "play", 1) != 0) return 0;
+    PgoProfile *profile = pgo_profile_load(PROFILE_FILE);
+    unlink(PROFILE_FILE);
+    if (!profile) return 0;
+
+    Assembler *as = assembler_create();
+    as->profile = profile;
+    int result = assembler_assemble_string(as, src, "test.asm");
+    int passed = result == 0 && as->warnings == 1 &&
+                 profile->slot_count == 1 && profile->slots[0].pad == 0;
+    assembler_free(as);
+    pgo_profile_free(profile);
+    return passed;
+}
+
+/* ========== Main ========== */
+
+int main(void) {
+    printf("Profile-Guided Layout Tests\n");
+    printf("==================================\n\n");
+
+    opcodes_init();
+
+    printf("Directive Tests:\n");
+    RUN_TEST(pad_directive_defaults_to_nothing);
+    RUN_TEST(pad_directive_applies_layout);
+    RUN_TEST(pad_directive_errors);
+
+    printf("\nProfile Tests:\n");
+    RUN_TEST(train_counts_instructions);
+    RUN_TEST(train_rejects_bad_entry);
+    RUN_TEST(profile_rejects_other_files);
+
+    printf("\nLayout Tests:\n");
+    RUN_TEST(layout_moves_table_off_page_boundary);
+    RUN_TEST(layout_skips_fall_through_pad);
+
+    printf("\n==================================\n");
+    printf("Total: %d passed, %d failed\n", tests_passed, tests_run - tests_passed);
+
+    return tests_run == tests_passed ? 0 : 1;
+}
@@ -263,6 +263,112 @@ TEST(cpu_65c02) {
     return passed;
 }
 
+TEST(cpu_65c02_instructions) {
+    Assembler *as = assembler_create();
+
+    const char *src =
+        "*=$1000\n"
+        "!cpu \"65c02\"\n"
+        "start\n"
+        "    stz $d020\n"
+        "    stz $80,x\n"
+        "    lda ($fb)\n"
+        "    inc\n"
+        "    dec a\n"
+        "    phx\n"
+        "    ply\n"
+        "    tsb $02\n"
+        "    bit #$40\n"
+        "    jmp (table,x)\n"
+        "    smb3 $80\n"
+        "    bbr3 $80,start\n"
+        "    bra start\n"
+        "table !word start\n";
+
+    static const uint8_t expected[] = {
+        0x9C, 0x20, 0xD0,   /* STZ $D020 */
+        0x74, 0x80,         /* STZ $80,X */
+        0xB2, 0xFB,         /* LDA ($FB) */
+        0x1A,               /* INC A */
+        0x3A,               /* DEC A */
+        0xDA,               /* PHX */
+        0x7A,               /* PLY */
+        0x04, 0x02,         /* TSB $02 */
+        0x89, 0x40,         /* BIT #$40 */
+        0x7C, 0x19, 0x10,   /* JMP ($1019,X) */
+        0xB7, 0x80,         /* SMB3 $80 */
+        0x3F, 0x80, 0xE9,   /* BBR3 $80,start */
+        0x80, 0xE7          /* BRA start */
+    };
+
+    int result = assembler_assemble_string(as, src, "test.asm");
+    int passed = (result == 0 && as->errors == 0 &&
+                  memcmp(&as->memory[0x1000], expected, sizeof(expected)) == 0);
+
+    assembler_free(as);
+    return passed;
+}
+
+TEST(cpu_65c02_timings) {
+    Assembler *as = assembler_create();
+
+    const char *src =
+        "*=$1000\n"
+        "!cpu \"65c02\"\n"
+        "    jmp ($2000)\n"
+        "    asl $2000,x\n"
+        "    lda ($fb)\n";
+
+    int result = assembler_assemble_string(as, src, "test.asm");
+    int passed = (result == 0 && as->errors == 0 && as->line_count >= 5 &&
+                  as->lines[2].cycles == 6 &&
+                  as->lines[3].cycles == 6 && as->lines[3].page_penalty == 1 &&
+                  as->lines[4].cycles == 5);
+
+    assembler_free(as);
+    return passed;
+}
+
+TEST(cpu_rejects_foreign_instructions) {
+    Assembler *as = assembler_create();
+
+    const char *src =
+        "*=$1000\n"
+        "!cpu 6502\n"
+        "    lax $80\n"
+        "!cpu \"65c02\"\n"
+        "    lax $80\n"
+        "    lda ($80,x)\n"
+        "!cpu 6510\n"
+        "    lda ($80)\n"
+        "    lax $80\n";
+
+    (void)assembler_assemble_string(as, src, "test.asm");
+
+    /* Both LAXs before the 6510, and (zp) on the 6510 */
+    int passed = (as->errors == 3);
+
+    assembler_free(as);
+    return passed;
+}
+
+TEST(cpu_6510_keeps_65c02_names_free) {
+    Assembler *as = assembler_create();
+
+    const char *src =
+        "*=$1000\n"
+        "bra\n"
+        "    jmp bra\n";
+
+    int result = assembler_assemble_string(as, src, "test.asm");
+    Symbol *sym = symbol_lookup(as->symbols, "bra");
+    int passed = (result == 0 && as->errors == 0 && sym && sym->value == 0x1000 &&
+                  as->memory[0x1000] == 0x4C);
+
+    assembler_free(as);
+    return passed;
+}
+
 TEST(cpu_invalid) {
     Assembler *as = assembler_create();
 
@@ -336,6 +442,10 @@ int main(void) {
     RUN_TEST(cpu_6502);
     RUN_TEST(cpu_6510);
     RUN_TEST(cpu_65c02);
+    RUN_TEST(cpu_65c02_instructions);
+    RUN_TEST(cpu_65c02_timings);
+    RUN_TEST(cpu_rejects_foreign_instructions);
+    RUN_TEST(cpu_6510_keeps_65c02_names_free);
     RUN_TEST(cpu_invalid);
 
     printf("\nError/Warn Tests:\n");
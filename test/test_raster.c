@@ -0,0 +1,776 @@
+/* Test suite for the 6510 cycle model, raster block verification, IRQ report, delays and balanced blocks */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/assembler.h"
+#include "../include/delay.h"
+#include "../include/irq.h"
+#include "../include/opcodes.h"
+#include "../include/raster.h"
+#include "../include/sim6510.h"
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST(name) static int test_##name(void)
+#define RUN_TEST(name) do { \
+    tests_run++; \
+    printf("  %-40s ", #name); \
+    if (test_##name()) { \
+        printf("\033[0;32mPASS\033[0m\n"); \
+        tests_passed++; \
+    } else { \
+        printf("\033[0;31mFAIL\033[0m\n"); \
+    } \
+} while(0)
+
+/* ========== Helpers ========== */
+
+static uint8_t memory[65536];
+
+/* Load bytes at addr and execute one instruction from there */
+static int run_one(Sim6510 *cpu, uint16_t addr, const uint8_t *code, int len, SimStep *step) {
+    memcpy(memory + addr, code, len);
+    cpu->pc = addr;
+    return sim6510_step(cpu, step);
+}
+
+/* Assemble src and run the raster check, capturing report and stderr */
+static int check_raster(const char *src, RasterSystem system, char *report, size_t size,
+                        int *errors) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_raster_%d.err", getpid());
+
+    fflush(stderr);
+    int saved = dup(2);
+    FILE *err = fopen(path, "w");
+    dup2(fileno(err), 2);
+
+    FILE *out = tmpfile();
+    Assembler *as = assembler_create();
+    int result = assembler_assemble_string(as, src, "test.asm");
+    if (result == 0) {
+        result = assembler_check_raster(as, system, out);
+    }
+    *errors = as->errors;
+    assembler_free(as);
+
+    fflush(stderr);
+    dup2(saved, 2);
+    close(saved);
+    fclose(err);
+    unlink(path);
+
+    rewind(out);
+    size_t n = fread(report, 1, size - 1, out);
+    report[n] = '\0';
+    fclose(out);
+    return result;
+}
+
+/* Assemble src and capture its IRQ report */
+static int irq_report(const char *src, char *report, size_t size) {
+    FILE *out = tmpfile();
+    Assembler *as = assembler_create();
+    int result = assembler_assemble_string(as, src, "test.asm");
+    if (result == 0) {
+        assembler_irq_report(as, out);
+    }
+    assembler_free(as);
+
+    rewind(out);
+    size_t n = fread(report, 1, size - 1, out);
+    report[n] = '\0';
+    fclose(out);
+    return result;
+}
+
+/* Copy the first asm block after heading in README.md; 0 if not found */
+static int readme_example(const char *heading, char *out, size_t size) {
+    static char readme[1 << 17];
+    FILE *f = fopen("README.md", "r");
+    if (!f) return 0;
+    size_t n = fread(readme, 1, sizeof(readme) - 1, f);
+    readme[n] = '\0';
+    fclose(f);
+
+    const char *start = strstr(readme, heading);
+    if (start) start = strstr(start, "```asm\n");
+    const char *end = start ? strstr(start + 7, "```") : NULL;
+    if (!end || (size_t)(end - start - 7) >= size) return 0;
+    memcpy(out, start + 7, (size_t)(end - start - 7));
+    out[end - start - 7] = '\0';
+    return 1;
+}
+
+/* ========== VIC-II Model Tests ========== */
+
+TEST(badlines_follow_yscroll) {
+    RasterModel vic;
+    raster_model_init(&vic, RASTER_PAL);
+    int passed = raster_is_badline(&vic, 0x33) && raster_is_badline(&vic, 0xF3) &&
+                 !raster_is_badline(&vic, 0x34) && !raster_is_badline(&vic, 0x2B) &&
+                 !raster_is_badline(&vic, 0xFB);
+    vic.d011 = 0x10;    /* YSCROLL 0 */
+    passed = passed && raster_is_badline(&vic, 0x30) && !raster_is_badline(&vic, 0x33);
+    vic.d011 = 0x03;    /* Display disabled */
+    passed = passed && !raster_is_badline(&vic, 0x33);
+    return passed;
+}
+
+TEST(badline_stalls_reads_then_writes) {
+    RasterModel vic;
+    raster_model_init(&vic, RASTER_PAL);
+    RasterPos before = { 0x33, 11 }, ba = { 0x33, 12 }, third = { 0x33, 14 };
+    RasterPos dma = { 0x33, 15 }, last = { 0x33, 54 }, after = { 0x33, 55 };
+    return !raster_cpu_stalled(&vic, before, 0) &&
+           raster_cpu_stalled(&vic, ba, 0) && !raster_cpu_stalled(&vic, ba, 1) &&
+           !raster_cpu_stalled(&vic, third, 1) && raster_cpu_stalled(&vic, dma, 1) &&
+           raster_cpu_stalled(&vic, last, 0) && !raster_cpu_stalled(&vic, after, 0) &&
+           raster_ba_low(&vic, last) == 43;
+}
+
+TEST(sprite_dma_windows) {
+    RasterModel pal, ntsc;
+    raster_model_init(&pal, RASTER_PAL);
+    raster_model_init(&ntsc, RASTER_NTSC);
+    pal.d015 = 0x01;
+    ntsc.d015 = 0x01;
+    RasterPos c54 = { 0x10, 54 }, c55 = { 0x10, 55 }, c59 = { 0x10, 59 }, c60 = { 0x10, 60 };
+    RasterPos c57 = { 0x10, 57 };
+    int passed = !raster_cpu_stalled(&pal, c54, 0) && raster_cpu_stalled(&pal, c55, 0) &&
+                 raster_cpu_stalled(&pal, c59, 0) && !raster_cpu_stalled(&pal, c60, 0) &&
+                 !raster_cpu_stalled(&ntsc, c55, 0) && raster_cpu_stalled(&ntsc, c57, 0);
+
+    /* Sprite 7 wraps into the start of the next line */
+    pal.d015 = 0x80;
+    RasterPos c5 = { 0x10, 5 }, c10 = { 0x10, 10 }, c11 = { 0x10, 11 };
+    passed = passed && !raster_cpu_stalled(&pal, c5, 0) &&
+             raster_cpu_stalled(&pal, c10, 0) && !raster_cpu_stalled(&pal, c11, 0);
+    return passed;
+}
+
+TEST(advance_wraps_lines_and_frames) {
+    RasterModel pal, ntsc;
+    raster_model_init(&pal, RASTER_PAL);
+    raster_model_init(&ntsc, RASTER_NTSC);
+    RasterPos a = { 0, 60 }, b = { 311, 63 }, c = { 262, 64 };
+    raster_advance(&pal, &a, 5);
+    raster_advance(&pal, &b, 1);
+    raster_advance(&ntsc, &c, 3);
+    return a.line == 1 && a.cycle == 2 && b.line == 0 && b.cycle == 1 &&
+           c.line == 0 && c.cycle == 2;
+}
+
+/* ========== 6510 Model Tests ========== */
+
+TEST(sim_cycles_and_write_cycles) {
+    Sim6510 cpu;
+    SimStep step;
+    memset(memory, 0, sizeof(memory));
+    sim6510_init(&cpu, memory, 0x1000);
+
+    static const uint8_t sta[] = { 0x8D, 0x20, 0xD0 };        /* STA $D020 */
+    static const uint8_t inc[] = { 0xEE, 0x19, 0xD0 };        /* INC $D019 */
+    static const uint8_t jsr[] = { 0x20, 0x00, 0x20 };        /* JSR $2000 */
+
+    int passed = run_one(&cpu, 0x1000, sta, 3, &step) == 0 &&
+                 step.cycles == 4 && step.write_mask == 0x08 &&
+                 step.io_write_count == 1 && step.io_writes[0].address == 0xD020 &&
+                 step.io_writes[0].cycle == 3;
+    passed = passed && run_one(&cpu, 0x1000, inc, 3, &step) == 0 &&
+             step.cycles == 6 && step.write_mask == 0x30 &&
+             step.io_writes[0].value == 0x01 && step.io_writes[0].cycle == 5;
+    passed = passed && run_one(&cpu, 0x1000, jsr, 3, &step) == 0 &&
+             step.cycles == 6 && step.write_mask == 0x18 && cpu.pc == 0x2000 &&
+             memory[0x01FF] == 0x10 && memory[0x01FE] == 0x02;
+    return passed;
+}
+
+TEST(sim_page_and_branch_penalties) {
+    Sim6510 cpu;
+    SimStep step;
+    memset(memory, 0, sizeof(memory));
+    sim6510_init(&cpu, memory, 0x1000);
+
+    static const uint8_t lda_abx[] = { 0xBD, 0xFF, 0x20 };    /* LDA $20FF,X */
+    static const uint8_t bne[] = { 0xD0, 0x10 };              /* BNE *+$12 */
+
+    cpu.x = 0;
+    int passed = run_one(&cpu, 0x1000, lda_abx, 3, &step) == 0 && step.cycles == 4;
+    cpu.x = 1;
+    passed = passed && run_one(&cpu, 0x1000, lda_abx, 3, &step) == 0 && step.cycles == 5;
+
+    cpu.p |= SIM6510_FLAG_Z;
+    passed = passed && run_one(&cpu, 0x1000, bne, 2, &step) == 0 &&
+             step.cycles == 2 && cpu.pc == 0x1002;
+    cpu.p &= ~SIM6510_FLAG_Z;
+    passed = passed && run_one(&cpu, 0x1000, bne, 2, &step) == 0 &&
+             step.cycles == 3 && cpu.pc == 0x1012;
+    passed = passed && run_one(&cpu, 0x10F0, bne, 2, &step) == 0 &&
+             step.cycles == 4 && cpu.pc == 0x1102;
+    return passed;
+}
+
+TEST(sim_decimal_arithmetic) {
+    Sim6510 cpu;
+    SimStep step;
+    memset(memory, 0, sizeof(memory));
+    sim6510_init(&cpu, memory, 0x1000);
+
+    static const uint8_t adc[] = { 0x69, 0x27 };              /* ADC #$27 */
+    static const uint8_t sbc[] = { 0xE9, 0x19 };              /* SBC #$19 */
+
+    cpu.p |= SIM6510_FLAG_D;
+    cpu.a = 0x15;
+    int passed = run_one(&cpu, 0x1000, adc, 2, &step) == 0 &&
+                 cpu.a == 0x42 && !(cpu.p & SIM6510_FLAG_C);
+    cpu.p |= SIM6510_FLAG_C;
+    passed = passed && run_one(&cpu, 0x1000, sbc, 2, &step) == 0 &&
+             cpu.a == 0x23 && (cpu.p & SIM6510_FLAG_C);
+    return passed;
+}
+
+TEST(sim_rejects_jam) {
+    Sim6510 cpu;
+    SimStep step;
+    static const uint8_t jam[] = { 0x02 };
+    memset(memory, 0, sizeof(memory));
+    sim6510_init(&cpu, memory, 0x1000);
+    return run_one(&cpu, 0x1000, jam, 1, &step) == -1 && cpu.pc == 0x1000;
+}
+
+/* ========== Raster Block Tests ========== */
+
+TEST(reports_store_positions) {
+    const char *src =
+        "*=$1000\n"
+        "    !raster_block line=$33, cycle=1\n"
+        "    ldx #3\n"
+        "-   dex\n"
+        "    bne -\n"
+        "    sta $d020\n"
+        "    inc $d020\n"
+        "    !raster_end\n"
+        "    rts\n";
+    char report[2048];
+    int errors;
+    int result = check_raster(src, RASTER_PAL, report, sizeof(report), &errors);
+
+    /* The badline stops the loop from cycle 12 to 54 */
+    return result == 0 && errors == 0 &&
+           strstr(report, "test.asm:6: $D020 <- $00  line $033 cycle 63") != NULL &&
+           strstr(report, "test.asm:7: $D020 <- $01  line $034 cycle 6") != NULL;
+}
+
+TEST(checkpoint_detects_drift) {
+    const char *src =
+        "*=$1000\n"
+        "    !raster_block line=$31, cycle=1\n"
+        "    lda #1\n"
+        "    sta $d020\n"
+        "    !raster_block line=$31, cycle=7\n"
+        "    nop\n"
+        "    !raster_block line=$31, cycle=10\n"
+        "    sta $d021\n"
+        "    rts\n";
+    char report[2048];
+    int errors;
+    int result = check_raster(src, RASTER_PAL, report, sizeof(report), &errors);
+
+    /* The first checkpoint holds; the second is one cycle early */
+    return result == -1 && errors == 1 &&
+           strstr(report, "$D021 <- $01  line $031 cycle 13") != NULL;
+}
+
+TEST(readme_example_holds) {
+    char example[1024];
+    char src[1100];
+    if (!readme_example("#### Raster Timing", example, sizeof(example))) return 0;
+    snprintf(src, sizeof(src), "*=$1000\n%s", example);
+
+    char report[2048];
+    int errors;
+    int result = check_raster(src, RASTER_PAL, report, sizeof(report), &errors);
+    return result == 0 && errors == 0 &&
+           strstr(report, "$D021 <- $06  line $032 cycle 10") != NULL;
+}
+
+TEST(sprites_and_standard_change_timing) {
+    const char *src =
+        "*=$1000\n"
+        "    !raster_block line=$10, cycle=50, sprites=%00000001\n"
+        "    lda #0\n"
+        "    sta $d020\n"
+        "    sta $d020\n"
+        "    rts\n";
+    char pal[2048], ntsc[2048];
+    int errors;
+    check_raster(src, RASTER_PAL, pal, sizeof(pal), &errors);
+    check_raster(src, RASTER_NTSC, ntsc, sizeof(ntsc), &errors);
+
+    /* The second store waits out sprite 0's fetch: BA is low over
+     * cycles 55-59 on PAL and 57-61 on NTSC */
+    return strstr(pal, "line $010 cycle 55") != NULL &&
+           strstr(pal, "line $010 cycle 63") != NULL &&
+           strstr(ntsc, "line $010 cycle 55") != NULL &&
+           strstr(ntsc, "line $010 cycle 64") != NULL;
+}
+
+TEST(polls_raster_register) {
+    const char *src =
+        "*=$1000\n"
+        "    !raster_block line=$20, cycle=1\n"
+        "-   lda $d012\n"
+        "    cmp #$22\n"
+        "    bne -\n"
+        "    stx $d020\n"
+        "    rts\n";
+    char report[2048];
+    int errors;
+    int result = check_raster(src, RASTER_PAL, report, sizeof(report), &errors);
+    return result == 0 && strstr(report, "line $022 cycle") != NULL;
+}
+
+TEST(directive_errors) {
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as,
+        "*=$1000\n"
+        "    !raster_block line=$30\n"
+        "    !raster_block line=$30, cycle=70\n"
+        "    !raster_block line=$30, cycle=1, colour=2\n"
+        "    !raster_end 1\n"
+        "    !raster_block line=$30, cycle=1\n"
+        "    rts\n", "test.asm");
+    int passed = as->errors == 4;
+    assembler_free(as);
+    return passed;
+}
+
+/* ========== IRQ Report Tests ========== */
+
+TEST(irq_instruction_worst_cases) {
+    static const uint8_t inc_abx[] = { 0xFE, 0x20, 0xD0 };    /* INC $D020,X */
+    static const uint8_t lda_aby[] = { 0xB9, 0xFF, 0x20 };    /* LDA $20FF,Y */
+    static const uint8_t lda_page[] = { 0xB9, 0x00, 0x20 };   /* LDA $2000,Y */
+    static const uint8_t dcp_iny[] = { 0xD3, 0x80 };          /* DCP ($80),Y */
+    static const uint8_t beq_far[] = { 0xF0, 0x10 };          /* BEQ across a page */
+    int best, worst;
+
+    int passed = irq_instruction_cycles(inc_abx, 0x1000, &best, &worst) == 0 &&
+                 best == 7 && worst == 7;
+    passed = passed && irq_instruction_cycles(lda_aby, 0x1000, &best, &worst) == 0 &&
+             best == 4 && worst == 5;
+    passed = passed && irq_instruction_cycles(lda_page, 0x1000, &best, &worst) == 0 &&
+             worst == 4;
+    passed = passed && irq_instruction_cycles(dcp_iny, 0x1000, &best, &worst) == 0 &&
+             worst == 8;
+    passed = passed && irq_instruction_cycles(beq_far, 0x10F0, &best, &worst) == 0 &&
+             best == 2 && worst == 4;
+    passed = passed && irq_instruction_cycles(beq_far, 0x1000, &best, &worst) == 0 &&
+             worst == 3;
+    return passed;
+}
+
+TEST(irq_instruction_65c02_timing) {
+    static const uint8_t bra_far[] = { 0x80, 0x10 };          /* BRA across a page */
+    static const uint8_t bbr_far[] = { 0x0F, 0x80, 0x10 };    /* BBR0 $80 across a page */
+    static const uint8_t adc_abs[] = { 0x6D, 0x00, 0x20 };    /* ADC $2000 */
+    static const uint8_t stz_abs[] = { 0x9C, 0x00, 0x20 };    /* STZ $2000 */
+    int best, worst;
+
+    int passed = irq_instruction_cycles_cpu(CPU_65C02, bra_far, 0x10F0, &best, &worst) == 0 &&
+                 best == 4 && worst == 4;
+    passed = passed && irq_instruction_cycles_cpu(CPU_65C02, bbr_far, 0x10F0, &best, &worst) == 0 &&
+             best == 5 && worst == 7;
+    passed = passed && irq_instruction_cycles_cpu(CPU_65C02, adc_abs, 0x1000, &best, &worst) == 0 &&
+             best == 4 && worst == 5;
+    passed = passed && irq_instruction_cycles_cpu(CPU_6510, adc_abs, 0x1000, &best, &worst) == 0 &&
+             worst == 4;
+    passed = passed && irq_instruction_cycles_cpu(CPU_65C02, stz_abs, 0x1000, &best, &worst) == 0 &&
+             best == 4;
+    passed = passed && irq_instruction_cycles_cpu(CPU_6502, stz_abs, 0x1000, &best, &worst) < 0;
+    return passed;
+}
+
+TEST(irq_report_latency_to_mark) {
+    const char *src =
+        "*=$1000\n"
+        "    !irq handler\n"
+        "main\n"
+        "    inc $d020,x\n"
+        "    lda $20ff,y\n"
+        "    jmp main\n"
+        "    !irq_end\n"
+        "handler\n"
+        "    pha\n"
+        "    txa\n"
+        "    pha\n"
+        "    jmp +\n"
+        "    nop\n"
+        "+   lda #1\n"
+        "    !irq_mark\n"
+        "    sta $d019\n"
+        "    rti\n";
+    char report[2048];
+    irq_report(src, report, sizeof(report));
+
+    /* 1-7 cycles wait + 7 entry + 13 cycles of handler path */
+    return strstr(report, "longest 7 cycles at $1000 (inc $d020,x)") != NULL &&
+           strstr(report, "1-7 cycles, jitter 6") != NULL &&
+           strstr(report, "latency to mark at test.asm:15: 21-27 cycles, jitter 6") != NULL &&
+           strstr(report, "replace 7-cycle RMW at $1000") != NULL;
+}
+
+TEST(irq_report_kernal_entry) {
+    const char *src =
+        "*=$1000\n"
+        "    !irq h, kernal=1\n"
+        "-   jmp -\n"
+        "    !irq_end\n"
+        "h   rti\n";
+    char report[2048];
+    irq_report(src, report, sizeof(report));
+
+    /* A 3-cycle idle loop needs no suggestion */
+    return strstr(report, "handler $1003 via KERNAL") != NULL &&
+           strstr(report, "latency to handler entry: 37-39 cycles") != NULL &&
+           strstr(report, "suggestion") == NULL;
+}
+
+TEST(irq_directive_errors) {
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as,
+        "*=$1000\n"
+        "    !irq\n"
+        "    !irq missing\n"
+        "    !irq $1000, speed=2\n"
+        "    !irq_mark 1\n"
+        "    rts\n", "test.asm");
+    int passed = as->errors == 4;
+    assembler_free(as);
+    return passed;
+}
+
+/* ========== Delay Tests ========== */
+
+TEST(delay_code_takes_exact_cycles) {
+    static const unsigned keeps[] = {
+        0, DELAY_KEEP_A, DELAY_KEEP_X | DELAY_KEEP_Y, DELAY_KEEP_FLAGS,
+        DELAY_KEEP_FLAGS | DELAY_KEEP_STACK, DELAY_KEEP_X | DELAY_KEEP_C,
+        DELAY_KEEP_A | DELAY_KEEP_X | DELAY_KEEP_Y | DELAY_KEEP_C,
+        DELAY_KEEP_A | DELAY_KEEP_X | DELAY_KEEP_Y | DELAY_KEEP_FLAGS
+    };
+    static const uint16_t addresses[] = { 0x1000, 0x10FB, 0x20FD };
+
+    for (int n = 0; n <= 1400; n++) {
+        if (n == 1) continue;
+        for (int k = 0; k < 8; k++) {
+            for (int a = 0; a < 3; a++) {
+                DelayCode code;
+                int cycles = -1;
+                if (delay_generate(n, keeps[k], k & 1, addresses[a], &code) < 0) return 0;
+                int ok = delay_measure(&code, addresses[a], keeps[k], &cycles) == 0 &&
+                         cycles == n;
+                delay_code_free(&code);
+                if (!ok) return 0;
+            }
+        }
+    }
+
+    DelayCode code;
+    return delay_generate(1, 0, 1, 0x1000, &code) < 0;
+}
+
+TEST(delay_loops_keep_flags_and_registers) {
+    /* Saving flags with PHP/PLP and X through A costs a few bytes, not
+     * a fall back to straight-line code */
+    static const unsigned keeps[] = {
+        DELAY_KEEP_A | DELAY_KEEP_X | DELAY_KEEP_Y | DELAY_KEEP_C,
+        DELAY_KEEP_Z,
+        DELAY_KEEP_A | DELAY_KEEP_X | DELAY_KEEP_Y | DELAY_KEEP_FLAGS
+    };
+    static const int lengths[] = { 1000, 5000, 20000, 65535 };
+
+    for (int i = 0; i < 4; i++) {
+        /* Loops counting X with nothing to save around them */
+        DelayCode plain;
+        if (delay_generate(lengths[i], DELAY_KEEP_Y, 0, 0x1000, &plain) < 0) return 0;
+        int limit = plain.length + 10;
+        int plain_length = plain.length;
+        delay_code_free(&plain);
+
+        for (int k = 0; k < 3; k++) {
+            DelayCode code;
+            int cycles = -1;
+            if (delay_generate(lengths[i], keeps[k], 0, 0x1000, &code) < 0) return 0;
+            int ok = code.loops > 0 && code.length <= limit &&
+                     delay_measure(&code, 0x1000, keeps[k], &cycles) == 0 &&
+                     cycles == lengths[i];
+            /* PHA, TXA and TAX, PLA are all keeping A, X and Y costs */
+            if (k == 0) ok = ok && code.length <= plain_length + 4;
+            delay_code_free(&code);
+            if (!ok) return 0;
+        }
+    }
+    return 1;
+}
+
+TEST(delay_nests_loops_when_x_and_y_are_free) {
+    /* Y counting an X loop covers any length in a few bytes, including
+     * where either branch crosses a page; one loop may still be shorter */
+    static const unsigned keeps[] = { 0, DELAY_KEEP_A | DELAY_KEEP_FLAGS };
+    static const uint16_t addresses[] = { 0x1000, 0x10F8, 0x10FB };
+
+    for (int n = 1500; n <= DELAY_MAX_CYCLES; n += n < 3000 ? 1 : 97) {
+        for (int k = 0; k < 2; k++) {
+            for (int a = 0; a < 3; a++) {
+                DelayCode code;
+                int cycles = -1;
+                if (delay_generate(n, keeps[k], k, addresses[a], &code) < 0) return 0;
+                int ok = code.loops > 0 && code.length <= 16 &&
+                         delay_measure(&code, addresses[a], keeps[k], &cycles) == 0 &&
+                         cycles == n;
+                delay_code_free(&code);
+                if (!ok) return 0;
+            }
+        }
+    }
+
+    DelayCode code;
+    int cycles = -1;
+    int ok = delay_generate(DELAY_MAX_CYCLES, 0, 1, 0x1000, &code) == 0 &&
+             code.loops == 2 && code.length <= 12 &&
+             delay_measure(&code, 0x1000, 0, &cycles) == 0 && cycles == DELAY_MAX_CYCLES;
+    delay_code_free(&code);
+    return ok;
+}
+
+TEST(delay_directive_generates_code) {
+    Assembler *as = assembler_create();
+    int result = assembler_assemble_string(as,
+        "*=$1000\n"
+        "    !delay 7\n"
+        "    !delay 5, preserve=nvz\n"
+        "    !cpu 6502\n"
+        "    !delay 5, preserve=nvz\n"
+        "*=$10fb\n"
+        "    !delay 100\n"
+        "next rts\n", "test.asm");
+
+    /* LDX #16 / DEX / BNE crosses into $1100: 16 * 6 cycles + 2 NOPs */
+    static const uint8_t expected[] = {
+        0x08, 0x28, 0x04, 0x00, 0xEA, 0x4C, 0x08, 0x10, 0xEA
+    };
+    Symbol *next = symbol_lookup(as->symbols, "next");
+    int passed = result == 0 && memcmp(as->memory + 0x1000, expected, sizeof(expected)) == 0 &&
+                 as->memory[0x10FB] == 0xA2 && as->memory[0x10FC] == 16 &&
+                 next && next->value == 0x1102;
+    assembler_free(as);
+    return passed;
+}
+
+TEST(delay_directive_errors) {
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as,
+        "*=$1000\n"
+        "    !delay\n"
+        "    !delay 1\n"
+        "    !delay later\n"
+        "    !delay 5, speed=2\n"
+        "    !delay 5, preserve=q\n"
+        "later rts\n", "test.asm");
+    int passed = as->errors == 5;
+    assembler_free(as);
+    return passed;
+}
+
+/* ========== Balanced Block Tests ========== */
+
+/* Cycles the 6510 model takes from start to done with flags p, or -1 */
+static int balanced_cycles(Assembler *as, uint8_t p) {
+    Symbol *start = symbol_lookup(as->symbols, "start");
+    Symbol *done = symbol_lookup(as->symbols, "done");
+    if (!start || !done) return -1;
+
+    memcpy(memory, as->memory, sizeof(memory));
+    Sim6510 cpu;
+    sim6510_init(&cpu, memory, start->value);
+    cpu.p = p;
+    int cycles = 0;
+    for (int steps = 0; cpu.pc != done->value; steps++) {
+        SimStep step;
+        if (steps > 1000 || sim6510_step(&cpu, &step) < 0) return -1;
+        cycles += step.cycles;
+    }
+    return cycles;
+}
+
+TEST(balanced_paths_take_same_cycles) {
+    static const char *const sources[] = {
+        /* Second path longer */
+        "*=$1000\n"
+        "start !balanced beq\n"
+        "    lda #1\n"
+        "    sta $d020\n"
+        "    !balanced_else\n"
+        "    lda #2\n"
+        "    sta $d020\n"
+        "    inc $d021\n"
+        "    nop\n"
+        "    !balanced_end\n"
+        "done rts\n",
+        /* First path longer, and one cycle apart */
+        "*=$1000\n"
+        "start !balanced beq\n"
+        "    inc $d020\n"
+        "    inc $d021\n"
+        "    !balanced_else\n"
+        "    nop\n"
+        "    !balanced_end\n"
+        "done rts\n",
+        "*=$1000\n"
+        "start !balanced beq\n"
+        "    lda #1\n"
+        "    !balanced_else\n"
+        "    lda $fe\n"
+        "    !balanced_end\n"
+        "done rts\n",
+        /* The branch over the first path crosses a page */
+        "*=$10f0\n"
+        "start !balanced beq, preserve=a\n"
+        "    lda #1\n"
+        "    sta $d020\n"
+        "    sta $d021\n"
+        "    sta $d022\n"
+        "    sta $d023\n"
+        "    !balanced_else\n"
+        "    ldx #0\n"
+        "    lda $c000,x\n"
+        "    !delay 40\n"
+        "    !balanced_end\n"
+        "done rts\n"
+    };
+
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        Assembler *as = assembler_create();
+        int result = assembler_assemble_string(as, sources[i], "test.asm");
+        int taken = balanced_cycles(as, 0x02);
+        int not_taken = balanced_cycles(as, 0x00);
+        assembler_free(as);
+        if (result != 0 || taken < 0 || taken != not_taken) return 0;
+    }
+    return 1;
+}
+
+TEST(balanced_pads_with_fewest_bytes) {
+    Assembler *as = assembler_create();
+    int result = assembler_assemble_string(as,
+        "*=$1000\n"
+        "start !balanced bcs\n"
+        "    !balanced_else\n"
+        "    !balanced_end\n"
+        "done rts\n", "test.asm");
+
+    /* BCC over the JMP; the first path takes 2 + 3 cycles and the second
+     * 3, so it gets one NOP */
+    static const uint8_t expected[] = { 0x90, 0x03, 0x4C, 0x06, 0x10, 0xEA, 0x60 };
+    int passed = result == 0 && memcmp(as->memory + 0x1000, expected, sizeof(expected)) == 0 &&
+                 balanced_cycles(as, 0x01) == 5 && balanced_cycles(as, 0x00) == 5;
+    assembler_free(as);
+    return passed;
+}
+
+TEST(balanced_directive_errors) {
+    Assembler *as = assembler_create();
+    assembler_assemble_string(as,
+        "*=$1000\n"
+        "    !balanced\n"
+        "    !balanced bra\n"
+        "    !balanced beq, speed=1\n"
+        "    !balanced beq, preserve=q\n"
+        "    !balanced beq, max=300\n"
+        "    !balanced_else\n"
+        "    !balanced_end\n"
+        "    !balanced beq\n"
+        "    !balanced bne\n"
+        "    !balanced_end\n"
+        "    rts\n", "test.asm");
+    int passed = as->errors == 9;
+    assembler_free(as);
+
+    /* Paths that leave, hold data, cannot be padded in max= or may
+     * cross a page */
+    static const char *const sources[] = {
+        "*=$1000\n !balanced beq\n jsr $ffd2\n !balanced_else\n !balanced_end\n",
+        "*=$1000\n !balanced beq\n !balanced_else\n bne *\n !balanced_end\n",
+        "*=$1000\n !balanced beq\n !byte 1\n !balanced_else\n !balanced_end\n",
+        "*=$1000\n !balanced beq, max=2\n !balanced_else\n !delay 20\n !balanced_end\n",
+        "*=$1000\n !balanced beq\n lda $c010,x\n !balanced_else\n !balanced_end\n",
+        "*=$1000\n !balanced beq\n lda ($fb),y\n !balanced_else\n !balanced_end\n",
+        "*=$1000\n !balanced beq\n !for i, 1, 130\n nop\n !end\n !balanced_else\n !balanced_end\n",
+        "*=$1000\n !balanced beq\n nop\n"
+    };
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        as = assembler_create();
+        assembler_assemble_string(as, sources[i], "test.asm");
+        if (as->errors == 0) passed = 0;
+        assembler_free(as);
+    }
+    return passed;
+}
+
+/* ========== Main ========== */
+
+int main(void) {
+    printf("Raster and IRQ Timing Tests\n");
+    printf("==================================\n\n");
+
+    opcodes_init();
+
+    printf("VIC-II Model Tests:\n");
+    RUN_TEST(badlines_follow_yscroll);
+    RUN_TEST(badline_stalls_reads_then_writes);
+    RUN_TEST(sprite_dma_windows);
+    RUN_TEST(advance_wraps_lines_and_frames);
+
+    printf("\n6510 Model Tests:\n");
+    RUN_TEST(sim_cycles_and_write_cycles);
+    RUN_TEST(sim_page_and_branch_penalties);
+    RUN_TEST(sim_decimal_arithmetic);
+    RUN_TEST(sim_rejects_jam);
+
+    printf("\nRaster Block Tests:\n");
+    RUN_TEST(reports_store_positions);
+    RUN_TEST(checkpoint_detects_drift);
+    RUN_TEST(readme_example_holds);
+    RUN_TEST(sprites_and_standard_change_timing);
+    RUN_TEST(polls_raster_register);
+    RUN_TEST(directive_errors);
+
+    printf("\nIRQ Report Tests:\n");
+    RUN_TEST(irq_instruction_worst_cases);
+    RUN_TEST(irq_instruction_65c02_timing);
+    RUN_TEST(irq_report_latency_to_mark);
+    RUN_TEST(irq_report_kernal_entry);
+    RUN_TEST(irq_directive_errors);
+
+    printf("\nDelay Tests:\n");
+    RUN_TEST(delay_code_takes_exact_cycles);
+    RUN_TEST(delay_loops_keep_flags_and_registers);
+    RUN_TEST(delay_nests_loops_when_x_and_y_are_free);
+    RUN_TEST(delay_directive_generates_code);
+    RUN_TEST(delay_directive_errors);
+
+    printf("\nBalanced Block Tests:\n");
+    RUN_TEST(balanced_paths_take_same_cycles);
+    RUN_TEST(balanced_pads_with_fewest_bytes);
+    RUN_TEST(balanced_directive_errors);
+
+    printf("\n==================================\n");
+    printf("Total: %d passed, %d failed\n", tests_passed, tests_run - tests_passed);
+
+    return tests_run == tests_passed ? 0 : 1;
+}